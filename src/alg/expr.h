@@ -0,0 +1,222 @@
+#ifndef EXPR_H_
+#define EXPR_H_
+#include <stddef.h>
+#include "cpl_port.h"
+#include "../core/galg.h"
+
+/*
+* Fused per-pixel expressions
+*
+* Header only. Arithmetic on exprPixel() builds an expression type at compile time instead of computing anything:
+*
+*     PixelExpression<...> proc = pixelExpression(exprClamp(exprPixel() * 0.5f + 10.0f, 0.0f, 255.0f));
+*
+* The result is an IProcessImage which evaluates the whole expression in one loop over the window, where
+* chaining Rescale and Clamp through mapMany would make a pass over the window for each. The loop has no
+* calls or branches, so the compiler can vectorise it. Use `auto` (or decltype) to hold an expression.
+*/
+
+/*
+* Base of every expression node; E is the node type itself
+*/
+template <class E>
+struct PixelExpr {
+    const E &self() const {
+        return static_cast<const E &>(*this);
+    }
+};
+
+/*
+* The input pixel
+*/
+struct ExprPixel: public PixelExpr<ExprPixel> {
+    float eval(float x) const {
+        return x;
+    }
+};
+
+struct ExprConst: public PixelExpr<ExprConst> {
+    explicit ExprConst(float value) : value_(value) {}
+    float eval(float) const {
+        return value_;
+    }
+    float value_;
+};
+
+template <class A, class Op>
+struct ExprUnary: public PixelExpr<ExprUnary<A, Op> > {
+    explicit ExprUnary(const A &a) : a_(a) {}
+    float eval(float x) const {
+        return Op::apply(a_.eval(x));
+    }
+    A a_;
+};
+
+template <class A, class B, class Op>
+struct ExprBinary: public PixelExpr<ExprBinary<A, B, Op> > {
+    ExprBinary(const A &a, const B &b) : a_(a), b_(b) {}
+    float eval(float x) const {
+        return Op::apply(a_.eval(x), b_.eval(x));
+    }
+    A a_;
+    B b_;
+};
+
+/*
+* cond ? a : b, where cond is a comparison
+*/
+template <class C, class A, class B>
+struct ExprSelect: public PixelExpr<ExprSelect<C, A, B> > {
+    ExprSelect(const C &c, const A &a, const B &b) : c_(c), a_(a), b_(b) {}
+    float eval(float x) const {
+        return c_.eval(x) != 0.0f ? a_.eval(x) : b_.eval(x);
+    }
+    C c_;
+    A a_;
+    B b_;
+};
+
+struct ExprAdd { static float apply(float a, float b) { return a + b; } };
+struct ExprSub { static float apply(float a, float b) { return a - b; } };
+struct ExprMul { static float apply(float a, float b) { return a * b; } };
+struct ExprDiv { static float apply(float a, float b) { return a / b; } };
+struct ExprMin { static float apply(float a, float b) { return b < a ? b : a; } };
+struct ExprMax { static float apply(float a, float b) { return b > a ? b : a; } };
+struct ExprGreater { static float apply(float a, float b) { return a > b ? 1.0f : 0.0f; } };
+struct ExprLess { static float apply(float a, float b) { return a < b ? 1.0f : 0.0f; } };
+struct ExprGreaterEqual { static float apply(float a, float b) { return a >= b ? 1.0f : 0.0f; } };
+struct ExprLessEqual { static float apply(float a, float b) { return a <= b ? 1.0f : 0.0f; } };
+struct ExprNeg { static float apply(float a) { return -a; } };
+struct ExprAbs { static float apply(float a) { return a < 0.0f ? -a : a; } };
+
+inline ExprPixel exprPixel() {
+    return ExprPixel();
+}
+
+/*
+* Operators on two expressions, or an expression and a constant
+*/
+#define GALG_EXPR_BINARY(op, OpType) \
+    template <class A, class B> \
+    inline ExprBinary<A, B, OpType> op(const PixelExpr<A> &a, const PixelExpr<B> &b) { \
+        return ExprBinary<A, B, OpType>(a.self(), b.self()); \
+    } \
+    template <class A> \
+    inline ExprBinary<A, ExprConst, OpType> op(const PixelExpr<A> &a, float b) { \
+        return ExprBinary<A, ExprConst, OpType>(a.self(), ExprConst(b)); \
+    } \
+    template <class B> \
+    inline ExprBinary<ExprConst, B, OpType> op(float a, const PixelExpr<B> &b) { \
+        return ExprBinary<ExprConst, B, OpType>(ExprConst(a), b.self()); \
+    }
+
+GALG_EXPR_BINARY(operator+, ExprAdd)
+GALG_EXPR_BINARY(operator-, ExprSub)
+GALG_EXPR_BINARY(operator*, ExprMul)
+GALG_EXPR_BINARY(operator/, ExprDiv)
+GALG_EXPR_BINARY(operator>, ExprGreater)
+GALG_EXPR_BINARY(operator<, ExprLess)
+GALG_EXPR_BINARY(operator>=, ExprGreaterEqual)
+GALG_EXPR_BINARY(operator<=, ExprLessEqual)
+GALG_EXPR_BINARY(exprMin, ExprMin)
+GALG_EXPR_BINARY(exprMax, ExprMax)
+
+#undef GALG_EXPR_BINARY
+
+template <class A>
+inline ExprUnary<A, ExprNeg> operator-(const PixelExpr<A> &a) {
+    return ExprUnary<A, ExprNeg>(a.self());
+}
+
+template <class A>
+inline ExprUnary<A, ExprAbs> exprAbs(const PixelExpr<A> &a) {
+    return ExprUnary<A, ExprAbs>(a.self());
+}
+
+/*
+* Clamp to [lo, hi]
+*/
+template <class A>
+inline ExprBinary<ExprBinary<A, ExprConst, ExprMax>, ExprConst, ExprMin> exprClamp(const PixelExpr<A> &a,
+    float lo, float hi) {
+    return exprMin(exprMax(a, lo), hi);
+}
+
+/*
+* cond ? a : b. Either branch may be an expression or a constant.
+*/
+template <class C, class A, class B>
+inline ExprSelect<C, A, B> exprSelect(const PixelExpr<C> &c, const PixelExpr<A> &a, const PixelExpr<B> &b) {
+    return ExprSelect<C, A, B>(c.self(), a.self(), b.self());
+}
+
+template <class C, class A>
+inline ExprSelect<C, A, ExprConst> exprSelect(const PixelExpr<C> &c, const PixelExpr<A> &a, float b) {
+    return ExprSelect<C, A, ExprConst>(c.self(), a.self(), ExprConst(b));
+}
+
+template <class C, class B>
+inline ExprSelect<C, ExprConst, B> exprSelect(const PixelExpr<C> &c, float a, const PixelExpr<B> &b) {
+    return ExprSelect<C, ExprConst, B>(c.self(), ExprConst(a), b.self());
+}
+
+template <class C>
+inline ExprSelect<C, ExprConst, ExprConst> exprSelect(const PixelExpr<C> &c, float a, float b) {
+    return ExprSelect<C, ExprConst, ExprConst>(c.self(), ExprConst(a), ExprConst(b));
+}
+
+/*
+* Applies an expression to every pixel in a single pass
+*
+* No data pixels (and NaN pixels, when the input no data value is NaN) are written as the output no data value.
+*/
+template <class E>
+class PixelExpression: public IProcessImage {
+
+public:
+    explicit PixelExpression(const E &expr) : expr_(expr) {}
+
+    GALGError processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+        double *inNoDataValue, double *outNoDataValue) {
+
+        GALGError err = { 0, NULL };
+        const E expr = expr_;
+        size_t nPixels = (size_t)nWindowXSize * nWindowYSize;
+        if (inNoDataValue == NULL || outNoDataValue == NULL) {
+            for (size_t i = 0; i < nPixels; ++i) {
+                outputArray[i] = expr.eval(inputArray[i]);
+            }
+            return err;
+        }
+        float inNoData = (float)*inNoDataValue;
+        float outNoData = (float)*outNoDataValue;
+        if (CPLIsNan(inNoData)) {
+            for (size_t i = 0; i < nPixels; ++i) {
+                float x = inputArray[i];
+                float y = expr.eval(x);
+                outputArray[i] = x != x ? outNoData : y;
+            }
+        } else {
+            for (size_t i = 0; i < nPixels; ++i) {
+                float x = inputArray[i];
+                float y = expr.eval(x);
+                outputArray[i] = x == inNoData ? outNoData : y;
+            }
+        }
+        return err;
+    }
+
+    float eval(float x) const {
+        return expr_.eval(x);
+    }
+
+private:
+    E expr_;
+};
+
+template <class E>
+inline PixelExpression<E> pixelExpression(const PixelExpr<E> &expr) {
+    return PixelExpression<E>(expr.self());
+}
+
+#endif /* EXPR_H_ */
@@ -0,0 +1,506 @@
+#include "focal.h"
+#include <math.h>
+#include <algorithm>
+#include <limits>
+
+/*
+* Columns per strip of a vertical pass. A strip of the rows a pass touches at once stays in cache.
+*/
+static const int FOCAL_STRIP_WIDTH = 512;
+
+static const double DEG_TO_RAD = 3.14159265358979323846 / 180.0;
+
+/*
+* Splits a window into values (no data replaced by 0) and a validity mask (1 or 0).
+* Returns whether any pixel is no data.
+*/
+static bool splitNoData(const float *in, size_t nPixels, double *inNoDataValue, std::vector<float> &values,
+    std::vector<float> &valid) {
+
+    values.assign(in, in + nPixels);
+    valid.assign(nPixels, 1.0f);
+    if (inNoDataValue == NULL) {
+        return false;
+    }
+    float inNoData = (float)*inNoDataValue;
+    bool nanNoData = CPLIsNan(inNoData);
+    bool anyNoData = false;
+    for (size_t i = 0; i < nPixels; ++i) {
+        if (in[i] == inNoData || (nanNoData && CPLIsNan(in[i]))) {
+            values[i] = 0.0f;
+            valid[i] = 0.0f;
+            anyNoData = true;
+        }
+    }
+    return anyNoData;
+}
+
+/*
+* Sum of src over the (2 * rx + 1) x (2 * ry + 1) neighbourhood of each pixel, clipped to the window.
+* A running sum along each row, then a running sum of rows.
+*/
+template <class T>
+static void boxSum(const T *src, double *dst, int nx, int ny, int rx, int ry) {
+    std::vector<double> rows((size_t)nx * ny);
+    for (int y = 0; y < ny; ++y) {
+        const T *in = src + (size_t)y * nx;
+        double *out = &rows[(size_t)y * nx];
+        double sum = 0;
+        for (int x = 0; x < std::min(rx, nx - 1) + 1; ++x) {
+            sum += in[x];
+        }
+        for (int x = 0; x < nx; ++x) {
+            out[x] = sum;
+            if (x + rx + 1 < nx) {
+                sum += in[x + rx + 1];
+            }
+            if (x - rx >= 0) {
+                sum -= in[x - rx];
+            }
+        }
+    }
+    std::vector<double> acc(nx, 0.0);
+    for (int y = 0; y < std::min(ry, ny - 1) + 1; ++y) {
+        const double *row = &rows[(size_t)y * nx];
+        for (int x = 0; x < nx; ++x) {
+            acc[x] += row[x];
+        }
+    }
+    for (int y = 0; y < ny; ++y) {
+        double *out = dst + (size_t)y * nx;
+        const double *add = y + ry + 1 < ny ? &rows[(size_t)(y + ry + 1) * nx] : NULL;
+        const double *sub = y - ry >= 0 ? &rows[(size_t)(y - ry) * nx] : NULL;
+        for (int x = 0; x < nx; ++x) {
+            out[x] = acc[x];
+        }
+        if (add != NULL) {
+            for (int x = 0; x < nx; ++x) {
+                acc[x] += add[x];
+            }
+        }
+        if (sub != NULL) {
+            for (int x = 0; x < nx; ++x) {
+                acc[x] -= sub[x];
+            }
+        }
+    }
+}
+
+struct FocalMin {
+    static float identity() { return std::numeric_limits<float>::infinity(); }
+    static float apply(float a, float b) { return b < a ? b : a; }
+};
+
+struct FocalMax {
+    static float identity() { return -std::numeric_limits<float>::infinity(); }
+    static float apply(float a, float b) { return b > a ? b : a; }
+};
+
+/*
+* Van Herk/Gil-Werman running minimum or maximum over windows of 2 * r + 1 pixels, rows then columns.
+*
+* The line is padded with r identity values at each end and cut into blocks of 2 * r + 1. g holds the running result
+* from the start of each block and h to its end; every window spans at most two blocks, so its result is
+* op(h[start], g[end]): three operations per pixel whatever the radius.
+*/
+template <class Op>
+static void vanHerk(const float *src, float *dst, int nx, int ny, int r) {
+    int k = 2 * r + 1;
+    std::vector<float> rows((size_t)nx * ny);
+
+    // Rows
+    int m = nx + 2 * r;
+    std::vector<float> p(m), g(m), h(m);
+    for (int y = 0; y < ny; ++y) {
+        const float *in = src + (size_t)y * nx;
+        float *out = &rows[(size_t)y * nx];
+        std::fill(p.begin(), p.end(), Op::identity());
+        std::copy(in, in + nx, p.begin() + r);
+        for (int j = 0; j < m; ++j) {
+            g[j] = j % k == 0 ? p[j] : Op::apply(g[j - 1], p[j]);
+        }
+        for (int j = m - 1; j >= 0; --j) {
+            h[j] = (j % k == k - 1 || j == m - 1) ? p[j] : Op::apply(h[j + 1], p[j]);
+        }
+        for (int x = 0; x < nx; ++x) {
+            out[x] = Op::apply(h[x], g[x + 2 * r]);
+        }
+    }
+
+    // Columns, in strips, a row at a time
+    m = ny + 2 * r;
+    std::vector<float> identityRow(std::min(nx, FOCAL_STRIP_WIDTH), Op::identity());
+    for (int x0 = 0; x0 < nx; x0 += FOCAL_STRIP_WIDTH) {
+        int w = std::min(FOCAL_STRIP_WIDTH, nx - x0);
+        std::vector<float> gs((size_t)m * w), hs((size_t)m * w);
+        for (int j = 0; j < m; ++j) {
+            const float *pj = (j < r || j >= r + ny) ? &identityRow[0] : &rows[(size_t)(j - r) * nx + x0];
+            float *gj = &gs[(size_t)j * w];
+            if (j % k == 0) {
+                std::copy(pj, pj + w, gj);
+            } else {
+                const float *gPrev = gj - w;
+                for (int x = 0; x < w; ++x) {
+                    gj[x] = Op::apply(gPrev[x], pj[x]);
+                }
+            }
+        }
+        for (int j = m - 1; j >= 0; --j) {
+            const float *pj = (j < r || j >= r + ny) ? &identityRow[0] : &rows[(size_t)(j - r) * nx + x0];
+            float *hj = &hs[(size_t)j * w];
+            if (j % k == k - 1 || j == m - 1) {
+                std::copy(pj, pj + w, hj);
+            } else {
+                const float *hNext = hj + w;
+                for (int x = 0; x < w; ++x) {
+                    hj[x] = Op::apply(hNext[x], pj[x]);
+                }
+            }
+        }
+        for (int y = 0; y < ny; ++y) {
+            const float *hy = &hs[(size_t)y * w];
+            const float *gy = &gs[(size_t)(y + 2 * r) * w];
+            float *out = dst + (size_t)y * nx + x0;
+            for (int x = 0; x < w; ++x) {
+                out[x] = Op::apply(hy[x], gy[x]);
+            }
+        }
+    }
+}
+
+/*
+* Convolution of each row with kernel (odd length). Missing pixels are zero (extend false) or the edge pixel (extend true).
+*/
+static void convolveRows(const float *src, float *dst, int nx, int ny, const std::vector<float> &kernel, bool extend) {
+    int r = (int)kernel.size() / 2;
+    std::vector<float> p(nx + 2 * r);
+    for (int y = 0; y < ny; ++y) {
+        const float *in = src + (size_t)y * nx;
+        float *out = dst + (size_t)y * nx;
+        for (int j = 0; j < r; ++j) {
+            p[j] = extend ? in[0] : 0.0f;
+            p[r + nx + j] = extend ? in[nx - 1] : 0.0f;
+        }
+        std::copy(in, in + nx, p.begin() + r);
+        std::fill(out, out + nx, 0.0f);
+        for (int j = 0; j < (int)kernel.size(); ++j) {
+            float kj = kernel[j];
+            const float *pj = &p[j];
+            for (int x = 0; x < nx; ++x) {
+                out[x] += kj * pj[x];
+            }
+        }
+    }
+}
+
+/*
+* Convolution of each column with kernel (odd length), a strip of columns at a time
+*/
+static void convolveColumns(const float *src, float *dst, int nx, int ny, const std::vector<float> &kernel, bool extend) {
+    int r = (int)kernel.size() / 2;
+    for (int x0 = 0; x0 < nx; x0 += FOCAL_STRIP_WIDTH) {
+        int w = std::min(FOCAL_STRIP_WIDTH, nx - x0);
+        for (int y = 0; y < ny; ++y) {
+            float *out = dst + (size_t)y * nx + x0;
+            std::fill(out, out + w, 0.0f);
+            for (int j = 0; j < (int)kernel.size(); ++j) {
+                int yj = y + j - r;
+                if (yj < 0 || yj >= ny) {
+                    if (!extend) {
+                        continue;
+                    }
+                    yj = yj < 0 ? 0 : ny - 1;
+                }
+                float kj = kernel[j];
+                const float *in = src + (size_t)yj * nx + x0;
+                for (int x = 0; x < w; ++x) {
+                    out[x] += kj * in[x];
+                }
+            }
+        }
+    }
+}
+
+/************************
+ * SEPARABLE CONVOLUTION
+ ************************/
+
+void SeparableConvolution::setKernel(const std::vector<float> &kx, const std::vector<float> &ky, bool normalise) {
+    kx_ = kx;
+    ky_ = ky;
+    normalise_ = normalise;
+}
+
+int SeparableConvolution::getPixelBuffer() {
+    return (int)std::max(kx_.size(), ky_.size()) / 2;
+}
+
+GALGError SeparableConvolution::processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+    double *inNoDataValue, double *outNoDataValue) {
+
+    GALGError err = { 0, NULL };
+    if (kx_.size() % 2 == 0 || ky_.size() % 2 == 0) {
+        err.errnum = 1;
+        err.msg = "Convolution kernels must have an odd number of weights";
+        return err;
+    }
+    int nx = nWindowXSize, ny = nWindowYSize;
+    size_t nPixels = (size_t)nx * ny;
+    float outNoData = outNoDataValue != NULL ? (float)*outNoDataValue : 0.0f;
+    std::vector<float> values, valid, tmp(nPixels);
+    bool anyNoData = splitNoData(inputArray, nPixels, inNoDataValue, values, valid);
+
+    if (normalise_) {
+        // Convolve the values and the mask of valid pixels; their ratio weights only the pixels present
+        std::vector<float> weights(nPixels);
+        convolveRows(&values[0], &tmp[0], nx, ny, kx_, false);
+        convolveColumns(&tmp[0], outputArray, nx, ny, ky_, false);
+        convolveRows(&valid[0], &tmp[0], nx, ny, kx_, false);
+        convolveColumns(&tmp[0], &weights[0], nx, ny, ky_, false);
+        for (size_t i = 0; i < nPixels; ++i) {
+            outputArray[i] = (valid[i] == 0.0f || weights[i] == 0.0f) ? outNoData : outputArray[i] / weights[i];
+        }
+        return err;
+    }
+
+    convolveRows(&values[0], &tmp[0], nx, ny, kx_, true);
+    convolveColumns(&tmp[0], outputArray, nx, ny, ky_, true);
+    if (anyNoData) {
+        std::vector<double> nValid(nPixels);
+        boxSum(&valid[0], &nValid[0], nx, ny, (int)kx_.size() / 2, (int)ky_.size() / 2);
+        int rx = (int)kx_.size() / 2, ry = (int)ky_.size() / 2;
+        for (int y = 0; y < ny; ++y) {
+            int nRows = std::min(y + ry, ny - 1) - std::max(y - ry, 0) + 1;
+            for (int x = 0; x < nx; ++x) {
+                int nCols = std::min(x + rx, nx - 1) - std::max(x - rx, 0) + 1;
+                size_t i = (size_t)y * nx + x;
+                if (nValid[i] < nRows * nCols - 0.5) {
+                    outputArray[i] = outNoData;
+                }
+            }
+        }
+    }
+    return err;
+}
+
+void GaussianBlur::setGaussianParams(double sigma) {
+    int r = (int)ceil(3 * sigma);
+    std::vector<float> kernel(2 * r + 1);
+    for (int i = -r; i <= r; ++i) {
+        kernel[i + r] = sigma > 0 ? (float)exp(-(double)i * i / (2 * sigma * sigma)) : 1.0f;
+    }
+    setKernel(kernel, kernel, true);
+}
+
+/*******************
+ * FOCAL STATISTICS
+ *******************/
+
+void FocalStatistics::setFocalParams(int radius, int statType) {
+    radius_ = radius;
+    statType_ = statType;
+}
+
+int FocalStatistics::getPixelBuffer() {
+    return radius_;
+}
+
+GALGError FocalStatistics::processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+    double *inNoDataValue, double *outNoDataValue) {
+
+    GALGError err = { 0, NULL };
+    if (radius_ < 0) {
+        err.errnum = 1;
+        err.msg = "Focal radius must not be negative";
+        return err;
+    }
+    int nx = nWindowXSize, ny = nWindowYSize, r = radius_;
+    size_t nPixels = (size_t)nx * ny;
+    float outNoData = outNoDataValue != NULL ? (float)*outNoDataValue : 0.0f;
+    std::vector<float> values, valid;
+    splitNoData(inputArray, nPixels, inNoDataValue, values, valid);
+
+    switch (statType_) {
+    case FOCAL_MEAN:
+    case FOCAL_STD: {
+        std::vector<double> sum(nPixels), count(nPixels), sumSq;
+        boxSum(&values[0], &sum[0], nx, ny, r, r);
+        boxSum(&valid[0], &count[0], nx, ny, r, r);
+        if (statType_ == FOCAL_STD) {
+            std::vector<double> squares(nPixels);
+            for (size_t i = 0; i < nPixels; ++i) {
+                squares[i] = (double)values[i] * values[i];
+            }
+            sumSq.resize(nPixels);
+            boxSum(&squares[0], &sumSq[0], nx, ny, r, r);
+        }
+        for (size_t i = 0; i < nPixels; ++i) {
+            if (valid[i] == 0.0f || count[i] < 0.5) {
+                outputArray[i] = outNoData;
+                continue;
+            }
+            double mean = sum[i] / count[i];
+            if (statType_ == FOCAL_MEAN) {
+                outputArray[i] = (float)mean;
+            } else {
+                double variance = sumSq[i] / count[i] - mean * mean;
+                outputArray[i] = (float)sqrt(variance > 0 ? variance : 0);
+            }
+        }
+        return err;
+    }
+    case FOCAL_MIN:
+    case FOCAL_MAX: {
+        bool isMin = statType_ == FOCAL_MIN;
+        float identity = isMin ? FocalMin::identity() : FocalMax::identity();
+        for (size_t i = 0; i < nPixels; ++i) {
+            if (valid[i] == 0.0f) {
+                values[i] = identity;
+            }
+        }
+        if (isMin) {
+            vanHerk<FocalMin>(&values[0], outputArray, nx, ny, r);
+        } else {
+            vanHerk<FocalMax>(&values[0], outputArray, nx, ny, r);
+        }
+        for (size_t i = 0; i < nPixels; ++i) {
+            if (valid[i] == 0.0f) {
+                outputArray[i] = outNoData;
+            }
+        }
+        return err;
+    }
+    default:
+        err.errnum = 1;
+        err.msg = "Unknown focal statistic";
+        return err;
+    }
+}
+
+/*******************
+ * TERRAIN
+ *******************/
+
+void TerrainFunction::setTerrainParams(double xRes, double yRes, double zFactor) {
+    xRes_ = fabs(xRes);
+    yRes_ = fabs(yRes);
+    zFactor_ = zFactor;
+}
+
+int TerrainFunction::getPixelBuffer() {
+    return 1;
+}
+
+void TerrainFunction::gradients(const float *inputArray, int nWindowXSize, int nWindowYSize, double *inNoDataValue,
+    std::vector<float> &dzdx, std::vector<float> &dzdy, std::vector<unsigned char> &valid) {
+
+    int nx = nWindowXSize, ny = nWindowYSize;
+    size_t nPixels = (size_t)nx * ny;
+    dzdx.resize(nPixels);
+    dzdy.resize(nPixels);
+    valid.assign(nPixels, 1);
+    if (inNoDataValue != NULL) {
+        float inNoData = (float)*inNoDataValue;
+        bool nanNoData = CPLIsNan(inNoData);
+        for (size_t i = 0; i < nPixels; ++i) {
+            if (inputArray[i] == inNoData || (nanNoData && CPLIsNan(inputArray[i]))) {
+                valid[i] = 0;
+            }
+        }
+    }
+    double xScale = zFactor_ / (8 * xRes_), yScale = zFactor_ / (8 * yRes_);
+    for (int y = 0; y < ny; ++y) {
+        int rows[3] = { std::max(y - 1, 0), y, std::min(y + 1, ny - 1) };
+        for (int x = 0; x < nx; ++x) {
+            size_t i = (size_t)y * nx + x;
+            int cols[3] = { std::max(x - 1, 0), x, std::min(x + 1, nx - 1) };
+            float centre = inputArray[i];
+            float z[3][3];
+            for (int dy = 0; dy < 3; ++dy) {
+                for (int dx = 0; dx < 3; ++dx) {
+                    size_t j = (size_t)rows[dy] * nx + cols[dx];
+                    z[dy][dx] = valid[j] ? inputArray[j] : centre;
+                }
+            }
+            // Rows run north to south, so north is the first row
+            dzdx[i] = (float)(((z[0][2] + 2 * z[1][2] + z[2][2]) - (z[0][0] + 2 * z[1][0] + z[2][0])) * xScale);
+            dzdy[i] = (float)(((z[0][0] + 2 * z[0][1] + z[0][2]) - (z[2][0] + 2 * z[2][1] + z[2][2])) * yScale);
+        }
+    }
+}
+
+void Slope::setSlopeParams(bool percent) {
+    percent_ = percent;
+}
+
+GALGError Slope::processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+    double *inNoDataValue, double *outNoDataValue) {
+
+    GALGError err = { 0, NULL };
+    std::vector<float> dzdx, dzdy;
+    std::vector<unsigned char> valid;
+    gradients(inputArray, nWindowXSize, nWindowYSize, inNoDataValue, dzdx, dzdy, valid);
+    float outNoData = outNoDataValue != NULL ? (float)*outNoDataValue : 0.0f;
+    size_t nPixels = (size_t)nWindowXSize * nWindowYSize;
+    for (size_t i = 0; i < nPixels; ++i) {
+        double rise = sqrt((double)dzdx[i] * dzdx[i] + (double)dzdy[i] * dzdy[i]);
+        float slope = (float)(percent_ ? 100 * rise : atan(rise) / DEG_TO_RAD);
+        outputArray[i] = valid[i] ? slope : outNoData;
+    }
+    return err;
+}
+
+GALGError Aspect::processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+    double *inNoDataValue, double *outNoDataValue) {
+
+    GALGError err = { 0, NULL };
+    std::vector<float> dzdx, dzdy;
+    std::vector<unsigned char> valid;
+    gradients(inputArray, nWindowXSize, nWindowYSize, inNoDataValue, dzdx, dzdy, valid);
+    float outNoData = outNoDataValue != NULL ? (float)*outNoDataValue : 0.0f;
+    float flat = outNoDataValue != NULL ? outNoData : -1.0f;
+    size_t nPixels = (size_t)nWindowXSize * nWindowYSize;
+    for (size_t i = 0; i < nPixels; ++i) {
+        if (!valid[i]) {
+            outputArray[i] = outNoData;
+        } else if (dzdx[i] == 0.0f && dzdy[i] == 0.0f) {
+            outputArray[i] = flat;
+        } else {
+            // The slope faces down the gradient
+            double aspect = atan2(-(double)dzdx[i], -(double)dzdy[i]) / DEG_TO_RAD;
+            outputArray[i] = (float)(aspect < 0 ? aspect + 360 : aspect);
+        }
+    }
+    return err;
+}
+
+void Hillshade::setHillshadeParams(double azimuth, double altitude) {
+    azimuth_ = azimuth;
+    altitude_ = altitude;
+}
+
+GALGError Hillshade::processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+    double *inNoDataValue, double *outNoDataValue) {
+
+    GALGError err = { 0, NULL };
+    std::vector<float> dzdx, dzdy;
+    std::vector<unsigned char> valid;
+    gradients(inputArray, nWindowXSize, nWindowYSize, inNoDataValue, dzdx, dzdy, valid);
+    float outNoData = outNoDataValue != NULL ? (float)*outNoDataValue : 0.0f;
+    double zenith = (90 - altitude_) * DEG_TO_RAD;
+    double cosZenith = cos(zenith), sinZenith = sin(zenith);
+    double azimuth = azimuth_ * DEG_TO_RAD;
+    size_t nPixels = (size_t)nWindowXSize * nWindowYSize;
+    for (size_t i = 0; i < nPixels; ++i) {
+        if (!valid[i]) {
+            outputArray[i] = outNoData;
+            continue;
+        }
+        double rise = sqrt((double)dzdx[i] * dzdx[i] + (double)dzdy[i] * dzdy[i]);
+        double slope = atan(rise);
+        double aspect = atan2(-(double)dzdx[i], -(double)dzdy[i]);
+        double shade = 255 * (cosZenith * cos(slope) + sinZenith * sin(slope) * cos(azimuth - aspect));
+        outputArray[i] = (float)(shade > 0 ? shade : 0);
+    }
+    return err;
+}
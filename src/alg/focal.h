@@ -0,0 +1,125 @@
+#ifndef FOCAL_H_
+#define FOCAL_H_
+#include <vector>
+#include "../core/galg.h"
+#include "func_exp.h"
+
+/*
+* Neighbourhood (focal) functions
+*
+* Each function asks RasterProcess for a pixel buffer of its radius through getPixelBuffer, so windows arrive with the
+* neighbours of their edge pixels. Neighbours outside the window are treated as missing. Separable filters run as a
+* horizontal pass over each row followed by a vertical pass over strips of columns, so the rows a vertical pass
+* touches stay in cache however wide the window is.
+*/
+
+/*
+* Separable convolution with a horizontal kernel kx and a vertical kernel ky (odd lengths, centred on the pixel)
+*
+* With normalise, missing and no data neighbours are left out and the result is divided by the sum of the weights
+* actually used, as needed by smoothing kernels. Otherwise edges are extended and a pixel with no data anywhere in
+* its neighbourhood is no data.
+*/
+class GALGFUNC_DLL SeparableConvolution: public IProcessImage {
+
+public:
+    void setKernel(const std::vector<float> &kx, const std::vector<float> &ky, bool normalise);
+    int getPixelBuffer();
+    GALGError processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+        double *inNoDataValue, double *outNoDataValue);
+protected:
+    std::vector<float> kx_;
+    std::vector<float> ky_;
+    bool normalise_ = true;
+};
+
+/*
+* Gaussian blur, truncated at 3 sigma
+*/
+class GALGFUNC_DLL GaussianBlur: public SeparableConvolution {
+
+public:
+    void setGaussianParams(double sigma);
+};
+
+enum GALGFUNC_DLL FocalStatType {FOCAL_MEAN = 0, FOCAL_STD = 1, FOCAL_MIN = 2, FOCAL_MAX = 3};
+
+/*
+* Statistics of the square neighbourhood of side 2 * radius + 1 around each pixel
+*
+* Mean and standard deviation use running sums and minimum and maximum the van Herk/Gil-Werman algorithm, so the cost
+* per pixel does not depend on the radius. No data neighbours are ignored; no data pixels stay no data.
+*/
+class GALGFUNC_DLL FocalStatistics: public IProcessImage {
+
+public:
+    void setFocalParams(int radius, int statType);
+    int getPixelBuffer();
+    GALGError processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+        double *inNoDataValue, double *outNoDataValue);
+private:
+    int radius_ = 1;
+    int statType_ = FOCAL_MEAN;
+};
+
+/*
+* Base of the terrain functions: gradients of a DEM by Horn's method over the 3x3 neighbourhood
+*
+* xRes and yRes are the pixel sizes in the units of the elevations (divided by zFactor).
+* Missing and no data neighbours take the value of the centre pixel.
+*/
+class GALGFUNC_DLL TerrainFunction: public IProcessImage {
+
+public:
+    void setTerrainParams(double xRes, double yRes, double zFactor);
+    int getPixelBuffer();
+protected:
+    /*
+    * East and north components of the gradient of each pixel; valid is 0 for no data pixels
+    */
+    void gradients(const float *inputArray, int nWindowXSize, int nWindowYSize, double *inNoDataValue,
+        std::vector<float> &dzdx, std::vector<float> &dzdy, std::vector<unsigned char> &valid);
+    double xRes_ = 1;
+    double yRes_ = 1;
+    double zFactor_ = 1;
+};
+
+/*
+* Slope in degrees, or in percent
+*/
+class GALGFUNC_DLL Slope: public TerrainFunction {
+
+public:
+    void setSlopeParams(bool percent);
+    GALGError processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+        double *inNoDataValue, double *outNoDataValue);
+private:
+    bool percent_ = false;
+};
+
+/*
+* Aspect: the compass direction the slope faces, in degrees clockwise from north.
+* Flat pixels are written as the output no data value, or -1 when there is none.
+*/
+class GALGFUNC_DLL Aspect: public TerrainFunction {
+
+public:
+    GALGError processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+        double *inNoDataValue, double *outNoDataValue);
+};
+
+/*
+* Hillshade from 0 (in shadow) to 255 for a light source at the given compass azimuth and altitude (degrees)
+*/
+class GALGFUNC_DLL Hillshade: public TerrainFunction {
+
+public:
+    void setHillshadeParams(double azimuth, double altitude);
+    GALGError processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+        double *inNoDataValue, double *outNoDataValue);
+private:
+    double azimuth_ = 315;
+    double altitude_ = 45;
+};
+
+#endif /* FOCAL_H_ */
@@ -0,0 +1,144 @@
+#include "pixelops.h"
+#include <math.h>
+#include <limits>
+
+void Rescale::setRescaleParams(double scale, double offset) {
+    scale_ = scale;
+    offset_ = offset;
+}
+
+void Rescale::setRescaleRange(double inMin, double inMax, double outMin, double outMax) {
+    scale_ = inMax != inMin ? (outMax - outMin) / (inMax - inMin) : 0.0;
+    offset_ = outMin - inMin * scale_;
+}
+
+GALGError Rescale::processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+    double *inNoDataValue, double *outNoDataValue) {
+
+    GALGError err = { 0, NULL };
+    float inf = std::numeric_limits<float>::infinity();
+    galgAffineClamp(inputArray, outputArray, (size_t)nWindowXSize * nWindowYSize, (float)scale_, (float)offset_,
+        -inf, inf, false, galgPixelNoData(inNoDataValue, outNoDataValue));
+    return err;
+}
+
+void Clamp::setClampParams(double minVal, double maxVal) {
+    minVal_ = minVal;
+    maxVal_ = maxVal;
+}
+
+GALGError Clamp::processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+    double *inNoDataValue, double *outNoDataValue) {
+
+    GALGError err = { 0, NULL };
+    if (minVal_ > maxVal_) {
+        err.errnum = 1;
+        err.msg = "Clamp minimum is greater than its maximum";
+        return err;
+    }
+    galgAffineClamp(inputArray, outputArray, (size_t)nWindowXSize * nWindowYSize, 1.0f, 0.0f,
+        (float)minVal_, (float)maxVal_, false, galgPixelNoData(inNoDataValue, outNoDataValue));
+    return err;
+}
+
+void NoDataMask::setMaskParams(double minVal, double maxVal) {
+    minVal_ = minVal;
+    maxVal_ = maxVal;
+}
+
+GALGError NoDataMask::processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+    double *inNoDataValue, double *outNoDataValue) {
+
+    GALGError err = { 0, NULL };
+    if (outNoDataValue == NULL) {
+        err.errnum = 1;
+        err.msg = "Masking requires an output no data value";
+        return err;
+    }
+    size_t nPixels = (size_t)nWindowXSize * nWindowYSize;
+    float outNoData = (float)*outNoDataValue;
+    GALGPixelNoData noData = galgPixelNoData(inNoDataValue, outNoDataValue);
+
+    // Mask values above the range, then (in place) values below it: x >= min is x > the next float down
+    galgThresholdSelect(inputArray, outputArray, nPixels, (float)maxVal_, outNoData, false, 0.0f, true, noData);
+    float belowMin = nextafterf((float)minVal_, -std::numeric_limits<float>::infinity());
+    GALGPixelNoData none = galgPixelNoData(NULL, NULL);
+    galgThresholdSelect(outputArray, outputArray, nPixels, belowMin, 0.0f, true, outNoData, false, none);
+    return err;
+}
+
+void Cast::setCastParams(GDALDataType dataType) {
+    dataType_ = dataType;
+}
+
+GALGError Cast::processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+    double *inNoDataValue, double *outNoDataValue) {
+
+    GALGError err = { 0, NULL };
+    float lo, hi;
+    switch (dataType_) {
+    case GDT_Byte:
+        lo = 0.0f;
+        hi = 255.0f;
+        break;
+    case GDT_UInt16:
+        lo = 0.0f;
+        hi = 65535.0f;
+        break;
+    case GDT_Int16:
+        lo = -32768.0f;
+        hi = 32767.0f;
+        break;
+    case GDT_UInt32:
+        lo = 0.0f;
+        hi = 4294967295.0f;
+        break;
+    case GDT_Int32:
+        lo = -2147483648.0f;
+        hi = 2147483647.0f;
+        break;
+    case GDT_Float32:
+    case GDT_Float64: {
+        float inf = std::numeric_limits<float>::infinity();
+        galgAffineClamp(inputArray, outputArray, (size_t)nWindowXSize * nWindowYSize, 1.0f, 0.0f, -inf, inf, false,
+            galgPixelNoData(inNoDataValue, outNoDataValue));
+        return err;
+    }
+    default:
+        err.errnum = 1;
+        err.msg = "Unsupported data type for casting";
+        return err;
+    }
+    galgAffineClamp(inputArray, outputArray, (size_t)nWindowXSize * nWindowYSize, 1.0f, 0.0f, lo, hi, true,
+        galgPixelNoData(inNoDataValue, outNoDataValue));
+    return err;
+}
+
+void BandMath::setBandMathParams(GALGBandOp op, int bandA, int bandB) {
+    op_ = op;
+    bandA_ = bandA;
+    bandB_ = bandB;
+}
+
+int BandMath::getOutputBandCount(int nInputBands) {
+    return 1;
+}
+
+GALGError BandMath::processBands(float *inputArray, int nInputBands, float *outputArray, int nOutputBands,
+    int nWindowXSize, int nWindowYSize, double *inNoDataValues, double *outNoDataValues) {
+
+    GALGError err = { 0, NULL };
+    if (bandA_ < 1 || bandA_ > nInputBands || bandB_ < 1 || bandB_ > nInputBands) {
+        err.errnum = 1;
+        err.msg = "Band number out of range";
+        return err;
+    }
+    // Band interleaved: each band is a contiguous plane
+    size_t nPixels = (size_t)nWindowXSize * nWindowYSize;
+    double *outNoDataValue = outNoDataValues != NULL ? &outNoDataValues[0] : NULL;
+    GALGPixelNoData noDataA = galgPixelNoData(inNoDataValues != NULL ? &inNoDataValues[bandA_ - 1] : NULL, outNoDataValue);
+    GALGPixelNoData noDataB = galgPixelNoData(inNoDataValues != NULL ? &inNoDataValues[bandB_ - 1] : NULL, outNoDataValue);
+    galgBandOp(inputArray + (bandA_ - 1) * nPixels, inputArray + (bandB_ - 1) * nPixels, outputArray, nPixels, op_,
+        noDataA, noDataB);
+    return err;
+}
@@ -0,0 +1,99 @@
+#ifndef PIXELOPS_H_
+#define PIXELOPS_H_
+#include "../core/galg.h"
+#include "func_exp.h"
+#include "simd.h"
+
+/*
+* Linear rescaling: out = in * scale + offset
+*
+* No data pixels are written as the output no data value.
+*/
+class GALGFUNC_DLL Rescale: public IProcessImage {
+
+public:
+    void setRescaleParams(double scale, double offset);
+    /*
+    * Map the range [inMin, inMax] linearly onto [outMin, outMax]
+    */
+    void setRescaleRange(double inMin, double inMax, double outMin, double outMax);
+    GALGError processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+        double *inNoDataValue, double *outNoDataValue);
+private:
+    double scale_ = 1;
+    double offset_ = 0;
+};
+
+/*
+* Clamp each pixel to [minVal, maxVal]
+*
+* No data pixels are written as the output no data value.
+*/
+class GALGFUNC_DLL Clamp: public IProcessImage {
+
+public:
+    void setClampParams(double minVal, double maxVal);
+    GALGError processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+        double *inNoDataValue, double *outNoDataValue);
+private:
+    double minVal_ = 0;
+    double maxVal_ = 0;
+};
+
+/*
+* No data masking
+*
+* Pixels outside the valid range [minVal, maxVal], NaN pixels and no data pixels are written as the output no data value.
+* Valid pixels are unchanged.
+*/
+class GALGFUNC_DLL NoDataMask: public IProcessImage {
+
+public:
+    void setMaskParams(double minVal, double maxVal);
+    GALGError processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+        double *inNoDataValue, double *outNoDataValue);
+private:
+    double minVal_ = 0;
+    double maxVal_ = 0;
+};
+
+/*
+* Type casting
+*
+* Rounds each pixel to the nearest integer (ties to even) and saturates it to the range of an integer data type,
+* as a conversion to that type would, so that the result can be written to a dataset of that type without wrapping.
+* For floating point types the values are passed through. No data pixels are written as the output no data value.
+*/
+class GALGFUNC_DLL Cast: public IProcessImage {
+
+public:
+    void setCastParams(GDALDataType dataType);
+    GALGError processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+        double *inNoDataValue, double *outNoDataValue);
+private:
+    GDALDataType dataType_ = GDT_Float32;
+};
+
+/*
+* Arithmetic between two bands of a raster, e.g. a band ratio or NDVI
+*
+* Produces a single output band: bandA op bandB. A pixel which is no data in either band, or divides by zero,
+* is written as the output no data value.
+*/
+class GALGFUNC_DLL BandMath: public IProcessBands {
+
+public:
+    /*
+    * bandA and bandB are 1-based band numbers of the input raster
+    */
+    void setBandMathParams(GALGBandOp op, int bandA, int bandB);
+    GALGError processBands(float *inputArray, int nInputBands, float *outputArray, int nOutputBands,
+        int nWindowXSize, int nWindowYSize, double *inNoDataValues, double *outNoDataValues);
+    int getOutputBandCount(int nInputBands);
+private:
+    GALGBandOp op_ = GALG_BAND_ADD;
+    int bandA_ = 1;
+    int bandB_ = 2;
+};
+
+#endif /* PIXELOPS_H_ */
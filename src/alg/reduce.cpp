@@ -0,0 +1,98 @@
+
+#include "reduce.h"
+#include <vector>
+#include <algorithm>
+
+GALGError ReduceMax::fold(float *inputArray, float *accumulator, int nWindowXSize, int nWindowYSize,
+    double *inNoDataValue, double *outNoDataValue) {
+
+    GALGError err = { 0, NULL };
+    size_t nPixels = (size_t)nWindowXSize * nWindowYSize;
+    float inNoData = (float)*inNoDataValue;
+    float *max = accumulator, *valid = accumulator + nPixels;
+    for (size_t i = 0; i < nPixels; ++i) {
+        if (inputArray[i] == inNoData) {
+            continue;
+        }
+        if (valid[i] == 0 || inputArray[i] > max[i]) {
+            max[i] = inputArray[i];
+            valid[i] = 1.0f;
+        }
+    }
+    return err;
+}
+
+int ReduceMean::getAccumulatorCount() {
+    // A running sum followed by a count of valid values
+    return 2;
+}
+
+GALGError ReduceMean::initialise(float *accumulator, int nWindowXSize, int nWindowYSize, double *outNoDataValue) {
+    GALGError err = { 0, NULL };
+    size_t nPixels = (size_t)nWindowXSize * nWindowYSize;
+    std::fill(accumulator, accumulator + 2 * nPixels, 0.0f);
+    return err;
+}
+
+GALGError ReduceMean::fold(float *inputArray, float *accumulator, int nWindowXSize, int nWindowYSize,
+    double *inNoDataValue, double *outNoDataValue) {
+
+    GALGError err = { 0, NULL };
+    size_t nPixels = (size_t)nWindowXSize * nWindowYSize;
+    float inNoData = (float)*inNoDataValue;
+    float *sum = accumulator, *count = accumulator + nPixels;
+    for (size_t i = 0; i < nPixels; ++i) {
+        if (inputArray[i] != inNoData) {
+            sum[i] += inputArray[i];
+            count[i] += 1.0f;
+        }
+    }
+    return err;
+}
+
+GALGError ReduceMean::finalise(float *accumulator, float *outputArray, int nWindowXSize, int nWindowYSize, int nInputs,
+    double *outNoDataValue) {
+
+    GALGError err = { 0, NULL };
+    size_t nPixels = (size_t)nWindowXSize * nWindowYSize;
+    float *sum = accumulator, *count = accumulator + nPixels;
+    for (size_t i = 0; i < nPixels; ++i) {
+        outputArray[i] = count[i] > 0 ? sum[i] / count[i] : (float)*outNoDataValue;
+    }
+    return err;
+}
+
+bool ReduceMedian::isIncremental() {
+    return false;
+}
+
+GALGError ReduceMedian::reduceImage(float **inputArrays, int nInputs, float *outputArray, int nWindowXSize,
+    int nWindowYSize, double *inNoDataValues, double *outNoDataValue) {
+
+    GALGError err = { 0, NULL };
+    size_t nPixels = (size_t)nWindowXSize * nWindowYSize;
+    std::vector<float> values;
+    values.reserve(nInputs);
+    for (size_t i = 0; i < nPixels; ++i) {
+        values.clear();
+        for (int j = 0; j < nInputs; ++j) {
+            if (inputArrays[j][i] != (float)inNoDataValues[j]) {
+                values.push_back(inputArrays[j][i]);
+            }
+        }
+        if (values.empty()) {
+            outputArray[i] = (float)*outNoDataValue;
+            continue;
+        }
+        size_t mid = values.size() / 2;
+        std::nth_element(values.begin(), values.begin() + mid, values.end());
+        float median = values[mid];
+        if (values.size() % 2 == 0) {
+            // Even count: average the two middle values
+            float lower = *std::max_element(values.begin(), values.begin() + mid);
+            median = (lower + median) / 2.0f;
+        }
+        outputArray[i] = median;
+    }
+    return err;
+}
@@ -0,0 +1,48 @@
+#ifndef REDUCE_H_
+#define REDUCE_H_
+#include "../core/galg.h"
+#include "func_exp.h"
+
+/*
+* Per-pixel maximum across the inputs
+*
+* Folded one input at a time into the maximum and whether one has been seen (the default accumulator layout).
+* No data values are ignored; a pixel with no valid input is no data.
+*/
+class GALGFUNC_DLL ReduceMax: public IReduceImage {
+
+public:
+    GALGError fold(float *inputArray, float *accumulator, int nWindowXSize, int nWindowYSize,
+        double *inNoDataValue, double *outNoDataValue);
+};
+
+/*
+* Per-pixel mean across the inputs
+*
+* Folded one input at a time into a running sum and count. No data values are ignored.
+*/
+class GALGFUNC_DLL ReduceMean: public IReduceImage {
+
+public:
+    int getAccumulatorCount();
+    GALGError initialise(float *accumulator, int nWindowXSize, int nWindowYSize, double *outNoDataValue);
+    GALGError fold(float *inputArray, float *accumulator, int nWindowXSize, int nWindowYSize,
+        double *inNoDataValue, double *outNoDataValue);
+    GALGError finalise(float *accumulator, float *outputArray, int nWindowXSize, int nWindowYSize, int nInputs,
+        double *outNoDataValue);
+};
+
+/*
+* Per-pixel median across the inputs
+*
+* Not incremental: every input window is held in memory at once. No data values are ignored.
+*/
+class GALGFUNC_DLL ReduceMedian: public IReduceImage {
+
+public:
+    bool isIncremental();
+    GALGError reduceImage(float **inputArrays, int nInputs, float *outputArray, int nWindowXSize, int nWindowYSize,
+        double *inNoDataValues, double *outNoDataValue);
+};
+
+#endif /* REDUCE_H_ */
@@ -0,0 +1,404 @@
+#include "simd.h"
+#include <math.h>
+#include "cpl_port.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define GALG_HAVE_X86
+#  define GALG_TARGET(isa) __attribute__((target(isa)))
+#  include <immintrin.h>
+#elif defined(_MSC_VER) && defined(_M_X64)
+#  define GALG_HAVE_X86
+#  define GALG_TARGET(isa)
+#  include <immintrin.h>
+#  include <intrin.h>
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+#  define GALG_HAVE_NEON
+#  include <arm_neon.h>
+#endif
+
+/*
+* Scalar reference implementations. These also finish off the pixels left over after the last whole vector.
+* The comparisons are arranged so that NaN behaves the same as in the vector code.
+*/
+
+static inline bool isNoData(float x, const GALGPixelNoData &noData) {
+    return noData.hasNoData && (x == noData.inValue || (CPLIsNan(noData.inValue) && CPLIsNan(x)));
+}
+
+// Round to nearest, ties to even, without depending on the floating point environment
+static inline float roundEven(float y) {
+    float a = fabsf(y);
+    if (a < 8388608.0f) {
+        // Adding 2^23 leaves no fractional bits
+        a = (a + 8388608.0f) - 8388608.0f;
+    }
+    return y < 0 ? -a : a;
+}
+
+static void scalarAffineClamp(const float *in, float *out, size_t n, float scale, float offset,
+    float lo, float hi, bool round, GALGPixelNoData noData) {
+
+    for (size_t i = 0; i < n; ++i) {
+        float y = in[i] * scale + offset;
+        if (round) {
+            y = roundEven(y);
+        }
+        y = y < lo ? lo : y;
+        y = y > hi ? hi : y;
+        out[i] = isNoData(in[i], noData) ? noData.outValue : y;
+    }
+}
+
+static void scalarThresholdSelect(const float *in, float *out, size_t n, float threshold,
+    float above, bool aboveIsInput, float below, bool belowIsInput, GALGPixelNoData noData) {
+
+    for (size_t i = 0; i < n; ++i) {
+        float x = in[i];
+        float y = x > threshold ? (aboveIsInput ? x : above) : (belowIsInput ? x : below);
+        out[i] = isNoData(x, noData) ? noData.outValue : y;
+    }
+}
+
+static void scalarBandOp(const float *a, const float *b, float *out, size_t n, GALGBandOp op,
+    GALGPixelNoData noDataA, GALGPixelNoData noDataB, GALGPixelNoData noData) {
+
+    for (size_t i = 0; i < n; ++i) {
+        float x = a[i], z = b[i], y, divisor = 0;
+        switch (op) {
+        case GALG_BAND_ADD:
+            y = x + z;
+            break;
+        case GALG_BAND_SUBTRACT:
+            y = x - z;
+            break;
+        case GALG_BAND_MULTIPLY:
+            y = x * z;
+            break;
+        case GALG_BAND_DIVIDE:
+            divisor = z;
+            y = x / z;
+            break;
+        default:
+            divisor = x + z;
+            y = (x - z) / divisor;
+            break;
+        }
+        bool invalid = isNoData(x, noDataA) || isNoData(z, noDataB);
+        if (op == GALG_BAND_DIVIDE || op == GALG_BAND_NORMALISED_DIFFERENCE) {
+            invalid = invalid || (noData.hasNoData && divisor == 0);
+        }
+        out[i] = invalid ? noData.outValue : y;
+    }
+}
+
+/*
+* SSE2 and AVX2
+*/
+#ifdef GALG_HAVE_X86
+
+GALG_TARGET("sse2") static inline __m128 sse2Blend(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+GALG_TARGET("sse2") static inline __m128 sse2FromBool(bool value) {
+    return _mm_castsi128_ps(_mm_set1_epi32(value ? -1 : 0));
+}
+GALG_TARGET("sse2") static inline __m128 sse2Round(__m128 y) {
+    __m128 signMask = _mm_set1_ps(-0.0f), twoTo23 = _mm_set1_ps(8388608.0f);
+    __m128 a = _mm_andnot_ps(signMask, y);
+    __m128 rounded = _mm_sub_ps(_mm_add_ps(a, twoTo23), twoTo23);
+    a = sse2Blend(_mm_cmplt_ps(a, twoTo23), rounded, a);
+    return _mm_or_ps(a, _mm_and_ps(_mm_cmplt_ps(y, _mm_setzero_ps()), signMask));
+}
+
+#define GALG_V __m128
+#define GALG_M __m128
+#define GALG_VWIDTH 4
+#define GALG_VLOAD _mm_loadu_ps
+#define GALG_VSTORE _mm_storeu_ps
+#define GALG_VSET1 _mm_set1_ps
+#define GALG_VADD _mm_add_ps
+#define GALG_VSUB _mm_sub_ps
+#define GALG_VMUL _mm_mul_ps
+#define GALG_VDIV _mm_div_ps
+#define GALG_VLT _mm_cmplt_ps
+#define GALG_VGT _mm_cmpgt_ps
+#define GALG_VEQ _mm_cmpeq_ps
+#define GALG_VISNAN(x) _mm_cmpunord_ps(x, x)
+#define GALG_VROUND sse2Round
+#define GALG_VBLEND sse2Blend
+#define GALG_MOR _mm_or_ps
+#define GALG_MAND _mm_and_ps
+#define GALG_MFROMBOOL sse2FromBool
+#define GALG_SIMD(name) sse2_##name
+#define GALG_SIMD_ATTR GALG_TARGET("sse2")
+#include "simd_kernels.h"
+#undef GALG_V
+#undef GALG_M
+#undef GALG_VWIDTH
+#undef GALG_VLOAD
+#undef GALG_VSTORE
+#undef GALG_VSET1
+#undef GALG_VADD
+#undef GALG_VSUB
+#undef GALG_VMUL
+#undef GALG_VDIV
+#undef GALG_VLT
+#undef GALG_VGT
+#undef GALG_VEQ
+#undef GALG_VISNAN
+#undef GALG_VROUND
+#undef GALG_VBLEND
+#undef GALG_MOR
+#undef GALG_MAND
+#undef GALG_MFROMBOOL
+#undef GALG_SIMD
+#undef GALG_SIMD_ATTR
+
+GALG_TARGET("avx2") static inline __m256 avx2Blend(__m256 mask, __m256 a, __m256 b) {
+    return _mm256_blendv_ps(b, a, mask);
+}
+GALG_TARGET("avx2") static inline __m256 avx2FromBool(bool value) {
+    return _mm256_castsi256_ps(_mm256_set1_epi32(value ? -1 : 0));
+}
+GALG_TARGET("avx2") static inline __m256 avx2Lt(__m256 a, __m256 b) {
+    return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+}
+GALG_TARGET("avx2") static inline __m256 avx2Gt(__m256 a, __m256 b) {
+    return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+}
+GALG_TARGET("avx2") static inline __m256 avx2Eq(__m256 a, __m256 b) {
+    return _mm256_cmp_ps(a, b, _CMP_EQ_OQ);
+}
+GALG_TARGET("avx2") static inline __m256 avx2IsNan(__m256 x) {
+    return _mm256_cmp_ps(x, x, _CMP_UNORD_Q);
+}
+GALG_TARGET("avx2") static inline __m256 avx2Round(__m256 y) {
+    __m256 signMask = _mm256_set1_ps(-0.0f), twoTo23 = _mm256_set1_ps(8388608.0f);
+    __m256 a = _mm256_andnot_ps(signMask, y);
+    __m256 rounded = _mm256_sub_ps(_mm256_add_ps(a, twoTo23), twoTo23);
+    a = avx2Blend(avx2Lt(a, twoTo23), rounded, a);
+    return _mm256_or_ps(a, _mm256_and_ps(avx2Lt(y, _mm256_setzero_ps()), signMask));
+}
+
+#define GALG_V __m256
+#define GALG_M __m256
+#define GALG_VWIDTH 8
+#define GALG_VLOAD _mm256_loadu_ps
+#define GALG_VSTORE _mm256_storeu_ps
+#define GALG_VSET1 _mm256_set1_ps
+#define GALG_VADD _mm256_add_ps
+#define GALG_VSUB _mm256_sub_ps
+#define GALG_VMUL _mm256_mul_ps
+#define GALG_VDIV _mm256_div_ps
+#define GALG_VLT avx2Lt
+#define GALG_VGT avx2Gt
+#define GALG_VEQ avx2Eq
+#define GALG_VISNAN avx2IsNan
+#define GALG_VROUND avx2Round
+#define GALG_VBLEND avx2Blend
+#define GALG_MOR _mm256_or_ps
+#define GALG_MAND _mm256_and_ps
+#define GALG_MFROMBOOL avx2FromBool
+#define GALG_SIMD(name) avx2_##name
+#define GALG_SIMD_ATTR GALG_TARGET("avx2")
+#include "simd_kernels.h"
+#undef GALG_V
+#undef GALG_M
+#undef GALG_VWIDTH
+#undef GALG_VLOAD
+#undef GALG_VSTORE
+#undef GALG_VSET1
+#undef GALG_VADD
+#undef GALG_VSUB
+#undef GALG_VMUL
+#undef GALG_VDIV
+#undef GALG_VLT
+#undef GALG_VGT
+#undef GALG_VEQ
+#undef GALG_VISNAN
+#undef GALG_VROUND
+#undef GALG_VBLEND
+#undef GALG_MOR
+#undef GALG_MAND
+#undef GALG_MFROMBOOL
+#undef GALG_SIMD
+#undef GALG_SIMD_ATTR
+
+static bool cpuHasAvx2() {
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#else
+    // AVX2 is CPUID leaf 7, EBX bit 5; the OS must also save the YMM registers
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#endif
+}
+
+#endif /* GALG_HAVE_X86 */
+
+/*
+* NEON (AArch64, where it is always available)
+*/
+#ifdef GALG_HAVE_NEON
+
+static inline float32x4_t neonBlend(uint32x4_t mask, float32x4_t a, float32x4_t b) {
+    return vbslq_f32(mask, a, b);
+}
+static inline uint32x4_t neonFromBool(bool value) {
+    return vdupq_n_u32(value ? 0xFFFFFFFFu : 0u);
+}
+static inline uint32x4_t neonIsNan(float32x4_t x) {
+    return vmvnq_u32(vceqq_f32(x, x));
+}
+
+#define GALG_V float32x4_t
+#define GALG_M uint32x4_t
+#define GALG_VWIDTH 4
+#define GALG_VLOAD vld1q_f32
+#define GALG_VSTORE vst1q_f32
+#define GALG_VSET1 vdupq_n_f32
+#define GALG_VADD vaddq_f32
+#define GALG_VSUB vsubq_f32
+#define GALG_VMUL vmulq_f32
+#define GALG_VDIV vdivq_f32
+#define GALG_VLT vcltq_f32
+#define GALG_VGT vcgtq_f32
+#define GALG_VEQ vceqq_f32
+#define GALG_VISNAN neonIsNan
+#define GALG_VROUND vrndnq_f32
+#define GALG_VBLEND neonBlend
+#define GALG_MOR vorrq_u32
+#define GALG_MAND vandq_u32
+#define GALG_MFROMBOOL neonFromBool
+#define GALG_SIMD(name) neon_##name
+#define GALG_SIMD_ATTR
+#include "simd_kernels.h"
+
+#endif /* GALG_HAVE_NEON */
+
+/*
+* Dispatch
+*/
+
+static GALGSimdLevel bestSimdLevel() {
+#if defined(GALG_HAVE_X86)
+    return cpuHasAvx2() ? GALG_SIMD_AVX2 : GALG_SIMD_SSE2;
+#elif defined(GALG_HAVE_NEON)
+    return GALG_SIMD_NEON;
+#else
+    return GALG_SIMD_SCALAR;
+#endif
+}
+
+// -1 until first use. Concurrent first calls detect the same level, so the race is harmless.
+static volatile int activeSimdLevel = -1;
+
+GALGSimdLevel galgGetSimdLevel() {
+    if (activeSimdLevel < 0) {
+        activeSimdLevel = bestSimdLevel();
+    }
+    return (GALGSimdLevel)activeSimdLevel;
+}
+
+GALGSimdLevel galgSetSimdLevel(GALGSimdLevel level) {
+    GALGSimdLevel best = bestSimdLevel();
+    bool supported = level == GALG_SIMD_SCALAR || level == best
+        || (level == GALG_SIMD_SSE2 && best == GALG_SIMD_AVX2);
+    if (supported) {
+        activeSimdLevel = level;
+    }
+    return galgGetSimdLevel();
+}
+
+GALGPixelNoData galgPixelNoData(double *inNoDataValue, double *outNoDataValue) {
+    GALGPixelNoData noData = { false, 0.0f, 0.0f };
+    if (inNoDataValue != NULL && outNoDataValue != NULL) {
+        noData.hasNoData = true;
+        noData.inValue = (float)*inNoDataValue;
+        noData.outValue = (float)*outNoDataValue;
+    }
+    return noData;
+}
+
+void galgAffineClamp(const float *in, float *out, size_t n, float scale, float offset,
+    float lo, float hi, bool round, GALGPixelNoData noData) {
+
+    size_t done = 0;
+    switch (galgGetSimdLevel()) {
+#ifdef GALG_HAVE_X86
+    case GALG_SIMD_AVX2:
+        done = avx2_affineClamp(in, out, n, scale, offset, lo, hi, round, noData);
+        break;
+    case GALG_SIMD_SSE2:
+        done = sse2_affineClamp(in, out, n, scale, offset, lo, hi, round, noData);
+        break;
+#endif
+#ifdef GALG_HAVE_NEON
+    case GALG_SIMD_NEON:
+        done = neon_affineClamp(in, out, n, scale, offset, lo, hi, round, noData);
+        break;
+#endif
+    default:
+        break;
+    }
+    scalarAffineClamp(in + done, out + done, n - done, scale, offset, lo, hi, round, noData);
+}
+
+void galgThresholdSelect(const float *in, float *out, size_t n, float threshold,
+    float above, bool aboveIsInput, float below, bool belowIsInput, GALGPixelNoData noData) {
+
+    size_t done = 0;
+    switch (galgGetSimdLevel()) {
+#ifdef GALG_HAVE_X86
+    case GALG_SIMD_AVX2:
+        done = avx2_thresholdSelect(in, out, n, threshold, above, aboveIsInput, below, belowIsInput, noData);
+        break;
+    case GALG_SIMD_SSE2:
+        done = sse2_thresholdSelect(in, out, n, threshold, above, aboveIsInput, below, belowIsInput, noData);
+        break;
+#endif
+#ifdef GALG_HAVE_NEON
+    case GALG_SIMD_NEON:
+        done = neon_thresholdSelect(in, out, n, threshold, above, aboveIsInput, below, belowIsInput, noData);
+        break;
+#endif
+    default:
+        break;
+    }
+    scalarThresholdSelect(in + done, out + done, n - done, threshold, above, aboveIsInput, below, belowIsInput,
+        noData);
+}
+
+void galgBandOp(const float *a, const float *b, float *out, size_t n, GALGBandOp op,
+    GALGPixelNoData noDataA, GALGPixelNoData noDataB) {
+
+    // The combined no data: enabled if either input has it, written as the first input's value if it has one
+    GALGPixelNoData noData = noDataA.hasNoData ? noDataA : noDataB;
+    size_t done = 0;
+    switch (galgGetSimdLevel()) {
+#ifdef GALG_HAVE_X86
+    case GALG_SIMD_AVX2:
+        done = avx2_bandOp(a, b, out, n, op, noDataA, noDataB, noData);
+        break;
+    case GALG_SIMD_SSE2:
+        done = sse2_bandOp(a, b, out, n, op, noDataA, noDataB, noData);
+        break;
+#endif
+#ifdef GALG_HAVE_NEON
+    case GALG_SIMD_NEON:
+        done = neon_bandOp(a, b, out, n, op, noDataA, noDataB, noData);
+        break;
+#endif
+    default:
+        break;
+    }
+    scalarBandOp(a + done, b + done, out + done, n - done, op, noDataA, noDataB, noData);
+}
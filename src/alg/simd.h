@@ -0,0 +1,66 @@
+#ifndef SIMD_H_
+#define SIMD_H_
+#include <stddef.h>
+#include "../core/galg.h"
+#include "func_exp.h"
+
+/*
+* Vectorised per-pixel primitives shared by the built-in processing functions
+*
+* Each primitive has a scalar, SSE2, AVX2 and NEON implementation. The widest one supported by the
+* CPU is picked the first time a primitive is called. All implementations give the same results
+* (up to the rounding of fused multiply-adds some compilers emit for the scalar code).
+*/
+enum GALGFUNC_DLL GALGSimdLevel {GALG_SIMD_SCALAR = 0, GALG_SIMD_SSE2 = 1, GALG_SIMD_AVX2 = 2, GALG_SIMD_NEON = 3};
+
+/*
+* The instruction set used by the primitives
+*/
+GALGFUNC_DLL GALGSimdLevel galgGetSimdLevel();
+
+/*
+* Restrict the primitives to an instruction set, e.g. GALG_SIMD_SCALAR to compare against the reference code.
+* Levels the CPU (or build) does not support are ignored. Returns the level now in use.
+*/
+GALGFUNC_DLL GALGSimdLevel galgSetSimdLevel(GALGSimdLevel level);
+
+/*
+* How a primitive treats no data: input pixels equal to inValue (or any NaN, if inValue is NaN) are written as outValue
+*/
+typedef struct GALGPixelNoData {
+    bool hasNoData;
+    float inValue;
+    float outValue;
+} GALGPixelNoData;
+
+/*
+* No data handling for an IProcessImage call. Either pointer may be NULL, which disables no data handling.
+*/
+GALGFUNC_DLL GALGPixelNoData galgPixelNoData(double *inNoDataValue, double *outNoDataValue);
+
+/*
+* out = clamp(round?(in * scale + offset), lo, hi)
+*
+* Rounding is to the nearest integer, ties to even.
+*/
+GALGFUNC_DLL void galgAffineClamp(const float *in, float *out, size_t n, float scale, float offset,
+    float lo, float hi, bool round, GALGPixelNoData noData);
+
+/*
+* out = in > threshold ? above : below, where each of above and below is either the input pixel
+* (when aboveIsInput/belowIsInput) or a constant
+*/
+GALGFUNC_DLL void galgThresholdSelect(const float *in, float *out, size_t n, float threshold,
+    float above, bool aboveIsInput, float below, bool belowIsInput, GALGPixelNoData noData);
+
+enum GALGFUNC_DLL GALGBandOp {GALG_BAND_ADD = 0, GALG_BAND_SUBTRACT = 1, GALG_BAND_MULTIPLY = 2,
+                              GALG_BAND_DIVIDE = 3, GALG_BAND_NORMALISED_DIFFERENCE = 4};
+
+/*
+* out = a op b, with (a - b) / (a + b) for GALG_BAND_NORMALISED_DIFFERENCE. When either input has no data, a pixel which is
+* no data in either input, or has a zero divisor, is written as noDataA.outValue (or noDataB.outValue if only b has no data).
+*/
+GALGFUNC_DLL void galgBandOp(const float *a, const float *b, float *out, size_t n, GALGBandOp op,
+    GALGPixelNoData noDataA, GALGPixelNoData noDataB);
+
+#endif /* SIMD_H_ */
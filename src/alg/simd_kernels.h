@@ -0,0 +1,103 @@
+/*
+* Kernel bodies for the vectorised primitives of simd.cpp
+*
+* Not a public header. simd.cpp includes it once per instruction set, after defining the GALG_V* vector
+* operations, GALG_SIMD_ATTR (the function target) and GALG_SIMD(name) (the function name). The loops
+* process whole vectors and leave the remaining pixels to the scalar reference code.
+*/
+
+GALG_SIMD_ATTR static inline GALG_M GALG_SIMD(noDataMask)(GALG_V x, GALG_V vInNoData, GALG_M nanNoData) {
+    return GALG_MOR(GALG_VEQ(x, vInNoData), GALG_MAND(GALG_VISNAN(x), nanNoData));
+}
+
+GALG_SIMD_ATTR static size_t GALG_SIMD(affineClamp)(const float *in, float *out, size_t n, float scale, float offset,
+    float lo, float hi, bool round, GALGPixelNoData noData) {
+
+    GALG_V vScale = GALG_VSET1(scale), vOffset = GALG_VSET1(offset);
+    GALG_V vLo = GALG_VSET1(lo), vHi = GALG_VSET1(hi);
+    GALG_V vInNoData = GALG_VSET1(noData.inValue), vOutNoData = GALG_VSET1(noData.outValue);
+    GALG_M nanNoData = GALG_MFROMBOOL(CPLIsNan(noData.inValue));
+    size_t i = 0;
+    for (; i + GALG_VWIDTH <= n; i += GALG_VWIDTH) {
+        GALG_V x = GALG_VLOAD(in + i);
+        GALG_V y = GALG_VADD(GALG_VMUL(x, vScale), vOffset);
+        if (round) {
+            y = GALG_VROUND(y);
+        }
+        y = GALG_VBLEND(GALG_VLT(y, vLo), vLo, y);
+        y = GALG_VBLEND(GALG_VGT(y, vHi), vHi, y);
+        if (noData.hasNoData) {
+            y = GALG_VBLEND(GALG_SIMD(noDataMask)(x, vInNoData, nanNoData), vOutNoData, y);
+        }
+        GALG_VSTORE(out + i, y);
+    }
+    return i;
+}
+
+GALG_SIMD_ATTR static size_t GALG_SIMD(thresholdSelect)(const float *in, float *out, size_t n, float threshold,
+    float above, bool aboveIsInput, float below, bool belowIsInput, GALGPixelNoData noData) {
+
+    GALG_V vThreshold = GALG_VSET1(threshold);
+    GALG_V vAbove = GALG_VSET1(above), vBelow = GALG_VSET1(below);
+    GALG_M aboveInput = GALG_MFROMBOOL(aboveIsInput), belowInput = GALG_MFROMBOOL(belowIsInput);
+    GALG_V vInNoData = GALG_VSET1(noData.inValue), vOutNoData = GALG_VSET1(noData.outValue);
+    GALG_M nanNoData = GALG_MFROMBOOL(CPLIsNan(noData.inValue));
+    size_t i = 0;
+    for (; i + GALG_VWIDTH <= n; i += GALG_VWIDTH) {
+        GALG_V x = GALG_VLOAD(in + i);
+        GALG_V a = GALG_VBLEND(aboveInput, x, vAbove);
+        GALG_V b = GALG_VBLEND(belowInput, x, vBelow);
+        GALG_V y = GALG_VBLEND(GALG_VGT(x, vThreshold), a, b);
+        if (noData.hasNoData) {
+            y = GALG_VBLEND(GALG_SIMD(noDataMask)(x, vInNoData, nanNoData), vOutNoData, y);
+        }
+        GALG_VSTORE(out + i, y);
+    }
+    return i;
+}
+
+GALG_SIMD_ATTR static size_t GALG_SIMD(bandOp)(const float *a, const float *b, float *out, size_t n, GALGBandOp op,
+    GALGPixelNoData noDataA, GALGPixelNoData noDataB, GALGPixelNoData noData) {
+
+    GALG_V vZero = GALG_VSET1(0.0f), vOutNoData = GALG_VSET1(noData.outValue);
+    GALG_V vInNoDataA = GALG_VSET1(noDataA.inValue), vInNoDataB = GALG_VSET1(noDataB.inValue);
+    GALG_M nanNoDataA = GALG_MFROMBOOL(noDataA.hasNoData && CPLIsNan(noDataA.inValue));
+    GALG_M nanNoDataB = GALG_MFROMBOOL(noDataB.hasNoData && CPLIsNan(noDataB.inValue));
+    GALG_M hasNoDataA = GALG_MFROMBOOL(noDataA.hasNoData), hasNoDataB = GALG_MFROMBOOL(noDataB.hasNoData);
+    size_t i = 0;
+    for (; i + GALG_VWIDTH <= n; i += GALG_VWIDTH) {
+        GALG_V x = GALG_VLOAD(a + i);
+        GALG_V z = GALG_VLOAD(b + i);
+        GALG_V y;
+        GALG_V divisor = vZero;
+        switch (op) {
+        case GALG_BAND_ADD:
+            y = GALG_VADD(x, z);
+            break;
+        case GALG_BAND_SUBTRACT:
+            y = GALG_VSUB(x, z);
+            break;
+        case GALG_BAND_MULTIPLY:
+            y = GALG_VMUL(x, z);
+            break;
+        case GALG_BAND_DIVIDE:
+            divisor = z;
+            y = GALG_VDIV(x, z);
+            break;
+        default:
+            divisor = GALG_VADD(x, z);
+            y = GALG_VDIV(GALG_VSUB(x, z), divisor);
+            break;
+        }
+        if (noData.hasNoData) {
+            GALG_M invalid = GALG_MOR(GALG_MAND(GALG_SIMD(noDataMask)(x, vInNoDataA, nanNoDataA), hasNoDataA),
+                GALG_MAND(GALG_SIMD(noDataMask)(z, vInNoDataB, nanNoDataB), hasNoDataB));
+            if (op == GALG_BAND_DIVIDE || op == GALG_BAND_NORMALISED_DIFFERENCE) {
+                invalid = GALG_MOR(invalid, GALG_VEQ(divisor, vZero));
+            }
+            y = GALG_VBLEND(invalid, vOutNoData, y);
+        }
+        GALG_VSTORE(out + i, y);
+    }
+    return i;
+}
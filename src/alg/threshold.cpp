@@ -1,6 +1,5 @@
-
 #include "threshold.h"
-#include "opencv2/core/core.hpp"
+#include "simd.h"
 
 void Threshold::setThresholdParams(double maxVal, double threshold, int thresholdType){
     maxVal_ = maxVal;
@@ -11,11 +10,32 @@ void Threshold::setThresholdParams(double maxVal, double threshold, int threshol
 GALGError Threshold::processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
     double *inNoDataValue, double *outNoDataValue) {
 
-    err.errnum = 0;
-    err.msg = NULL;
-    cv::Mat inMat(nWindowXSize, nWindowYSize, CV_32F, (void *)inputArray);
-    cv::Mat outMat(nWindowXSize, nWindowYSize, CV_32F, (void *)outputArray);
-    cv::threshold(inMat, outMat, threshold_, maxVal_, thresholdType_);
+    GALGError err = { 0, NULL };
+    size_t nPixels = (size_t)nWindowXSize * nWindowYSize;
+    float maxVal = (float)maxVal_, threshold = (float)threshold_;
+    GALGPixelNoData noData = galgPixelNoData(inNoDataValue, outNoDataValue);
 
+    // Each type selects either the pixel itself or a constant on each side of the threshold
+    switch (thresholdType_) {
+    case THRESH_BINARY:
+        galgThresholdSelect(inputArray, outputArray, nPixels, threshold, maxVal, false, 0.0f, false, noData);
+        break;
+    case THRESH_BINARY_INV:
+        galgThresholdSelect(inputArray, outputArray, nPixels, threshold, 0.0f, false, maxVal, false, noData);
+        break;
+    case THRESH_TRUNC:
+        galgThresholdSelect(inputArray, outputArray, nPixels, threshold, threshold, false, 0.0f, true, noData);
+        break;
+    case THRESH_TOZERO:
+        galgThresholdSelect(inputArray, outputArray, nPixels, threshold, 0.0f, true, 0.0f, false, noData);
+        break;
+    case THRESH_TOZERO_INV:
+        galgThresholdSelect(inputArray, outputArray, nPixels, threshold, 0.0f, false, 0.0f, true, noData);
+        break;
+    default:
+        err.errnum = 1;
+        err.msg = "Unknown threshold type";
+        break;
+    }
     return err;
-}
\ No newline at end of file
+}
@@ -2,17 +2,17 @@
 #define THRESHOLD_H_
 #include "../core/galg.h"
 #include "func_exp.h"
-#include "opencv2/imgproc/imgproc.hpp"
 
 
-enum GALGFUNC_DLL ThresholdType {THRESH_BINARY = cv::THRESH_BINARY, THRESH_TRUNC = cv::THRESH_TRUNC,
-                    THRESH_TOZERO = cv::THRESH_TOZERO, THRESH_BINARY_INV = cv::THRESH_BINARY_INV,
-                    THRESH_TOZERO_INV = cv::THRESH_TOZERO_INV};
+enum GALGFUNC_DLL ThresholdType {THRESH_BINARY = 0, THRESH_BINARY_INV = 1, THRESH_TRUNC = 2,
+                    THRESH_TOZERO = 3, THRESH_TOZERO_INV = 4};
 
 /*
 * Fixed level thresholding
 *
-* A fixed level threshold is applied to each array element using OpenCV threshold
+* A fixed level threshold is applied to each array element. Pixels above the threshold become:
+* THRESH_BINARY: maxVal, THRESH_BINARY_INV: 0, THRESH_TRUNC: threshold, THRESH_TOZERO: unchanged, THRESH_TOZERO_INV: 0.
+* Other pixels become 0, maxVal, unchanged, 0 and unchanged respectively. No data pixels are written as the output no data value.
 */
 class GALGFUNC_DLL Threshold: public IProcessImage {
 
@@ -24,7 +24,6 @@ private:
     double maxVal_ = 0;
     double threshold_ = 0;
     int thresholdType_ = THRESH_TOZERO;
-    GALGError err;
 };
 
 #endif /* THRESHOLD_H_ */
@@ -0,0 +1,164 @@
+#include <algorithm>
+#include "blockcache.h"
+#include "cpl_conv.h"
+
+/*****************
+ * BLOCK CACHE
+ *****************/
+
+BlockCache::BlockCache() {
+	this->budgetBytes = 0;
+	this->cachedBytes = 0;
+	this->nHits = 0;
+	this->nMisses = 0;
+	this->mutex = CPLCreateMutex();
+	CPLReleaseMutex(this->mutex);
+}
+
+BlockCache::~BlockCache() {
+	this->clear();
+	CPLDestroyMutex(this->mutex);
+}
+
+GALGError BlockCache::setBudget(GIntBig budgetBytes) {
+	GALGError err = { 0, NULL };
+	if (budgetBytes < 0) {
+		err.errnum = 1;
+		err.msg = "Cache budget must not be negative (0 disables the cache)";
+		return err;
+	}
+	CPLAcquireMutex(this->mutex, 1000.0);
+	this->budgetBytes = budgetBytes;
+	this->evict();
+	CPLReleaseMutex(this->mutex);
+	return err;
+}
+
+GIntBig BlockCache::getBudget() {
+	return this->budgetBytes;
+}
+
+bool BlockCache::isEnabled() {
+	return this->budgetBytes > 0;
+}
+
+GIntBig BlockCache::getHits() {
+	return this->nHits;
+}
+
+GIntBig BlockCache::getMisses() {
+	return this->nMisses;
+}
+
+GIntBig BlockCache::getCachedBytes() {
+	return this->cachedBytes;
+}
+
+void BlockCache::clear() {
+	CPLAcquireMutex(this->mutex, 1000.0);
+	std::map<BlockKey, BlockEntry>::iterator it;
+	for (it = this->blocks.begin(); it != this->blocks.end(); ++it) {
+		VSIFree(it->second.data);
+	}
+	this->blocks.clear();
+	this->lru.clear();
+	this->cachedBytes = 0;
+	this->nHits = 0;
+	this->nMisses = 0;
+	CPLReleaseMutex(this->mutex);
+}
+
+/*
+ * Drop least recently used blocks until the cache is within budget.
+ * Must be called with the mutex held.
+ */
+void BlockCache::evict() {
+	while (this->cachedBytes > this->budgetBytes && !this->lru.empty()) {
+		std::map<BlockKey, BlockEntry>::iterator it = this->blocks.find(
+				this->lru.back());
+		this->cachedBytes -= it->second.nBytes;
+		VSIFree(it->second.data);
+		this->blocks.erase(it);
+		this->lru.pop_back();
+	}
+}
+
+GALGError BlockCache::read(GDALRasterBand *band, int bandIndex, int xOff,
+		int yOff, int xSize, int ySize, void *buffer, GDALDataType eBufType) {
+	GALGError err = { 0, NULL };
+	int blockXSize, blockYSize;
+	band->GetBlockSize(&blockXSize, &blockYSize);
+	GDALDataType eBlockType = band->GetRasterDataType();
+	int nBlockPixelBytes = GDALGetDataTypeSize(eBlockType) / 8;
+	int nBufPixelBytes = GDALGetDataTypeSize(eBufType) / 8;
+	size_t nBlockBytes = (size_t) blockXSize * blockYSize * nBlockPixelBytes;
+
+	for (int yBlock = yOff / blockYSize;
+			yBlock <= (yOff + ySize - 1) / blockYSize; ++yBlock) {
+		for (int xBlock = xOff / blockXSize;
+				xBlock <= (xOff + xSize - 1) / blockXSize; ++xBlock) {
+			BlockKey key = { bandIndex, xBlock, yBlock };
+
+			CPLAcquireMutex(this->mutex, 1000.0);
+			std::map<BlockKey, BlockEntry>::iterator it = this->blocks.find(key);
+			void *data = NULL;
+			bool owned = false;
+			if (it != this->blocks.end()) {
+				this->nHits++;
+				this->lru.splice(this->lru.begin(), this->lru,
+						it->second.lruPosition);
+				data = it->second.data;
+			} else {
+				this->nMisses++;
+				// Decode without holding the lock; if another thread inserts
+				// the same block meanwhile, its copy is used and ours dropped
+				CPLReleaseMutex(this->mutex);
+				data = VSIMalloc(nBlockBytes);
+				RETURNIF(data == NULL, 1, "Unable to allocate cache block");
+				if (band->ReadBlock(xBlock, yBlock, data) != CE_None) {
+					VSIFree(data);
+					err.errnum = 1;
+					err.msg = "Could not read from source dataset";
+					return err;
+				}
+				CPLAcquireMutex(this->mutex, 1000.0);
+				it = this->blocks.find(key);
+				if (it != this->blocks.end()) {
+					VSIFree(data);
+					data = it->second.data;
+				} else if ((GIntBig) nBlockBytes <= this->budgetBytes) {
+					this->lru.push_front(key);
+					BlockEntry entry = { data, nBlockBytes, this->lru.begin() };
+					this->blocks[key] = entry;
+					this->cachedBytes += nBlockBytes;
+				} else {
+					owned = true;
+				}
+			}
+
+			// Copy the part of the block that overlaps the window
+			int x0 = std::max(xOff, xBlock * blockXSize);
+			int x1 = std::min(xOff + xSize, (xBlock + 1) * blockXSize);
+			int y0 = std::max(yOff, yBlock * blockYSize);
+			int y1 = std::min(yOff + ySize, (yBlock + 1) * blockYSize);
+			for (int y = y0; y < y1; ++y) {
+				GByte *src = (GByte *) data
+						+ ((size_t) (y - yBlock * blockYSize) * blockXSize
+								+ (x0 - xBlock * blockXSize)) * nBlockPixelBytes;
+				GByte *dst = (GByte *) buffer
+						+ ((size_t) (y - yOff) * xSize + (x0 - xOff))
+								* nBufPixelBytes;
+				GDALCopyWords(src, eBlockType, nBlockPixelBytes, dst, eBufType,
+						nBufPixelBytes, x1 - x0);
+			}
+
+			if (owned) {
+				VSIFree(data);
+			} else {
+				this->evict();
+			}
+			CPLReleaseMutex(this->mutex);
+		}
+	}
+	return err;
+}
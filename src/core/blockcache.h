@@ -0,0 +1,83 @@
+/*
+ * BLOCK CACHE API
+ *
+ * A byte-budgeted cache of decoded source blocks, so that the halos
+ * of overlapping windows are served from memory instead of being
+ * read and decoded again.
+ */
+#ifndef BLOCKCACHE_H_
+#define BLOCKCACHE_H_
+
+#include <list>
+#include <map>
+#include "gdal_priv.h"
+#include "cpl_multiproc.h"
+
+#include "core_exp.h"
+#include "common.h"
+
+/*
+ * \brief Least-recently-used cache of decoded raster blocks.
+ *
+ * Blocks are decoded with GDALRasterBand::ReadBlock, bypassing GDAL's global
+ * block cache, and are kept in the band's own data type. Blocks are keyed by
+ * band number and block position only, so a cache must be cleared before it
+ * is used with a different source dataset. All methods may be called
+ * concurrently, each thread passing its own handle on the source.
+ * A budget of 0 (the default) disables the cache.
+ */
+class GALGCORE_DLL BlockCache {
+
+public:
+	BlockCache();
+	virtual ~BlockCache();
+	GALGError setBudget(GIntBig budgetBytes);
+	GIntBig getBudget();
+	bool isEnabled();
+
+	/*
+	 * Read a window of ``band`` into ``buffer`` as ``eBufType``,
+	 * assembling it from cached blocks and decoding the missing ones
+	 */
+	GALGError read(GDALRasterBand *band, int bandIndex, int xOff, int yOff,
+			int xSize, int ySize, void *buffer, GDALDataType eBufType);
+
+	/*
+	 * Drop all cached blocks and reset the counters
+	 */
+	void clear();
+	GIntBig getHits();
+	GIntBig getMisses();
+	GIntBig getCachedBytes();
+
+protected:
+	typedef struct BlockKey {
+		int band, xBlock, yBlock;
+		bool operator<(const BlockKey &other) const {
+			if (band != other.band) {
+				return band < other.band;
+			}
+			if (yBlock != other.yBlock) {
+				return yBlock < other.yBlock;
+			}
+			return xBlock < other.xBlock;
+		}
+	} BlockKey;
+
+	typedef struct BlockEntry {
+		void *data;
+		size_t nBytes;
+		std::list<BlockKey>::iterator lruPosition;
+	} BlockEntry;
+
+	void evict();
+	BlockCache(const BlockCache &);
+	BlockCache &operator=(const BlockCache &);
+	std::map<BlockKey, BlockEntry> blocks;
+	std::list<BlockKey> lru;
+	GIntBig budgetBytes, cachedBytes;
+	GIntBig nHits, nMisses;
+	CPLMutex *mutex;
+};
+
+#endif // BLOCKCACHE_H_
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include "bufferpool.h"
+#include "cpl_conv.h"
+#include "cpl_vsi.h"
+#include "gdal.h"
+
+/*
+ * Aligned allocation. VSIMallocAligned only exists from GDAL 2.2, before
+ * which the block is over-allocated and the original pointer kept just
+ * before the aligned one.
+ */
+static void *mallocAligned(size_t nBytes) {
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(2,2,0)
+	return VSIMallocAligned(GALG_BUFFER_ALIGNMENT, nBytes);
+#else
+	GByte *raw = (GByte *) VSIMalloc(
+			nBytes + GALG_BUFFER_ALIGNMENT + sizeof(void *));
+	if (raw == NULL) {
+		return NULL;
+	}
+	size_t address = (size_t) (raw + sizeof(void *));
+	GByte *aligned = raw + sizeof(void *)
+			+ (GALG_BUFFER_ALIGNMENT - address % GALG_BUFFER_ALIGNMENT)
+					% GALG_BUFFER_ALIGNMENT;
+	((void **) aligned)[-1] = raw;
+	return aligned;
+#endif
+}
+
+static void freeAligned(void *buffer) {
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(2,2,0)
+	VSIFreeAligned(buffer);
+#else
+	if (buffer != NULL) {
+		VSIFree(((void **) buffer)[-1]);
+	}
+#endif
+}
+
+/*****************
+ * BUFFER POOL
+ *****************/
+
+BufferPool::BufferPool() {
+	this->allocatedBytes = 0;
+	this->peakBytes = 0;
+	this->nAllocations = 0;
+	this->mutex = CPLCreateMutex();
+	CPLReleaseMutex(this->mutex);
+}
+
+BufferPool::~BufferPool() {
+	// Buffers still in use are freed too: their owners must not outlive the pool
+	std::map<void *, size_t>::iterator it;
+	for (it = this->bufferSizes.begin(); it != this->bufferSizes.end(); ++it) {
+		freeAligned(it->first);
+	}
+	CPLDestroyMutex(this->mutex);
+}
+
+void *BufferPool::acquire(size_t nBytes) {
+	void *buffer = NULL;
+	nBytes = std::max(nBytes, (size_t) 1);
+
+	CPLAcquireMutex(this->mutex, 1000.0);
+	std::multimap<size_t, void *>::iterator it = this->idleBuffers.lower_bound(
+			nBytes);
+	if (it != this->idleBuffers.end()) {
+		buffer = it->second;
+		this->idleBuffers.erase(it);
+		CPLReleaseMutex(this->mutex);
+		return buffer;
+	}
+	CPLReleaseMutex(this->mutex);
+
+	buffer = mallocAligned(nBytes);
+	if (buffer == NULL) {
+		return NULL;
+	}
+	CPLAcquireMutex(this->mutex, 1000.0);
+	this->bufferSizes[buffer] = nBytes;
+	this->allocatedBytes += nBytes;
+	this->peakBytes = std::max(this->peakBytes, this->allocatedBytes);
+	this->nAllocations++;
+	CPLReleaseMutex(this->mutex);
+	return buffer;
+}
+
+void BufferPool::release(void *buffer) {
+	if (buffer == NULL) {
+		return;
+	}
+	CPLAcquireMutex(this->mutex, 1000.0);
+	std::map<void *, size_t>::iterator it = this->bufferSizes.find(buffer);
+	if (it != this->bufferSizes.end()) {
+		this->idleBuffers.insert(std::make_pair(it->second, buffer));
+	}
+	CPLReleaseMutex(this->mutex);
+}
+
+void BufferPool::trim() {
+	CPLAcquireMutex(this->mutex, 1000.0);
+	std::multimap<size_t, void *>::iterator it;
+	for (it = this->idleBuffers.begin(); it != this->idleBuffers.end(); ++it) {
+		freeAligned(it->second);
+		this->bufferSizes.erase(it->second);
+		this->allocatedBytes -= it->first;
+	}
+	this->idleBuffers.clear();
+	CPLReleaseMutex(this->mutex);
+}
+
+GIntBig BufferPool::getAllocatedBytes() {
+	return this->allocatedBytes;
+}
+
+GIntBig BufferPool::getPeakBytes() {
+	return this->peakBytes;
+}
+
+GIntBig BufferPool::getAllocationCount() {
+	return this->nAllocations;
+}
@@ -0,0 +1,65 @@
+/*
+ * BUFFER POOL API
+ *
+ * Aligned window buffers which are recycled between windows,
+ * bands, processing stages and runs.
+ */
+#ifndef BUFFERPOOL_H_
+#define BUFFERPOOL_H_
+
+#include <map>
+#include "cpl_port.h"
+#include "cpl_multiproc.h"
+
+#include "core_exp.h"
+#include "common.h"
+
+/*
+ * Alignment of pool buffers, in bytes. Enough for any SIMD load
+ * and a whole cache line.
+ */
+#define GALG_BUFFER_ALIGNMENT 64
+
+/*
+ * \brief A pool of aligned buffers.
+ *
+ * ``acquire`` hands out the smallest idle buffer that is large enough,
+ * allocating a new one only when there is none. ``release`` returns a
+ * buffer to the pool rather than freeing it, so a long-lived pool stops
+ * allocating once it has seen the largest working set. ``trim`` frees
+ * the idle buffers. All methods may be called concurrently.
+ */
+class GALGCORE_DLL BufferPool {
+
+public:
+	BufferPool();
+	virtual ~BufferPool();
+	void *acquire(size_t nBytes);
+	void release(void *buffer);
+	void trim();
+
+	/*
+	 * Bytes currently allocated, idle or not
+	 */
+	GIntBig getAllocatedBytes();
+	/*
+	 * The most bytes the pool has had allocated at once
+	 */
+	GIntBig getPeakBytes();
+	/*
+	 * The number of buffers allocated (rather than reused) so far
+	 */
+	GIntBig getAllocationCount();
+
+protected:
+	std::multimap<size_t, void *> idleBuffers;
+	std::map<void *, size_t> bufferSizes;
+	GIntBig allocatedBytes, peakBytes, nAllocations;
+	CPLMutex *mutex;
+
+private:
+	BufferPool(const BufferPool &);
+	BufferPool &operator=(const BufferPool &);
+};
+
+#endif // BUFFERPOOL_H_
@@ -0,0 +1,104 @@
+#include <cstdlib>
+#include <cstring>
+#include "checkpoint.h"
+#include "cpl_conv.h"
+#include "cpl_string.h"
+
+CheckpointJournal::CheckpointJournal() :
+		file(NULL) {
+}
+
+CheckpointJournal::~CheckpointJournal() {
+	this->close();
+}
+
+GALGError CheckpointJournal::open(const char *pathStr, const char *jobKey,
+		const std::vector<GALGWindow> &windows, std::vector<bool> &done) {
+	GALGError err = { 0, NULL };
+	this->close();
+	this->pathStr = pathStr;
+
+	// FNV-1a over the key and window list: a journal only matches the same
+	// job over the same windows
+	GUIntBig hash = 14695981039346656037ULL;
+	for (const char *c = jobKey != NULL ? jobKey : ""; *c != '\0'; ++c) {
+		hash = (hash ^ (GByte) *c) * 1099511628211ULL;
+	}
+	for (size_t i = 0; i < windows.size(); ++i) {
+		const GALGWindow &w = windows[i];
+		int fields[] = { w.index, w.band, w.xOff, w.yOff, w.xSize, w.ySize };
+		for (size_t j = 0; j < sizeof(fields) / sizeof(fields[0]); ++j) {
+			hash = (hash ^ (GUInt32) fields[j]) * 1099511628211ULL;
+		}
+	}
+	this->header = CPLSPrintf("GALG_CHECKPOINT %d " CPL_FRMT_GIB,
+			(int) windows.size(), (GIntBig) (hash >> 1));
+
+	done.assign(windows.size(), false);
+	VSILFILE *existing = VSIFOpenL(pathStr, "rb");
+	if (existing != NULL) {
+		const char *line = CPLReadLineL(existing);
+		bool matches = line != NULL && this->header == line;
+		while (matches && (line = CPLReadLineL(existing)) != NULL) {
+			size_t length = strlen(line);
+			int index = atoi(line);
+			if (length > 0 && line[length - 1] == ';' && index >= 0
+					&& index < (int) done.size()) {
+				done[index] = true;
+			}
+		}
+		VSIFCloseL(existing);
+		if (matches) {
+			this->file = VSIFOpenL(pathStr, "ab");
+			RETURNIF(this->file == NULL, 1, "Could not open checkpoint journal");
+			return err;
+		}
+		done.assign(windows.size(), false);
+	}
+	return this->create();
+}
+
+GALGError CheckpointJournal::create() {
+	GALGError err = { 0, NULL };
+	if (this->file != NULL) {
+		VSIFCloseL(this->file);
+	}
+	this->file = VSIFOpenL(this->pathStr.c_str(), "wb");
+	RETURNIF(this->file == NULL, 1, "Could not create checkpoint journal");
+	RETURNIF(
+			VSIFPrintfL(this->file, "%s\n", this->header.c_str()) <= 0
+					|| VSIFFlushL(this->file) != 0, 1,
+			"Could not write checkpoint journal");
+	return err;
+}
+
+GALGError CheckpointJournal::reset() {
+	return this->create();
+}
+
+GALGError CheckpointJournal::record(const std::vector<int> &indices) {
+	GALGError err = { 0, NULL };
+	RETURNIF(this->file == NULL, 1, "Checkpoint journal is not open");
+	bool ok = true;
+	for (size_t i = 0; i < indices.size() && ok; ++i) {
+		ok = VSIFPrintfL(this->file, "%d;\n", indices[i]) > 0;
+	}
+	ok = VSIFFlushL(this->file) == 0 && ok;
+	RETURNIF(!ok, 1, "Could not write checkpoint journal");
+	return err;
+}
+
+GALGError CheckpointJournal::remove() {
+	GALGError err = { 0, NULL };
+	this->close();
+	RETURNIF(VSIUnlink(this->pathStr.c_str()) != 0, 1,
+			"Could not remove checkpoint journal");
+	return err;
+}
+
+void CheckpointJournal::close() {
+	if (this->file != NULL) {
+		VSIFCloseL(this->file);
+		this->file = NULL;
+	}
+}
@@ -0,0 +1,67 @@
+/*
+ * CHECKPOINT API
+ *
+ * A journal of the windows of a job whose output is safely in the
+ * destination file, so that an interrupted job can be resumed.
+ */
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <string>
+#include <vector>
+#include "cpl_vsi.h"
+
+#include "core_exp.h"
+#include "common.h"
+#include "engine.h"
+
+/*
+ * \brief A sidecar file listing completed windows.
+ *
+ * The first line identifies the job by a hash of its key and window list;
+ * each further line is the index of a window whose output has been flushed
+ * to the destination, terminated by a ';' so that a line cut short by a
+ * crash is ignored. A journal left by a different job (another key or
+ * other windows) is refused and replaced.
+ */
+class GALGCORE_DLL CheckpointJournal {
+
+public:
+	CheckpointJournal();
+	virtual ~CheckpointJournal();
+
+	/*
+	 * Open or create the journal at pathStr for a job with these windows.
+	 * jobKey identifies everything else the output depends on (source,
+	 * processing parameters...). done receives, by window index, the
+	 * windows recorded by an earlier run of the same job.
+	 */
+	GALGError open(const char *pathStr, const char *jobKey,
+			const std::vector<GALGWindow> &windows, std::vector<bool> &done);
+
+	/*
+	 * Forget all recorded windows, e.g. when the output is started afresh
+	 */
+	GALGError reset();
+
+	/*
+	 * Append windows and flush the journal
+	 */
+	GALGError record(const std::vector<int> &indices);
+
+	/*
+	 * Close and delete the journal, once the job has finished
+	 */
+	GALGError remove();
+	void close();
+
+protected:
+	GALGError create();
+	std::string pathStr;
+	std::string header;
+	VSILFILE *file;
+	CheckpointJournal(const CheckpointJournal &);
+	CheckpointJournal &operator=(const CheckpointJournal &);
+};
+
+#endif // CHECKPOINT_H_
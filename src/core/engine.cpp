@@ -0,0 +1,417 @@
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include "engine.h"
+#include "cpl_conv.h"
+#include "cpl_multiproc.h"
+
+/*****************
+ * WINDOW ENGINE
+ *****************/
+
+WindowEngine::WindowEngine() {
+	this->nThreads = 1;
+	this->pipelineDepth = 0;
+}
+
+GALGError WindowEngine::setNumThreads(int nThreads) {
+	GALGError err = { 0, NULL };
+	if (nThreads < 0) {
+		err.errnum = 1;
+		err.msg = "Number of threads must be positive (or 0 for all CPUs)";
+	} else if (nThreads == 0) {
+		this->nThreads = CPLGetNumCPUs();
+	} else {
+		this->nThreads = nThreads;
+	}
+	return err;
+}
+
+int WindowEngine::getNumThreads() {
+	return this->nThreads;
+}
+
+GALGError WindowEngine::setPipelineDepth(int nSlots) {
+	GALGError err = { 0, NULL };
+	if (nSlots < 0) {
+		err.errnum = 1;
+		err.msg = "Pipeline depth must be positive (or 0 to disable pipelining)";
+	} else if (nSlots > 0 && nSlots < 3) {
+		// One window being read, one computed and one written
+		this->pipelineDepth = 3;
+	} else {
+		this->pipelineDepth = nSlots;
+	}
+	return err;
+}
+
+int WindowEngine::getPipelineDepth() {
+	return this->pipelineDepth;
+}
+
+void WindowEngine::collectWindows(BlockIterator &iterator, int nBands,
+		std::vector<GALGWindow> &windows) {
+	std::vector<GALGWindow> bandWindows;
+	GALGWindow window;
+	window.band = 0;
+	while (iterator.next(&window.xSize, &window.ySize, &window.xOff,
+			&window.yOff)) {
+		bandWindows.push_back(window);
+	}
+
+	windows.clear();
+	windows.reserve(bandWindows.size() * nBands);
+	for (int iBand = 0; iBand < nBands; ++iBand) {
+		for (size_t iWindow = 0; iWindow < bandWindows.size(); ++iWindow) {
+			window = bandWindows[iWindow];
+			window.band = iBand + 1;
+			window.index = (int) windows.size();
+			windows.push_back(window);
+		}
+	}
+}
+
+GALGError WindowEngine::run(WindowJob &job,
+		const std::vector<GALGWindow> &windows) {
+	if (this->pipelineDepth > 0 && windows.size() > 1) {
+		return this->runPipelined(job, windows);
+	}
+	if (this->nThreads > 1 && windows.size() > 1) {
+		return this->runParallel(job, windows);
+	}
+	return this->runSerial(job, windows);
+}
+
+GALGError WindowEngine::runSerial(WindowJob &job,
+		const std::vector<GALGWindow> &windows) {
+	GALGError err = { 0, NULL };
+	WindowReader *reader = NULL;
+	WindowSlot *slot = NULL;
+
+	err = job.createReader(reader);
+	if (err.errnum == 0) {
+		err = job.createSlot(slot);
+	}
+	for (size_t i = 0; i < windows.size() && err.errnum == 0; ++i) {
+		slot->skip = false;
+		err = job.read(reader, slot, windows[i]);
+		if (err.errnum == 0 && !slot->skip) {
+			err = job.compute(slot, windows[i]);
+		}
+		if (err.errnum == 0 && !slot->skip) {
+			err = job.write(slot, windows[i]);
+		}
+	}
+	delete slot;
+	delete reader;
+	return err;
+}
+
+/*
+ * State shared by the workers of one parallel run
+ */
+typedef struct ParallelState {
+	WindowJob *job;
+	const std::vector<GALGWindow> *windows;
+	CPLMutex *mutex;
+	CPLCond *writeCond;
+	int nextWindow;  // next window to be claimed
+	int nextWrite;   // next window allowed to write
+	GALGError err;   // first error raised by any worker
+} ParallelState;
+
+typedef struct ParallelWorker {
+	ParallelState *state;
+	WindowReader *reader;
+	WindowSlot *slot;
+} ParallelWorker;
+
+static void parallelWorkerFn(void *data) {
+	ParallelWorker *worker = (ParallelWorker *) data;
+	ParallelState *state = worker->state;
+	const std::vector<GALGWindow> &windows = *state->windows;
+	GALGError err = { 0, NULL };
+
+	while (true) {
+		// Claim the next window. Windows are claimed in order, so the window
+		// that is next to be written is always held by a running worker
+		CPLAcquireMutex(state->mutex, 1000.0);
+		int i = state->nextWindow;
+		bool stop = state->err.errnum != 0 || i >= (int) windows.size();
+		if (!stop) {
+			state->nextWindow++;
+		}
+		CPLReleaseMutex(state->mutex);
+		if (stop) {
+			break;
+		}
+
+		worker->slot->skip = false;
+		err = state->job->read(worker->reader, worker->slot, windows[i]);
+		if (err.errnum == 0 && !worker->slot->skip) {
+			err = state->job->compute(worker->slot, windows[i]);
+		}
+
+		// Commit the result in window order
+		CPLAcquireMutex(state->mutex, 1000.0);
+		while (state->nextWrite != i && state->err.errnum == 0) {
+			CPLCondWait(state->writeCond, state->mutex);
+		}
+		if (state->err.errnum == 0 && err.errnum == 0 && !worker->slot->skip) {
+			err = state->job->write(worker->slot, windows[i]);
+		}
+		if (state->err.errnum == 0 && err.errnum != 0) {
+			state->err = err;
+		}
+		state->nextWrite++;
+		CPLCondBroadcast(state->writeCond);
+		CPLReleaseMutex(state->mutex);
+	}
+}
+
+GALGError WindowEngine::runParallel(WindowJob &job,
+		const std::vector<GALGWindow> &windows) {
+	GALGError err = { 0, NULL };
+	int nWorkers = this->nThreads;
+	if (nWorkers > (int) windows.size()) {
+		nWorkers = (int) windows.size();
+	}
+
+	ParallelState state;
+	state.job = &job;
+	state.windows = &windows;
+	state.nextWindow = 0;
+	state.nextWrite = 0;
+	state.err = err;
+
+	// Per-worker state is created up front, on this thread, so that
+	// a failure to open a dataset or allocate a buffer is reported cleanly
+	std::vector<ParallelWorker> workers(nWorkers);
+	for (int i = 0; i < nWorkers; ++i) {
+		workers[i].state = &state;
+		workers[i].reader = NULL;
+		workers[i].slot = NULL;
+		if (err.errnum == 0) {
+			err = job.createReader(workers[i].reader);
+		}
+		if (err.errnum == 0) {
+			err = job.createSlot(workers[i].slot);
+		}
+	}
+
+	if (err.errnum == 0) {
+		state.mutex = CPLCreateMutex();
+		CPLReleaseMutex(state.mutex);
+		state.writeCond = CPLCreateCond();
+
+		std::vector<CPLJoinableThread *> threads(nWorkers);
+		for (int i = 0; i < nWorkers; ++i) {
+			threads[i] = CPLCreateJoinableThread(parallelWorkerFn, &workers[i]);
+		}
+		for (int i = 0; i < nWorkers; ++i) {
+			if (threads[i] != NULL) {
+				CPLJoinThread(threads[i]);
+			} else {
+				// Could not start the thread - run the worker inline instead
+				parallelWorkerFn(&workers[i]);
+			}
+		}
+		CPLDestroyCond(state.writeCond);
+		CPLDestroyMutex(state.mutex);
+		err = state.err;
+	}
+
+	for (int i = 0; i < nWorkers; ++i) {
+		delete workers[i].slot;
+		delete workers[i].reader;
+	}
+	return err;
+}
+
+/*
+ * State shared by the stages of one pipelined run. All queues are
+ * guarded by ``mutex``; any change is announced on ``cond``.
+ */
+typedef struct PipelineState {
+	WindowJob *job;
+	const std::vector<GALGWindow> *windows;
+	WindowReader *reader;
+	std::vector<WindowSlot *> slots;
+	CPLMutex *mutex;
+	CPLCond *cond;
+	std::deque<int> freeSlots;                  // slots ready to be read into
+	std::deque<std::pair<int, int> > readQueue; // (window, slot) ready to compute
+	std::map<int, int> doneSlots;               // window -> computed slot
+	bool readFinished;
+	GALGError err;
+} PipelineState;
+
+static void pipelineFail(PipelineState *state, GALGError err) {
+	CPLAcquireMutex(state->mutex, 1000.0);
+	if (state->err.errnum == 0) {
+		state->err = err;
+	}
+	CPLCondBroadcast(state->cond);
+	CPLReleaseMutex(state->mutex);
+}
+
+static void pipelineReaderFn(void *data) {
+	PipelineState *state = (PipelineState *) data;
+	const std::vector<GALGWindow> &windows = *state->windows;
+
+	for (size_t i = 0; i < windows.size(); ++i) {
+		// Wait for a slot to come back from the writer
+		CPLAcquireMutex(state->mutex, 1000.0);
+		while (state->freeSlots.empty() && state->err.errnum == 0) {
+			CPLCondWait(state->cond, state->mutex);
+		}
+		if (state->err.errnum != 0) {
+			CPLReleaseMutex(state->mutex);
+			break;
+		}
+		int iSlot = state->freeSlots.front();
+		state->freeSlots.pop_front();
+		CPLReleaseMutex(state->mutex);
+
+		state->slots[iSlot]->skip = false;
+		GALGError err = state->job->read(state->reader, state->slots[iSlot],
+				windows[i]);
+		if (err.errnum != 0) {
+			pipelineFail(state, err);
+			break;
+		}
+
+		CPLAcquireMutex(state->mutex, 1000.0);
+		state->readQueue.push_back(std::make_pair((int) i, iSlot));
+		CPLCondBroadcast(state->cond);
+		CPLReleaseMutex(state->mutex);
+	}
+
+	CPLAcquireMutex(state->mutex, 1000.0);
+	state->readFinished = true;
+	CPLCondBroadcast(state->cond);
+	CPLReleaseMutex(state->mutex);
+}
+
+static void pipelineComputeFn(void *data) {
+	PipelineState *state = (PipelineState *) data;
+	const std::vector<GALGWindow> &windows = *state->windows;
+
+	while (true) {
+		CPLAcquireMutex(state->mutex, 1000.0);
+		while (state->readQueue.empty() && !state->readFinished
+				&& state->err.errnum == 0) {
+			CPLCondWait(state->cond, state->mutex);
+		}
+		if (state->readQueue.empty() || state->err.errnum != 0) {
+			CPLReleaseMutex(state->mutex);
+			break;
+		}
+		std::pair<int, int> item = state->readQueue.front();
+		state->readQueue.pop_front();
+		CPLReleaseMutex(state->mutex);
+
+		GALGError err = { 0, NULL };
+		if (!state->slots[item.second]->skip) {
+			err = state->job->compute(state->slots[item.second],
+					windows[item.first]);
+		}
+		if (err.errnum != 0) {
+			pipelineFail(state, err);
+			break;
+		}
+
+		CPLAcquireMutex(state->mutex, 1000.0);
+		state->doneSlots[item.first] = item.second;
+		CPLCondBroadcast(state->cond);
+		CPLReleaseMutex(state->mutex);
+	}
+}
+
+GALGError WindowEngine::runPipelined(WindowJob &job,
+		const std::vector<GALGWindow> &windows) {
+	GALGError err = { 0, NULL };
+
+	// Every compute thread needs a slot, plus one being read and one being written
+	int nSlots = std::max(this->pipelineDepth, this->nThreads + 2);
+	PipelineState state;
+	state.job = &job;
+	state.windows = &windows;
+	state.reader = NULL;
+	state.readFinished = false;
+	state.err = err;
+
+	err = job.createReader(state.reader);
+	for (int i = 0; i < nSlots && err.errnum == 0; ++i) {
+		WindowSlot *slot = NULL;
+		err = job.createSlot(slot);
+		state.slots.push_back(slot);
+		state.freeSlots.push_back(i);
+	}
+
+	if (err.errnum == 0) {
+		state.mutex = CPLCreateMutex();
+		CPLReleaseMutex(state.mutex);
+		state.cond = CPLCreateCond();
+
+		std::vector<CPLJoinableThread *> threads;
+		threads.push_back(CPLCreateJoinableThread(pipelineReaderFn, &state));
+		for (int i = 0; i < this->nThreads; ++i) {
+			threads.push_back(
+					CPLCreateJoinableThread(pipelineComputeFn, &state));
+		}
+		for (size_t i = 0; i < threads.size(); ++i) {
+			if (threads[i] == NULL) {
+				GALGError threadErr = { 1, "Unable to start pipeline thread" };
+				pipelineFail(&state, threadErr);
+			}
+		}
+
+		// The calling thread is the writer: flush windows in order and
+		// hand each slot back to the reader
+		for (size_t i = 0; i < windows.size(); ++i) {
+			CPLAcquireMutex(state.mutex, 1000.0);
+			while (state.doneSlots.find((int) i) == state.doneSlots.end()
+					&& state.err.errnum == 0) {
+				CPLCondWait(state.cond, state.mutex);
+			}
+			if (state.err.errnum != 0) {
+				CPLReleaseMutex(state.mutex);
+				break;
+			}
+			int iSlot = state.doneSlots[(int) i];
+			state.doneSlots.erase((int) i);
+			CPLReleaseMutex(state.mutex);
+
+			GALGError writeErr = { 0, NULL };
+			if (!state.slots[iSlot]->skip) {
+				writeErr = job.write(state.slots[iSlot], windows[i]);
+			}
+			if (writeErr.errnum != 0) {
+				pipelineFail(&state, writeErr);
+				break;
+			}
+
+			CPLAcquireMutex(state.mutex, 1000.0);
+			state.freeSlots.push_back(iSlot);
+			CPLCondBroadcast(state.cond);
+			CPLReleaseMutex(state.mutex);
+		}
+
+		for (size_t i = 0; i < threads.size(); ++i) {
+			if (threads[i] != NULL) {
+				CPLJoinThread(threads[i]);
+			}
+		}
+		CPLDestroyCond(state.cond);
+		CPLDestroyMutex(state.mutex);
+		err = state.err;
+	}
+
+	for (size_t i = 0; i < state.slots.size(); ++i) {
+		delete state.slots[i];
+	}
+	delete state.reader;
+	return err;
+}
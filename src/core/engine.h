@@ -0,0 +1,112 @@
+/*
+ * ENGINE API
+ *
+ * Runs a list of raster windows through read, compute and write
+ * stages, either serially or on a pool of worker threads.
+ */
+#ifndef ENGINE_H_
+#define ENGINE_H_
+
+#include <vector>
+#include "gdal_priv.h"
+
+#include "core_exp.h"
+#include "common.h"
+#include "iterator.h"
+
+/*
+ * A single unit of work: one iterator window of one band.
+ * ``index`` is the position of the window in the serial processing order.
+ */
+typedef struct GALGWindow {
+	int index;
+	int band;
+	int xOff, yOff, xSize, ySize;
+} GALGWindow;
+
+/*
+ * The buffers used by one in-flight window.
+ * A slot is only ever used by one thread at a time.
+ * ``read`` may set ``skip`` to drop a window (e.g. one with no data):
+ * it is then neither computed nor written.
+ */
+class GALGCORE_DLL WindowSlot {
+
+public:
+	WindowSlot() :
+			skip(false) {
+	}
+	virtual ~WindowSlot() {};
+	bool skip;
+};
+
+/*
+ * Thread-private read state, e.g. a source dataset handle.
+ */
+class GALGCORE_DLL WindowReader {
+
+public:
+	virtual ~WindowReader() {};
+};
+
+/*
+ * The work to be done for each window.
+ * ``read`` and ``compute`` may be called concurrently from several threads,
+ * each with its own reader and slot. ``write`` is always called
+ * from one thread at a time and in window order.
+ */
+class GALGCORE_DLL WindowJob {
+
+public:
+	virtual ~WindowJob() {};
+	virtual GALGError createReader(WindowReader *&reader) = 0;
+	virtual GALGError createSlot(WindowSlot *&slot) = 0;
+	virtual GALGError read(WindowReader *reader, WindowSlot *slot,
+			const GALGWindow &window) = 0;
+	virtual GALGError compute(WindowSlot *slot, const GALGWindow &window) = 0;
+	virtual GALGError write(WindowSlot *slot, const GALGWindow &window) = 0;
+};
+
+/*
+ * \brief Executes a WindowJob over a list of windows.
+ *
+ * With a single thread, windows are read, computed and written in turn.
+ * With N threads, each worker owns a reader and a slot and claims windows
+ * in order; writes are committed in window order so the output is identical
+ * to the serial path. A job writing its output from compute (as map does,
+ * through a TileSink) must keep that order itself.
+ *
+ * When a pipeline depth is set, reading, computing and writing run
+ * concurrently instead: a reader thread prefetches windows into a fixed
+ * ring of slots, N compute threads process them and the calling thread
+ * writes them out in window order, returning each slot to the ring.
+ */
+class GALGCORE_DLL WindowEngine {
+
+public:
+	WindowEngine();
+	virtual ~WindowEngine() {};
+	GALGError setNumThreads(int nThreads);
+	int getNumThreads();
+	GALGError setPipelineDepth(int nSlots);
+	int getPipelineDepth();
+	GALGError run(WindowJob &job, const std::vector<GALGWindow> &windows);
+
+	/*
+	 * Drain an iterator into a window list, repeating the windows for
+	 * each of the ``nBands`` bands (band-major order)
+	 */
+	static void collectWindows(BlockIterator &iterator, int nBands,
+			std::vector<GALGWindow> &windows);
+
+protected:
+	GALGError runSerial(WindowJob &job, const std::vector<GALGWindow> &windows);
+	GALGError runParallel(WindowJob &job,
+			const std::vector<GALGWindow> &windows);
+	GALGError runPipelined(WindowJob &job,
+			const std::vector<GALGWindow> &windows);
+	int nThreads;
+	int pipelineDepth;
+};
+
+#endif // ENGINE_H_
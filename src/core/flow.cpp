@@ -0,0 +1,642 @@
+#include <algorithm>
+#include <limits>
+#include <queue>
+#include <set>
+#include "flow.h"
+#include "cpl_port.h"
+
+static const int D8_DX[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+static const int D8_DY[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+
+GByte galgD8Code(int dx, int dy) {
+	for (int i = 0; i < 8; ++i) {
+		if (D8_DX[i] == dx && D8_DY[i] == dy) {
+			return (GByte) (1 << i);
+		}
+	}
+	return 0;
+}
+
+bool galgD8Offset(GByte code, int *dx, int *dy) {
+	for (int i = 0; i < 8; ++i) {
+		if (code == (1 << i)) {
+			*dx = D8_DX[i];
+			*dy = D8_DY[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * A cell waiting in a priority-flood queue. Equal levels leave in the
+ * order they were queued, so flats are crossed breadth first.
+ */
+typedef struct FloodCell {
+	double level;
+	GIntBig order;
+	int index;
+	bool operator<(const FloodCell &other) const {
+		// std::priority_queue pops the largest
+		if (level != other.level) {
+			return level > other.level;
+		}
+		return order > other.order;
+	}
+} FloodCell;
+
+/*****************
+ * TILE GRID
+ *****************/
+
+TileGrid::TileGrid(const std::vector<GALGWindow> &windows, int rasterXSize,
+		int rasterYSize) :
+		windows(windows), rasterXSize(rasterXSize), rasterYSize(rasterYSize) {
+	for (size_t i = 0; i < windows.size(); ++i) {
+		this->xOffs.push_back(windows[i].xOff);
+		this->yOffs.push_back(windows[i].yOff);
+	}
+	std::sort(this->xOffs.begin(), this->xOffs.end());
+	this->xOffs.erase(std::unique(this->xOffs.begin(), this->xOffs.end()),
+			this->xOffs.end());
+	std::sort(this->yOffs.begin(), this->yOffs.end());
+	this->yOffs.erase(std::unique(this->yOffs.begin(), this->yOffs.end()),
+			this->yOffs.end());
+}
+
+int TileGrid::getRasterXSize() const {
+	return this->rasterXSize;
+}
+
+int TileGrid::getRasterYSize() const {
+	return this->rasterYSize;
+}
+
+const GALGWindow &TileGrid::tileAt(int x, int y) const {
+	// Windows come row by row, each row with the same columns
+	int col = (int) (std::upper_bound(this->xOffs.begin(), this->xOffs.end(), x)
+			- this->xOffs.begin()) - 1;
+	int row = (int) (std::upper_bound(this->yOffs.begin(), this->yOffs.end(), y)
+			- this->yOffs.begin()) - 1;
+	return this->windows[(size_t) row * this->xOffs.size() + col];
+}
+
+GIntBig TileGrid::perimeterLabel(int x, int y) const {
+	const GALGWindow &tile = this->tileAt(x, y);
+	int lx = x - tile.xOff, ly = y - tile.yOff;
+	int w = tile.xSize, h = tile.ySize;
+	// Top row, bottom row, left column then right column
+	int position;
+	if (ly == 0) {
+		position = lx;
+	} else if (ly == h - 1) {
+		position = w + lx;
+	} else if (lx == 0) {
+		position = 2 * w + ly - 1;
+	} else {
+		position = 2 * w + (h - 2) + ly - 1;
+	}
+	return ((GIntBig) tile.index << 32) | (GIntBig) (position + 1);
+}
+
+/*****************
+ * TILE FLOOD
+ *****************/
+
+TileFlood::TileFlood(const TileGrid &grid, bool hasNoData, double noDataValue) :
+		grid(grid), hasNoData(hasNoData), noDataValue(noDataValue), buffer(NULL), bufXOff(
+				0), bufYOff(0), bufXSize(0), bufYSize(0) {
+}
+
+void TileFlood::getReadWindow(const GALGWindow &tile, int *xOff, int *yOff,
+		int *xSize, int *ySize) const {
+	*xOff = std::max(tile.xOff - 2, 0);
+	*yOff = std::max(tile.yOff - 2, 0);
+	*xSize = std::min(tile.xOff + tile.xSize + 2, this->grid.getRasterXSize())
+			- *xOff;
+	*ySize = std::min(tile.yOff + tile.ySize + 2, this->grid.getRasterYSize())
+			- *yOff;
+}
+
+double TileFlood::elevation(int x, int y) const {
+	return this->buffer[(size_t) (y - this->bufYOff) * this->bufXSize
+			+ (x - this->bufXOff)];
+}
+
+bool TileFlood::isValid(int x, int y) const {
+	if (x < 0 || y < 0 || x >= this->grid.getRasterXSize()
+			|| y >= this->grid.getRasterYSize()) {
+		return false;
+	}
+	double z = this->elevation(x, y);
+	return !CPLIsNan(z) && !(this->hasNoData && z == this->noDataValue);
+}
+
+bool TileFlood::isOutlet(int x, int y) const {
+	if (!this->isValid(x, y)) {
+		return false;
+	}
+	for (int i = 0; i < 8; ++i) {
+		if (!this->isValid(x + D8_DX[i], y + D8_DY[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void TileFlood::flood(const double *elevations, const GALGWindow &tile,
+		std::vector<GALGSpill> *spills) {
+	this->buffer = elevations;
+	this->tile = tile;
+	this->getReadWindow(tile, &this->bufXOff, &this->bufYOff, &this->bufXSize,
+			&this->bufYSize);
+	int w = tile.xSize, h = tile.ySize;
+	GIntBig nXSize = this->grid.getRasterXSize();
+	this->labels.assign((size_t) w * h, -1);
+	this->fill.assign((size_t) w * h, 0.0);
+
+	// Seed with the perimeter and the outlets
+	std::priority_queue<FloodCell> queue;
+	GIntBig order = 0;
+	for (int ly = 0; ly < h; ++ly) {
+		for (int lx = 0; lx < w; ++lx) {
+			int x = tile.xOff + lx, y = tile.yOff + ly;
+			if (!this->isValid(x, y)) {
+				continue;
+			}
+			bool perimeter = lx == 0 || ly == 0 || lx == w - 1 || ly == h - 1;
+			bool outlet = this->isOutlet(x, y);
+			if (!perimeter && !outlet) {
+				continue;
+			}
+			int i = ly * w + lx;
+			this->labels[i] = outlet ? 0 : this->grid.perimeterLabel(x, y);
+			this->fill[i] = this->elevation(x, y);
+			FloodCell cell = { this->fill[i], order++, i };
+			queue.push(cell);
+		}
+	}
+
+	// Lowest spill between each pair of labels, with the lower label first
+	std::map<std::pair<GIntBig, GIntBig>, GALGSpill> lowest;
+	while (!queue.empty()) {
+		FloodCell cell = queue.top();
+		queue.pop();
+		int lx = cell.index % w, ly = cell.index / w;
+		GIntBig label = this->labels[cell.index];
+		for (int d = 0; d < 8; ++d) {
+			int nx = lx + D8_DX[d], ny = ly + D8_DY[d];
+			if (nx < 0 || ny < 0 || nx >= w || ny >= h
+					|| !this->isValid(tile.xOff + nx, tile.yOff + ny)) {
+				continue;
+			}
+			int n = ny * w + nx;
+			if (this->labels[n] < 0) {
+				this->labels[n] = label;
+				this->fill[n] = std::max(
+						this->elevation(tile.xOff + nx, tile.yOff + ny),
+						cell.level);
+				FloodCell next = { this->fill[n], order++, n };
+				queue.push(next);
+			} else if (spills != NULL && this->labels[n] != label) {
+				GALGSpill spill;
+				spill.labelA = label;
+				spill.labelB = this->labels[n];
+				spill.cellA = (tile.yOff + ly) * nXSize + tile.xOff + lx;
+				spill.cellB = (tile.yOff + ny) * nXSize + tile.xOff + nx;
+				spill.level = std::max(cell.level, this->fill[n]);
+				if (spill.labelA > spill.labelB) {
+					std::swap(spill.labelA, spill.labelB);
+					std::swap(spill.cellA, spill.cellB);
+				}
+				std::pair<GIntBig, GIntBig> key(spill.labelA, spill.labelB);
+				std::map<std::pair<GIntBig, GIntBig>, GALGSpill>::iterator it =
+						lowest.find(key);
+				if (it == lowest.end() || spill.level < it->second.level) {
+					lowest[key] = spill;
+				}
+			}
+		}
+	}
+	if (spills == NULL) {
+		return;
+	}
+
+	// Spills into the perimeter cells of later tiles, which are seeds there
+	for (int ly = 0; ly < h; ++ly) {
+		for (int lx = 0; lx < w; ++lx) {
+			if (lx != 0 && ly != 0 && lx != w - 1 && ly != h - 1) {
+				continue;
+			}
+			int x = tile.xOff + lx, y = tile.yOff + ly;
+			int i = ly * w + lx;
+			if (this->labels[i] < 0) {
+				continue;
+			}
+			for (int d = 0; d < 8; ++d) {
+				int nx = x + D8_DX[d], ny = y + D8_DY[d];
+				if (!this->isValid(nx, ny)
+						|| this->grid.tileAt(nx, ny).index <= tile.index) {
+					continue;
+				}
+				GALGSpill spill;
+				spill.labelA = this->labels[i];
+				spill.labelB =
+						this->isOutlet(nx, ny) ? 0 : this->grid.perimeterLabel(nx, ny);
+				if (spill.labelA == spill.labelB) {
+					continue;
+				}
+				spill.cellA = y * nXSize + x;
+				spill.cellB = ny * nXSize + nx;
+				spill.level = std::max(this->elevation(x, y),
+						this->elevation(nx, ny));
+				if (spill.labelA > spill.labelB) {
+					std::swap(spill.labelA, spill.labelB);
+					std::swap(spill.cellA, spill.cellB);
+				}
+				std::pair<GIntBig, GIntBig> key(spill.labelA, spill.labelB);
+				std::map<std::pair<GIntBig, GIntBig>, GALGSpill>::iterator it =
+						lowest.find(key);
+				if (it == lowest.end() || spill.level < it->second.level) {
+					lowest[key] = spill;
+				}
+			}
+		}
+	}
+	for (std::map<std::pair<GIntBig, GIntBig>, GALGSpill>::iterator it =
+			lowest.begin(); it != lowest.end(); ++it) {
+		spills->push_back(it->second);
+	}
+}
+
+void TileFlood::route(const SpillGraph &graph, double *filled,
+		GByte *directions) {
+	const GALGWindow &tile = this->tile;
+	int w = tile.xSize, h = tile.ySize;
+	size_t nCells = (size_t) w * h;
+	GIntBig nXSize = this->grid.getRasterXSize();
+
+	// Raise each cell to the level of its label
+	GIntBig lastLabel = -1;
+	double level = 0;
+	std::set<GIntBig> tileLabels;
+	for (size_t i = 0; i < nCells; ++i) {
+		directions[i] = 0;
+		if (this->labels[i] < 0) {
+			int x = tile.xOff + (int) (i % w), y = tile.yOff + (int) (i / w);
+			filled[i] = this->hasNoData ? this->noDataValue : this->elevation(x, y);
+			continue;
+		}
+		if (this->labels[i] != lastLabel) {
+			lastLabel = this->labels[i];
+			level = graph.getLevel(lastLabel);
+			tileLabels.insert(lastLabel);
+		}
+		filled[i] = std::max(this->fill[i], level);
+	}
+
+	// Flood each label's region from its outlet: every cell drains towards
+	// the cell that reached it, over ground no higher than itself
+	std::priority_queue<FloodCell> queue;
+	GIntBig order = 0;
+	std::vector<bool> routed(nCells, false);
+	for (size_t i = 0; i < nCells; ++i) {
+		int x = tile.xOff + (int) (i % w), y = tile.yOff + (int) (i / w);
+		if (this->labels[i] != 0 || !this->isOutlet(x, y)) {
+			continue;
+		}
+		// Off the raster or into no data
+		for (int d = 0; d < 8; ++d) {
+			if (!this->isValid(x + D8_DX[d], y + D8_DY[d])) {
+				directions[i] = (GByte) (1 << d);
+				break;
+			}
+		}
+		routed[i] = true;
+		FloodCell cell = { filled[i], order++, (int) i };
+		queue.push(cell);
+	}
+	for (std::set<GIntBig>::iterator it = tileLabels.begin();
+			it != tileLabels.end(); ++it) {
+		GIntBig cell, target;
+		if (!graph.getOutlet(*it, &cell, &target)) {
+			continue;
+		}
+		int x = (int) (cell % nXSize), y = (int) (cell / nXSize);
+		int tx = (int) (target % nXSize), ty = (int) (target / nXSize);
+		if (x < tile.xOff || y < tile.yOff || x >= tile.xOff + w
+				|| y >= tile.yOff + h) {
+			continue;
+		}
+		int i = (y - tile.yOff) * w + (x - tile.xOff);
+		directions[i] = galgD8Code(tx - x, ty - y);
+		routed[i] = true;
+		FloodCell next = { filled[i], order++, i };
+		queue.push(next);
+	}
+	while (!queue.empty()) {
+		FloodCell cell = queue.top();
+		queue.pop();
+		int lx = cell.index % w, ly = cell.index / w;
+		for (int d = 0; d < 8; ++d) {
+			int nx = lx + D8_DX[d], ny = ly + D8_DY[d];
+			if (nx < 0 || ny < 0 || nx >= w || ny >= h) {
+				continue;
+			}
+			int n = ny * w + nx;
+			if (routed[n] || this->labels[n] != this->labels[cell.index]) {
+				continue;
+			}
+			directions[n] = galgD8Code(-D8_DX[d], -D8_DY[d]);
+			routed[n] = true;
+			FloodCell next = { filled[n], order++, n };
+			queue.push(next);
+		}
+	}
+}
+
+/*****************
+ * SPILL GRAPH
+ *****************/
+
+void SpillGraph::addSpills(const std::vector<GALGSpill> &spills) {
+	this->spills.insert(this->spills.end(), spills.begin(), spills.end());
+}
+
+GALGError SpillGraph::solve() {
+	GALGError err = { 0, NULL };
+	this->states.clear();
+
+	// Spills by label, in both directions
+	std::vector<std::pair<GIntBig, int> > adjacency;
+	adjacency.reserve(this->spills.size() * 2);
+	for (size_t i = 0; i < this->spills.size(); ++i) {
+		adjacency.push_back(std::make_pair(this->spills[i].labelA, (int) i));
+		adjacency.push_back(std::make_pair(this->spills[i].labelB, (int) i));
+	}
+	std::sort(adjacency.begin(), adjacency.end());
+
+	LabelState unreached = { std::numeric_limits<double>::infinity(), -1, -1 };
+	for (size_t i = 0; i < adjacency.size(); ++i) {
+		this->states[adjacency[i].first] = unreached;
+	}
+	LabelState ocean = { -std::numeric_limits<double>::infinity(), -1, -1 };
+	this->states[0] = ocean;
+
+	// Minimax Dijkstra from the ocean
+	typedef std::pair<double, GIntBig> Entry;
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > queue;
+	std::set<GIntBig> done;
+	queue.push(Entry(ocean.level, 0));
+	while (!queue.empty()) {
+		Entry entry = queue.top();
+		queue.pop();
+		GIntBig label = entry.second;
+		if (!done.insert(label).second) {
+			continue;
+		}
+		std::vector<std::pair<GIntBig, int> >::iterator it = std::lower_bound(
+				adjacency.begin(), adjacency.end(), std::make_pair(label, -1));
+		for (; it != adjacency.end() && it->first == label; ++it) {
+			const GALGSpill &spill = this->spills[it->second];
+			bool fromA = spill.labelA == label;
+			GIntBig other = fromA ? spill.labelB : spill.labelA;
+			double level = std::max(entry.first, spill.level);
+			LabelState &state = this->states[other];
+			if (done.count(other) == 0 && level < state.level) {
+				state.level = level;
+				// Water leaves the other label through its own cell
+				state.cell = fromA ? spill.cellB : spill.cellA;
+				state.target = fromA ? spill.cellA : spill.cellB;
+				queue.push(Entry(level, other));
+			}
+		}
+	}
+	RETURNIF(done.size() != this->states.size(), 1,
+			"Some cells have no path to an outlet");
+	return err;
+}
+
+double SpillGraph::getLevel(GIntBig label) const {
+	std::map<GIntBig, LabelState>::const_iterator it = this->states.find(label);
+	return it == this->states.end() ?
+			-std::numeric_limits<double>::infinity() : it->second.level;
+}
+
+bool SpillGraph::getOutlet(GIntBig label, GIntBig *cell, GIntBig *target) const {
+	std::map<GIntBig, LabelState>::const_iterator it = this->states.find(label);
+	if (it == this->states.end() || it->second.cell < 0) {
+		return false;
+	}
+	*cell = it->second.cell;
+	*target = it->second.target;
+	return true;
+}
+
+void SpillGraph::clear() {
+	this->spills.clear();
+	this->states.clear();
+}
+
+/*****************
+ * TILE ACCUMULATOR
+ *****************/
+
+TileAccumulator::TileAccumulator(int rasterXSize, int rasterYSize) :
+		rasterXSize(rasterXSize), rasterYSize(rasterYSize) {
+}
+
+/*
+ * The cell a tile cell flows into, -1 off the raster or without a direction
+ */
+GIntBig TileAccumulator::target(const GByte *directions, const GALGWindow &tile,
+		int x, int y) const {
+	int dx, dy;
+	if (!galgD8Offset(directions[y * tile.xSize + x], &dx, &dy)) {
+		return -1;
+	}
+	int tx = tile.xOff + x + dx, ty = tile.yOff + y + dy;
+	if (tx < 0 || ty < 0 || tx >= this->rasterXSize || ty >= this->rasterYSize) {
+		return -1;
+	}
+	return (GIntBig) ty * this->rasterXSize + tx;
+}
+
+bool TileAccumulator::accumulate(const GByte *directions, const GALGWindow &tile,
+		const std::map<GIntBig, double> *inflows, double *accumulation) {
+	int w = tile.xSize, h = tile.ySize;
+	size_t nCells = (size_t) w * h;
+	std::vector<int> downstream(nCells, -1);
+	std::vector<int> nUpstream(nCells, 0);
+	size_t nValid = 0;
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			int i = y * w + x;
+			accumulation[i] = 0;
+			if (directions[i] == 0) {
+				continue;
+			}
+			nValid++;
+			accumulation[i] = 1;
+			GIntBig t = this->target(directions, tile, x, y);
+			if (t < 0) {
+				continue;
+			}
+			int tx = (int) (t % this->rasterXSize) - tile.xOff;
+			int ty = (int) (t / this->rasterXSize) - tile.yOff;
+			if (tx >= 0 && ty >= 0 && tx < w && ty < h
+					&& directions[ty * w + tx] != 0) {
+				downstream[i] = ty * w + tx;
+				nUpstream[downstream[i]]++;
+			}
+		}
+	}
+	if (inflows != NULL && !inflows->empty()) {
+		for (int y = 0; y < h; ++y) {
+			for (int x = 0; x < w; ++x) {
+				if (x != 0 && y != 0 && x != w - 1 && y != h - 1) {
+					continue;
+				}
+				std::map<GIntBig, double>::const_iterator it = inflows->find(
+						(GIntBig) (tile.yOff + y) * this->rasterXSize + tile.xOff
+								+ x);
+				if (it != inflows->end() && directions[y * w + x] != 0) {
+					accumulation[y * w + x] += it->second;
+				}
+			}
+		}
+	}
+
+	// Topological order: a cell is passed on once all its upstream cells are
+	this->order.clear();
+	this->order.reserve(nValid);
+	for (size_t i = 0; i < nCells; ++i) {
+		if (directions[i] != 0 && nUpstream[i] == 0) {
+			this->order.push_back((int) i);
+		}
+	}
+	for (size_t k = 0; k < this->order.size(); ++k) {
+		int i = this->order[k];
+		int d = downstream[i];
+		if (d >= 0) {
+			accumulation[d] += accumulation[i];
+			if (--nUpstream[d] == 0) {
+				this->order.push_back(d);
+			}
+		}
+	}
+	return this->order.size() == nValid;
+}
+
+void TileAccumulator::link(const GByte *directions, const GALGWindow &tile,
+		const double *accumulation, std::vector<GALGFlowLink> &links) {
+	int w = tile.xSize, h = tile.ySize;
+	std::vector<GIntBig> exits((size_t) w * h, -1), targets((size_t) w * h, -1);
+
+	// Downstream cells first, so each cell's exit is known from the next
+	for (size_t k = this->order.size(); k-- > 0;) {
+		int i = this->order[k];
+		int x = i % w, y = i / w;
+		int dx, dy;
+		if (!galgD8Offset(directions[i], &dx, &dy)) {
+			continue;
+		}
+		GIntBig t = this->target(directions, tile, x, y);
+		int nx = x + dx, ny = y + dy;
+		if (nx < 0 || ny < 0 || nx >= w || ny >= h) {
+			// Leaves the tile
+			exits[i] = (GIntBig) (tile.yOff + y) * this->rasterXSize + tile.xOff
+					+ x;
+			targets[i] = t;
+		} else if (directions[ny * w + nx] != 0) {
+			exits[i] = exits[ny * w + nx];
+		}
+	}
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			int i = y * w + x;
+			if ((x != 0 && y != 0 && x != w - 1 && y != h - 1)
+					|| directions[i] == 0) {
+				continue;
+			}
+			GALGFlowLink flowLink;
+			flowLink.cell = (GIntBig) (tile.yOff + y) * this->rasterXSize
+					+ tile.xOff + x;
+			flowLink.exit = exits[i];
+			flowLink.target = targets[i];
+			flowLink.accumulation = accumulation[i];
+			links.push_back(flowLink);
+		}
+	}
+}
+
+/*****************
+ * FLOW LINKS
+ *****************/
+
+void FlowLinks::addLinks(const std::vector<GALGFlowLink> &links) {
+	this->links.insert(this->links.end(), links.begin(), links.end());
+}
+
+GALGError FlowLinks::solve() {
+	GALGError err = { 0, NULL };
+	this->inflows.clear();
+	std::map<GIntBig, int> nodes;
+	for (size_t i = 0; i < this->links.size(); ++i) {
+		nodes[this->links[i].cell] = (int) i;
+	}
+
+	// Each perimeter cell passes on what enters it: an exit cell its whole
+	// accumulation to the next tile, other cells their inflow to their exit
+	size_t nLinks = this->links.size();
+	std::vector<int> next(nLinks, -1), nWaiting(nLinks, 0);
+	std::vector<double> inflow(nLinks, 0.0), throughflow(nLinks, 0.0);
+	for (size_t i = 0; i < nLinks; ++i) {
+		const GALGFlowLink &flowLink = this->links[i];
+		GIntBig to = flowLink.exit == flowLink.cell ?
+				flowLink.target : flowLink.exit;
+		std::map<GIntBig, int>::iterator it = nodes.find(to);
+		if (to >= 0 && it != nodes.end()) {
+			next[i] = it->second;
+			nWaiting[it->second]++;
+		}
+	}
+	std::vector<int> ready;
+	for (size_t i = 0; i < nLinks; ++i) {
+		if (nWaiting[i] == 0) {
+			ready.push_back((int) i);
+		}
+	}
+	size_t nDone = 0;
+	while (!ready.empty()) {
+		int i = ready.back();
+		ready.pop_back();
+		nDone++;
+		const GALGFlowLink &flowLink = this->links[i];
+		if (inflow[i] > 0) {
+			this->inflows[flowLink.cell] = inflow[i];
+		}
+		if (next[i] < 0) {
+			continue;
+		}
+		if (flowLink.exit == flowLink.cell) {
+			inflow[next[i]] += flowLink.accumulation + inflow[i] + throughflow[i];
+		} else {
+			throughflow[next[i]] += inflow[i];
+		}
+		if (--nWaiting[next[i]] == 0) {
+			ready.push_back(next[i]);
+		}
+	}
+	RETURNIF(nDone != nLinks, 1, "Flow directions form a cycle");
+	return err;
+}
+
+const std::map<GIntBig, double> &FlowLinks::getInflows() const {
+	return this->inflows;
+}
+
+void FlowLinks::clear() {
+	this->links.clear();
+	this->inflows.clear();
+}
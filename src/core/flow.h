@@ -0,0 +1,215 @@
+/*
+ * FLOW API
+ *
+ * The tile-level pieces of out-of-core flow routing: depression filling
+ * and D8 flow directions by a labelled priority-flood of each tile, and
+ * flow accumulation within each tile. Tiles only exchange summaries of
+ * their perimeter cells, which are solved globally (SpillGraph, FlowLinks).
+ */
+#ifndef FLOW_H_
+#define FLOW_H_
+
+#include <map>
+#include <vector>
+#include "gdal_priv.h"
+
+#include "core_exp.h"
+#include "common.h"
+#include "engine.h"
+
+/*
+ * D8 direction codes (as used by ArcGIS): 1 east, 2 south east, 4 south,
+ * 8 south west, 16 west, 32 north west, 64 north, 128 north east.
+ * 0 is no direction (no data).
+ */
+GALGCORE_DLL GByte galgD8Code(int dx, int dy);
+GALGCORE_DLL bool galgD8Offset(GByte code, int *dx, int *dy);
+
+/*
+ * \brief The tiles of a raster: the windows of a BlockIterator without a buffer.
+ *
+ * Finds the tile holding any cell, so that a tile can name the labels of
+ * its neighbours' perimeter cells without seeing the neighbours.
+ */
+class GALGCORE_DLL TileGrid {
+
+public:
+	TileGrid(const std::vector<GALGWindow> &windows, int rasterXSize,
+			int rasterYSize);
+	int getRasterXSize() const;
+	int getRasterYSize() const;
+	/*
+	 * The tile holding cell (x, y)
+	 */
+	const GALGWindow &tileAt(int x, int y) const;
+
+	/*
+	 * The label of a perimeter cell: the tile index in the high 32 bits and
+	 * the cell's position around the tile's perimeter, from 1, in the low bits
+	 */
+	GIntBig perimeterLabel(int x, int y) const;
+
+protected:
+	std::vector<GALGWindow> windows;
+	std::vector<int> xOffs, yOffs;
+	int rasterXSize, rasterYSize;
+};
+
+/*
+ * A pair of neighbouring cells where two labels meet, and the level at
+ * which water would spill from one into the other
+ */
+typedef struct GALGSpill {
+	GIntBig labelA, labelB;
+	GIntBig cellA, cellB;
+	double level;
+} GALGSpill;
+
+/*
+ * \brief Priority-flood of one tile from its perimeter (Barnes et al., 2016).
+ *
+ * Every perimeter cell seeds a label of its own, except outlets - cells on
+ * the raster edge or next to no data - which are all labelled 0 (the
+ * ocean); outlets inside the tile are seeds too. Each cell takes the label
+ * of the seed that floods it and is filled to the lowest level from which
+ * water could reach that seed. Where labels meet, within the tile or
+ * across its edge, the spill level between them is recorded.
+ *
+ * The elevation buffer covers the tile and up to 2 cells around it
+ * (clipped to the raster), as outlets among the neighbouring perimeter
+ * cells are found from their own neighbours.
+ */
+class GALGCORE_DLL TileFlood {
+
+public:
+	TileFlood(const TileGrid &grid, bool hasNoData, double noDataValue);
+	virtual ~TileFlood() {};
+
+	/*
+	 * The area to read for a tile: the tile and a halo of 2 cells
+	 */
+	void getReadWindow(const GALGWindow &tile, int *xOff, int *yOff,
+			int *xSize, int *ySize) const;
+
+	/*
+	 * Flood a tile. With spills, also list where labels meet (each meeting
+	 * across tiles is listed by only one of the two tiles).
+	 */
+	void flood(const double *elevations, const GALGWindow &tile,
+			std::vector<GALGSpill> *spills);
+
+	/*
+	 * After flood: fill each cell to at least the level of its label and
+	 * route flow along the fill, each label draining through its outlet
+	 * cell towards the target cell (see SpillGraph). Filled no data cells
+	 * keep the no data value; their direction is 0.
+	 */
+	void route(const class SpillGraph &graph, double *filled,
+			GByte *directions);
+
+protected:
+	bool isValid(int x, int y) const;
+	bool isOutlet(int x, int y) const;
+	double elevation(int x, int y) const;
+	const TileGrid &grid;
+	bool hasNoData;
+	double noDataValue;
+	const double *buffer;
+	int bufXOff, bufYOff, bufXSize, bufYSize;
+	GALGWindow tile;
+	std::vector<GIntBig> labels;
+	std::vector<double> fill;
+};
+
+/*
+ * \brief The graph of labels joined by spills, solved for the level of
+ * each label: the lowest level at which its water reaches the ocean.
+ *
+ * Solved with a minimax Dijkstra from the ocean; each label also records
+ * the spill it drains through.
+ */
+class GALGCORE_DLL SpillGraph {
+
+public:
+	void addSpills(const std::vector<GALGSpill> &spills);
+	GALGError solve();
+	double getLevel(GIntBig label) const;
+
+	/*
+	 * The cell of the label water leaves through, and the neighbouring
+	 * cell it flows into. False for the ocean.
+	 */
+	bool getOutlet(GIntBig label, GIntBig *cell, GIntBig *target) const;
+	void clear();
+
+protected:
+	typedef struct LabelState {
+		double level;
+		GIntBig cell, target;
+	} LabelState;
+	std::vector<GALGSpill> spills;
+	std::map<GIntBig, LabelState> states;
+};
+
+/*
+ * The flow summary of a perimeter cell of a tile: where its flow leaves
+ * the tile (the exit cell, -1 if it ends in the tile) and, for exit cells,
+ * the cell outside the tile it flows into (-1 if none) and the
+ * accumulation from within the tile
+ */
+typedef struct GALGFlowLink {
+	GIntBig cell;
+	GIntBig exit;
+	GIntBig target;
+	double accumulation;
+} GALGFlowLink;
+
+/*
+ * \brief Flow accumulation of one tile from a D8 direction buffer.
+ *
+ * Counts the cells draining through each cell, itself included, plus any
+ * inflow from other tiles entering at perimeter cells.
+ */
+class GALGCORE_DLL TileAccumulator {
+
+public:
+	TileAccumulator(int rasterXSize, int rasterYSize);
+	virtual ~TileAccumulator() {};
+
+	/*
+	 * Returns false if the directions within the tile form a cycle
+	 */
+	bool accumulate(const GByte *directions, const GALGWindow &tile,
+			const std::map<GIntBig, double> *inflows, double *accumulation);
+
+	/*
+	 * After accumulate: the summary of each perimeter cell
+	 */
+	void link(const GByte *directions, const GALGWindow &tile,
+			const double *accumulation, std::vector<GALGFlowLink> &links);
+
+protected:
+	GIntBig target(const GByte *directions, const GALGWindow &tile, int x,
+			int y) const;
+	int rasterXSize, rasterYSize;
+	std::vector<int> order;
+};
+
+/*
+ * \brief Solves the perimeter summaries of every tile for the flow
+ * entering each tile at each perimeter cell.
+ */
+class GALGCORE_DLL FlowLinks {
+
+public:
+	void addLinks(const std::vector<GALGFlowLink> &links);
+	GALGError solve();
+	const std::map<GIntBig, double> &getInflows() const;
+	void clear();
+
+protected:
+	std::vector<GALGFlowLink> links;
+	std::map<GIntBig, double> inflows;
+};
+
+#endif // FLOW_H_
@@ -10,9 +10,19 @@
 
 #include "core_exp.h"
 #include "common.h"
+#include "statistics.h"
+#include "zonal.h"
+#include "output.h"
+#include "gdal.h"
+#include <string>
 #include <vector>
 #include <memory>
 
+// Internals of RasterProcess, only used through pointers here
+class WindowEngine;
+class BlockCache;
+class BufferPool;
+
 // Include processing functions
 
 /**
@@ -45,13 +55,299 @@ public:
     virtual GALGError processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
             double *inNoDataValue, double *outNoDataValue);
 
+    /**
+     * \brief The number of neighbouring pixels this function needs on each side of an output pixel.
+     *
+     * RasterProcess widens the read window by at least this many pixels. Functions working on single pixels return 0 (the default).
+     */
+    virtual int getPixelBuffer();
+
+    /**
+     * \brief Whether processImageNative can work directly on pixels of the given type.
+     *
+     * When every function applied to a band supports the band's data type, windows are read, processed and written
+     * in that type without conversion. Otherwise they are converted to and from float and processImage is called.
+     * The default supports only GDT_Float32.
+     */
+    virtual bool supportsDataType(GDALDataType eDataType);
+
+    /**
+     * \brief Process a window in its native data type.
+     *
+     * Only called with types for which supportsDataType returned true. The arrays hold nWindowXSize * nWindowYSize
+     * values of eDataType. The default forwards GDT_Float32 windows to processImage.
+     */
+    virtual GALGError processImageNative(void *inputArray, void *outputArray, GDALDataType eDataType,
+            int nWindowXSize, int nWindowYSize, double *inNoDataValue, double *outNoDataValue);
+};
+
+/**
+ * \brief Maps a C++ pixel type to its GDALDataType
+ */
+template <typename T> struct GALGDataType { };
+template <> struct GALGDataType<GByte> { static const GDALDataType type = GDT_Byte; };
+template <> struct GALGDataType<GUInt16> { static const GDALDataType type = GDT_UInt16; };
+template <> struct GALGDataType<GInt16> { static const GDALDataType type = GDT_Int16; };
+template <> struct GALGDataType<GUInt32> { static const GDALDataType type = GDT_UInt32; };
+template <> struct GALGDataType<GInt32> { static const GDALDataType type = GDT_Int32; };
+template <> struct GALGDataType<float> { static const GDALDataType type = GDT_Float32; };
+template <> struct GALGDataType<double> { static const GDALDataType type = GDT_Float64; };
+
+/**
+ * \brief A processing function written for a single pixel type.
+ *
+ * Implement processImageT. Bands of type T are processed without any conversion.
+ * Bands of any other type are still supported through the float path: each window is converted to T
+ * (rounding and clamping to the range of T), processed and converted back.
+ */
+template <typename T>
+class IProcessImageT : public IProcessImage {
+
+public:
+    virtual GALGError processImageT(T *inputArray, T *outputArray, int nWindowXSize, int nWindowYSize,
+            double *inNoDataValue, double *outNoDataValue) = 0;
+
+    bool supportsDataType(GDALDataType eDataType) {
+        return eDataType == GALGDataType<T>::type;
+    }
+
+    GALGError processImageNative(void *inputArray, void *outputArray, GDALDataType eDataType,
+            int nWindowXSize, int nWindowYSize, double *inNoDataValue, double *outNoDataValue) {
+        RETURNIF(eDataType != GALGDataType<T>::type, 1, "Data type not supported by processing function");
+        return processImageT((T *)inputArray, (T *)outputArray, nWindowXSize, nWindowYSize,
+                inNoDataValue, outNoDataValue);
+    }
+
+    GALGError processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+            double *inNoDataValue, double *outNoDataValue) {
+        int nPixels = nWindowXSize * nWindowYSize;
+        std::vector<T> input(nPixels), output(nPixels);
+        GDALCopyWords(inputArray, GDT_Float32, sizeof(float), &input[0], GALGDataType<T>::type, sizeof(T), nPixels);
+        GALGError err = processImageT(&input[0], &output[0], nWindowXSize, nWindowYSize, inNoDataValue, outNoDataValue);
+        GDALCopyWords(&output[0], GALGDataType<T>::type, sizeof(T), outputArray, GDT_Float32, sizeof(float), nPixels);
+        return err;
+    }
+};
+
+/**
+ * \brief Layout of the bands of a window passed to IProcessBands.
+ *
+ * GALG_INTERLEAVE_BAND stores each band as a contiguous nWindowXSize * nWindowYSize plane, one after the other.
+ * GALG_INTERLEAVE_PIXEL stores the values of all bands of a pixel next to each other.
+ */
+enum GALGInterleave { GALG_INTERLEAVE_BAND, GALG_INTERLEAVE_PIXEL };
+
+/**
+ * \brief Definition of a multi-band raster processing function.
+ *
+ * Unlike IProcessImage, which is called once per band, an IProcessBands receives every band of a window at once,
+ * which allows per-pixel multi-band algorithms such as NDVI or pansharpening.
+ * The input holds nInputBands * nWindowXSize * nWindowYSize values and the output
+ * nOutputBands * nWindowXSize * nWindowYSize values, both laid out as returned by getInterleave().
+ * The number of output bands may differ from the input, see getOutputBandCount.
+ *
+ * inNoDataValues and outNoDataValues hold one value per input and output band respectively.
+ *
+ * The default implementation copies the input bands to the output.
+ */
+class GALGCORE_DLL IProcessBands {
+
+public:
+    IProcessBands();
+    virtual ~IProcessBands();
+    virtual GALGError processBands(float *inputArray, int nInputBands, float *outputArray, int nOutputBands,
+            int nWindowXSize, int nWindowYSize, double *inNoDataValues, double *outNoDataValues);
+    virtual GALGInterleave getInterleave();
+    virtual int getOutputBandCount(int nInputBands);
+    virtual int getPixelBuffer();
+};
+
+/**
+ * \brief Definition of a raster reduction function.
+ *
+ * An IReduceImage combines the co-registered windows of several input rasters into a single output window,
+ * e.g. a per-pixel maximum, mean or median across a time series.
+ *
+ * Reductions which can be folded one input at a time (isIncremental() returns true) implement initialise, fold and
+ * finalise. Only the current input window and the accumulator are then held in memory, however many inputs there are.
+ * The accumulator holds getAccumulatorCount() planes of nWindowXSize * nWindowYSize floats, e.g. a running sum and a count.
+ *
+ * Other reductions (e.g. median) return false from isIncremental() and implement reduceImage, which receives
+ * one window from every input at once.
+ *
+ * The default implementation is a mosaic: each output pixel takes the first value which is not no data. Its two
+ * accumulator planes hold the value and whether one has been taken, since with inputs of differing no data values a
+ * valid value can equal the output's no data value. Subclasses relying on the default initialise or finalise must keep
+ * that layout.
+ */
+class GALGCORE_DLL IReduceImage {
+
+public:
+    IReduceImage();
+    virtual ~IReduceImage();
+    virtual bool isIncremental();
+    virtual int getAccumulatorCount();
+    virtual GALGError reduceImage(float **inputArrays, int nInputs, float *outputArray, int nWindowXSize, int nWindowYSize,
+            double *inNoDataValues, double *outNoDataValue);
+    virtual GALGError initialise(float *accumulator, int nWindowXSize, int nWindowYSize, double *outNoDataValue);
+    virtual GALGError fold(float *inputArray, float *accumulator, int nWindowXSize, int nWindowYSize,
+            double *inNoDataValue, double *outNoDataValue);
+    virtual GALGError finalise(float *accumulator, float *outputArray, int nWindowXSize, int nWindowYSize, int nInputs,
+            double *outNoDataValue);
 };
 
 class GALGCORE_DLL RasterProcess {
 
 public:
     RasterProcess();
-    ~RasterProcess(){};
+    ~RasterProcess();
+
+    /**
+     * \brief Set the number of worker threads used by map.
+     *
+     * Each worker reads through its own handle on the source dataset and owns its window buffers.
+     * Output tiles are written in the same order as a single-threaded run (see TileSink), so the output is identical.
+     * With more than one thread, the IProcessImage passed to map may be called concurrently and
+     * must not modify shared state in processImage.
+     *
+     * @param nThreads The number of workers. 1 (the default) processes serially, 0 uses one worker per CPU.
+     *
+     * @return a GALGError struct indicating whether the value was accepted.
+     */
+    GALGError setNumThreads(int nThreads);
+
+    /**
+     * \brief Overlap reading, processing and writing of windows.
+     *
+     * When enabled, a reader thread prefetches the next windows and the calling thread writes finished windows
+     * while the processing function runs on the current one (on setNumThreads workers). Window buffers rotate
+     * through a fixed ring of nSlots, so memory use stays bounded. Output is written in the same order as a serial run.
+     *
+     * @param nSlots The number of window buffers in the ring. 0 (the default) disables pipelining; values below 3 are raised to 3.
+     *
+     * @return a GALGError struct indicating whether the value was accepted.
+     */
+    GALGError setPipelineDepth(int nSlots);
+
+    /**
+     * \brief Limit the memory used for window buffers when the window size is chosen automatically.
+     *
+     * When no window size is given, windows are planned from the source's block layout: each window is a whole
+     * number of source tiles or strips, grown until the buffers of all in-flight windows would exceed this budget.
+     * With a pixel buffer, windows still end on block edges and the halo read around them counts towards the budget.
+     *
+     * The same budget again bounds the output tiles of map/mapMany waiting for the rest of their pixels.
+     *
+     * @param budgetBytes The budget in bytes, shared between threads/pipeline slots. Defaults to 256MB.
+     *
+     * @return a GALGError struct indicating whether the value was accepted.
+     */
+    GALGError setMemoryBudget(GIntBig budgetBytes);
+
+    /**
+     * \brief Cache decoded source blocks between the windows of a map/mapMany run.
+     *
+     * With a pixel buffer, neighbouring windows overlap and would otherwise read and decode the shared
+     * blocks again. With the cache enabled, source blocks are decoded once into a least-recently-used
+     * cache of at most budgetBytes (separate from GDAL's own block cache) and halos are copied from memory.
+     * The cache is emptied at the start of each run.
+     *
+     * @param budgetBytes The cache size in bytes. 0 (the default) disables the cache.
+     *
+     * @return a GALGError struct indicating whether the value was accepted.
+     */
+    GALGError setBlockCacheSize(GIntBig budgetBytes);
+
+    /**
+     * \brief The number of block lookups served from the cache during the last run.
+     */
+    GIntBig getBlockCacheHits();
+
+    /**
+     * \brief The number of blocks read and decoded from the source during the last run.
+     */
+    GIntBig getBlockCacheMisses();
+
+    /**
+     * \brief Read uncompressed inputs of map/mapMany through a read-only memory mapping.
+     *
+     * Bands stored uncompressed in the machine's byte order (e.g. uncompressed tiled or striped GeoTIFFs) are mapped
+     * into memory and windows are copied straight from the mapping instead of through RasterIO. Windows that are
+     * exactly one tile, or full-width runs of rows of a striped file, are passed to the processor without any copy, so
+     * processing functions must not write to their input array. Other inputs are read as usual.
+     * The mapping shares the operating system's page cache, so concurrent jobs scanning the same file share its pages.
+     *
+     * @param memoryMapInput True to map inputs where possible. Off by default.
+     */
+    void setMemoryMapInput(bool memoryMapInput);
+
+    /**
+     * \brief The most memory held for window buffers at any one time.
+     *
+     * Window buffers are 64-byte aligned, sized for the largest (halo-expanded) window and kept in a pool owned by
+     * the RasterProcess. They are reused by later windows, bands and runs instead of being freed, so a long-lived
+     * RasterProcess stops allocating once it has seen its largest job.
+     */
+    GIntBig getPeakBufferBytes();
+
+    /**
+     * \brief The number of windows the last map or mapMany processed in place in GDAL's block cache.
+     */
+    GIntBig getInPlaceWindows();
+
+    /**
+     * \brief Free the idle window buffers held by the pool.
+     */
+    void releaseBuffers();
+
+    /**
+     * \brief Collect statistics of the output of map and mapMany in the same pass that writes it.
+     *
+     * statistics gets one RasterStatistics per output band, reset at the start of each run; bands beyond those
+     * already in the vector take the histogram and quantile settings of the first. Only the pixels each window leaves
+     * in the output are counted, so overlapping (pixel buffered) windows count each pixel once, and windows are
+     * merged in window order, so the result does not depend on the number of threads.
+     *
+     * @param statistics The statistics to fill, or NULL (the default) to stop collecting. Must outlive the runs.
+     */
+    void setOutputStatistics(std::vector<RasterStatistics> *statistics);
+
+    /**
+     * \brief Set how output datasets are created: driver, compression, predictor, tiling, BigTIFF and COG output.
+     *
+     * The default writes a tiled GeoTIFF compressed with ZSTD at level 1 (DEFLATE where GDAL lacks ZSTD) with a
+     * predictor suited to the data type, which keeps compression from holding up the writer thread. Cloud optimised
+     * output is written to a temporary GeoTIFF beside the output and copied into place with overviews at the end of
+     * the run. Applies to every function writing a raster.
+     *
+     * @param options The creation options, copied.
+     */
+    void setOutputOptions(const OutputOptions &options);
+    const OutputOptions &getOutputOptions();
+
+    /**
+     * \brief Make map and mapMany resumable after an interruption.
+     *
+     * The windows of the job are recorded in a journal beside the output (its path plus ".journal") once their tiles
+     * have been written and the output flushed, which happens at most every intervalSeconds. If a run is
+     * interrupted, running the same job again (same source, output, windows and options) reopens the partial output
+     * for update and only processes the windows not in the journal. The journal is deleted when a run succeeds.
+     * Output statistics only cover the windows processed by the last run. Not available with MEM output.
+     *
+     * The journal is tied to the source's path, size and band count, the window list and jobKey. A journal left by a
+     * run with any of these different is refused and the job starts afresh. The library cannot see inside the
+     * processors, so callers whose processors take parameters should pass them (and the chain's makeup) as jobKey.
+     *
+     * @param checkpointing True to keep a journal. Off by default.
+     *
+     * @param intervalSeconds The least time between flushes of the output. 0 flushes after every window.
+     *
+     * @param jobKey Identifies the processing, e.g. the processors' names and parameters. NULL is the same as "".
+     *
+     * @return a GALGError struct indicating whether the values were accepted.
+     */
+    GALGError setCheckpointing(bool checkpointing, int intervalSeconds = 60,
+            const char *jobKey = NULL);
 
     /**
      * \brief Apply a raster processing function to each sub-window of a raster.
@@ -67,18 +363,26 @@ public:
      *
      * @param inputPathStr Path to the source raster dataset from which pixel values are read
      *
-     * @param outputPathStr Path to the desired output GeoTiff dataset
+     * @param outputPathStr Path to the desired output dataset
      *
      * @param dataObject Process-specific data. This is passed straight through to the GDALRasterProcessFn on each call.
      *
-     * @param windowXSize The desired width of each read window. If NULL it defaults to the 'natural' block size of the raster
+     * @param windowXSize The desired width of each read window. If NULL, windows are planned from the source's block layout (see setMemoryBudget)
      *
-     * @param windowYSize The desired height of each read window. If NULL it defaults to the 'natural' block size.
+     * @param windowYSize The desired height of each read window. If NULL, it is planned along with windowXSize.
      *
-     * @param nPixelBuffer A pixel buffer to apply to the read window. The read window is expanded by pnPixelBuffer pixels in all directions such that
-     *    each window overlaps by pnPixelBuffer pixels.
+     * @param nPixelBuffer A pixel buffer to apply to the read window. The windows of windowXSize * windowYSize tile the raster and each is read
+     *    expanded by pnPixelBuffer pixels in all directions (within the raster), so neighbouring read windows overlap by twice the buffer.
+     *    Only the window itself, whose pixels all have their whole neighbourhood, is written to the output.
      *
-     * @param skipHoles If true, will skip processing blocks which contain only no data values and create a sparse geotiff. Only available for geotiff inputs
+     * @param skipHoles If true, will skip processing blocks which contain only no data values and create a sparse geotiff. Only available for geotiff inputs.
+     *    Windows lying in blocks missing from a sparse source are not read at all; windows which read back as entirely no data are
+     *    neither processed nor written. Skipped areas of the output read back as the no data value.
+     *
+     * When running single threaded, a window that is exactly one source block in the band's native data type, with no halo
+     * (and the output has the same tiling and data type, as it does for tiled sources) is processed in place: the processor
+     * reads straight from the locked source block and writes straight into the destination block, without copying through
+     * window buffers. getInPlaceWindows counts them.
      *
      * @return a GALGError struct indicating whether the process succeeded.
      */
@@ -91,6 +395,10 @@ public:
      *
      * For each window, the functions defined by the paProcessFn array are called in turn, with the array output of the previous function forming the input
      * to the next function. This allows processing 'toolchains' to be built without having to create intermediate datasets, which can be less efficient in time and space.
+     * Each window is read and written once; the stages ping-pong between two window buffers.
+     * The pixel buffer used is the larger of nPixelBuffer and the sum of IProcessImage::getPixelBuffer over all stages,
+     * as each neighbourhood stage shrinks the valid region left for the next one.
+     * The first stage receives the source no data value; later stages receive the output no data value.
      *
      *
      * @param processFnArray An array of GDALRasterProcessFn to apply to each sub window of the raster
@@ -103,12 +411,13 @@ public:
      *
      * @param dataObjectArray an array of process-specific data objects of size nProcesses. Each data object will be passed to the corresponding GDALRasterProcessFn
      *
-     * @param windowXSize The desired width of each read window. If NULL it defaults to the 'natural' block size of the raster
+     * @param windowXSize The desired width of each read window. If NULL, windows are planned from the source's block layout (see setMemoryBudget)
      *
-     * @param windowYSize The desired height of each read window. If NULL it defaults to the 'natural' block size.
+     * @param windowYSize The desired height of each read window. If NULL, it is planned along with windowXSize.
      *
-     * @param nPixelBuffer A pixel buffer to apply to the read window. The read window is expanded by pnPixelBuffer pixels in all directions such that
-     *    each window overlaps by pnPixelBuffer pixels.
+     * @param nPixelBuffer A pixel buffer to apply to the read window. The windows of windowXSize * windowYSize tile the raster and each is read
+     *    expanded by pnPixelBuffer pixels in all directions (within the raster), so neighbouring read windows overlap by twice the buffer.
+     *    Only the window itself, whose pixels all have their whole neighbourhood, is written to the output.
      *
      *    @param skipHoles If true, will skip processing blocks which contain only no data values and create a sparse geotiff. Only available for geotiff inputs
      *
@@ -118,15 +427,284 @@ public:
             const char *inputPathStr, const char *outputPathStr,
             int *windowXSize, int *windowYSize, int *nPixelBuffer, bool skipHoles);
 
+    /**
+     * \brief map and mapMany on an already open source dataset, optionally keeping the result open.
+     *
+     * mapBands, mapRows and reduce have the same overloads, declared after their path versions.
+     *
+     * Lets short jobs be chained without going through the filesystem: the source can be any open dataset, e.g. a
+     * MEM dataset or the result of a previous job, and the output can go to a /vsimem/ path, or to a MEM dataset
+     * with OutputOptions::setDriver("MEM"). The source is not closed. Further worker threads open their own handles
+     * on the source's path; an in-memory source has none, so its threads share the one handle and read in turn.
+     *
+     * @param srcDataset The source dataset
+     *
+     * @param resultDataset Receives the output dataset, left open for the caller to use and GDALClose, instead of
+     * closing it; NULL (the default) closes it. Set to NULL if the job fails.
+     *
+     * The other parameters are those of map and mapMany.
+     *
+     * @return a GALGError struct indicating whether the process succeeded.
+     */
+    GALGError map(IProcessImage &processor, GDALDataset *srcDataset,
+            const char *outputPathStr, int *windowXSize, int *windowYSize,
+            int *nPixelBuffer, bool skipHoles, GDALDataset **resultDataset = NULL);
+    GALGError mapMany(std::vector<IProcessImage *> &processorArray,
+            GDALDataset *srcDataset, const char *outputPathStr,
+            int *windowXSize, int *windowYSize, int *nPixelBuffer, bool skipHoles,
+            GDALDataset **resultDataset = NULL);
+
+    /**
+     * \brief Apply a multi-band raster processing function to each sub-window of a raster.
+     *
+     * As map, except all bands of each window are read with a single RasterIO call and passed to the processing
+     * function together. The output dataset has IProcessBands::getOutputBandCount bands.
+     *
+     * @param processor An IProcessBands to apply to each sub window of the raster.
+     *
+     * @param inputPathStr Path to the source raster dataset from which pixel values are read
+     *
+     * @param outputPathStr Path to the desired output dataset
+     *
+     * @param windowXSize The desired width of each read window. If NULL, windows are planned from the source's block layout (see setMemoryBudget)
+     *
+     * @param windowYSize The desired height of each read window. If NULL, it is planned along with windowXSize.
+     *
+     * @param nPixelBuffer A pixel buffer to apply to the read window. The larger of this and IProcessBands::getPixelBuffer is used.
+     *
+     * @param skipHoles If true, create a sparse geotiff.
+     *
+     * @return a GALGError struct indicating whether the process succeeded.
+     */
+    GALGError mapBands(IProcessBands &processor, const char *inputPathStr,
+            const char *outputPathStr, int *windowXSize,
+            int *windowYSize, int *nPixelBuffer, bool skipHoles);
+
+    /**
+     * \brief mapBands on an already open source dataset; see the map overload taking a GDALDataset.
+     */
+    GALGError mapBands(IProcessBands &processor, GDALDataset *srcDataset,
+            const char *outputPathStr, int *windowXSize,
+            int *windowYSize, int *nPixelBuffer, bool skipHoles,
+            GDALDataset **resultDataset = NULL);
+
+    /**
+     * \brief Stream a neighbourhood operation over a raster in full-width strips.
+     *
+     * Suited to focal operations (convolution, slope...) on very wide rasters. Rather than reading square windows whose halos
+     * overlap in both directions, the raster is read top to bottom and a rolling view of stripHeight + 2 * nPixelBuffer rows
+     * is kept: each source row is read exactly once. The processing function is called on the whole view
+     * (nX = raster width) and only the central strip rows of its output are written. Peak memory is proportional to
+     * width * (stripHeight + 2 * nPixelBuffer), regardless of the raster height. Bands are processed in turn.
+     *
+     * @param processor An IProcessImage to apply to each view.
+     *
+     * @param inputPathStr Path to the source raster dataset from which pixel values are read
+     *
+     * @param outputPathStr Path to the desired output dataset
+     *
+     * @param stripHeight The number of output rows per call. If NULL, the source's block height is used.
+     *
+     * @param nPixelBuffer The number of rows above and below each strip. The larger of this and IProcessImage::getPixelBuffer is used.
+     *
+     * @return a GALGError struct indicating whether the process succeeded.
+     */
+    GALGError mapRows(IProcessImage &processor, const char *inputPathStr,
+            const char *outputPathStr, int *stripHeight, int *nPixelBuffer);
+
+    /**
+     * \brief mapRows on an already open source dataset; see the map overload taking a GDALDataset.
+     */
+    GALGError mapRows(IProcessImage &processor, GDALDataset *srcDataset,
+            const char *outputPathStr, int *stripHeight, int *nPixelBuffer,
+            GDALDataset **resultDataset = NULL);
+
     /**
      * \brief Apply a raster processing 'reduction' function to each sub-window of multiple raster datasets.
      *
-     * TODO: Complete
+     * The inputs must share the same size and band count. They are streamed window by window: for each window
+     * (and band) the co-registered window of every input is read and reduced to one output window, so a full
+     * scene is never held in memory. The output takes its georeferencing, data type and no data values from the first input.
+     *
+     * @param reducer An IReduceImage to apply to each sub window of the inputs.
+     *
+     * @param inputPathStrArray A NULL terminated array of paths to the source raster datasets.
+     *
+     * @param outputPathStr Path to the desired output dataset
+     *
+     * @param windowXSize The desired width of each read window. If NULL, windows are planned from the source's block layout (see setMemoryBudget)
+     *
+     * @param windowYSize The desired height of each read window. If NULL, it is planned along with windowXSize.
+     *
+     * @param nPixelBuffer A pixel buffer to apply to the read window.
+     *
+     * @param skipHoles If true, create a sparse geotiff.
+     *
+     * @return a GALGError struct indicating whether the process succeeded.
      */
-    GALGError reduce(IProcessImage &processor, const char **inputPathStrArray,
+    GALGError reduce(IReduceImage &reducer, const char **inputPathStrArray,
             const char *outputPathStr, int *windowXSize,
             int *windowYSize, int *nPixelBuffer, bool skipHoles);
 
+    /**
+     * \brief reduce on already open source datasets; see the map overload taking a GDALDataset.
+     *
+     * @param srcDatasetArray A NULL terminated array of source datasets, which are not closed.
+     */
+    GALGError reduce(IReduceImage &reducer, GDALDataset **srcDatasetArray,
+            const char *outputPathStr, int *windowXSize,
+            int *windowYSize, int *nPixelBuffer, bool skipHoles,
+            GDALDataset **resultDataset = NULL);
+
+    /**
+     * \brief Label the connected components of the first band of a raster, however large.
+     *
+     * Foreground pixels are those which are neither no data nor zero. With matchValues only neighbouring pixels of
+     * equal value connect, so each region of a classified raster is a component. Each component gets a label from 1 up,
+     * numbered in the order of the first window it appears in; background pixels are 0, which is also the output's
+     * no data value. The output is UInt32.
+     *
+     * Works in two passes over the windows, each of which may use several threads (see setNumThreads). The first labels
+     * each window on its own and joins labels where components cross window edges; the second labels each window
+     * again and writes the final labels. Besides the window buffers, memory holds one row of pixels of the raster plus
+     * the labels of components which touch a window edge, never the whole label raster.
+     *
+     * @param inputPathStr Path to the source raster dataset
+     *
+     * @param outputPathStr Path to the desired output dataset
+     *
+     * @param windowXSize The desired width of each window. If NULL, windows are planned from the source's block layout (see setMemoryBudget)
+     *
+     * @param windowYSize The desired height of each window. If NULL, it is planned along with windowXSize.
+     *
+     * @param connectivity 4 or 8
+     *
+     * @param matchValues If true, label regions of equal value rather than non-zero regions.
+     *
+     * @param nComponents If not NULL, receives the number of components.
+     *
+     * @return a GALGError struct indicating whether the process succeeded.
+     */
+    GALGError labelComponents(const char *inputPathStr, const char *outputPathStr,
+            int *windowXSize, int *windowYSize, int connectivity, bool matchValues,
+            GIntBig *nComponents);
+
+    /**
+     * \brief Statistics of one band of a raster, without writing anything.
+     *
+     * Windows are read (in parallel, see setNumThreads) and accumulated separately, then merged in window order.
+     * Memory holds the window buffers and the statistics, whose size does not depend on the raster's: see
+     * RasterStatistics for the histogram and quantile settings, which are kept. The band's no data value is used.
+     *
+     * @param inputPathStr Path to the source raster dataset
+     *
+     * @param band The band, from 1
+     *
+     * @param statistics Receives the statistics. Its previous values are reset.
+     *
+     * @param windowXSize The desired width of each window. If NULL, windows are planned from the source's block layout (see setMemoryBudget)
+     *
+     * @param windowYSize The desired height of each window. If NULL, it is planned along with windowXSize.
+     *
+     * @return a GALGError struct indicating whether the process succeeded.
+     */
+    GALGError computeStatistics(const char *inputPathStr, int band,
+            RasterStatistics &statistics, int *windowXSize, int *windowYSize);
+
+    /**
+     * \brief Statistics of the first band of a value raster within each zone of a co-registered zone raster.
+     *
+     * Both rasters are read window by window (in parallel, see setNumThreads). Each thread aggregates its windows into
+     * its own hash table of zones and the tables are merged at the end, so memory holds the window buffers and one
+     * entry per zone per thread (compute threads when pipelined, not slots), however large the rasters. Pixels which are no data or NaN in either raster are left
+     * out. Zone ids are whole numbers; any fraction is dropped.
+     * Sums and means are summed in a different order with different numbers of threads, so they can differ in their
+     * last digits.
+     *
+     * @param valuePathStr Path to the raster of values
+     *
+     * @param zonePathStr Path to the raster of zone ids. It must have the same size as the value raster.
+     *
+     * @param tablePathStr Path to a CSV table to write (see galgWriteZoneTable), or NULL.
+     *
+     * @param zones If not NULL, receives the statistics of each zone, in zone order.
+     *
+     * @param windowXSize The desired width of each window. If NULL, windows are planned from the value raster's block layout (see setMemoryBudget)
+     *
+     * @param windowYSize The desired height of each window. If NULL, it is planned along with windowXSize.
+     *
+     * @return a GALGError struct indicating whether the process succeeded.
+     */
+    GALGError zonalStatistics(const char *valuePathStr, const char *zonePathStr,
+            const char *tablePathStr, std::vector<GALGZoneStats> *zones,
+            int *windowXSize, int *windowYSize);
+
+    /**
+     * \brief Fill the depressions of a DEM and route flow over it, however large.
+     *
+     * Every depression is filled to the level at which it spills, so that water from every cell reaches the edge of
+     * the raster or a no data cell. Each cell is given the D8 direction of its steepest path down to there, with
+     * flats drained towards their outlet. Directions are coded 1 (east), 2 (south east), 4, 8, 16, 32, 64 and 128
+     * (north east) and 0 for no data, which is the output's no data value.
+     *
+     * Tiles are flooded one at a time (in parallel, see setNumThreads) from their edges; only the levels at which
+     * neighbouring regions spill into each other are kept in memory, and solved for the level of each region once
+     * every tile has been seen (Barnes et al., 2016). A second pass over the tiles writes the outputs.
+     *
+     * @param inputPathStr Path to the source DEM
+     *
+     * @param filledPathStr Path to the desired filled DEM, or NULL. Has the source's data type.
+     *
+     * @param directionPathStr Path to the desired Byte raster of flow directions, or NULL.
+     *
+     * @param windowXSize The desired width of each tile. If NULL, tiles are planned from the source's block layout (see setMemoryBudget)
+     *
+     * @param windowYSize The desired height of each tile. If NULL, it is planned along with windowXSize.
+     *
+     * @return a GALGError struct indicating whether the process succeeded.
+     */
+    GALGError routeFlow(const char *inputPathStr, const char *filledPathStr,
+            const char *directionPathStr, int *windowXSize, int *windowYSize);
+
+    /**
+     * \brief Flow accumulation from a raster of D8 flow directions (as written by routeFlow).
+     *
+     * Each cell receives the number of cells that drain through it, itself included; no data cells are 0, which is
+     * also the output's no data value. The output is Float64.
+     *
+     * Works in two passes over the tiles. The first accumulates flow within each tile and keeps only where the flow
+     * of each edge cell leaves the tile; these are solved for the flow entering each tile, which the second pass adds
+     * in as it accumulates each tile again.
+     *
+     * @param directionPathStr Path to the flow direction raster
+     *
+     * @param outputPathStr Path to the desired output dataset
+     *
+     * @param windowXSize The desired width of each tile. If NULL, tiles are planned from the source's block layout (see setMemoryBudget)
+     *
+     * @param windowYSize The desired height of each tile. If NULL, it is planned along with windowXSize.
+     *
+     * @return a GALGError struct indicating whether the process succeeded. Fails if the directions form a cycle.
+     */
+    GALGError accumulateFlow(const char *directionPathStr, const char *outputPathStr,
+            int *windowXSize, int *windowYSize);
+
+private:
+    GIntBig windowBudget();
+    OutputOptions writeOptions();
+    RasterProcess(const RasterProcess &);
+    RasterProcess &operator=(const RasterProcess &);
+    WindowEngine *engine;
+    BlockCache *blockCache;
+    BufferPool *bufferPool;
+    GIntBig memoryBudget;
+    bool memoryMapInput;
+    std::vector<RasterStatistics> *outputStatistics;
+    OutputOptions outputOptions;
+    bool checkpointing;
+    int checkpointInterval;
+    std::string checkpointKey;
+    GIntBig nInPlaceWindows;
 };
 
 #endif /* GALG_H_ */
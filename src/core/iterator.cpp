@@ -1,5 +1,6 @@
 #include "iterator.h"
 #include <iostream>
+#include <algorithm>
 #include "cpl_conv.h"
 
 /*****************
@@ -52,10 +53,10 @@ bool BlockIterator::next(int *xSize, int *ySize, int *xOff, int *yOff) {
 	} else {
 		this->nextXOff();
 	}
-	if (this->xOff >= this->rasterXSize - 1) {
+	if (this->xOff >= this->rasterXSize) {
 		this->xOff = 0;
 		this->nextYOff();
-		if (this->yOff >= this->rasterYSize - 1) {
+		if (this->yOff >= this->rasterYSize) {
 			// Return FALSE to indicate we have reached the end
 			return false;
 		}
@@ -89,74 +90,211 @@ BufferedIterator::BufferedIterator(GDALDataset *dataset, int bufferSize) :
 }
 
 bool BufferedIterator::next(int *xSize, int *ySize, int *xOff, int *yOff) {
+	// Visit the same blocks as the block iterator, each widened by the
+	// buffer on every side where the raster allows
+	if (!BlockIterator::next(xSize, ySize, xOff, yOff)) {
+		return false;
+	}
+	int xEnd = std::min(*xOff + *xSize + this->bufferSize, this->rasterXSize);
+	int yEnd = std::min(*yOff + *ySize + this->bufferSize, this->rasterYSize);
+	*xOff = std::max(*xOff - this->bufferSize, 0);
+	*yOff = std::max(*yOff - this->bufferSize, 0);
+	*xSize = xEnd - *xOff;
+	*ySize = yEnd - *yOff;
+	return true;
+}
 
-	// Calculate the x and y offsets for this window
-	if (this->xOff < 0) {
-		this->xOff = 0;
+GALGError BufferedIterator::setBufferSize(int bufferSize) {
+	GALGError err = { 0, NULL };
+	if (bufferSize >= (this->rasterXSize + this->blockWidth)
+			|| bufferSize >= (this->rasterYSize + this->blockHeight)) {
+
+		err.msg = "Requested buffer size is greater than the raster size";
+		err.errnum = 1;
 	} else {
-		this->nextXOff();
-	}
-	if ((this->xOff + this->bufferSize) >= this->rasterXSize) {
-		this->xOff = 0;
-		this->nextYOff();
-		if ((this->yOff + this->bufferSize) >= this->rasterYSize) {
-			// Return FALSE to indicate we have reached the end
-			return false;
-		}
+		this->bufferSize = bufferSize;
 	}
-	*xOff = this->xOff;
-	*yOff = this->yOff;
+	return err;
+}
 
-	// Calculate the x and y window size for this window
-	this->calcBlockSize(xSize, ySize);
-	this->getActualBlockSize(xSize, ySize);
-	return true;
+/*****************
+ * ROW ITERATOR
+ *****************/
+
+RowIterator::RowIterator(GDALDataset *dataset, int bufferSize) {
+	this->rasterYSize = dataset->GetRasterYSize();
+	this->bufferSize = std::max(bufferSize, 0);
+	this->stripHeight = 1;
+	this->stripYOff = 0;
+	this->viewYEnd = 0;
 }
 
-void BufferedIterator::nextXOff() {
-	// We subtract the desired buffer size from the blockwidth
-	// in order to read an overlapping buffer - we will
-	// add the buffer size on to the block size to get the total number of pixels to read
-	if (this->xOff == 0) {
-		this->xOff += this->blockWidth;
+GALGError RowIterator::setStripHeight(int stripHeight) {
+	GALGError err = { 0, NULL };
+	if (stripHeight < 1 || stripHeight > this->rasterYSize) {
+		err.errnum = 1;
+		err.msg = "Strip height must be between 1 and the raster height";
 	} else {
-		this->xOff += this->blockWidth + this->bufferSize;
+		this->stripHeight = stripHeight;
 	}
+	return err;
 }
 
-void BufferedIterator::nextYOff() {
-	if (this->yOff == 0) {
-		this->yOff += this->blockHeight;
-	} else {
-		this->yOff += this->blockHeight + this->bufferSize;
+int RowIterator::getMaxViewHeight() {
+	return std::min(this->stripHeight + 2 * this->bufferSize,
+			this->rasterYSize);
+}
+
+bool RowIterator::next(int *stripYOff, int *stripYSize, int *viewYOff,
+		int *viewYSize, int *readYOff, int *readYSize) {
+	if (this->stripYOff >= this->rasterYSize) {
+		return false;
 	}
+	*stripYOff = this->stripYOff;
+	*stripYSize = std::min(this->stripHeight,
+			this->rasterYSize - this->stripYOff);
+	*viewYOff = std::max(0, this->stripYOff - this->bufferSize);
+	int viewYEnd = std::min(this->rasterYSize,
+			this->stripYOff + *stripYSize + this->bufferSize);
+	*viewYSize = viewYEnd - *viewYOff;
+
+	// Rows up to the end of the previous view are already held
+	*readYOff = std::max(*viewYOff, this->viewYEnd);
+	*readYSize = viewYEnd - *readYOff;
+
+	this->viewYEnd = viewYEnd;
+	this->stripYOff += *stripYSize;
+	return true;
 }
 
-void BufferedIterator::calcBlockSize(int *xSize, int *ySize) {
-	if (this->xOff == 0) {
-		*xSize = this->blockWidth + this->bufferSize;
+/*****************
+ * WINDOW PLANNER
+ *****************/
+
+WindowPlanner::WindowPlanner(GDALDataset *dataset) {
+	GDALRasterBand *band;
+	band = dataset->GetRasterBand(1);
+	band->GetBlockSize(&blockWidth, &blockHeight);
+	rasterXSize = dataset->GetRasterXSize();
+	rasterYSize = dataset->GetRasterYSize();
+	bufferSize = 0;
+	bytesPerPixel = 2 * sizeof(float);
+	budgetBytes = 64 * 1024 * 1024;
+
+	const char *compression = dataset->GetMetadataItem("COMPRESSION",
+			"IMAGE_STRUCTURE");
+	compressed = compression != NULL && !EQUAL(compression, "NONE");
+}
+
+GALGError WindowPlanner::setMemoryBudget(GIntBig budgetBytes) {
+	GALGError err = { 0, NULL };
+	if (budgetBytes <= 0) {
+		err.errnum = 1;
+		err.msg = "Memory budget must be positive";
 	} else {
-		*xSize = this->blockWidth + 2 * this->bufferSize;
+		this->budgetBytes = budgetBytes;
 	}
+	return err;
+}
 
-	if (this->yOff == 0) {
-		*ySize = this->blockHeight + this->bufferSize;
+GALGError WindowPlanner::setBytesPerPixel(int bytesPerPixel) {
+	GALGError err = { 0, NULL };
+	if (bytesPerPixel <= 0) {
+		err.errnum = 1;
+		err.msg = "Bytes per pixel must be positive";
 	} else {
-		*ySize = this->blockHeight + 2 * this->bufferSize;
+		this->bytesPerPixel = bytesPerPixel;
 	}
-
+	return err;
 }
 
-GALGError BufferedIterator::setBufferSize(int bufferSize) {
+GALGError WindowPlanner::setBufferSize(int bufferSize) {
 	GALGError err = { 0, NULL };
-	if (bufferSize >= (this->rasterXSize + this->blockWidth)
-			|| bufferSize >= (this->rasterYSize + this->blockHeight)) {
-
-		err.msg = "Requested buffer size is greater than the raster size";
+	if (bufferSize < 0) {
 		err.errnum = 1;
+		err.msg = "Buffer size must not be negative";
 	} else {
 		this->bufferSize = bufferSize;
 	}
 	return err;
 }
 
+bool WindowPlanner::isCompressed() {
+	return this->compressed;
+}
+
+void WindowPlanner::windowSize(int nXBlocks, int nYBlocks, int *xSize,
+		int *ySize) {
+	// Windows are whole blocks; their halo is read on top, from the
+	// neighbouring blocks
+	*xSize = std::min(nXBlocks * this->blockWidth, this->rasterXSize);
+	*ySize = std::min(nYBlocks * this->blockHeight, this->rasterYSize);
+}
+
+bool WindowPlanner::fitsBudget(int xSize, int ySize) {
+	// Budget the full read window, including the buffer on both sides
+	GIntBig nPixels = (GIntBig) (xSize + 2 * this->bufferSize)
+			* (ySize + 2 * this->bufferSize);
+	return nPixels * this->bytesPerPixel <= this->budgetBytes;
+}
+
+void WindowPlanner::plan(int *windowXSize, int *windowYSize) {
+	int nXBlocksTotal = (this->rasterXSize + this->blockWidth - 1)
+			/ this->blockWidth;
+	int nYBlocksTotal = (this->rasterYSize + this->blockHeight - 1)
+			/ this->blockHeight;
+	int nXBlocks = 1, nYBlocks = 1;
+	int xSize, ySize;
+
+	// Grow the window a whole block at a time, widening the shorter side
+	// first to keep windows square-ish (strips can only grow downwards)
+	// until the budget is reached
+	bool grown = true;
+	while (grown) {
+		grown = false;
+		this->windowSize(nXBlocks, nYBlocks, &xSize, &ySize);
+		bool growX = nXBlocks < nXBlocksTotal;
+		bool growY = nYBlocks < nYBlocksTotal;
+		if (growX && growY) {
+			growY = ySize < xSize;
+			growX = !growY;
+		}
+		for (int attempt = 0; attempt < 2 && !grown; ++attempt) {
+			int candidateX, candidateY;
+			if (growX) {
+				this->windowSize(nXBlocks + 1, nYBlocks, &candidateX,
+						&candidateY);
+				if (this->fitsBudget(candidateX, candidateY)) {
+					nXBlocks++;
+					grown = true;
+				}
+			} else if (growY) {
+				this->windowSize(nXBlocks, nYBlocks + 1, &candidateX,
+						&candidateY);
+				if (this->fitsBudget(candidateX, candidateY)) {
+					nYBlocks++;
+					grown = true;
+				}
+			}
+			// Try the other direction if the preferred one does not fit
+			bool otherX = !growX && nXBlocks < nXBlocksTotal;
+			bool otherY = !growY && nYBlocks < nYBlocksTotal;
+			growX = otherX;
+			growY = otherY;
+		}
+	}
+	this->windowSize(nXBlocks, nYBlocks, &xSize, &ySize);
+
+	// A single block may already exceed the budget. A compressed block is
+	// decoded as a whole anyway, so keep it; an uncompressed one can be
+	// read in parts without penalty, so split it by rows
+	if (!this->compressed && !this->fitsBudget(xSize, ySize)) {
+		GIntBig nBudgetRows = this->budgetBytes
+				/ ((GIntBig) this->bytesPerPixel * (xSize + 2 * this->bufferSize))
+				- 2 * this->bufferSize;
+		ySize = (int) std::max((GIntBig) 1,
+				std::min(nBudgetRows, (GIntBig) ySize));
+	}
+	*windowXSize = xSize;
+	*windowYSize = ySize;
+}
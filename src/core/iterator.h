@@ -40,8 +40,10 @@ protected:
 
 /*
  * Iterates over the pixels of a raster band in buffered blocks.
- * Same as ``BlockIterator`` except each block overlaps the previous
- * by ``N`` pixels. ``N`` is the buffer size set by calling ``setBufferSize``
+ * Same as ``BlockIterator`` except each block is widened by ``N`` pixels
+ * on every side (within the raster), so neighbouring blocks overlap by
+ * ``2N`` pixels and every pixel of the block itself has ``N`` pixels of
+ * neighbours. ``N`` is the buffer size set by calling ``setBufferSize``
  */
 class GALGCORE_DLL BufferedIterator: public BlockIterator {
 
@@ -50,15 +52,67 @@ public:
 	GALGError setBufferSize(int bufferSize);
 	bool next(int *xSize, int *ySize, int *xOff, int *yOff);
 
-protected:
-	void calcBlockSize(int *xSize, int *ySize);
-	void nextXOff();
-	void nextYOff();
-
 private:
 	int bufferSize;
 
 };
 
+/*
+ * Streams a raster in full-width strips for neighbourhood operations.
+ * Each call to ``next`` returns a strip of ``stripHeight`` output rows,
+ * the view of source rows a processor needs for it (the strip plus up to
+ * ``bufferSize`` rows either side) and the rows of that view which were
+ * not part of the previous view. Reading only those rows, and keeping the
+ * rest, reads each source row exactly once.
+ */
+class GALGCORE_DLL RowIterator {
+
+public:
+	RowIterator(GDALDataset *dataset, int bufferSize);
+	virtual ~RowIterator() {};
+	GALGError setStripHeight(int stripHeight);
+	bool next(int *stripYOff, int *stripYSize, int *viewYOff, int *viewYSize,
+			int *readYOff, int *readYSize);
+	/*
+	 * The largest view returned by ``next``
+	 */
+	int getMaxViewHeight();
+
+protected:
+	int stripHeight, bufferSize, rasterYSize;
+	int stripYOff, viewYEnd;
+};
+
+/*
+ * Chooses a window size for iterating a dataset.
+ * Windows are whole multiples of the source's natural block (tile or strip)
+ * and as large as possible within a memory budget, so that each compressed
+ * block is decoded once. With a pixel buffer, windows still end on block
+ * edges: the halo read around each one reaches into the neighbouring blocks
+ * and is counted in the budget.
+ */
+class GALGCORE_DLL WindowPlanner {
+
+public:
+	WindowPlanner(GDALDataset *dataset);
+	virtual ~WindowPlanner() {};
+	GALGError setMemoryBudget(GIntBig budgetBytes);
+	GALGError setBytesPerPixel(int bytesPerPixel);
+	GALGError setBufferSize(int bufferSize);
+	bool isCompressed();
+	virtual void plan(int *windowXSize, int *windowYSize);
+
+protected:
+	/*
+	 * The window size covering the given number of blocks in each direction
+	 */
+	virtual void windowSize(int nXBlocks, int nYBlocks, int *xSize, int *ySize);
+	virtual bool fitsBudget(int xSize, int ySize);
+	int blockWidth, blockHeight, rasterXSize, rasterYSize;
+	int bufferSize, bytesPerPixel;
+	GIntBig budgetBytes;
+	bool compressed;
+};
+
 #endif // ITERATOR_H_
 
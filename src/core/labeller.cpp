@@ -0,0 +1,183 @@
+#include "labeller.h"
+#include "cpl_port.h"
+
+/*****************
+ * WINDOW LABELLER
+ *****************/
+
+WindowLabeller::WindowLabeller() {
+	this->connectivity = 8;
+	this->matchValues = false;
+	this->hasNoData = false;
+	this->noDataValue = 0;
+}
+
+GALGError WindowLabeller::setConnectivity(int connectivity) {
+	GALGError err = { 0, NULL };
+	RETURNIF(connectivity != 4 && connectivity != 8, 1,
+			"Connectivity must be 4 or 8");
+	this->connectivity = connectivity;
+	return err;
+}
+
+int WindowLabeller::getConnectivity() const {
+	return this->connectivity;
+}
+
+void WindowLabeller::setMatchValues(bool matchValues) {
+	this->matchValues = matchValues;
+}
+
+void WindowLabeller::setNoData(bool hasNoData, float noDataValue) {
+	this->hasNoData = hasNoData;
+	this->noDataValue = noDataValue;
+}
+
+bool WindowLabeller::isForeground(float value) const {
+	if (CPLIsNan(value)) {
+		return false;
+	}
+	if (this->hasNoData && value == this->noDataValue) {
+		return false;
+	}
+	return value != 0;
+}
+
+bool WindowLabeller::connects(float a, float b) const {
+	return this->isForeground(a) && this->isForeground(b)
+			&& (!this->matchValues || a == b);
+}
+
+static GUInt32 findRoot(std::vector<GUInt32> &parent, GUInt32 label) {
+	GUInt32 root = label;
+	while (parent[root] != root) {
+		root = parent[root];
+	}
+	while (parent[label] != root) {
+		GUInt32 next = parent[label];
+		parent[label] = root;
+		label = next;
+	}
+	return root;
+}
+
+GUInt32 WindowLabeller::label(const float *values, int xSize, int ySize,
+		GUInt32 *labels) {
+	// First pass: provisional labels in raster order, joined on contact.
+	// Sets are represented by their smallest label.
+	this->parent.assign(1, 0);
+	for (int y = 0; y < ySize; ++y) {
+		for (int x = 0; x < xSize; ++x) {
+			size_t i = (size_t) y * xSize + x;
+			float value = values[i];
+			labels[i] = 0;
+			if (!this->isForeground(value)) {
+				continue;
+			}
+			// Already visited neighbours: W, and N (NW, N, NE with 8-connectivity)
+			int nNeighbours = 0;
+			GUInt32 neighbours[4];
+			if (x > 0 && labels[i - 1] != 0
+					&& this->connects(values[i - 1], value)) {
+				neighbours[nNeighbours++] = labels[i - 1];
+			}
+			if (y > 0) {
+				int dxMin = this->connectivity == 8 ? -1 : 0;
+				int dxMax = this->connectivity == 8 ? 1 : 0;
+				for (int dx = dxMin; dx <= dxMax; ++dx) {
+					if (x + dx < 0 || x + dx >= xSize) {
+						continue;
+					}
+					size_t j = i - xSize + dx;
+					if (labels[j] != 0 && this->connects(values[j], value)) {
+						neighbours[nNeighbours++] = labels[j];
+					}
+				}
+			}
+			if (nNeighbours == 0) {
+				GUInt32 newLabel = (GUInt32) this->parent.size();
+				this->parent.push_back(newLabel);
+				labels[i] = newLabel;
+				continue;
+			}
+			GUInt32 root = findRoot(this->parent, neighbours[0]);
+			for (int n = 1; n < nNeighbours; ++n) {
+				GUInt32 other = findRoot(this->parent, neighbours[n]);
+				if (other < root) {
+					this->parent[root] = other;
+					root = other;
+				} else if (other > root) {
+					this->parent[other] = root;
+				}
+			}
+			labels[i] = root;
+		}
+	}
+
+	// Number the sets 1..n in order of their smallest label, which is the
+	// order of their first pixel. A parent is never larger than its child,
+	// so visiting labels in order finds each parent already pointing at its root.
+	this->finalLabels.assign(this->parent.size(), 0);
+	GUInt32 nLabels = 0;
+	for (size_t l = 1; l < this->parent.size(); ++l) {
+		GUInt32 root = this->parent[this->parent[l]];
+		this->parent[l] = root;
+		this->finalLabels[l] = root == l ? ++nLabels : this->finalLabels[root];
+	}
+	size_t nPixels = (size_t) xSize * ySize;
+	for (size_t i = 0; i < nPixels; ++i) {
+		labels[i] = this->finalLabels[labels[i]];
+	}
+	return nLabels;
+}
+
+/*****************
+ * LABEL FOREST
+ *****************/
+
+GIntBig LabelForest::find(GIntBig label) {
+	std::map<GIntBig, GIntBig>::iterator it = this->parent.find(label);
+	if (it == this->parent.end()) {
+		this->parent[label] = label;
+		return label;
+	}
+	GIntBig root = it->second;
+	while (root != label) {
+		label = root;
+		root = this->parent[label];
+	}
+	it->second = root;
+	return root;
+}
+
+void LabelForest::join(GIntBig a, GIntBig b) {
+	GIntBig rootA = this->find(a);
+	GIntBig rootB = this->find(b);
+	if (rootA < rootB) {
+		this->parent[rootB] = rootA;
+	} else if (rootB < rootA) {
+		this->parent[rootA] = rootB;
+	}
+}
+
+void LabelForest::flatten() {
+	// A root is smaller than its members, so visiting labels in order
+	// finds every parent already pointing at its root
+	for (std::map<GIntBig, GIntBig>::iterator it = this->parent.begin();
+			it != this->parent.end(); ++it) {
+		it->second = this->parent[it->second];
+	}
+}
+
+GIntBig LabelForest::getRoot(GIntBig label) const {
+	std::map<GIntBig, GIntBig>::const_iterator it = this->parent.find(label);
+	return it == this->parent.end() ? label : it->second;
+}
+
+const std::map<GIntBig, GIntBig> &LabelForest::getLabels() const {
+	return this->parent;
+}
+
+void LabelForest::clear() {
+	this->parent.clear();
+}
@@ -0,0 +1,78 @@
+/*
+ * LABELLER API
+ *
+ * Connected-component labelling of a single window, and the union-find
+ * which joins the labels of components that cross window edges.
+ */
+#ifndef LABELLER_H_
+#define LABELLER_H_
+
+#include <map>
+#include <vector>
+#include "gdal_priv.h"
+
+#include "core_exp.h"
+#include "common.h"
+
+/*
+ * \brief Labels the connected components of one window.
+ *
+ * Foreground pixels are those which are neither no data nor zero. Two
+ * neighbouring foreground pixels are connected when values are not matched,
+ * or when they have the same value.
+ * The labelling only depends on the window's pixels, so a window labelled
+ * twice gets the same labels.
+ */
+class GALGCORE_DLL WindowLabeller {
+
+public:
+	WindowLabeller();
+	virtual ~WindowLabeller() {};
+	GALGError setConnectivity(int connectivity);
+	int getConnectivity() const;
+	void setMatchValues(bool matchValues);
+	void setNoData(bool hasNoData, float noDataValue);
+	bool isForeground(float value) const;
+	bool connects(float a, float b) const;
+
+	/*
+	 * Label the components of a window 1..n, in raster order of their first
+	 * pixel; background pixels are labelled 0. Returns n.
+	 */
+	GUInt32 label(const float *values, int xSize, int ySize, GUInt32 *labels);
+
+protected:
+	int connectivity;
+	bool matchValues;
+	bool hasNoData;
+	float noDataValue;
+	std::vector<GUInt32> parent, finalLabels;
+};
+
+/*
+ * \brief Union-find over labels which touch a window edge.
+ *
+ * Each set is represented by its smallest label, so the result does not
+ * depend on the order in which sets are joined. Labels never joined are
+ * not stored: they are their own root.
+ */
+class GALGCORE_DLL LabelForest {
+
+public:
+	void join(GIntBig a, GIntBig b);
+	GIntBig find(GIntBig label);
+
+	/*
+	 * Point every label straight at its root. After this, getRoot may be
+	 * called concurrently as long as join is not.
+	 */
+	void flatten();
+	GIntBig getRoot(GIntBig label) const;
+	const std::map<GIntBig, GIntBig> &getLabels() const;
+	void clear();
+
+protected:
+	std::map<GIntBig, GIntBig> parent;
+};
+
+#endif // LABELLER_H_
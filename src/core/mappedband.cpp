@@ -0,0 +1,224 @@
+#include <algorithm>
+#include "mappedband.h"
+#include "cpl_conv.h"
+#include "cpl_string.h"
+#include "cpl_vsi.h"
+
+/*****************
+ * MAPPED BAND
+ *****************/
+
+MappedBand::MappedBand() {
+	this->mem = NULL;
+	this->fp = NULL;
+	this->base = NULL;
+	this->eDataType = GDT_Unknown;
+	this->nPixelBytes = 0;
+	this->rasterXSize = 0;
+	this->rasterYSize = 0;
+	this->blockXSize = 0;
+	this->blockYSize = 0;
+	this->nXBlocks = 0;
+	this->lineSpace = 0;
+}
+
+MappedBand::~MappedBand() {
+	this->close();
+}
+
+void MappedBand::close() {
+	if (this->mem != NULL) {
+		CPLVirtualMemFree(this->mem);
+		this->mem = NULL;
+	}
+	if (this->fp != NULL) {
+		VSIFCloseL(this->fp);
+		this->fp = NULL;
+	}
+	this->base = NULL;
+	this->lineSpace = 0;
+	this->blockOffsets.clear();
+}
+
+bool MappedBand::isOpen() {
+	return this->base != NULL;
+}
+
+bool MappedBand::open(const char *pathStr, GDALRasterBand *band) {
+	this->close();
+	GDALDataset *dataset = band->GetDataset();
+
+	// Only plain, whole-byte samples can be used as they are stored
+	const char *compression = dataset->GetMetadataItem("COMPRESSION",
+			"IMAGE_STRUCTURE");
+	if ((compression != NULL && !EQUAL(compression, "NONE"))
+			|| band->GetMetadataItem("NBITS", "IMAGE_STRUCTURE") != NULL) {
+		return false;
+	}
+	this->eDataType = band->GetRasterDataType();
+	this->nPixelBytes = GDALGetDataTypeSize(this->eDataType) / 8;
+	this->rasterXSize = band->GetXSize();
+	this->rasterYSize = band->GetYSize();
+	band->GetBlockSize(&this->blockXSize, &this->blockYSize);
+	this->nXBlocks = (this->rasterXSize + this->blockXSize - 1)
+			/ this->blockXSize;
+
+	return this->openVirtualMem(band) || this->openFileMap(pathStr, band);
+}
+
+/*
+ * Ask the driver for a mapping of the band. Without the default
+ * implementation, GDAL only returns one if it can map the file directly.
+ */
+bool MappedBand::openVirtualMem(GDALRasterBand *band) {
+	int nPixelSpace;
+	GIntBig nLineSpace;
+	char **options = CSLSetNameValue(NULL, "USE_DEFAULT_IMPLEMENTATION", "NO");
+	this->mem = band->GetVirtualMemAuto(GF_Read, &nPixelSpace, &nLineSpace,
+			options);
+	CSLDestroy(options);
+	if (this->mem == NULL) {
+		return false;
+	}
+	if (nPixelSpace != this->nPixelBytes) {
+		this->close();
+		return false;
+	}
+	this->base = (GByte *) CPLVirtualMemGetAddr(this->mem);
+	this->lineSpace = nLineSpace;
+	return true;
+}
+
+/*
+ * Map the whole GeoTIFF and find each block in it
+ */
+bool MappedBand::openFileMap(const char *pathStr, GDALRasterBand *band) {
+	GDALDataset *dataset = band->GetDataset();
+	const char *interleave = dataset->GetMetadataItem("INTERLEAVE",
+			"IMAGE_STRUCTURE");
+	if (!CPLIsVirtualMemFileMapAvailable()
+			|| (dataset->GetRasterCount() > 1 && interleave != NULL
+					&& EQUAL(interleave, "PIXEL"))) {
+		return false;
+	}
+
+	// Every block must be present and stored whole
+	int nYBlocks = (this->rasterYSize + this->blockYSize - 1)
+			/ this->blockYSize;
+	for (int yBlock = 0; yBlock < nYBlocks; ++yBlock) {
+		for (int xBlock = 0; xBlock < this->nXBlocks; ++xBlock) {
+			const char *offset = band->GetMetadataItem(
+					CPLSPrintf("BLOCK_OFFSET_%d_%d", xBlock, yBlock), "TIFF");
+			const char *size = band->GetMetadataItem(
+					CPLSPrintf("BLOCK_SIZE_%d_%d", xBlock, yBlock), "TIFF");
+			GUIntBig nOffset = offset != NULL ? CPLScanUIntBig(offset, 32) : 0;
+			// The last strip of a striped file only holds the remaining rows
+			int nRows = std::min(this->blockYSize,
+					this->rasterYSize - yBlock * this->blockYSize);
+			GUIntBig nMinBytes = (GUIntBig) this->blockXSize * nRows
+					* this->nPixelBytes;
+			if (nOffset == 0 || size == NULL
+					|| CPLScanUIntBig(size, 32) < nMinBytes) {
+				this->blockOffsets.clear();
+				return false;
+			}
+			this->blockOffsets.push_back(nOffset);
+		}
+	}
+
+	// The header gives the file's byte order
+	this->fp = VSIFOpenL(pathStr, "rb");
+	if (this->fp == NULL) {
+		this->close();
+		return false;
+	}
+	char byteOrder[2] = { 0, 0 };
+	VSIFReadL(byteOrder, 1, 2, this->fp);
+#ifdef CPL_LSB
+	bool bNative = byteOrder[0] == 'I' && byteOrder[1] == 'I';
+#else
+	bool bNative = byteOrder[0] == 'M' && byteOrder[1] == 'M';
+#endif
+	VSIStatBufL stat;
+	if ((!bNative && this->nPixelBytes > 1) || VSIStatL(pathStr, &stat) != 0) {
+		this->close();
+		return false;
+	}
+	this->mem = CPLVirtualMemFileMapNew(this->fp, 0, stat.st_size,
+			VIRTUALMEM_READONLY, NULL, NULL);
+	if (this->mem == NULL) {
+		this->close();
+		return false;
+	}
+	this->base = (GByte *) CPLVirtualMemGetAddr(this->mem);
+	return true;
+}
+
+GALGError MappedBand::read(int xOff, int yOff, int xSize, int ySize,
+		void *buffer, GDALDataType eBufType) {
+	GALGError err = { 0, NULL };
+	RETURNIF(this->base == NULL, 1, "Band is not mapped");
+	int nBufPixelBytes = GDALGetDataTypeSize(eBufType) / 8;
+
+	if (this->lineSpace != 0) {
+		for (int y = 0; y < ySize; ++y) {
+			GDALCopyWords(
+					this->base + (yOff + y) * this->lineSpace
+							+ (GIntBig) xOff * this->nPixelBytes,
+					this->eDataType, this->nPixelBytes,
+					(GByte *) buffer + (size_t) y * xSize * nBufPixelBytes,
+					eBufType, nBufPixelBytes, xSize);
+		}
+		return err;
+	}
+
+	for (int yBlock = yOff / this->blockYSize;
+			yBlock <= (yOff + ySize - 1) / this->blockYSize; ++yBlock) {
+		for (int xBlock = xOff / this->blockXSize;
+				xBlock <= (xOff + xSize - 1) / this->blockXSize; ++xBlock) {
+			GByte *data = this->base
+					+ this->blockOffsets[yBlock * this->nXBlocks + xBlock];
+			int x0 = std::max(xOff, xBlock * this->blockXSize);
+			int x1 = std::min(xOff + xSize, (xBlock + 1) * this->blockXSize);
+			int y0 = std::max(yOff, yBlock * this->blockYSize);
+			int y1 = std::min(yOff + ySize, (yBlock + 1) * this->blockYSize);
+			for (int y = y0; y < y1; ++y) {
+				GDALCopyWords(
+						data
+								+ ((size_t) (y - yBlock * this->blockYSize)
+										* this->blockXSize
+										+ (x0 - xBlock * this->blockXSize))
+										* this->nPixelBytes, this->eDataType,
+						this->nPixelBytes,
+						(GByte *) buffer
+								+ ((size_t) (y - yOff) * xSize + (x0 - xOff))
+										* nBufPixelBytes, eBufType,
+						nBufPixelBytes, x1 - x0);
+			}
+		}
+	}
+	return err;
+}
+
+void *MappedBand::getView(int xOff, int yOff, int xSize, int ySize,
+		GDALDataType eBufType) {
+	if (this->base == NULL || eBufType != this->eDataType) {
+		return NULL;
+	}
+	if (this->lineSpace != 0) {
+		// Consecutive full rows are contiguous
+		if (xOff == 0 && xSize == this->rasterXSize
+				&& this->lineSpace == (GIntBig) xSize * this->nPixelBytes) {
+			return this->base + yOff * this->lineSpace;
+		}
+		return NULL;
+	}
+	// A whole block is contiguous
+	if (xOff % this->blockXSize == 0 && yOff % this->blockYSize == 0
+			&& xSize == this->blockXSize && ySize == this->blockYSize) {
+		return this->base
+				+ this->blockOffsets[(yOff / this->blockYSize) * this->nXBlocks
+						+ xOff / this->blockXSize];
+	}
+	return NULL;
+}
@@ -0,0 +1,73 @@
+/*
+ * MAPPED BAND API
+ *
+ * Read-only memory-mapped access to the pixels of an
+ * uncompressed raster band.
+ */
+#ifndef MAPPEDBAND_H_
+#define MAPPEDBAND_H_
+
+#include <vector>
+#include "gdal_priv.h"
+#include "cpl_virtualmem.h"
+
+#include "core_exp.h"
+#include "common.h"
+
+/*
+ * \brief A read-only memory mapping of one raster band.
+ *
+ * ``open`` maps the band if its pixels are stored uncompressed and in the
+ * machine's byte order, first through GDAL's own virtual memory view of the
+ * band (available for uncompressed strip GeoTIFFs) and otherwise by mapping
+ * the GeoTIFF file and locating each tile with the ``BLOCK_OFFSET`` metadata.
+ * Windows are then read by copying from the mapping, with no system calls,
+ * and ``getView`` gives a window's pixels in place where the mapping already
+ * holds them contiguously (full-width strips, or whole tiles).
+ * Pages are shared through the page cache by every process mapping the file.
+ */
+class GALGCORE_DLL MappedBand {
+
+public:
+	MappedBand();
+	virtual ~MappedBand();
+	/*
+	 * Map ``band`` of the file ``pathStr``. Returns false (and leaves the
+	 * band unmapped) if the band cannot be mapped.
+	 */
+	bool open(const char *pathStr, GDALRasterBand *band);
+	bool isOpen();
+
+	/*
+	 * Copy a window into ``buffer`` as ``eBufType``
+	 */
+	GALGError read(int xOff, int yOff, int xSize, int ySize, void *buffer,
+			GDALDataType eBufType);
+
+	/*
+	 * The window's pixels in place, or NULL if they are not stored
+	 * contiguously as ``eBufType``. The memory is read-only.
+	 */
+	void *getView(int xOff, int yOff, int xSize, int ySize,
+			GDALDataType eBufType);
+
+protected:
+	void close();
+	bool openVirtualMem(GDALRasterBand *band);
+	bool openFileMap(const char *pathStr, GDALRasterBand *band);
+	CPLVirtualMem *mem;
+	VSILFILE *fp;
+	GByte *base;
+	GDALDataType eDataType;
+	int nPixelBytes;
+	int rasterXSize, rasterYSize, blockXSize, blockYSize, nXBlocks;
+	// A whole band view has a line stride; a file map has one offset per tile
+	GIntBig lineSpace;
+	std::vector<GUIntBig> blockOffsets;
+
+private:
+	MappedBand(const MappedBand &);
+	MappedBand &operator=(const MappedBand &);
+};
+
+#endif // MAPPEDBAND_H_
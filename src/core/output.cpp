@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <cstring>
+#include "output.h"
+#include "cpl_string.h"
+
+OutputOptions::OutputOptions() :
+		driverName("GTiff"), codec("DEFAULT"), level(-1), predictor(0), compressionThreads(
+				0), blockXSize(0), blockYSize(0), bigTiff(false), cloudOptimised(
+				false), resampling("NEAREST") {
+}
+
+GALGError OutputOptions::setDriver(const char *driverName) {
+	GALGError err = { 0, NULL };
+	RETURNIF(driverName == NULL || GDALGetDriverByName(driverName) == NULL, 1,
+			"Unknown output driver");
+	this->driverName = driverName;
+	return err;
+}
+
+const char *OutputOptions::getDriver() const {
+	return this->driverName.c_str();
+}
+
+GALGError OutputOptions::setCompression(const char *codec, int level) {
+	GALGError err = { 0, NULL };
+	static const char *codecs[] = { "DEFAULT", "ZSTD", "DEFLATE", "LZW", "LERC",
+			"NONE", NULL };
+	bool known = false;
+	for (int i = 0; codecs[i] != NULL && codec != NULL; ++i) {
+		known = known || EQUAL(codec, codecs[i]);
+	}
+	RETURNIF(!known, 1, "Unknown compression codec");
+	RETURNIF(level < -1 || level == 0 || level > 22, 1,
+			"Compression level must be from 1 to 22, or -1");
+	this->codec = codec;
+	std::transform(this->codec.begin(), this->codec.end(), this->codec.begin(),
+			::toupper);
+	this->level = level;
+	return err;
+}
+
+GALGError OutputOptions::setPredictor(int predictor) {
+	GALGError err = { 0, NULL };
+	RETURNIF(predictor < 0 || predictor > 3, 1, "Predictor must be from 0 to 3");
+	this->predictor = predictor;
+	return err;
+}
+
+GALGError OutputOptions::setCompressionThreads(int nThreads) {
+	GALGError err = { 0, NULL };
+	RETURNIF(nThreads < 0, 1, "Number of compression threads cannot be negative");
+	this->compressionThreads = nThreads;
+	return err;
+}
+
+int OutputOptions::getCompressionThreads() const {
+	return this->compressionThreads;
+}
+
+GALGError OutputOptions::setBlockSize(int blockXSize, int blockYSize) {
+	GALGError err = { 0, NULL };
+	RETURNIF(blockXSize < 0 || blockYSize < 0 || blockXSize % 16 != 0
+			|| blockYSize % 16 != 0 || (blockXSize == 0) != (blockYSize == 0),
+			1, "Block sizes must be multiples of 16");
+	this->blockXSize = blockXSize;
+	this->blockYSize = blockYSize;
+	return err;
+}
+
+void OutputOptions::setBigTiff(bool bigTiff) {
+	this->bigTiff = bigTiff;
+}
+
+void OutputOptions::setCloudOptimised(bool cloudOptimised,
+		const char *resampling) {
+	this->cloudOptimised = cloudOptimised;
+	this->resampling = resampling != NULL ? resampling : "NEAREST";
+}
+
+bool OutputOptions::isCloudOptimised() const {
+	return this->cloudOptimised;
+}
+
+void OutputOptions::setCreationOption(const char *name, const char *value) {
+	this->extraOptions.push_back(std::make_pair(name, value));
+}
+
+const char *OutputOptions::getCompression(GDALDriver *driver) const {
+	if (this->codec != "DEFAULT") {
+		return this->codec.c_str();
+	}
+	// ZSTD depends on how the driver (libtiff for GeoTIFF and COG) was
+	// built; the driver lists it among its creation options if so
+	if (driver == NULL) {
+		driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	}
+	const char *optionList =
+			driver != NULL ?
+					driver->GetMetadataItem(GDAL_DMD_CREATIONOPTIONLIST) : NULL;
+	return optionList != NULL && strstr(optionList, "ZSTD") != NULL ?
+			"ZSTD" : "DEFLATE";
+}
+
+void OutputOptions::compressionOptions(GDALDriver *driver, GDALDataType eType,
+		bool forCog, char **&options) const {
+	std::string compression = this->getCompression(driver);
+	options = CSLSetNameValue(options, "COMPRESS", compression.c_str());
+
+	int compressionLevel = this->level;
+	if (compressionLevel == -1 && this->codec == "DEFAULT") {
+		compressionLevel = 1;
+	}
+	if (compressionLevel > 0
+			&& (compression == "ZSTD" || compression == "DEFLATE")) {
+		const char *levelName =
+				forCog ? "LEVEL" : (compression == "ZSTD" ? "ZSTD_LEVEL" : "ZLEVEL");
+		options = CSLSetNameValue(options, levelName,
+				CPLSPrintf("%d", compression == "DEFLATE" ?
+						std::min(compressionLevel, 9) : compressionLevel));
+	}
+
+	if (compression == "ZSTD" || compression == "DEFLATE"
+			|| compression == "LZW") {
+		bool floating = eType == GDT_Float32 || eType == GDT_Float64;
+		int p = this->predictor != 0 ? this->predictor : (floating ? 3 : 2);
+		if (forCog) {
+			options = CSLSetNameValue(options, "PREDICTOR",
+					p == 3 ? "FLOATING_POINT" : (p == 2 ? "YES" : "NO"));
+		} else if (p > 1) {
+			options = CSLSetNameValue(options, "PREDICTOR", CPLSPrintf("%d", p));
+		}
+	}
+	// The driver compresses tiles on a pool of threads as they are flushed
+	// and still writes them in order
+	if (compression != "NONE" && this->compressionThreads > 1) {
+		options = CSLSetNameValue(options, "NUM_THREADS",
+				CPLSPrintf("%d", this->compressionThreads));
+	}
+	options = CSLSetNameValue(options, "BIGTIFF",
+			this->bigTiff ? "YES" : "IF_SAFER");
+}
+
+char **OutputOptions::getCreationOptions(GDALDriver *driver,
+		GDALDataType eType, int rasterXSize, int sourceBlockXSize,
+		int sourceBlockYSize, bool sparse) const {
+	char **options = NULL;
+	if (EQUAL(driver->GetDescription(), "GTiff")) {
+		options = CSLSetNameValue(options, "TILED", "YES");
+		// Bands are processed one after another, so each tile holds one band
+		// and can be written without the others
+		options = CSLSetNameValue(options, "INTERLEAVE", "BAND");
+		this->compressionOptions(driver, eType, false, options);
+		if (sparse) {
+			options = CSLSetNameValue(options, "SPARSE_OK", "TRUE");
+		}
+		// Match a tiled source's tiles so windows line up with both datasets'
+		// blocks (GeoTIFF tile sizes must be multiples of 16)
+		int xSize = this->blockXSize, ySize = this->blockYSize;
+		if (xSize == 0 && sourceBlockXSize < rasterXSize
+				&& sourceBlockXSize % 16 == 0 && sourceBlockYSize % 16 == 0) {
+			xSize = sourceBlockXSize;
+			ySize = sourceBlockYSize;
+		}
+		if (xSize > 0) {
+			options = CSLSetNameValue(options, "BLOCKXSIZE",
+					CPLSPrintf("%d", xSize));
+			options = CSLSetNameValue(options, "BLOCKYSIZE",
+					CPLSPrintf("%d", ySize));
+		}
+	}
+	for (size_t i = 0; i < this->extraOptions.size(); ++i) {
+		options = CSLSetNameValue(options, this->extraOptions[i].first.c_str(),
+				this->extraOptions[i].second.c_str());
+	}
+	return options;
+}
+
+GALGError OutputOptions::copyCloudOptimised(GDALDataset *tmpDataset,
+		const char *outputPathStr) const {
+	GALGError err = { 0, NULL };
+	GDALDataType eType = tmpDataset->GetRasterBand(1)->GetRasterDataType();
+	GDALDriver *cogDriver = GetGDALDriverManager()->GetDriverByName("COG");
+	GDALDriver *driver = cogDriver;
+	char **options = NULL;
+	if (cogDriver != NULL) {
+		// GDAL 3.1 and later: the COG driver builds the overviews itself
+		this->compressionOptions(cogDriver, eType, true, options);
+		if (this->blockXSize > 0) {
+			options = CSLSetNameValue(options, "BLOCKSIZE",
+					CPLSPrintf("%d", this->blockXSize));
+		}
+		options = CSLSetNameValue(options, "RESAMPLING",
+				this->resampling.c_str());
+	} else {
+		// Otherwise overviews go into the temporary file and are copied
+		// ahead of the full resolution tiles
+		int maxSize = std::max(tmpDataset->GetRasterXSize(),
+				tmpDataset->GetRasterYSize());
+		std::vector<int> overviews;
+		for (int factor = 2; maxSize / factor >= 256; factor *= 2) {
+			overviews.push_back(factor);
+		}
+		if (!overviews.empty()) {
+			CPLErr eErr = tmpDataset->BuildOverviews(this->resampling.c_str(),
+					(int) overviews.size(), &overviews[0], 0, NULL, NULL, NULL);
+			RETURNIF(eErr != CE_None, 1, "Could not build overviews");
+		}
+		driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+		int sourceBlockXSize, sourceBlockYSize;
+		tmpDataset->GetRasterBand(1)->GetBlockSize(&sourceBlockXSize,
+				&sourceBlockYSize);
+		options = this->getCreationOptions(driver, eType,
+				tmpDataset->GetRasterXSize(), sourceBlockXSize,
+				sourceBlockYSize, false);
+		options = CSLSetNameValue(options, "COPY_SRC_OVERVIEWS", "YES");
+	}
+	for (size_t i = 0; i < this->extraOptions.size(); ++i) {
+		options = CSLSetNameValue(options, this->extraOptions[i].first.c_str(),
+				this->extraOptions[i].second.c_str());
+	}
+	GDALDataset *cogDataset = driver->CreateCopy(outputPathStr, tmpDataset,
+			FALSE, options, NULL, NULL);
+	CSLDestroy(options);
+	RETURNIF(cogDataset == NULL, 1, "Could not create output dataset");
+	GDALClose(cogDataset);
+	return err;
+}
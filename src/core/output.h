@@ -0,0 +1,128 @@
+/*
+ * OUTPUT API
+ *
+ * How output datasets are created: the driver, compression and layout of
+ * the file, and cloud optimised GeoTIFF (COG) output.
+ */
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+#include <string>
+#include <vector>
+#include "gdal_priv.h"
+
+#include "core_exp.h"
+#include "common.h"
+
+/*
+ * \brief Creation options for output datasets.
+ *
+ * The default is a tiled GeoTIFF compressed with ZSTD at level 1, or with
+ * DEFLATE where GDAL is built without ZSTD, and a predictor suited to the
+ * data type: a fast codec, so that writing does not hold up processing.
+ * Tiles match the source's tiling where possible.
+ *
+ * Compression, predictor, tiling and BigTIFF only apply to GeoTIFF (and
+ * COG) output; any other driver only gets the options set with
+ * setCreationOption.
+ */
+class GALGCORE_DLL OutputOptions {
+
+public:
+	OutputOptions();
+	virtual ~OutputOptions() {};
+
+	/*
+	 * A GDAL driver name, e.g. "GTiff" (the default)
+	 */
+	GALGError setDriver(const char *driverName);
+	const char *getDriver() const;
+
+	/*
+	 * "ZSTD", "DEFLATE", "LZW", "LERC", "NONE", or "DEFAULT" (ZSTD where
+	 * available, otherwise DEFLATE). level is the codec's compression level
+	 * (ZSTD 1-22, DEFLATE 1-9); -1 keeps the codec's own default, except that
+	 * the default codec is used at level 1. Ignored for LZW, LERC and NONE.
+	 */
+	GALGError setCompression(const char *codec, int level);
+
+	/*
+	 * 1 for none, 2 for horizontal differencing, 3 for floating point, or 0
+	 * (the default) for 2 on integer data and 3 on floating point data.
+	 * Only used with LZW, DEFLATE and ZSTD.
+	 */
+	GALGError setPredictor(int predictor);
+
+	/*
+	 * Threads compressing output tiles (NUM_THREADS of the GeoTIFF and COG
+	 * drivers), or 0 (the default) for as many as the RasterProcess has
+	 * worker threads. Tiles are still written in order, so the file is the
+	 * same whatever the number of threads.
+	 */
+	GALGError setCompressionThreads(int nThreads);
+	int getCompressionThreads() const;
+
+	/*
+	 * Tile size (multiples of 16). 0 by 0 (the default) matches the source's
+	 * tiles where it is tiled, otherwise uses the driver's default.
+	 */
+	GALGError setBlockSize(int blockXSize, int blockYSize);
+
+	/*
+	 * Always write BigTIFF. Otherwise GDAL decides (BIGTIFF=IF_SAFER).
+	 */
+	void setBigTiff(bool bigTiff);
+
+	/*
+	 * Write a cloud optimised GeoTIFF: the output is first written to a
+	 * temporary GeoTIFF beside it, then copied with overviews and its tiles
+	 * in order, through GDAL's COG driver where it has one.
+	 * resampling is the overview resampling method, e.g. "NEAREST" (the
+	 * default, which suits classes and codes) or "AVERAGE".
+	 */
+	void setCloudOptimised(bool cloudOptimised, const char *resampling = "NEAREST");
+	bool isCloudOptimised() const;
+
+	/*
+	 * Any other creation option, passed as is. Overrides those above.
+	 */
+	void setCreationOption(const char *name, const char *value);
+
+	/*
+	 * The codec actually used with a driver: DEFAULT resolved to ZSTD where
+	 * the driver offers it, else DEFLATE. A NULL driver means GeoTIFF.
+	 */
+	const char *getCompression(GDALDriver *driver) const;
+
+	/*
+	 * Creation options for a dataset of eType. sourceBlockXSize and
+	 * sourceBlockYSize are the tiles to match; sparse allows blocks to be
+	 * left unwritten. Free with CSLDestroy.
+	 */
+	char **getCreationOptions(GDALDriver *driver, GDALDataType eType,
+			int rasterXSize, int sourceBlockXSize, int sourceBlockYSize,
+			bool sparse) const;
+
+	/*
+	 * Turn a finished temporary GeoTIFF into a cloud optimised GeoTIFF at
+	 * outputPathStr
+	 */
+	GALGError copyCloudOptimised(GDALDataset *tmpDataset,
+			const char *outputPathStr) const;
+
+protected:
+	void compressionOptions(GDALDriver *driver, GDALDataType eType,
+			bool forCog, char **&options) const;
+	std::string driverName;
+	std::string codec;
+	int level;
+	int predictor;
+	int compressionThreads;
+	int blockXSize, blockYSize;
+	bool bigTiff;
+	bool cloudOptimised;
+	std::string resampling;
+	std::vector<std::pair<std::string, std::string> > extraOptions;
+};
+
+#endif // OUTPUT_H_
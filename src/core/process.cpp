@@ -6,32 +6,58 @@
  */
 
 #include <iostream>
+#include <algorithm>
+#include <ctime>
+#include <limits>
+#include <string>
 #include "galg.h"
 #include "iterator.h"
+#include "engine.h"
+#include "blockcache.h"
+#include "bufferpool.h"
+#include "mappedband.h"
+#include "labeller.h"
+#include "flow.h"
+#include "tilesink.h"
+#include "checkpoint.h"
 
 #include "gdal_priv.h"
 #include "cpl_error.h"
+#include "cpl_string.h"
 
-GALGError createOutputDataset(GDALDataset *srcDataset,
-		const char *outputPathStr, GDALDataset *&dstDataset, bool skipHoles) {
-	GALGError errResult = { 0, NULL };
+/*
+ * Where a cloud optimised output is written before it is copied into place
+ */
+static std::string temporaryOutputPath(const char *outputPathStr) {
+	return std::string(outputPathStr) + ".tmp.tif";
+}
 
-	const char *formatStr = "GTiff";
-	GDALDriver *gdalDriver;
-	gdalDriver = GetGDALDriverManager()->GetDriverByName(formatStr);
+GALGError createOutputDataset(const OutputOptions &options,
+		GDALDataset *srcDataset, const char *outputPathStr,
+		GDALDataset *&dstDataset, bool skipHoles, int nBands,
+		GDALDataType eType = GDT_Unknown) {
+	GALGError errResult = { 0, NULL };
 
-	RETURNIF(gdalDriver == NULL, 1, "Could not initialise Geotiff driver");
+	// Cloud optimised output is written as a plain GeoTIFF first
+	GDALDriver *gdalDriver = GetGDALDriverManager()->GetDriverByName(
+			options.isCloudOptimised() ? "GTiff" : options.getDriver());
+	RETURNIF(gdalDriver == NULL, 1, "Could not initialise output driver");
 
-	char **optionStrArray = NULL;
-	optionStrArray = CSLSetNameValue(optionStrArray, "TILED", "YES");
-	optionStrArray = CSLSetNameValue(optionStrArray, "COMPRESS", "LZW");
-	if (skipHoles) {
-		optionStrArray = CSLSetNameValue(optionStrArray, "SPARSE_OK", "TRUE");
+	if (eType == GDT_Unknown) {
+		eType = srcDataset->GetRasterBand(1)->GetRasterDataType();
 	}
+	int blockXSize, blockYSize;
+	srcDataset->GetRasterBand(1)->GetBlockSize(&blockXSize, &blockYSize);
+	char **optionStrArray = options.getCreationOptions(gdalDriver, eType,
+			srcDataset->GetRasterXSize(), blockXSize, blockYSize, skipHoles);
 
-	dstDataset = gdalDriver->Create(outputPathStr, srcDataset->GetRasterXSize(),
-			srcDataset->GetRasterYSize(), srcDataset->GetRasterCount(),
-			srcDataset->GetRasterBand(1)->GetRasterDataType(), optionStrArray);
+	std::string pathStr =
+			options.isCloudOptimised() ?
+					temporaryOutputPath(outputPathStr) : outputPathStr;
+	dstDataset = gdalDriver->Create(pathStr.c_str(),
+			srcDataset->GetRasterXSize(), srcDataset->GetRasterYSize(), nBands,
+			eType, optionStrArray);
+	CSLDestroy(optionStrArray);
 
 	RETURNIF(dstDataset == NULL, 1, "Could not create output dataset");
 
@@ -40,15 +66,91 @@ GALGError createOutputDataset(GDALDataset *srcDataset,
 	dstDataset->SetGeoTransform(geotransform);
 	dstDataset->SetProjection(srcDataset->GetProjectionRef());
 
+	// Any bands beyond those of the source take the no data value of the last source band
 	GDALRasterBand *srcBand, *dstBand;
-	for (int ixBand = 0; ixBand < srcDataset->GetRasterCount(); ++ixBand) {
-		srcBand = srcDataset->GetRasterBand(ixBand + 1);
+	for (int ixBand = 0; ixBand < nBands; ++ixBand) {
+		srcBand = srcDataset->GetRasterBand(
+				std::min(ixBand + 1, srcDataset->GetRasterCount()));
 		dstBand = dstDataset->GetRasterBand(ixBand + 1);
 		dstBand->SetNoDataValue(srcBand->GetNoDataValue());
 	}
 	return errResult;
 }
 
+/*
+ * Flush and close an output dataset. A cloud optimised output is copied
+ * into place from its temporary file, unless the run failed; a resumable
+ * run keeps the temporary file of a failed run.
+ * With resultDataset, a successful output is handed back open instead
+ * (reopened read-only when cloud optimised).
+ */
+GALGError closeOutputDataset(const OutputOptions &options,
+		GDALDataset *dstDataset, const char *outputPathStr, GALGError result,
+		GDALDataset **resultDataset = NULL, bool resumable = false) {
+	dstDataset->FlushCache();
+	bool keep = resultDataset != NULL && result.errnum == 0;
+	if (!options.isCloudOptimised()) {
+		if (keep) {
+			*resultDataset = dstDataset;
+		} else {
+			GDALClose(dstDataset);
+		}
+		return result;
+	}
+	if (result.errnum == 0) {
+		result = options.copyCloudOptimised(dstDataset, outputPathStr);
+	}
+	GDALDriver *driver = dstDataset->GetDriver();
+	GDALClose(dstDataset);
+	if (result.errnum == 0 || !resumable) {
+		driver->Delete(temporaryOutputPath(outputPathStr).c_str());
+	}
+	if (keep && result.errnum == 0) {
+		*resultDataset = (GDALDataset *) GDALOpen(outputPathStr, GA_ReadOnly);
+		RETURNIF(*resultDataset == NULL, 1, "Could not open output dataset");
+	}
+	return result;
+}
+
+/*
+ * Reopen the output of an interrupted run for update (its temporary file
+ * when cloud optimised), if it matches the source. NULL if it does not.
+ */
+static GDALDataset *reopenOutputDataset(const OutputOptions &options,
+		GDALDataset *srcDataset, const char *outputPathStr) {
+	std::string pathStr =
+			options.isCloudOptimised() ?
+					temporaryOutputPath(outputPathStr) : outputPathStr;
+	CPLPushErrorHandler(CPLQuietErrorHandler);
+	GDALDataset *dstDataset = (GDALDataset *) GDALOpen(pathStr.c_str(),
+			GA_Update);
+	CPLPopErrorHandler();
+	if (dstDataset != NULL
+			&& (dstDataset->GetRasterXSize() != srcDataset->GetRasterXSize()
+					|| dstDataset->GetRasterYSize()
+							!= srcDataset->GetRasterYSize()
+					|| dstDataset->GetRasterCount()
+							!= srcDataset->GetRasterCount())) {
+		GDALClose(dstDataset);
+		dstDataset = NULL;
+	}
+	return dstDataset;
+}
+
+/*
+ * The path to open further handles on a dataset with, or NULL where it
+ * cannot be reopened (in-memory datasets)
+ */
+static const char *reopenPath(GDALDataset *dataset) {
+	GDALDriver *driver = dataset->GetDriver();
+	const char *pathStr = dataset->GetDescription();
+	if (driver == NULL || EQUAL(driver->GetDescription(), "MEM")
+			|| pathStr == NULL || pathStr[0] == '\0') {
+		return NULL;
+	}
+	return pathStr;
+}
+
 // Default implementation of IProcessImage
 IProcessImage::IProcessImage() {
 }
@@ -58,108 +160,2771 @@ GALGError IProcessImage::processImage(float *inputArray, float *outputArray,
 		int nWindowXSize, int nWindowYSize, double *inNoDataValue,
 		double *outNoDataValue) {
 	GALGError err = { 0, NULL };
-	memcpy(outputArray, inputArray, (size_t) nWindowXSize * nWindowYSize);
+	memcpy(outputArray, inputArray,
+			(size_t) nWindowXSize * nWindowYSize * sizeof(float));
 	return err;
 }
+int IProcessImage::getPixelBuffer() {
+	return 0;
+}
+bool IProcessImage::supportsDataType(GDALDataType eDataType) {
+	return eDataType == GDT_Float32;
+}
+GALGError IProcessImage::processImageNative(void *inputArray,
+		void *outputArray, GDALDataType eDataType, int nWindowXSize,
+		int nWindowYSize, double *inNoDataValue, double *outNoDataValue) {
+	RETURNIF(eDataType != GDT_Float32, 1,
+			"Data type not supported by processing function");
+	return this->processImage((float *) inputArray, (float *) outputArray,
+			nWindowXSize, nWindowYSize, inNoDataValue, outNoDataValue);
+}
 
-RasterProcess::RasterProcess() {
+// Default implementation of IProcessBands: copies the input bands through
+IProcessBands::IProcessBands() {
+}
+IProcessBands::~IProcessBands() {
+}
+GALGInterleave IProcessBands::getInterleave() {
+	return GALG_INTERLEAVE_BAND;
+}
+int IProcessBands::getOutputBandCount(int nInputBands) {
+	return nInputBands;
+}
+int IProcessBands::getPixelBuffer() {
+	return 0;
+}
+GALGError IProcessBands::processBands(float *inputArray, int nInputBands,
+		float *outputArray, int nOutputBands, int nWindowXSize,
+		int nWindowYSize, double *inNoDataValues, double *outNoDataValues) {
+	GALGError err = { 0, NULL };
+	size_t nPixels = (size_t) nWindowXSize * nWindowYSize;
+	if (nInputBands == nOutputBands) {
+		memcpy(outputArray, inputArray,
+				nPixels * nInputBands * sizeof(float));
+	} else {
+		// Band layout is only identical for equal band counts; copy band by band
+		bool bPixel = this->getInterleave() == GALG_INTERLEAVE_PIXEL;
+		for (int iBand = 0; iBand < nOutputBands; ++iBand) {
+			for (size_t i = 0; i < nPixels; ++i) {
+				size_t iIn = bPixel ? i * nInputBands + iBand : iBand * nPixels + i;
+				size_t iOut = bPixel ? i * nOutputBands + iBand : iBand * nPixels + i;
+				outputArray[iOut] =
+						iBand < nInputBands ?
+								inputArray[iIn] : (float) outNoDataValues[iBand];
+			}
+		}
+	}
+	return err;
+}
 
+// Default implementation of IReduceImage: a mosaic, where each output pixel
+// takes the first valid value found across the inputs
+IReduceImage::IReduceImage() {
+}
+IReduceImage::~IReduceImage() {
+}
+bool IReduceImage::isIncremental() {
+	return true;
+}
+int IReduceImage::getAccumulatorCount() {
+	// The value followed by whether it has been set
+	return 2;
 }
+GALGError IReduceImage::reduceImage(float **inputArrays, int nInputs,
+		float *outputArray, int nWindowXSize, int nWindowYSize,
+		double *inNoDataValues, double *outNoDataValue) {
+	GALGError err = { 0, NULL };
+	size_t nPixels = (size_t) nWindowXSize * nWindowYSize;
+	std::vector<float> accumulator(nPixels * this->getAccumulatorCount());
 
-GALGError RasterProcess::map(IProcessImage &processor, const char *inputPathStr,
-		const char *outputPathStr, int *windowXSize, int *windowYSize,
-		int *nPixelBuffer, bool skipHoles) {
+	err = this->initialise(&accumulator[0], nWindowXSize, nWindowYSize,
+			outNoDataValue);
+	for (int i = 0; i < nInputs && err.errnum == 0; ++i) {
+		err = this->fold(inputArrays[i], &accumulator[0], nWindowXSize,
+				nWindowYSize, &inNoDataValues[i], outNoDataValue);
+	}
+	if (err.errnum == 0) {
+		err = this->finalise(&accumulator[0], outputArray, nWindowXSize,
+				nWindowYSize, nInputs, outNoDataValue);
+	}
+	return err;
+}
+GALGError IReduceImage::initialise(float *accumulator, int nWindowXSize,
+		int nWindowYSize, double *outNoDataValue) {
+	GALGError err = { 0, NULL };
+	size_t nPixels = (size_t) nWindowXSize * nWindowYSize;
+	std::fill(accumulator, accumulator + nPixels, (float) *outNoDataValue);
+	std::fill(accumulator + nPixels, accumulator + 2 * nPixels, 0.0f);
+	return err;
+}
+GALGError IReduceImage::fold(float *inputArray, float *accumulator,
+		int nWindowXSize, int nWindowYSize, double *inNoDataValue,
+		double *outNoDataValue) {
+	GALGError err = { 0, NULL };
+	size_t nPixels = (size_t) nWindowXSize * nWindowYSize;
+	float inNoData = (float) *inNoDataValue;
+	float *value = accumulator, *valid = accumulator + nPixels;
+	for (size_t i = 0; i < nPixels; ++i) {
+		// A valid value may equal the output's no data value, so whether a
+		// value has been taken is tracked apart from the value
+		if (valid[i] == 0 && inputArray[i] != inNoData) {
+			value[i] = inputArray[i];
+			valid[i] = 1.0f;
+		}
+	}
+	return err;
+}
+GALGError IReduceImage::finalise(float *accumulator, float *outputArray,
+		int nWindowXSize, int nWindowYSize, int nInputs,
+		double *outNoDataValue) {
+	GALGError err = { 0, NULL };
+	memcpy(outputArray, accumulator,
+			(size_t) nWindowXSize * nWindowYSize * sizeof(float));
+	return err;
+}
 
-	GALGError result = { 0, NULL };
-	GDALDataset *srcDataset;
-	GDALDataset *dstDataset;
-	// Open the input dataset and verify
-	srcDataset = (GDALDataset *) GDALOpen(inputPathStr, GA_ReadOnly);
+RasterProcess::RasterProcess() :
+		engine(new WindowEngine()), blockCache(new BlockCache()), bufferPool(
+				new BufferPool()), memoryBudget(256 * 1024 * 1024), memoryMapInput(
+				false), outputStatistics(NULL), checkpointing(false), checkpointInterval(
+				60), nInPlaceWindows(0) {
+}
 
-	// If the assesrtion is TRUE, exit the function with a suitable error
-	RETURNIF(srcDataset == NULL, 1, "Could not open source dataset");
+RasterProcess::~RasterProcess() {
+	delete this->engine;
+	delete this->blockCache;
+	delete this->bufferPool;
+}
 
-	// Create output dataset and verify
-	result = createOutputDataset(srcDataset, outputPathStr, dstDataset,
-			skipHoles);
-	RETURNIF(result.errnum != 0, result.errnum, result.msg);
-
-	// Setup the iterator. If pixelBuffer was passed, we created a buffered iterator,
-	// otherwise use a standard BlockIterator
-	BlockIterator *iterator = NULL;
-	if (nPixelBuffer != NULL && *nPixelBuffer > 0) {
-		iterator = new BufferedIterator(dstDataset, *nPixelBuffer);
-	} else {
-		iterator = new BlockIterator(dstDataset);
+/*
+ * Thread-private source dataset handle for a MapJob
+ */
+class MapReader: public WindowReader {
+
+public:
+	MapReader(GDALDataset *dataset, bool owned, CPLMutex *lock = NULL) :
+			dataset(dataset), lock(lock), owned(owned) {
 	}
-	RETURNIF(iterator == NULL, 1,
-			"Unable to allocate memory for BlockIterator");
-	iterator->setBlockSize(*windowXSize, *windowYSize);
+	~MapReader() {
+		if (this->owned) {
+			GDALClose(this->dataset);
+		}
+	}
+	GDALDataset *dataset;
+	/*
+	 * Held while reading when the dataset is shared between readers
+	 */
+	CPLMutex *lock;
 
-	// Prepare the data buffers
-	float *bufInputData = NULL, *bufOutputData = NULL;
+private:
+	bool owned;
+};
 
-	size_t nxBytes = *windowXSize * sizeof(float);
-	size_t nyBytes = *windowYSize * sizeof(float);
-	bufInputData = (float *) VSIMalloc2(nxBytes, nyBytes);
-	bufOutputData = (float *) VSIMalloc2(nxBytes, nyBytes);
-	RETURNIF(bufInputData == NULL || bufOutputData == NULL, 1,
-			"Unable to allocate data arrays");
+/*
+ * Input and output buffers for one window of a MapJob
+ */
+class MapSlot: public WindowSlot {
 
-	int nBands = srcDataset->GetRasterCount();
-	int xOff, yOff, xSize, ySize;
-	GDALRasterBand *srcBand, *dstBand;
-	double inNoDataValue, outNoDataValue;
-	int bSuccess;
+public:
+	MapSlot(BufferPool *pool) :
+			bufInputData(NULL), bufOutputData(NULL), inputView(NULL), srcBlock(
+					NULL), dstBlock(NULL), pool(pool) {
+	}
+	~MapSlot() {
+		this->dropBlocks();
+		this->pool->release(this->bufInputData);
+		this->pool->release(this->bufOutputData);
+	}
+	void dropBlocks() {
+		if (this->srcBlock != NULL) {
+			this->srcBlock->DropLock();
+			this->srcBlock = NULL;
+		}
+		if (this->dstBlock != NULL) {
+			this->dstBlock->DropLock();
+			this->dstBlock = NULL;
+		}
+	}
+	void *bufInputData, *bufOutputData;
+	/*
+	 * The window's input when it is read in place (from a locked block or
+	 * a mapped file) rather than into bufInputData. Read-only.
+	 */
+	void *inputView;
+	/*
+	 * Locked source and destination blocks when the window is processed
+	 * in place in GDAL's block cache
+	 */
+	GDALRasterBlock *srcBlock, *dstBlock;
+	/*
+	 * Statistics of the window's output, when they are collected
+	 */
+	RasterStatistics statistics;
 
-	// Apply the process function to each sub window of each band
-	// in the dataset
-	for (int iBand = 0; iBand < nBands; ++iBand) {
+private:
+	BufferPool *pool;
+};
+
+/*
+ * Whether a source band has no data at all within a window, judging only by
+ * which blocks exist in the file, i.e. before anything is decoded.
+ * Blocks that were never written to a sparse GeoTIFF are empty.
+ */
+static bool windowIsEmpty(GDALRasterBand *band, const GALGWindow &w) {
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(2,2,0)
+	int nStatus = band->GetDataCoverageStatus(w.xOff, w.yOff, w.xSize,
+			w.ySize, 0, NULL);
+	return nStatus == GDAL_DATA_COVERAGE_STATUS_EMPTY;
+#else
+	// Older GDAL: look for the offsets of the blocks in the TIFF directory
+	int blockXSize, blockYSize;
+	band->GetBlockSize(&blockXSize, &blockYSize);
+	for (int yBlock = w.yOff / blockYSize;
+			yBlock <= (w.yOff + w.ySize - 1) / blockYSize; ++yBlock) {
+		for (int xBlock = w.xOff / blockXSize;
+				xBlock <= (w.xOff + w.xSize - 1) / blockXSize; ++xBlock) {
+			const char *offsetStr = band->GetMetadataItem(
+					CPLSPrintf("BLOCK_OFFSET_%d_%d", xBlock, yBlock), "TIFF");
+			if (offsetStr == NULL || atoi(offsetStr) != 0) {
+				// Either not a GeoTIFF, or the block has data
+				return false;
+			}
+		}
+	}
+	return true;
+#endif
+}
+
+/*
+ * Whether every pixel equals value. A value T cannot hold (out of range, or
+ * not a whole number for integer types) matches no pixel; it is checked
+ * before the cast, which would be undefined.
+ */
+template<typename T>
+static bool allEqual(const void *buffer, size_t nPixels, double value) {
+	bool integer = std::numeric_limits<T>::is_integer;
+	double lowest = integer ?
+			(double) std::numeric_limits<T>::min() :
+			-(double) std::numeric_limits<T>::max();
+	bool inRange = value >= lowest
+			&& value <= (double) std::numeric_limits<T>::max();
+	bool infinite = value == std::numeric_limits<double>::infinity()
+			|| value == -std::numeric_limits<double>::infinity();
+	if (!inRange && (integer || !infinite)) {
+		return false;
+	}
+	if (integer && value != (double) (T) value) {
+		return false;
+	}
+	const T *data = (const T *) buffer;
+	const T typedValue = (T) value;
+	for (size_t i = 0; i < nPixels; ++i) {
+		if (data[i] != typedValue) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Whether every pixel of a decoded window is the no data value
+ */
+static bool windowIsNoData(const void *buffer, GDALDataType eType,
+		size_t nPixels, double noDataValue) {
+	switch (eType) {
+	case GDT_Byte:
+		return allEqual<GByte>(buffer, nPixels, noDataValue);
+	case GDT_UInt16:
+		return allEqual<GUInt16>(buffer, nPixels, noDataValue);
+	case GDT_Int16:
+		return allEqual<GInt16>(buffer, nPixels, noDataValue);
+	case GDT_UInt32:
+		return allEqual<GUInt32>(buffer, nPixels, noDataValue);
+	case GDT_Int32:
+		return allEqual<GInt32>(buffer, nPixels, noDataValue);
+	case GDT_Float32:
+		if (CPLIsNan(noDataValue)) {
+			const float *data = (const float *) buffer;
+			for (size_t i = 0; i < nPixels; ++i) {
+				if (!CPLIsNan(data[i])) {
+					return false;
+				}
+			}
+			return true;
+		}
+		return allEqual<float>(buffer, nPixels, noDataValue);
+	case GDT_Float64:
+		if (CPLIsNan(noDataValue)) {
+			const double *data = (const double *) buffer;
+			for (size_t i = 0; i < nPixels; ++i) {
+				if (!CPLIsNan(data[i])) {
+					return false;
+				}
+			}
+			return true;
+		}
+		return allEqual<double>(buffer, nPixels, noDataValue);
+	default:
+		return false;
+	}
+}
 
-		srcBand = srcDataset->GetRasterBand(iBand + 1);
-		dstBand = dstDataset->GetRasterBand(iBand + 1);
-		inNoDataValue = srcBand->GetNoDataValue(&bSuccess);
-		outNoDataValue = dstBand->GetNoDataValue(&bSuccess);
+/*
+ * Reads each window from the source, applies the chain of processors and
+ * writes the result to the destination.
+ * With skipHoles, windows without data are dropped: those in blocks absent
+ * from the source file are not even read, and those which read back as
+ * entirely no data are neither processed nor written, leaving the
+ * output sparse.
+ * Without an inputPathStr (e.g. an in-memory source), every reader shares
+ * the source dataset and reads one at a time.
+ */
+class MapJob: public WindowJob {
 
-		while (iterator->next(&xSize, &ySize, &xOff, &yOff)) {
+public:
+	MapJob(std::vector<IProcessImage *> &processorArray,
+			const char *inputPathStr, GDALDataset *srcDataset,
+			GDALDataset *dstDataset, int maxXSize, int maxYSize,
+			bool skipHoles, BlockCache *blockCache, BufferPool *pool,
+			bool zeroCopy, bool mapInput,
+			std::vector<RasterStatistics> *statistics, TileSink *sink,
+			const std::vector<GALGWindow> &owned) :
+			processorArray(processorArray), inputPathStr(inputPathStr), srcDataset(
+					srcDataset), dstDataset(dstDataset), maxXSize(maxXSize), maxYSize(
+					maxYSize), nReaders(0), maxPixelBytes(sizeof(float)), skipHoles(
+					skipHoles), blockCache(blockCache), pool(pool), zeroCopy(
+					zeroCopy), statistics(statistics), owned(owned), sink(sink), readMutex(
+					NULL), journal(NULL), checkpointInterval(0), lastCheckpoint(
+					0), nInPlaceWindows(0) {
+		int bSuccess;
+		if (inputPathStr == NULL) {
+			this->readMutex = CPLCreateMutex();
+			CPLReleaseMutex(this->readMutex);
+		}
+		if (statistics != NULL) {
+			// Each window starts from the settings of its band's statistics;
+			// the statistics themselves are only touched in write
+			this->emptyStatistics = *statistics;
+		}
+		for (int iBand = 0; iBand < srcDataset->GetRasterCount(); ++iBand) {
+			GDALRasterBand *srcBand = srcDataset->GetRasterBand(iBand + 1);
+			GDALRasterBand *dstBand = dstDataset->GetRasterBand(iBand + 1);
+			inNoDataValues.push_back(srcBand->GetNoDataValue(&bSuccess));
+			hasNoData.push_back(bSuccess != 0);
+			outNoDataValues.push_back(dstBand->GetNoDataValue(&bSuccess));
 
-			// Read input data. TODO:: Verify function ran
-			srcBand->RasterIO(GF_Read, xOff, yOff, xSize, ySize, bufInputData,
-					xSize, ySize, GDT_Float32, 0, 0);
+			// Work in the band's own data type when the whole chain supports
+			// it and no conversion is needed on write, otherwise in float
+			GDALDataType eWorkType = srcBand->GetRasterDataType();
+			bool bNative = eWorkType == dstBand->GetRasterDataType();
+			for (size_t i = 0; i < processorArray.size() && bNative; ++i) {
+				bNative = processorArray[i]->supportsDataType(eWorkType);
+			}
+			if (!bNative) {
+				eWorkType = GDT_Float32;
+			}
+			workTypes.push_back(eWorkType);
+			maxPixelBytes = std::max(maxPixelBytes,
+					(size_t) GDALGetDataTypeSize(eWorkType) / 8);
 
-			// Call the process function. TODO: Verify output
-			processor.processImage(bufInputData, bufOutputData, xSize, ySize,
-					&inNoDataValue, &outNoDataValue);
+			// A mapping is shared by all readers
+			MappedBand *mappedBand = NULL;
+			if (mapInput) {
+				mappedBand = new MappedBand();
+				if (!mappedBand->open(srcDataset->GetDescription(), srcBand)) {
+					delete mappedBand;
+					mappedBand = NULL;
+				}
+			}
+			mappedBands.push_back(mappedBand);
+		}
+	}
 
-			// Write out the result. TODO: Verify function ran
-			dstBand->RasterIO(GF_Write, xOff, yOff, xSize, ySize, bufOutputData,
-					xSize, ySize, GDT_Float32, 0, 0);
+	~MapJob() {
+		for (size_t i = 0; i < this->mappedBands.size(); ++i) {
+			delete this->mappedBands[i];
+		}
+		if (this->readMutex != NULL) {
+			CPLDestroyMutex(this->readMutex);
 		}
 	}
-	dstDataset->FlushCache();
-	GDALClose(dstDataset);
-	GDALClose(srcDataset);
+
+	/*
+	 * Record written windows in journal, flushing the output first, at most
+	 * every intervalSeconds
+	 */
+	void setCheckpoint(CheckpointJournal *journal, int intervalSeconds) {
+		this->journal = journal;
+		this->checkpointInterval = intervalSeconds;
+		this->lastCheckpoint = time(NULL);
+	}
+
+	GALGError createReader(WindowReader *&reader) {
+		GALGError err = { 0, NULL };
+		// The first reader shares the already-open source dataset. Any further
+		// readers get their own handle so they do not contend on its block cache
+		if (this->nReaders == 0 || this->inputPathStr == NULL) {
+			reader = new MapReader(this->srcDataset, false, this->readMutex);
+		} else {
+			GDALDataset *dataset = (GDALDataset *) GDALOpen(this->inputPathStr,
+					GA_ReadOnly);
+			RETURNIF(dataset == NULL, 1, "Could not open source dataset");
+			reader = new MapReader(dataset, true);
+		}
+		this->nReaders++;
+		return err;
+	}
+
+	GALGError createSlot(WindowSlot *&slot) {
+		GALGError err = { 0, NULL };
+		MapSlot *mapSlot = new MapSlot(this->pool);
+		slot = mapSlot;
+
+		size_t nBytes = (size_t) this->maxXSize * this->maxYSize
+				* this->maxPixelBytes;
+		mapSlot->bufInputData = this->pool->acquire(nBytes);
+		mapSlot->bufOutputData = this->pool->acquire(nBytes);
+		RETURNIF(
+				mapSlot->bufInputData == NULL || mapSlot->bufOutputData == NULL,
+				1, "Unable to allocate data arrays");
+		return err;
+	}
+
+	GALGError read(WindowReader *reader, WindowSlot *slot,
+			const GALGWindow &w) {
+		CPLMutex *lock = ((MapReader *) reader)->lock;
+		if (lock != NULL) {
+			CPLAcquireMutex(lock, 1000.0);
+		}
+		GALGError err = this->readWindow(reader, slot, w);
+		if (lock != NULL) {
+			CPLReleaseMutex(lock);
+		}
+		if (err.errnum == 0 && slot->skip) {
+			err = this->sink->discard(w);
+		}
+		if (err.errnum != 0) {
+			this->sink->abort();
+		}
+		return err;
+	}
+
+	/*
+	 * Windows are handed to the sink as soon as they are computed, in
+	 * whatever order they finish
+	 */
+	GALGError compute(WindowSlot *slot, const GALGWindow &w) {
+		MapSlot *mapSlot = (MapSlot *) slot;
+		GALGError err = this->computeWindow(mapSlot, w);
+		if (err.errnum == 0 && mapSlot->dstBlock != NULL) {
+			err = this->sink->discard(w);
+		} else if (err.errnum == 0) {
+			err = this->sink->write(w, mapSlot->bufOutputData,
+					this->workTypes[w.band - 1]);
+		}
+		if (err.errnum != 0) {
+			this->sink->abort();
+		}
+		return err;
+	}
+
+	GALGError write(WindowSlot *slot, const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		MapSlot *mapSlot = (MapSlot *) slot;
+		if (this->statistics != NULL) {
+			err = (*this->statistics)[w.band - 1].merge(mapSlot->statistics);
+			RETURNIFERROR(err);
+		}
+		if (mapSlot->dstBlock != NULL) {
+			// Already computed into the destination block
+			mapSlot->dstBlock->MarkDirty();
+			mapSlot->dropBlocks();
+			this->nInPlaceWindows++;
+		}
+		if (this->journal != NULL) {
+			this->unrecorded.push_back(w);
+			if (time(NULL) - this->lastCheckpoint >= this->checkpointInterval) {
+				err = this->checkpoint();
+			}
+		}
+		return err;
+	}
+
+	/*
+	 * The number of windows processed in place in GDAL's block cache
+	 */
+	GIntBig getInPlaceWindows() {
+		return this->nInPlaceWindows;
+	}
+
+private:
+	/*
+	 * Flush the output and record the windows whose tiles have all been
+	 * written. Windows still waiting on a tile are recorded later.
+	 */
+	GALGError checkpoint() {
+		std::vector<int> written;
+		std::vector<GALGWindow> waiting;
+		for (size_t i = 0; i < this->unrecorded.size(); ++i) {
+			if (this->sink->isWritten(this->unrecorded[i])) {
+				written.push_back(this->unrecorded[i].index);
+			} else {
+				waiting.push_back(this->unrecorded[i]);
+			}
+		}
+		this->unrecorded.swap(waiting);
+		this->lastCheckpoint = time(NULL);
+		if (written.empty()) {
+			GALGError err = { 0, NULL };
+			return err;
+		}
+		this->sink->flush();
+		return this->journal->record(written);
+	}
+
+	GALGError readWindow(WindowReader *reader, WindowSlot *slot,
+			const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		MapSlot *mapSlot = (MapSlot *) slot;
+		GDALRasterBand *srcBand =
+				((MapReader *) reader)->dataset->GetRasterBand(w.band);
+		if (this->skipHoles && windowIsEmpty(srcBand, w)) {
+			slot->skip = true;
+			return err;
+		}
+
+		GDALDataType eWorkType = this->workTypes[w.band - 1];
+		MappedBand *mappedBand = this->mappedBands[w.band - 1];
+		mapSlot->inputView = NULL;
+		if (mappedBand != NULL) {
+			mapSlot->inputView = mappedBand->getView(w.xOff, w.yOff, w.xSize,
+					w.ySize, eWorkType);
+		} else if (this->isBlockWindow(w)) {
+			mapSlot->srcBlock = srcBand->GetLockedBlockRef(
+					w.xOff / w.xSize, w.yOff / w.ySize);
+			if (mapSlot->srcBlock != NULL) {
+				mapSlot->inputView = mapSlot->srcBlock->GetDataRef();
+			}
+		}
+
+		if (mapSlot->inputView != NULL) {
+			// Nothing to copy
+		} else if (mappedBand != NULL) {
+			err = mappedBand->read(w.xOff, w.yOff, w.xSize, w.ySize,
+					mapSlot->bufInputData, eWorkType);
+			RETURNIFERROR(err);
+		} else if (this->blockCache != NULL) {
+			err = this->blockCache->read(srcBand, w.band, w.xOff, w.yOff,
+					w.xSize, w.ySize, mapSlot->bufInputData,
+					this->workTypes[w.band - 1]);
+			RETURNIFERROR(err);
+		} else {
+			CPLErr eErr = srcBand->RasterIO(GF_Read, w.xOff, w.yOff, w.xSize,
+					w.ySize, mapSlot->bufInputData, w.xSize, w.ySize,
+					this->workTypes[w.band - 1], 0, 0);
+			RETURNIF(eErr != CE_None, 1, "Could not read from source dataset");
+		}
+
+		if (this->skipHoles && this->hasNoData[w.band - 1]) {
+			void *inputData = mapSlot->inputView != NULL ?
+					mapSlot->inputView : mapSlot->bufInputData;
+			slot->skip = windowIsNoData(inputData, this->workTypes[w.band - 1],
+					(size_t) w.xSize * w.ySize, this->inNoDataValues[w.band - 1]);
+			if (slot->skip) {
+				mapSlot->dropBlocks();
+			}
+		}
+		return err;
+	}
+
+	GALGError computeWindow(MapSlot *mapSlot, const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		double *inNoDataValue = &this->inNoDataValues[w.band - 1];
+		double *outNoDataValue = &this->outNoDataValues[w.band - 1];
+		GDALDataType eWorkType = this->workTypes[w.band - 1];
+
+		// In place, the first stage reads the source block and the last one
+		// writes the destination block; the slot buffers carry the
+		// intermediate results between stages
+		void *inputData = mapSlot->inputView != NULL ?
+				mapSlot->inputView : mapSlot->bufInputData;
+		void *finalData = NULL;
+		if (this->isBlockWindow(w)) {
+			GDALRasterBand *dstBand = this->dstDataset->GetRasterBand(w.band);
+			mapSlot->dstBlock = dstBand->GetLockedBlockRef(w.xOff / w.xSize,
+					w.yOff / w.ySize, TRUE);
+			RETURNIF(mapSlot->dstBlock == NULL, 1,
+					"Could not write to output dataset");
+			finalData = mapSlot->dstBlock->GetDataRef();
+		}
+
+		// Each stage reads the previous stage's output. The two buffers
+		// swap roles after every stage, so the result of the final stage
+		// is always left in bufOutputData.
+		for (size_t i = 0; i < this->processorArray.size(); ++i) {
+			IProcessImage *processor = this->processorArray[i];
+			bool last = i + 1 == this->processorArray.size();
+			void *outputData = (last && finalData != NULL) ?
+					finalData : mapSlot->bufOutputData;
+			if (eWorkType == GDT_Float32) {
+				err = processor->processImage((float *) inputData,
+						(float *) outputData, w.xSize, w.ySize, inNoDataValue,
+						outNoDataValue);
+			} else {
+				err = processor->processImageNative(inputData, outputData,
+						eWorkType, w.xSize, w.ySize, inNoDataValue,
+						outNoDataValue);
+			}
+			RETURNIFERROR(err);
+			if (!last) {
+				std::swap(mapSlot->bufInputData, mapSlot->bufOutputData);
+				inputData = mapSlot->bufInputData;
+				inNoDataValue = outNoDataValue;
+			}
+		}
+		if (this->statistics != NULL) {
+			this->addStatistics(mapSlot,
+					finalData != NULL ? finalData : mapSlot->bufOutputData, w);
+		}
+		return err;
+	}
+
+	/*
+	 * Statistics of the pixels of a window's output that stay in the output
+	 */
+	void addStatistics(MapSlot *slot, const void *outputData,
+			const GALGWindow &w) {
+		slot->statistics = this->emptyStatistics[w.band - 1];
+		const GALGWindow &owned = this->owned[w.index];
+		GDALDataType eWorkType = this->workTypes[w.band - 1];
+		int nPixelBytes = GDALGetDataTypeSize(eWorkType) / 8;
+		for (int y = owned.yOff; y < owned.yOff + owned.ySize; ++y) {
+			slot->statistics.add(
+					(const GByte *) outputData
+							+ ((size_t) (y - w.yOff) * w.xSize
+									+ (owned.xOff - w.xOff)) * nPixelBytes,
+					eWorkType, nPixelBytes, owned.xSize);
+		}
+	}
+
+	/*
+	 * Whether a window can be processed in place in GDAL's block cache:
+	 * it must be exactly one whole block of both source and destination
+	 * in both bands' data type, and all of it owned. A read window that
+	 * happens to cover one block but carries a halo shares its tile with
+	 * the neighbours' owned pixels, which the tile sink writes over it.
+	 */
+	bool isBlockWindow(const GALGWindow &w) {
+		if (!this->zeroCopy) {
+			return false;
+		}
+		const GALGWindow &o = this->owned[w.index];
+		if (o.xOff != w.xOff || o.yOff != w.yOff || o.xSize != w.xSize
+				|| o.ySize != w.ySize) {
+			return false;
+		}
+		GDALRasterBand *srcBand = this->srcDataset->GetRasterBand(w.band);
+		GDALRasterBand *dstBand = this->dstDataset->GetRasterBand(w.band);
+		int srcBlockXSize, srcBlockYSize, dstBlockXSize, dstBlockYSize;
+		srcBand->GetBlockSize(&srcBlockXSize, &srcBlockYSize);
+		dstBand->GetBlockSize(&dstBlockXSize, &dstBlockYSize);
+		return this->workTypes[w.band - 1] == srcBand->GetRasterDataType()
+				&& this->workTypes[w.band - 1] == dstBand->GetRasterDataType()
+				&& srcBlockXSize == dstBlockXSize
+				&& srcBlockYSize == dstBlockYSize && w.xSize == srcBlockXSize
+				&& w.ySize == srcBlockYSize && w.xOff % srcBlockXSize == 0
+				&& w.yOff % srcBlockYSize == 0;
+	}
+
+	std::vector<IProcessImage *> &processorArray;
+	const char *inputPathStr;
+	GDALDataset *srcDataset, *dstDataset;
+	int maxXSize, maxYSize;
+	int nReaders;
+	size_t maxPixelBytes;
+	bool skipHoles;
+	BlockCache *blockCache;
+	BufferPool *pool;
+	bool zeroCopy;
+	std::vector<MappedBand *> mappedBands;
+	std::vector<GDALDataType> workTypes;
+	std::vector<bool> hasNoData;
+	std::vector<double> inNoDataValues, outNoDataValues;
+	std::vector<RasterStatistics> *statistics;
+	std::vector<RasterStatistics> emptyStatistics;
+	const std::vector<GALGWindow> &owned;
+	TileSink *sink;
+	CPLMutex *readMutex;
+	CheckpointJournal *journal;
+	int checkpointInterval;
+	time_t lastCheckpoint;
+	std::vector<GALGWindow> unrecorded;
+	GIntBig nInPlaceWindows;
+};
+
+/*
+ * Plan every window of nBands bands of a dataset up front. The same windows
+ * are visited for each band, in the same order as a serial run.
+ * The owned regions of the windows tile the raster; each window is its
+ * owned region widened by the pixel buffer on every side (within the
+ * raster), so that every owned pixel has its whole neighbourhood.
+ * owned, if given, receives the owned regions, by window index.
+ * maxXSize and maxYSize receive the largest window, halo included.
+ */
+static GALGError planWindows(GDALDataset *dataset, int nBands,
+		int *windowXSize, int *windowYSize, int pixelBuffer,
+		GIntBig budgetBytes, int bytesPerPixel,
+		std::vector<GALGWindow> &windows, int &maxXSize, int &maxYSize,
+		std::vector<GALGWindow> *owned = NULL) {
+	GALGError result = { 0, NULL };
+
+	BlockIterator *iterator = new BlockIterator(dataset);
+	if (windowXSize != NULL && windowYSize != NULL) {
+		result = iterator->setBlockSize(*windowXSize, *windowYSize);
+	} else {
+		// Snap windows to the source tiling so each block is decoded once
+		int xSize, ySize;
+		WindowPlanner planner(dataset);
+		planner.setMemoryBudget(budgetBytes);
+		planner.setBytesPerPixel(bytesPerPixel);
+		planner.setBufferSize(pixelBuffer);
+		planner.plan(&xSize, &ySize);
+		result = iterator->setBlockSize(xSize, ySize);
+	}
+	std::vector<GALGWindow> regions;
+	if (result.errnum == 0) {
+		WindowEngine::collectWindows(*iterator, nBands, regions);
+	}
+	delete iterator;
+
+	int rasterXSize = dataset->GetRasterXSize();
+	int rasterYSize = dataset->GetRasterYSize();
+	windows = regions;
+	for (size_t i = 0; i < windows.size(); ++i) {
+		GALGWindow &w = windows[i];
+		w.xOff = std::max(0, regions[i].xOff - pixelBuffer);
+		w.yOff = std::max(0, regions[i].yOff - pixelBuffer);
+		w.xSize = std::min(rasterXSize,
+				regions[i].xOff + regions[i].xSize + pixelBuffer) - w.xOff;
+		w.ySize = std::min(rasterYSize,
+				regions[i].yOff + regions[i].ySize + pixelBuffer) - w.yOff;
+	}
+	if (owned != NULL) {
+		owned->swap(regions);
+	}
+
+	maxXSize = 1;
+	maxYSize = 1;
+	for (size_t i = 0; i < windows.size(); ++i) {
+		maxXSize = std::max(maxXSize, windows[i].xSize);
+		maxYSize = std::max(maxYSize, windows[i].ySize);
+	}
 	return result;
 }
 
-GALGError RasterProcess::mapMany(std::vector<IProcessImage *> &processorArray,
-		const char *inputPathStr, const char *outputPathStr, int *windowXSize,
-		int *windowYSize, int *nPixelBuffer, bool skipHoles) {
+/*
+ * The share of the memory budget available to each in-flight window
+ */
+GIntBig RasterProcess::windowBudget() {
+	int nSlots = std::max(this->engine->getNumThreads(),
+			this->engine->getPipelineDepth());
+	return std::max((GIntBig) 1, this->memoryBudget / std::max(nSlots, 1));
+}
+
+/*
+ * The output options, with the number of compression threads resolved
+ */
+OutputOptions RasterProcess::writeOptions() {
+	OutputOptions options = this->outputOptions;
+	if (options.getCompressionThreads() == 0) {
+		options.setCompressionThreads(this->engine->getNumThreads());
+	}
+	return options;
+}
+
+GALGError RasterProcess::setBlockCacheSize(GIntBig budgetBytes) {
+	return this->blockCache->setBudget(budgetBytes);
+}
+
+GIntBig RasterProcess::getBlockCacheHits() {
+	return this->blockCache->getHits();
+}
+
+GIntBig RasterProcess::getBlockCacheMisses() {
+	return this->blockCache->getMisses();
+}
+
+GIntBig RasterProcess::getPeakBufferBytes() {
+	return this->bufferPool->getPeakBytes();
+}
+
+GIntBig RasterProcess::getInPlaceWindows() {
+	return this->nInPlaceWindows;
+}
+
+void RasterProcess::releaseBuffers() {
+	this->bufferPool->trim();
+}
 
-	GALGError result = { 1, "Not Implemented" };
+void RasterProcess::setMemoryMapInput(bool memoryMapInput) {
+	this->memoryMapInput = memoryMapInput;
+}
 
-	// TODO
+void RasterProcess::setOutputStatistics(
+		std::vector<RasterStatistics> *statistics) {
+	this->outputStatistics = statistics;
+}
 
+GALGError RasterProcess::setCheckpointing(bool checkpointing,
+		int intervalSeconds, const char *jobKey) {
+	GALGError result = { 0, NULL };
+	RETURNIF(intervalSeconds < 0, 1,
+			"Checkpoint interval must not be negative");
+	this->checkpointing = checkpointing;
+	this->checkpointInterval = intervalSeconds;
+	this->checkpointKey = jobKey != NULL ? jobKey : "";
 	return result;
 }
 
-GALGError RasterProcess::reduce(IProcessImage &processor,
-		const char **inputPathStrArray, const char *outputPathStr,
-		int *windowXSize, int *windowYSize, int *nPixelBuffer, bool skipHoles) {
-	GALGError result = { 1, "Not Implemented" };
+/*
+ * The key a checkpoint journal is kept under: the source's path, size in
+ * bytes, raster size and band count, and the caller's key for the rest
+ */
+static std::string journalKey(GDALDataset *srcDataset,
+		const std::string &jobKey) {
+	const char *pathStr = srcDataset->GetDescription();
+	VSIStatBufL stat;
+	GIntBig nBytes = -1;
+	if (pathStr != NULL && pathStr[0] != '\0' && VSIStatL(pathStr, &stat) == 0) {
+		nBytes = (GIntBig) stat.st_size;
+	}
+	std::string key = pathStr != NULL ? pathStr : "";
+	key += CPLSPrintf("\n" CPL_FRMT_GIB " %d %d %d\n", nBytes,
+			srcDataset->GetRasterXSize(), srcDataset->GetRasterYSize(),
+			srcDataset->GetRasterCount());
+	return key + jobKey;
+}
+
+void RasterProcess::setOutputOptions(const OutputOptions &options) {
+	this->outputOptions = options;
+}
+
+const OutputOptions &RasterProcess::getOutputOptions() {
+	return this->outputOptions;
+}
 
-	// TODO
+GALGError RasterProcess::setMemoryBudget(GIntBig budgetBytes) {
+	GALGError result = { 0, NULL };
+	RETURNIF(budgetBytes <= 0, 1, "Memory budget must be positive");
+	this->memoryBudget = budgetBytes;
+	return result;
+}
+
+GALGError RasterProcess::setNumThreads(int nThreads) {
+	return this->engine->setNumThreads(nThreads);
+}
+
+GALGError RasterProcess::setPipelineDepth(int nSlots) {
+	return this->engine->setPipelineDepth(nSlots);
+}
+
+GALGError RasterProcess::map(IProcessImage &processor, const char *inputPathStr,
+		const char *outputPathStr, int *windowXSize, int *windowYSize,
+		int *nPixelBuffer, bool skipHoles) {
+	std::vector<IProcessImage *> processorArray(1, &processor);
+	return this->mapMany(processorArray, inputPathStr, outputPathStr,
+			windowXSize, windowYSize, nPixelBuffer, skipHoles);
+}
+
+GALGError RasterProcess::mapMany(std::vector<IProcessImage *> &processorArray,
+		const char *inputPathStr, const char *outputPathStr, int *windowXSize,
+		int *windowYSize, int *nPixelBuffer, bool skipHoles) {
+	// Open the input dataset and verify
+	GDALDataset *srcDataset = (GDALDataset *) GDALOpen(inputPathStr,
+			GA_ReadOnly);
 
+	// If the assesrtion is TRUE, exit the function with a suitable error
+	RETURNIF(srcDataset == NULL, 1, "Could not open source dataset");
+	GALGError result = this->mapMany(processorArray, srcDataset,
+			outputPathStr, windowXSize, windowYSize, nPixelBuffer, skipHoles);
+	GDALClose(srcDataset);
 	return result;
 }
 
+GALGError RasterProcess::map(IProcessImage &processor,
+		GDALDataset *srcDataset, const char *outputPathStr, int *windowXSize,
+		int *windowYSize, int *nPixelBuffer, bool skipHoles,
+		GDALDataset **resultDataset) {
+	std::vector<IProcessImage *> processorArray(1, &processor);
+	return this->mapMany(processorArray, srcDataset, outputPathStr,
+			windowXSize, windowYSize, nPixelBuffer, skipHoles, resultDataset);
+}
+
+GALGError RasterProcess::mapMany(std::vector<IProcessImage *> &processorArray,
+		GDALDataset *srcDataset, const char *outputPathStr, int *windowXSize,
+		int *windowYSize, int *nPixelBuffer, bool skipHoles,
+		GDALDataset **resultDataset) {
+
+	GALGError result = { 0, NULL };
+	if (resultDataset != NULL) {
+		*resultDataset = NULL;
+	}
+	this->nInPlaceWindows = 0;
+	RETURNIF(srcDataset == NULL, 1, "No source dataset");
+	RETURNIF(processorArray.empty(), 1, "No processing functions given");
+
+	// Each neighbourhood stage consumes its own pixel buffer from the
+	// (already shrunk) valid region of the previous stage, so the
+	// window must carry the sum of all stage buffers
+	int chainBuffer = 0;
+	for (size_t i = 0; i < processorArray.size(); ++i) {
+		RETURNIF(processorArray[i] == NULL, 1, "Processing function is NULL");
+		chainBuffer += processorArray[i]->getPixelBuffer();
+	}
+	int pixelBuffer = chainBuffer;
+	if (nPixelBuffer != NULL && *nPixelBuffer > pixelBuffer) {
+		pixelBuffer = *nPixelBuffer;
+	}
+
+	std::vector<GALGWindow> windows, owned;
+	int maxXSize, maxYSize;
+	// An input and output buffer of (at most) doubles per window
+	result = planWindows(srcDataset, srcDataset->GetRasterCount(), windowXSize,
+			windowYSize, pixelBuffer, this->windowBudget(),
+			2 * sizeof(double), windows, maxXSize, maxYSize, &owned);
+	RETURNIFERROR(result);
+
+	// With checkpoints, an interrupted run of the same job left its output
+	// and a journal of the windows already in it
+	CheckpointJournal journal;
+	std::vector<bool> done(windows.size(), false);
+	GDALDataset *dstDataset = NULL;
+	if (this->checkpointing) {
+		RETURNIF(EQUAL(this->outputOptions.getDriver(), "MEM"), 1,
+				"Checkpoints need an output file");
+		std::string journalPathStr = std::string(outputPathStr) + ".journal";
+		result = journal.open(journalPathStr.c_str(),
+				journalKey(srcDataset, this->checkpointKey).c_str(), windows,
+				done);
+		RETURNIFERROR(result);
+		if (std::find(done.begin(), done.end(), true) != done.end()) {
+			dstDataset = reopenOutputDataset(this->outputOptions, srcDataset,
+					outputPathStr);
+			if (dstDataset == NULL) {
+				done.assign(windows.size(), false);
+				result = journal.reset();
+				RETURNIFERROR(result);
+			}
+		}
+	}
+
+	// Create output dataset and verify
+	if (dstDataset == NULL) {
+		result = createOutputDataset(this->writeOptions(), srcDataset,
+				outputPathStr, dstDataset, skipHoles,
+				srcDataset->GetRasterCount());
+		RETURNIFERROR(result);
+	}
+
+	// Windows may finish in any order; the sink writes each output tile
+	// once all of it has arrived
+	TileSink sink;
+	result = sink.open(dstDataset, owned, this->memoryBudget);
+	std::vector<GALGWindow> remaining;
+	for (size_t i = 0; i < windows.size() && result.errnum == 0; ++i) {
+		if (done[i]) {
+			result = sink.restore(windows[i]);
+		} else {
+			remaining.push_back(windows[i]);
+		}
+	}
+
+	// Apply the chain of process functions to each sub window of each band
+	// in the dataset
+	if (result.errnum == 0) {
+		// Cached blocks belong to this job's source only
+		this->blockCache->clear();
+		std::vector<RasterStatistics> *statistics = this->outputStatistics;
+		if (statistics != NULL) {
+			int nBands = dstDataset->GetRasterCount();
+			RasterStatistics settings =
+					statistics->empty() ? RasterStatistics() : (*statistics)[0];
+			statistics->resize(nBands, settings);
+			for (int iBand = 0; iBand < nBands; ++iBand) {
+				int bHasNoData;
+				double noDataValue =
+						dstDataset->GetRasterBand(iBand + 1)->GetNoDataValue(
+								&bHasNoData);
+				(*statistics)[iBand].reset();
+				(*statistics)[iBand].setNoData(bHasNoData != 0, noDataValue);
+			}
+		}
+		MapJob job(processorArray, reopenPath(srcDataset), srcDataset,
+				dstDataset, maxXSize, maxYSize, skipHoles,
+				this->blockCache->isEnabled() ? this->blockCache : NULL,
+				this->bufferPool, this->engine->getNumThreads() == 1
+						&& this->engine->getPipelineDepth() == 0,
+				this->memoryMapInput, statistics, &sink, owned);
+		if (this->checkpointing) {
+			job.setCheckpoint(&journal, this->checkpointInterval);
+		}
+		result = this->engine->run(job, remaining);
+		this->nInPlaceWindows = job.getInPlaceWindows();
+		GALGError sinkErr = sink.close();
+		if (result.errnum == 0) {
+			result = sinkErr;
+		}
+	}
+
+	result = closeOutputDataset(this->writeOptions(), dstDataset,
+			outputPathStr, result, resultDataset, this->checkpointing);
+	// The journal outlives a failed run, to resume from
+	if (this->checkpointing && result.errnum == 0) {
+		result = journal.remove();
+	}
+	return result;
+}
+
+/*
+ * Input and output buffers holding every band of one window for a MapBandsJob
+ */
+class MapBandsSlot: public WindowSlot {
+
+public:
+	MapBandsSlot(BufferPool *pool) :
+			bufInputData(NULL), bufOutputData(NULL), pool(pool) {
+	}
+	~MapBandsSlot() {
+		this->pool->release(this->bufInputData);
+		this->pool->release(this->bufOutputData);
+	}
+	float *bufInputData, *bufOutputData;
+
+private:
+	BufferPool *pool;
+};
+
+/*
+ * Reads all bands of each window with a single dataset RasterIO, in the
+ * interleaving the processor asks for, and writes the owned region of all
+ * output bands back the same way.
+ * Without an inputPathStr, every reader shares the source dataset and
+ * reads one at a time.
+ */
+class MapBandsJob: public WindowJob {
+
+public:
+	MapBandsJob(IProcessBands &processor, const char *inputPathStr,
+			GDALDataset *srcDataset, GDALDataset *dstDataset, int maxXSize,
+			int maxYSize, BufferPool *pool,
+			const std::vector<GALGWindow> &owned) :
+			processor(processor), inputPathStr(inputPathStr), srcDataset(
+					srcDataset), dstDataset(dstDataset), maxXSize(maxXSize), maxYSize(
+					maxYSize), nReaders(0), pool(pool), owned(owned), readMutex(
+					NULL) {
+		int bSuccess;
+		if (inputPathStr == NULL) {
+			this->readMutex = CPLCreateMutex();
+			CPLReleaseMutex(this->readMutex);
+		}
+		this->nInputBands = srcDataset->GetRasterCount();
+		this->nOutputBands = dstDataset->GetRasterCount();
+		this->interleave = processor.getInterleave();
+		for (int iBand = 0; iBand < this->nInputBands; ++iBand) {
+			inNoDataValues.push_back(
+					srcDataset->GetRasterBand(iBand + 1)->GetNoDataValue(
+							&bSuccess));
+		}
+		for (int iBand = 0; iBand < this->nOutputBands; ++iBand) {
+			outNoDataValues.push_back(
+					dstDataset->GetRasterBand(iBand + 1)->GetNoDataValue(
+							&bSuccess));
+		}
+	}
+
+	~MapBandsJob() {
+		if (this->readMutex != NULL) {
+			CPLDestroyMutex(this->readMutex);
+		}
+	}
+
+	GALGError createReader(WindowReader *&reader) {
+		GALGError err = { 0, NULL };
+		if (this->nReaders == 0 || this->inputPathStr == NULL) {
+			reader = new MapReader(this->srcDataset, false, this->readMutex);
+		} else {
+			GDALDataset *dataset = (GDALDataset *) GDALOpen(this->inputPathStr,
+					GA_ReadOnly);
+			RETURNIF(dataset == NULL, 1, "Could not open source dataset");
+			reader = new MapReader(dataset, true);
+		}
+		this->nReaders++;
+		return err;
+	}
+
+	GALGError createSlot(WindowSlot *&slot) {
+		GALGError err = { 0, NULL };
+		MapBandsSlot *bandsSlot = new MapBandsSlot(this->pool);
+		slot = bandsSlot;
+
+		size_t nBandBytes = (size_t) this->maxXSize * this->maxYSize
+				* sizeof(float);
+		bandsSlot->bufInputData = (float *) this->pool->acquire(
+				nBandBytes * this->nInputBands);
+		bandsSlot->bufOutputData = (float *) this->pool->acquire(
+				nBandBytes * this->nOutputBands);
+		RETURNIF(
+				bandsSlot->bufInputData == NULL || bandsSlot->bufOutputData == NULL,
+				1, "Unable to allocate data arrays");
+		return err;
+	}
+
+	GALGError read(WindowReader *reader, WindowSlot *slot,
+			const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		MapReader *mapReader = (MapReader *) reader;
+		if (mapReader->lock != NULL) {
+			CPLAcquireMutex(mapReader->lock, 1000.0);
+		}
+		CPLErr eErr = this->rasterIO(mapReader->dataset, GF_Read, w, w,
+				((MapBandsSlot *) slot)->bufInputData, this->nInputBands);
+		if (mapReader->lock != NULL) {
+			CPLReleaseMutex(mapReader->lock);
+		}
+		RETURNIF(eErr != CE_None, 1, "Could not read from source dataset");
+		return err;
+	}
+
+	GALGError compute(WindowSlot *slot, const GALGWindow &w) {
+		MapBandsSlot *bandsSlot = (MapBandsSlot *) slot;
+		return this->processor.processBands(bandsSlot->bufInputData,
+				this->nInputBands, bandsSlot->bufOutputData,
+				this->nOutputBands, w.xSize, w.ySize, &this->inNoDataValues[0],
+				&this->outNoDataValues[0]);
+	}
+
+	GALGError write(WindowSlot *slot, const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		CPLErr eErr = this->rasterIO(this->dstDataset, GF_Write, w,
+				this->owned[w.index], ((MapBandsSlot *) slot)->bufOutputData,
+				this->nOutputBands);
+		RETURNIF(eErr != CE_None, 1, "Could not write to output dataset");
+		return err;
+	}
+
+private:
+	/*
+	 * Transfer region (part of window w) between a dataset and the buffer
+	 * holding window w
+	 */
+	CPLErr rasterIO(GDALDataset *dataset, GDALRWFlag eRWFlag,
+			const GALGWindow &w, const GALGWindow &region, float *buffer,
+			int nBands) {
+		// Band interleaving stores each band as a plane of the window. For
+		// pixel interleaving the bands of each pixel are adjacent
+		GSpacing nPixelSpace = sizeof(float);
+		GSpacing nBandSpace = (GSpacing) sizeof(float) * w.xSize * w.ySize;
+		if (this->interleave == GALG_INTERLEAVE_PIXEL) {
+			nPixelSpace = (GSpacing) sizeof(float) * nBands;
+			nBandSpace = sizeof(float);
+		}
+		GSpacing nLineSpace = nPixelSpace * w.xSize;
+		GByte *data = (GByte *) buffer + (region.yOff - w.yOff) * nLineSpace
+				+ (region.xOff - w.xOff) * nPixelSpace;
+		return dataset->RasterIO(eRWFlag, region.xOff, region.yOff,
+				region.xSize, region.ySize, data, region.xSize, region.ySize,
+				GDT_Float32, nBands, NULL, nPixelSpace, nLineSpace, nBandSpace);
+	}
+
+	IProcessBands &processor;
+	const char *inputPathStr;
+	GDALDataset *srcDataset, *dstDataset;
+	int maxXSize, maxYSize;
+	int nReaders;
+	int nInputBands, nOutputBands;
+	GALGInterleave interleave;
+	BufferPool *pool;
+	const std::vector<GALGWindow> &owned;
+	CPLMutex *readMutex;
+	std::vector<double> inNoDataValues, outNoDataValues;
+};
+
+GALGError RasterProcess::mapBands(IProcessBands &processor,
+		const char *inputPathStr, const char *outputPathStr, int *windowXSize,
+		int *windowYSize, int *nPixelBuffer, bool skipHoles) {
+	GDALDataset *srcDataset = (GDALDataset *) GDALOpen(inputPathStr,
+			GA_ReadOnly);
+	RETURNIF(srcDataset == NULL, 1, "Could not open source dataset");
+	GALGError result = this->mapBands(processor, srcDataset, outputPathStr,
+			windowXSize, windowYSize, nPixelBuffer, skipHoles);
+	GDALClose(srcDataset);
+	return result;
+}
+
+GALGError RasterProcess::mapBands(IProcessBands &processor,
+		GDALDataset *srcDataset, const char *outputPathStr, int *windowXSize,
+		int *windowYSize, int *nPixelBuffer, bool skipHoles,
+		GDALDataset **resultDataset) {
+
+	GALGError result = { 0, NULL };
+	if (resultDataset != NULL) {
+		*resultDataset = NULL;
+	}
+	RETURNIF(srcDataset == NULL, 1, "No source dataset");
+	int pixelBuffer = processor.getPixelBuffer();
+	if (nPixelBuffer != NULL && *nPixelBuffer > pixelBuffer) {
+		pixelBuffer = *nPixelBuffer;
+	}
+
+	GDALDataset *dstDataset;
+	int nOutputBands = processor.getOutputBandCount(
+			srcDataset->GetRasterCount());
+	RETURNIF(nOutputBands < 1, 1,
+			"Processing function must output at least one band");
+	result = createOutputDataset(this->writeOptions(), srcDataset,
+			outputPathStr, dstDataset, skipHoles, nOutputBands);
+	RETURNIFERROR(result);
+
+	// Windows are planned once; each one covers every band
+	std::vector<GALGWindow> windows, owned;
+	int maxXSize, maxYSize;
+	result = planWindows(srcDataset, 1, windowXSize, windowYSize, pixelBuffer,
+			this->windowBudget(),
+			(srcDataset->GetRasterCount() + nOutputBands) * sizeof(float),
+			windows, maxXSize, maxYSize, &owned);
+
+	if (result.errnum == 0) {
+		MapBandsJob job(processor, reopenPath(srcDataset), srcDataset,
+				dstDataset, maxXSize, maxYSize, this->bufferPool, owned);
+		result = this->engine->run(job, windows);
+	}
+
+	return closeOutputDataset(this->writeOptions(), dstDataset, outputPathStr,
+			result, resultDataset);
+}
+
+GALGError RasterProcess::mapRows(IProcessImage &processor,
+		const char *inputPathStr, const char *outputPathStr, int *stripHeight,
+		int *nPixelBuffer) {
+	GDALDataset *srcDataset = (GDALDataset *) GDALOpen(inputPathStr,
+			GA_ReadOnly);
+	RETURNIF(srcDataset == NULL, 1, "Could not open source dataset");
+	GALGError result = this->mapRows(processor, srcDataset, outputPathStr,
+			stripHeight, nPixelBuffer);
+	GDALClose(srcDataset);
+	return result;
+}
+
+GALGError RasterProcess::mapRows(IProcessImage &processor,
+		GDALDataset *srcDataset, const char *outputPathStr, int *stripHeight,
+		int *nPixelBuffer, GDALDataset **resultDataset) {
+
+	GALGError result = { 0, NULL };
+	if (resultDataset != NULL) {
+		*resultDataset = NULL;
+	}
+	RETURNIF(srcDataset == NULL, 1, "No source dataset");
+	int pixelBuffer = processor.getPixelBuffer();
+	if (nPixelBuffer != NULL && *nPixelBuffer > pixelBuffer) {
+		pixelBuffer = *nPixelBuffer;
+	}
+
+	GDALDataset *dstDataset;
+	result = createOutputDataset(this->writeOptions(), srcDataset,
+			outputPathStr, dstDataset, false, srcDataset->GetRasterCount());
+	RETURNIFERROR(result);
+
+	int nXSize = srcDataset->GetRasterXSize();
+	void *bufInputData = NULL, *bufOutputData = NULL;
+	for (int iBand = 1;
+			iBand <= srcDataset->GetRasterCount() && result.errnum == 0;
+			++iBand) {
+		GDALRasterBand *srcBand = srcDataset->GetRasterBand(iBand);
+		GDALRasterBand *dstBand = dstDataset->GetRasterBand(iBand);
+		int bSuccess;
+		double inNoDataValue = srcBand->GetNoDataValue(&bSuccess);
+		double outNoDataValue = dstBand->GetNoDataValue(&bSuccess);
+		GDALDataType eWorkType = srcBand->GetRasterDataType();
+		if (eWorkType != dstBand->GetRasterDataType()
+				|| !processor.supportsDataType(eWorkType)) {
+			eWorkType = GDT_Float32;
+		}
+		size_t nRowBytes = (size_t) nXSize * (GDALGetDataTypeSize(eWorkType) / 8);
+
+		// Strips default to the source's own strips (or tile rows)
+		RowIterator iterator(srcDataset, pixelBuffer);
+		int nStripHeight;
+		if (stripHeight != NULL) {
+			nStripHeight = *stripHeight;
+		} else {
+			int nBlockXSize;
+			srcBand->GetBlockSize(&nBlockXSize, &nStripHeight);
+			nStripHeight = std::min(nStripHeight, srcDataset->GetRasterYSize());
+		}
+		result = iterator.setStripHeight(nStripHeight);
+		if (result.errnum != 0) {
+			break;
+		}
+
+		// Both buffers only ever hold one view of the raster
+		this->bufferPool->release(bufInputData);
+		this->bufferPool->release(bufOutputData);
+		bufInputData = this->bufferPool->acquire(
+				nRowBytes * iterator.getMaxViewHeight());
+		bufOutputData = this->bufferPool->acquire(
+				nRowBytes * iterator.getMaxViewHeight());
+		if (bufInputData == NULL || bufOutputData == NULL) {
+			result.errnum = 1;
+			result.msg = "Unable to allocate data arrays";
+			break;
+		}
+
+		int stripYOff, stripYSize, viewYOff, viewYSize, readYOff, readYSize;
+		int prevViewYOff = 0;
+		while (iterator.next(&stripYOff, &stripYSize, &viewYOff, &viewYSize,
+				&readYOff, &readYSize)) {
+			// Slide the rows still in view to the top of the buffer
+			// and read the new ones below them
+			int nKept = readYOff - viewYOff;
+			if (nKept > 0 && viewYOff > prevViewYOff) {
+				memmove(bufInputData,
+						(GByte *) bufInputData
+								+ (viewYOff - prevViewYOff) * nRowBytes,
+						nKept * nRowBytes);
+			}
+			prevViewYOff = viewYOff;
+			if (readYSize > 0) {
+				CPLErr eErr = srcBand->RasterIO(GF_Read, 0, readYOff, nXSize,
+						readYSize, (GByte *) bufInputData + nKept * nRowBytes,
+						nXSize, readYSize, eWorkType, 0, 0);
+				if (eErr != CE_None) {
+					result.errnum = 1;
+					result.msg = "Could not read from source dataset";
+					break;
+				}
+			}
+
+			if (eWorkType == GDT_Float32) {
+				result = processor.processImage((float *) bufInputData,
+						(float *) bufOutputData, nXSize, viewYSize,
+						&inNoDataValue, &outNoDataValue);
+			} else {
+				result = processor.processImageNative(bufInputData,
+						bufOutputData, eWorkType, nXSize, viewYSize,
+						&inNoDataValue, &outNoDataValue);
+			}
+			if (result.errnum != 0) {
+				break;
+			}
+
+			// Only the strip itself is written; its halo rows belong
+			// to the neighbouring strips
+			CPLErr eErr = dstBand->RasterIO(GF_Write, 0, stripYOff, nXSize,
+					stripYSize,
+					(GByte *) bufOutputData + (stripYOff - viewYOff) * nRowBytes,
+					nXSize, stripYSize, eWorkType, 0, 0);
+			if (eErr != CE_None) {
+				result.errnum = 1;
+				result.msg = "Could not write to output dataset";
+				break;
+			}
+		}
+	}
+	this->bufferPool->release(bufInputData);
+	this->bufferPool->release(bufOutputData);
+
+	return closeOutputDataset(this->writeOptions(), dstDataset, outputPathStr,
+			result, resultDataset);
+}
+
+/*
+ * Source dataset handles, one per input, for a ReduceJob
+ */
+class ReduceReader: public WindowReader {
+
+public:
+	~ReduceReader() {
+		for (size_t i = 0; i < this->datasets.size(); ++i) {
+			if (this->owned[i]) {
+				GDALClose(this->datasets[i]);
+			}
+		}
+	}
+	std::vector<GDALDataset *> datasets;
+	std::vector<bool> owned;
+};
+
+/*
+ * Window buffers for a ReduceJob. An incremental reduction holds one input
+ * window and the accumulator; otherwise one window per input is held.
+ */
+class ReduceSlot: public WindowSlot {
+
+public:
+	ReduceSlot(BufferPool *pool) :
+			bufAccumulator(NULL), bufOutputData(NULL), pool(pool) {
+	}
+	~ReduceSlot() {
+		for (size_t i = 0; i < this->bufInputData.size(); ++i) {
+			this->pool->release(this->bufInputData[i]);
+		}
+		this->pool->release(this->bufAccumulator);
+		this->pool->release(this->bufOutputData);
+	}
+	std::vector<float *> bufInputData;
+	float *bufAccumulator, *bufOutputData;
+
+private:
+	BufferPool *pool;
+};
+
+/*
+ * Reads co-registered windows from every input and reduces them to one
+ * output window. Incremental reductions fold each input into the
+ * accumulator as soon as it is read, during the read stage, so that only
+ * one input window is in memory at a time.
+ * Inputs which cannot be reopened (in-memory datasets) are shared by every
+ * reader and read one at a time.
+ */
+class ReduceJob: public WindowJob {
+
+public:
+	ReduceJob(IReduceImage &reducer, std::vector<GDALDataset *> &srcDatasets,
+			GDALDataset *dstDataset, int maxXSize, int maxYSize,
+			BufferPool *pool, const std::vector<GALGWindow> &owned) :
+			reducer(reducer), srcDatasets(srcDatasets), dstDataset(
+					dstDataset), maxXSize(maxXSize), maxYSize(maxYSize), nReaders(
+					0), pool(pool), owned(owned), readMutex(NULL) {
+		int bSuccess;
+		for (size_t i = 0; i < srcDatasets.size(); ++i) {
+			this->reopenPaths.push_back(reopenPath(srcDatasets[i]));
+			if (this->reopenPaths[i] == NULL && this->readMutex == NULL) {
+				this->readMutex = CPLCreateMutex();
+				CPLReleaseMutex(this->readMutex);
+			}
+		}
+		this->incremental = reducer.isIncremental();
+		int nBands = dstDataset->GetRasterCount();
+		this->inNoDataValues.resize(nBands);
+		for (int iBand = 0; iBand < nBands; ++iBand) {
+			for (size_t i = 0; i < srcDatasets.size(); ++i) {
+				this->inNoDataValues[iBand].push_back(
+						srcDatasets[i]->GetRasterBand(iBand + 1)->GetNoDataValue(
+								&bSuccess));
+			}
+			this->outNoDataValues.push_back(
+					dstDataset->GetRasterBand(iBand + 1)->GetNoDataValue(
+							&bSuccess));
+		}
+	}
+
+	~ReduceJob() {
+		if (this->readMutex != NULL) {
+			CPLDestroyMutex(this->readMutex);
+		}
+	}
+
+	GALGError createReader(WindowReader *&reader) {
+		GALGError err = { 0, NULL };
+		ReduceReader *reduceReader = new ReduceReader();
+		reader = reduceReader;
+		for (size_t i = 0; i < this->srcDatasets.size(); ++i) {
+			if (this->nReaders == 0 || this->reopenPaths[i] == NULL) {
+				reduceReader->datasets.push_back(this->srcDatasets[i]);
+				reduceReader->owned.push_back(false);
+			} else {
+				GDALDataset *dataset = (GDALDataset *) GDALOpen(
+						this->reopenPaths[i], GA_ReadOnly);
+				RETURNIF(dataset == NULL, 1, "Could not open source dataset");
+				reduceReader->datasets.push_back(dataset);
+				reduceReader->owned.push_back(true);
+			}
+		}
+		this->nReaders++;
+		return err;
+	}
+
+	GALGError createSlot(WindowSlot *&slot) {
+		GALGError err = { 0, NULL };
+		ReduceSlot *reduceSlot = new ReduceSlot(this->pool);
+		slot = reduceSlot;
+
+		size_t nBytes = (size_t) this->maxXSize * this->maxYSize * sizeof(float);
+		size_t nInputBuffers = this->incremental ? 1 : this->srcDatasets.size();
+		for (size_t i = 0; i < nInputBuffers; ++i) {
+			float *buffer = (float *) this->pool->acquire(nBytes);
+			reduceSlot->bufInputData.push_back(buffer);
+			RETURNIF(buffer == NULL, 1, "Unable to allocate data arrays");
+		}
+		if (this->incremental) {
+			reduceSlot->bufAccumulator = (float *) this->pool->acquire(
+					nBytes * this->reducer.getAccumulatorCount());
+			RETURNIF(reduceSlot->bufAccumulator == NULL, 1,
+					"Unable to allocate data arrays");
+		}
+		reduceSlot->bufOutputData = (float *) this->pool->acquire(nBytes);
+		RETURNIF(reduceSlot->bufOutputData == NULL, 1,
+				"Unable to allocate data arrays");
+		return err;
+	}
+
+	GALGError read(WindowReader *reader, WindowSlot *slot,
+			const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		ReduceReader *reduceReader = (ReduceReader *) reader;
+		ReduceSlot *reduceSlot = (ReduceSlot *) slot;
+		double *outNoDataValue = &this->outNoDataValues[w.band - 1];
+
+		if (this->incremental) {
+			err = this->reducer.initialise(reduceSlot->bufAccumulator, w.xSize,
+					w.ySize, outNoDataValue);
+			RETURNIFERROR(err);
+		}
+		for (size_t i = 0; i < reduceReader->datasets.size(); ++i) {
+			float *buffer = reduceSlot->bufInputData[this->incremental ? 0 : i];
+			GDALRasterBand *srcBand = reduceReader->datasets[i]->GetRasterBand(
+					w.band);
+			bool shared = this->reopenPaths[i] == NULL;
+			if (shared) {
+				CPLAcquireMutex(this->readMutex, 1000.0);
+			}
+			CPLErr eErr = srcBand->RasterIO(GF_Read, w.xOff, w.yOff, w.xSize,
+					w.ySize, buffer, w.xSize, w.ySize, GDT_Float32, 0, 0);
+			if (shared) {
+				CPLReleaseMutex(this->readMutex);
+			}
+			RETURNIF(eErr != CE_None, 1, "Could not read from source dataset");
+			if (this->incremental) {
+				err = this->reducer.fold(buffer, reduceSlot->bufAccumulator,
+						w.xSize, w.ySize, &this->inNoDataValues[w.band - 1][i],
+						outNoDataValue);
+				RETURNIFERROR(err);
+			}
+		}
+		return err;
+	}
+
+	GALGError compute(WindowSlot *slot, const GALGWindow &w) {
+		ReduceSlot *reduceSlot = (ReduceSlot *) slot;
+		double *outNoDataValue = &this->outNoDataValues[w.band - 1];
+		if (this->incremental) {
+			return this->reducer.finalise(reduceSlot->bufAccumulator,
+					reduceSlot->bufOutputData, w.xSize, w.ySize,
+					(int) this->srcDatasets.size(), outNoDataValue);
+		}
+		return this->reducer.reduceImage(&reduceSlot->bufInputData[0],
+				(int) this->srcDatasets.size(), reduceSlot->bufOutputData,
+				w.xSize, w.ySize, &this->inNoDataValues[w.band - 1][0],
+				outNoDataValue);
+	}
+
+	GALGError write(WindowSlot *slot, const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		// Only the owned region; the halo belongs to the neighbouring windows
+		const GALGWindow &o = this->owned[w.index];
+		GDALRasterBand *dstBand = this->dstDataset->GetRasterBand(w.band);
+		CPLErr eErr = dstBand->RasterIO(GF_Write, o.xOff, o.yOff, o.xSize,
+				o.ySize,
+				((ReduceSlot *) slot)->bufOutputData
+						+ (size_t) (o.yOff - w.yOff) * w.xSize
+						+ (o.xOff - w.xOff), o.xSize, o.ySize, GDT_Float32,
+				sizeof(float), (GSpacing) sizeof(float) * w.xSize);
+		RETURNIF(eErr != CE_None, 1, "Could not write to output dataset");
+		return err;
+	}
+
+private:
+	IReduceImage &reducer;
+	std::vector<GDALDataset *> &srcDatasets;
+	std::vector<const char *> reopenPaths;
+	GDALDataset *dstDataset;
+	int maxXSize, maxYSize;
+	int nReaders;
+	bool incremental;
+	BufferPool *pool;
+	const std::vector<GALGWindow> &owned;
+	CPLMutex *readMutex;
+	std::vector<std::vector<double> > inNoDataValues;
+	std::vector<double> outNoDataValues;
+};
+
+static void closeDatasets(std::vector<GDALDataset *> &datasets) {
+	for (size_t i = 0; i < datasets.size(); ++i) {
+		GDALClose(datasets[i]);
+	}
+	datasets.clear();
+}
+
+GALGError RasterProcess::reduce(IReduceImage &reducer,
+		const char **inputPathStrArray, const char *outputPathStr,
+		int *windowXSize, int *windowYSize, int *nPixelBuffer, bool skipHoles) {
+	GALGError result = { 0, NULL };
+	RETURNIF(inputPathStrArray == NULL || inputPathStrArray[0] == NULL, 1,
+			"No source datasets given");
+
+	std::vector<GDALDataset *> srcDatasets;
+	for (int i = 0; inputPathStrArray[i] != NULL; ++i) {
+		GDALDataset *dataset = (GDALDataset *) GDALOpen(inputPathStrArray[i],
+				GA_ReadOnly);
+		if (dataset == NULL) {
+			closeDatasets(srcDatasets);
+			result.errnum = 1;
+			result.msg = "Could not open source dataset";
+			return result;
+		}
+		srcDatasets.push_back(dataset);
+	}
+	srcDatasets.push_back(NULL);
+	result = this->reduce(reducer, &srcDatasets[0], outputPathStr, windowXSize,
+			windowYSize, nPixelBuffer, skipHoles);
+	srcDatasets.pop_back();
+	closeDatasets(srcDatasets);
+	return result;
+}
+
+GALGError RasterProcess::reduce(IReduceImage &reducer,
+		GDALDataset **srcDatasetArray, const char *outputPathStr,
+		int *windowXSize, int *windowYSize, int *nPixelBuffer, bool skipHoles,
+		GDALDataset **resultDataset) {
+	GALGError result = { 0, NULL };
+	if (resultDataset != NULL) {
+		*resultDataset = NULL;
+	}
+	RETURNIF(srcDatasetArray == NULL || srcDatasetArray[0] == NULL, 1,
+			"No source datasets given");
+
+	// Check every input shares the grid of the first
+	std::vector<GDALDataset *> srcDatasets;
+	for (int i = 0; srcDatasetArray[i] != NULL; ++i) {
+		GDALDataset *dataset = srcDatasetArray[i];
+		RETURNIF(
+				dataset->GetRasterXSize() != srcDatasetArray[0]->GetRasterXSize()
+						|| dataset->GetRasterYSize()
+								!= srcDatasetArray[0]->GetRasterYSize()
+						|| dataset->GetRasterCount()
+								!= srcDatasetArray[0]->GetRasterCount(), 1,
+				"Source datasets must have the same size and band count");
+		srcDatasets.push_back(dataset);
+	}
+
+	GDALDataset *dstDataset;
+	result = createOutputDataset(this->writeOptions(), srcDatasets[0],
+			outputPathStr, dstDataset, skipHoles,
+			srcDatasets[0]->GetRasterCount());
+	RETURNIFERROR(result);
+
+	int pixelBuffer = nPixelBuffer != NULL ? *nPixelBuffer : 0;
+	std::vector<GALGWindow> windows, owned;
+	int maxXSize, maxYSize;
+	// Non-incremental reductions hold every input window at once
+	int nWindowArrays = reducer.isIncremental() ?
+			1 + reducer.getAccumulatorCount() + 1 : (int) srcDatasets.size() + 1;
+	result = planWindows(srcDatasets[0], dstDataset->GetRasterCount(),
+			windowXSize, windowYSize, pixelBuffer, this->windowBudget(),
+			nWindowArrays * sizeof(float), windows, maxXSize, maxYSize, &owned);
+
+	if (result.errnum == 0) {
+		ReduceJob job(reducer, srcDatasets, dstDataset, maxXSize, maxYSize,
+				this->bufferPool, owned);
+		result = this->engine->run(job, windows);
+	}
+
+	return closeOutputDataset(this->writeOptions(), dstDataset, outputPathStr,
+			result, resultDataset);
+}
+
+/*
+ * Buffers for one window of a labelling pass. Each slot has its own
+ * labeller, as labelling keeps working state.
+ */
+class LabelSlot: public WindowSlot {
+
+public:
+	LabelSlot(BufferPool *pool, const WindowLabeller &labeller) :
+			values(NULL), labels(NULL), nLabels(0), labeller(labeller), pool(
+					pool) {
+	}
+	~LabelSlot() {
+		this->pool->release(this->values);
+		this->pool->release(this->labels);
+	}
+	float *values;
+	GUInt32 *labels;
+	GUInt32 nLabels;
+	WindowLabeller labeller;
+
+private:
+	BufferPool *pool;
+};
+
+/*
+ * Both passes of connected-component labelling.
+ *
+ * Each window is labelled on its own; a component's provisional label is
+ * the window index in the high 32 bits and its label within the window in
+ * the low 32 bits. The first pass joins provisional labels across window
+ * edges, in window order, keeping only the bottom rows of the previous row
+ * of windows and the right column of the previous window. The second pass
+ * labels each window again (giving the same labels) and writes the final
+ * label of each component: the rank of its root among all roots.
+ */
+class LabelJob: public WindowJob {
+
+public:
+	LabelJob(const char *inputPathStr, GDALDataset *srcDataset,
+			GDALDataset *dstDataset, const WindowLabeller &labeller,
+			LabelForest &forest, int maxXSize, int maxYSize, BufferPool *pool) :
+			inputPathStr(inputPathStr), srcDataset(srcDataset), dstDataset(
+					dstDataset), labeller(labeller), forest(forest), maxXSize(
+					maxXSize), maxYSize(maxYSize), nReaders(0), pool(pool), relabel(
+					false) {
+		int nXSize = srcDataset->GetRasterXSize();
+		this->aboveLabels.assign(nXSize, 0);
+		this->aboveValues.assign(nXSize, 0.0f);
+		this->bottomLabels.assign(nXSize, 0);
+		this->bottomValues.assign(nXSize, 0.0f);
+	}
+
+	/*
+	 * Switch to the second pass, once the first has run over every window
+	 */
+	GALGError finishScan(GIntBig *nComponents) {
+		GALGError err = { 0, NULL };
+		this->forest.flatten();
+
+		// Joined labels which are not roots, by window, in label order
+		this->nonRoots.assign(this->nLabels.size(), std::vector<GUInt32>());
+		const std::map<GIntBig, GIntBig> &labels = this->forest.getLabels();
+		for (std::map<GIntBig, GIntBig>::const_iterator it = labels.begin();
+				it != labels.end(); ++it) {
+			if (it->second != it->first) {
+				this->nonRoots[(size_t) (it->first >> 32)].push_back(
+						(GUInt32) (it->first & 0xFFFFFFFF));
+			}
+		}
+		// Final labels of each window's roots start after those of earlier windows
+		this->firstLabels.assign(this->nLabels.size(), 0);
+		GIntBig nRoots = 0;
+		for (size_t w = 0; w < this->nLabels.size(); ++w) {
+			this->firstLabels[w] = nRoots;
+			nRoots += this->nLabels[w] - (GIntBig) this->nonRoots[w].size();
+		}
+		RETURNIF(nRoots > 0xFFFFFFFFLL, 1,
+				"Too many components for a UInt32 label raster");
+		if (nComponents != NULL) {
+			*nComponents = nRoots;
+		}
+		this->relabel = true;
+		return err;
+	}
+
+	GALGError createReader(WindowReader *&reader) {
+		GALGError err = { 0, NULL };
+		if (this->nReaders == 0) {
+			reader = new MapReader(this->srcDataset, false);
+		} else {
+			GDALDataset *dataset = (GDALDataset *) GDALOpen(this->inputPathStr,
+					GA_ReadOnly);
+			RETURNIF(dataset == NULL, 1, "Could not open source dataset");
+			reader = new MapReader(dataset, true);
+		}
+		this->nReaders++;
+		return err;
+	}
+
+	GALGError createSlot(WindowSlot *&slot) {
+		GALGError err = { 0, NULL };
+		LabelSlot *labelSlot = new LabelSlot(this->pool, this->labeller);
+		slot = labelSlot;
+		size_t nPixels = (size_t) this->maxXSize * this->maxYSize;
+		labelSlot->values = (float *) this->pool->acquire(
+				nPixels * sizeof(float));
+		labelSlot->labels = (GUInt32 *) this->pool->acquire(
+				nPixels * sizeof(GUInt32));
+		RETURNIF(labelSlot->values == NULL || labelSlot->labels == NULL, 1,
+				"Unable to allocate data arrays");
+		return err;
+	}
+
+	GALGError read(WindowReader *reader, WindowSlot *slot,
+			const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		GDALRasterBand *band = ((MapReader *) reader)->dataset->GetRasterBand(
+				w.band);
+		CPLErr eErr = band->RasterIO(GF_Read, w.xOff, w.yOff, w.xSize, w.ySize,
+				((LabelSlot *) slot)->values, w.xSize, w.ySize, GDT_Float32, 0,
+				0);
+		RETURNIF(eErr != CE_None, 1, "Could not read from source dataset");
+		return err;
+	}
+
+	GALGError compute(WindowSlot *slot, const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		LabelSlot *labelSlot = (LabelSlot *) slot;
+		labelSlot->nLabels = labelSlot->labeller.label(labelSlot->values,
+				w.xSize, w.ySize, labelSlot->labels);
+		if (!this->relabel) {
+			return err;
+		}
+
+		// Final label of each of the window's components
+		std::vector<GUInt32> finalLabels(labelSlot->nLabels + 1, 0);
+		for (GUInt32 l = 1; l <= labelSlot->nLabels; ++l) {
+			finalLabels[l] = this->finalLabel(
+					this->forest.getRoot(provisional(w.index, l)));
+		}
+		size_t nPixels = (size_t) w.xSize * w.ySize;
+		for (size_t i = 0; i < nPixels; ++i) {
+			labelSlot->labels[i] = finalLabels[labelSlot->labels[i]];
+		}
+		return err;
+	}
+
+	GALGError write(WindowSlot *slot, const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		LabelSlot *labelSlot = (LabelSlot *) slot;
+		if (this->relabel) {
+			CPLErr eErr = this->dstDataset->GetRasterBand(w.band)->RasterIO(
+					GF_Write, w.xOff, w.yOff, w.xSize, w.ySize,
+					labelSlot->labels, w.xSize, w.ySize, GDT_UInt32, 0, 0);
+			RETURNIF(eErr != CE_None, 1, "Could not write to output dataset");
+			return err;
+		}
+		if ((size_t) w.index >= this->nLabels.size()) {
+			this->nLabels.resize(w.index + 1, 0);
+		}
+		this->nLabels[w.index] = labelSlot->nLabels;
+		this->joinEdges(labelSlot, w);
+		return err;
+	}
+
+private:
+	static GIntBig provisional(int windowIndex, GUInt32 label) {
+		return ((GIntBig) windowIndex << 32) | label;
+	}
+
+	/*
+	 * The rank of a root among all roots, in window then label order
+	 */
+	GUInt32 finalLabel(GIntBig root) {
+		size_t w = (size_t) (root >> 32);
+		GUInt32 label = (GUInt32) (root & 0xFFFFFFFF);
+		const std::vector<GUInt32> &windowNonRoots = this->nonRoots[w];
+		GIntBig nBefore = std::lower_bound(windowNonRoots.begin(),
+				windowNonRoots.end(), label) - windowNonRoots.begin();
+		return (GUInt32) (this->firstLabels[w] + label - nBefore);
+	}
+
+	/*
+	 * Join the window's components to those of the windows above and to the
+	 * left, then keep its bottom row and right column for the next windows.
+	 * Windows arrive in order, row of windows by row of windows.
+	 */
+	void joinEdges(LabelSlot *slot, const GALGWindow &w) {
+		const float *values = slot->values;
+		const GUInt32 *labels = slot->labels;
+		int nXSize = (int) this->aboveLabels.size();
+		int reach = this->labeller.getConnectivity() == 8 ? 1 : 0;
+
+		if (w.xOff == 0 && w.yOff > 0) {
+			// A new row of windows: the bottom rows gathered so far are now above
+			this->aboveLabels.swap(this->bottomLabels);
+			this->aboveValues.swap(this->bottomValues);
+		}
+		if (w.yOff > 0) {
+			for (int x = 0; x < w.xSize; ++x) {
+				if (labels[x] == 0) {
+					continue;
+				}
+				for (int dx = -reach; dx <= reach; ++dx) {
+					int ax = w.xOff + x + dx;
+					if (ax < 0 || ax >= nXSize || this->aboveLabels[ax] == 0) {
+						continue;
+					}
+					if (this->labeller.connects(this->aboveValues[ax], values[x])) {
+						this->forest.join(this->aboveLabels[ax],
+								provisional(w.index, labels[x]));
+					}
+				}
+			}
+		}
+		if (w.xOff > 0) {
+			for (int y = 0; y < w.ySize; ++y) {
+				size_t i = (size_t) y * w.xSize;
+				if (labels[i] == 0) {
+					continue;
+				}
+				for (int dy = -reach; dy <= reach; ++dy) {
+					int ly = y + dy;
+					if (ly < 0 || ly >= (int) this->leftLabels.size()
+							|| this->leftLabels[ly] == 0) {
+						continue;
+					}
+					if (this->labeller.connects(this->leftValues[ly], values[i])) {
+						this->forest.join(this->leftLabels[ly],
+								provisional(w.index, labels[i]));
+					}
+				}
+			}
+		}
+
+		size_t bottom = (size_t) (w.ySize - 1) * w.xSize;
+		for (int x = 0; x < w.xSize; ++x) {
+			GUInt32 label = labels[bottom + x];
+			this->bottomLabels[w.xOff + x] =
+					label != 0 ? provisional(w.index, label) : 0;
+			this->bottomValues[w.xOff + x] = values[bottom + x];
+		}
+		this->leftLabels.assign(w.ySize, 0);
+		this->leftValues.assign(w.ySize, 0.0f);
+		for (int y = 0; y < w.ySize; ++y) {
+			size_t i = (size_t) y * w.xSize + w.xSize - 1;
+			this->leftLabels[y] = labels[i] != 0 ? provisional(w.index, labels[i]) : 0;
+			this->leftValues[y] = values[i];
+		}
+	}
+
+	const char *inputPathStr;
+	GDALDataset *srcDataset, *dstDataset;
+	const WindowLabeller &labeller;
+	LabelForest &forest;
+	int maxXSize, maxYSize;
+	int nReaders;
+	BufferPool *pool;
+	bool relabel;
+	std::vector<GIntBig> aboveLabels, bottomLabels, leftLabels;
+	std::vector<float> aboveValues, bottomValues, leftValues;
+	std::vector<GUInt32> nLabels;
+	std::vector<std::vector<GUInt32> > nonRoots;
+	std::vector<GIntBig> firstLabels;
+};
+
+GALGError RasterProcess::labelComponents(const char *inputPathStr,
+		const char *outputPathStr, int *windowXSize, int *windowYSize,
+		int connectivity, bool matchValues, GIntBig *nComponents) {
+
+	GALGError result = { 0, NULL };
+	WindowLabeller labeller;
+	result = labeller.setConnectivity(connectivity);
+	RETURNIFERROR(result);
+	labeller.setMatchValues(matchValues);
+
+	GDALDataset *srcDataset;
+	GDALDataset *dstDataset;
+	srcDataset = (GDALDataset *) GDALOpen(inputPathStr, GA_ReadOnly);
+	RETURNIF(srcDataset == NULL, 1, "Could not open source dataset");
+	int bHasNoData;
+	double noDataValue = srcDataset->GetRasterBand(1)->GetNoDataValue(
+			&bHasNoData);
+	labeller.setNoData(bHasNoData != 0, (float) noDataValue);
+
+	result = createOutputDataset(this->writeOptions(), srcDataset,
+			outputPathStr, dstDataset, false, 1, GDT_UInt32);
+	if (result.errnum != 0) {
+		GDALClose(srcDataset);
+		return result;
+	}
+	dstDataset->GetRasterBand(1)->SetNoDataValue(0);
+
+	// Windows without a buffer: labels are joined across their edges instead
+	std::vector<GALGWindow> windows;
+	int maxXSize, maxYSize;
+	result = planWindows(srcDataset, 1, windowXSize, windowYSize, 0,
+			this->windowBudget(), sizeof(float) + sizeof(GUInt32), windows,
+			maxXSize, maxYSize);
+
+	if (result.errnum == 0) {
+		LabelForest forest;
+		LabelJob job(inputPathStr, srcDataset, dstDataset, labeller, forest,
+				maxXSize, maxYSize, this->bufferPool);
+		result = this->engine->run(job, windows);
+		if (result.errnum == 0) {
+			result = job.finishScan(nComponents);
+		}
+		if (result.errnum == 0) {
+			result = this->engine->run(job, windows);
+		}
+	}
+
+	result = closeOutputDataset(this->writeOptions(), dstDataset,
+			outputPathStr, result);
+	GDALClose(srcDataset);
+	return result;
+}
+
+/*
+ * Buffers for one tile of flow routing. Each slot has its own flood, as
+ * flooding keeps the tile's labels between compute and write.
+ */
+class FlowSlot: public WindowSlot {
+
+public:
+	FlowSlot(BufferPool *pool, const TileGrid &grid, bool hasNoData,
+			double noDataValue) :
+			elevations(NULL), filled(NULL), directions(NULL), flood(grid,
+					hasNoData, noDataValue), pool(pool) {
+	}
+	~FlowSlot() {
+		this->pool->release(this->elevations);
+		this->pool->release(this->filled);
+		this->pool->release(this->directions);
+	}
+	double *elevations, *filled;
+	GByte *directions;
+	TileFlood flood;
+	std::vector<GALGSpill> spills;
+
+private:
+	BufferPool *pool;
+};
+
+/*
+ * Both passes of depression filling and flow routing.
+ *
+ * The first pass floods each tile and gathers the spills between labels
+ * into the spill graph. Once it is solved, the second pass floods each tile
+ * again, raises it to the levels of its labels and writes the outputs.
+ */
+class FlowJob: public WindowJob {
+
+public:
+	FlowJob(const char *inputPathStr, GDALDataset *srcDataset,
+			GDALDataset *filledDataset, GDALDataset *directionDataset,
+			const TileGrid &grid, SpillGraph &graph, int maxXSize,
+			int maxYSize, BufferPool *pool) :
+			inputPathStr(inputPathStr), srcDataset(srcDataset), filledDataset(
+					filledDataset), directionDataset(directionDataset), grid(
+					grid), graph(graph), maxXSize(maxXSize), maxYSize(maxYSize), nReaders(
+					0), pool(pool), routing(false) {
+		int bHasNoData;
+		this->noDataValue = srcDataset->GetRasterBand(1)->GetNoDataValue(
+				&bHasNoData);
+		this->hasNoData = bHasNoData != 0;
+	}
+
+	/*
+	 * Switch to the second pass, once the first has run over every tile
+	 */
+	GALGError finishScan() {
+		GALGError err = this->graph.solve();
+		RETURNIFERROR(err);
+		this->routing = true;
+		return err;
+	}
+
+	GALGError createReader(WindowReader *&reader) {
+		GALGError err = { 0, NULL };
+		if (this->nReaders == 0) {
+			reader = new MapReader(this->srcDataset, false);
+		} else {
+			GDALDataset *dataset = (GDALDataset *) GDALOpen(this->inputPathStr,
+					GA_ReadOnly);
+			RETURNIF(dataset == NULL, 1, "Could not open source dataset");
+			reader = new MapReader(dataset, true);
+		}
+		this->nReaders++;
+		return err;
+	}
+
+	GALGError createSlot(WindowSlot *&slot) {
+		GALGError err = { 0, NULL };
+		FlowSlot *flowSlot = new FlowSlot(this->pool, this->grid,
+				this->hasNoData, this->noDataValue);
+		slot = flowSlot;
+		size_t nPixels = (size_t) this->maxXSize * this->maxYSize;
+		// Tiles are read with a halo of 2 cells
+		flowSlot->elevations = (double *) this->pool->acquire(
+				(size_t) (this->maxXSize + 4) * (this->maxYSize + 4)
+						* sizeof(double));
+		flowSlot->filled = (double *) this->pool->acquire(
+				nPixels * sizeof(double));
+		flowSlot->directions = (GByte *) this->pool->acquire(nPixels);
+		RETURNIF(
+				flowSlot->elevations == NULL || flowSlot->filled == NULL
+						|| flowSlot->directions == NULL, 1,
+				"Unable to allocate data arrays");
+		return err;
+	}
+
+	GALGError read(WindowReader *reader, WindowSlot *slot,
+			const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		FlowSlot *flowSlot = (FlowSlot *) slot;
+		int xOff, yOff, xSize, ySize;
+		flowSlot->flood.getReadWindow(w, &xOff, &yOff, &xSize, &ySize);
+		GDALRasterBand *band = ((MapReader *) reader)->dataset->GetRasterBand(
+				w.band);
+		CPLErr eErr = band->RasterIO(GF_Read, xOff, yOff, xSize, ySize,
+				flowSlot->elevations, xSize, ySize, GDT_Float64, 0, 0);
+		RETURNIF(eErr != CE_None, 1, "Could not read from source dataset");
+		return err;
+	}
+
+	GALGError compute(WindowSlot *slot, const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		FlowSlot *flowSlot = (FlowSlot *) slot;
+		if (!this->routing) {
+			flowSlot->spills.clear();
+			flowSlot->flood.flood(flowSlot->elevations, w, &flowSlot->spills);
+			return err;
+		}
+		flowSlot->flood.flood(flowSlot->elevations, w, NULL);
+		flowSlot->flood.route(this->graph, flowSlot->filled,
+				flowSlot->directions);
+		return err;
+	}
+
+	GALGError write(WindowSlot *slot, const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		FlowSlot *flowSlot = (FlowSlot *) slot;
+		if (!this->routing) {
+			this->graph.addSpills(flowSlot->spills);
+			return err;
+		}
+		if (this->filledDataset != NULL) {
+			CPLErr eErr = this->filledDataset->GetRasterBand(1)->RasterIO(
+					GF_Write, w.xOff, w.yOff, w.xSize, w.ySize,
+					flowSlot->filled, w.xSize, w.ySize, GDT_Float64, 0, 0);
+			RETURNIF(eErr != CE_None, 1, "Could not write to output dataset");
+		}
+		if (this->directionDataset != NULL) {
+			CPLErr eErr = this->directionDataset->GetRasterBand(1)->RasterIO(
+					GF_Write, w.xOff, w.yOff, w.xSize, w.ySize,
+					flowSlot->directions, w.xSize, w.ySize, GDT_Byte, 0, 0);
+			RETURNIF(eErr != CE_None, 1, "Could not write to output dataset");
+		}
+		return err;
+	}
+
+private:
+	const char *inputPathStr;
+	GDALDataset *srcDataset, *filledDataset, *directionDataset;
+	const TileGrid &grid;
+	SpillGraph &graph;
+	int maxXSize, maxYSize;
+	int nReaders;
+	BufferPool *pool;
+	bool routing;
+	bool hasNoData;
+	double noDataValue;
+};
+
+GALGError RasterProcess::routeFlow(const char *inputPathStr,
+		const char *filledPathStr, const char *directionPathStr,
+		int *windowXSize, int *windowYSize) {
+
+	GALGError result = { 0, NULL };
+	RETURNIF(filledPathStr == NULL && directionPathStr == NULL, 1,
+			"No output requested");
+	GDALDataset *srcDataset;
+	GDALDataset *filledDataset = NULL;
+	GDALDataset *directionDataset = NULL;
+	srcDataset = (GDALDataset *) GDALOpen(inputPathStr, GA_ReadOnly);
+	RETURNIF(srcDataset == NULL, 1, "Could not open source dataset");
+
+	if (filledPathStr != NULL) {
+		result = createOutputDataset(this->writeOptions(), srcDataset,
+				filledPathStr, filledDataset, false, 1);
+	}
+	if (result.errnum == 0 && directionPathStr != NULL) {
+		result = createOutputDataset(this->writeOptions(), srcDataset,
+				directionPathStr, directionDataset, false, 1, GDT_Byte);
+		if (result.errnum == 0) {
+			directionDataset->GetRasterBand(1)->SetNoDataValue(0);
+		}
+	}
+
+	// Elevations with their halo, filled elevations, directions, and the
+	// labels and fill levels of the flood
+	std::vector<GALGWindow> windows;
+	int maxXSize, maxYSize;
+	if (result.errnum == 0) {
+		result = planWindows(srcDataset, 1, windowXSize, windowYSize, 0,
+				this->windowBudget(), 4 * sizeof(double) + 1, windows, maxXSize,
+				maxYSize);
+	}
+
+	if (result.errnum == 0) {
+		TileGrid grid(windows, srcDataset->GetRasterXSize(),
+				srcDataset->GetRasterYSize());
+		SpillGraph graph;
+		FlowJob job(inputPathStr, srcDataset, filledDataset, directionDataset,
+				grid, graph, maxXSize, maxYSize, this->bufferPool);
+		result = this->engine->run(job, windows);
+		if (result.errnum == 0) {
+			result = job.finishScan();
+		}
+		if (result.errnum == 0) {
+			result = this->engine->run(job, windows);
+		}
+	}
+
+	if (filledDataset != NULL) {
+		result = closeOutputDataset(this->writeOptions(), filledDataset,
+				filledPathStr, result);
+	}
+	if (directionDataset != NULL) {
+		result = closeOutputDataset(this->writeOptions(), directionDataset,
+				directionPathStr, result);
+	}
+	GDALClose(srcDataset);
+	return result;
+}
+
+/*
+ * Buffers for one tile of flow accumulation
+ */
+class AccumulationSlot: public WindowSlot {
+
+public:
+	AccumulationSlot(BufferPool *pool, int rasterXSize, int rasterYSize) :
+			directions(NULL), accumulation(NULL), accumulator(rasterXSize,
+					rasterYSize), pool(pool) {
+	}
+	~AccumulationSlot() {
+		this->pool->release(this->directions);
+		this->pool->release(this->accumulation);
+	}
+	GByte *directions;
+	double *accumulation;
+	TileAccumulator accumulator;
+	std::vector<GALGFlowLink> links;
+
+private:
+	BufferPool *pool;
+};
+
+/*
+ * Both passes of flow accumulation.
+ *
+ * The first pass accumulates each tile on its own and gathers the links of
+ * its perimeter cells. Once they are solved for the inflow at each
+ * perimeter cell, the second pass accumulates each tile again with its
+ * inflows and writes it.
+ */
+class AccumulationJob: public WindowJob {
+
+public:
+	AccumulationJob(const char *inputPathStr, GDALDataset *srcDataset,
+			GDALDataset *dstDataset, FlowLinks &links, int maxXSize,
+			int maxYSize, BufferPool *pool) :
+			inputPathStr(inputPathStr), srcDataset(srcDataset), dstDataset(
+					dstDataset), links(links), maxXSize(maxXSize), maxYSize(
+					maxYSize), nReaders(0), pool(pool), accumulating(false) {
+		int bHasNoData;
+		double noDataValue = srcDataset->GetRasterBand(1)->GetNoDataValue(
+				&bHasNoData);
+		this->noData = bHasNoData != 0 && noDataValue >= 0
+				&& noDataValue <= 255 ? (int) noDataValue : -1;
+	}
+
+	/*
+	 * Switch to the second pass, once the first has run over every tile
+	 */
+	GALGError finishScan() {
+		GALGError err = this->links.solve();
+		RETURNIFERROR(err);
+		this->accumulating = true;
+		return err;
+	}
+
+	GALGError createReader(WindowReader *&reader) {
+		GALGError err = { 0, NULL };
+		if (this->nReaders == 0) {
+			reader = new MapReader(this->srcDataset, false);
+		} else {
+			GDALDataset *dataset = (GDALDataset *) GDALOpen(this->inputPathStr,
+					GA_ReadOnly);
+			RETURNIF(dataset == NULL, 1, "Could not open source dataset");
+			reader = new MapReader(dataset, true);
+		}
+		this->nReaders++;
+		return err;
+	}
+
+	GALGError createSlot(WindowSlot *&slot) {
+		GALGError err = { 0, NULL };
+		AccumulationSlot *accSlot = new AccumulationSlot(this->pool,
+				this->srcDataset->GetRasterXSize(),
+				this->srcDataset->GetRasterYSize());
+		slot = accSlot;
+		size_t nPixels = (size_t) this->maxXSize * this->maxYSize;
+		accSlot->directions = (GByte *) this->pool->acquire(nPixels);
+		accSlot->accumulation = (double *) this->pool->acquire(
+				nPixels * sizeof(double));
+		RETURNIF(accSlot->directions == NULL || accSlot->accumulation == NULL,
+				1, "Unable to allocate data arrays");
+		return err;
+	}
+
+	GALGError read(WindowReader *reader, WindowSlot *slot,
+			const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		AccumulationSlot *accSlot = (AccumulationSlot *) slot;
+		GDALRasterBand *band = ((MapReader *) reader)->dataset->GetRasterBand(
+				w.band);
+		CPLErr eErr = band->RasterIO(GF_Read, w.xOff, w.yOff, w.xSize, w.ySize,
+				accSlot->directions, w.xSize, w.ySize, GDT_Byte, 0, 0);
+		RETURNIF(eErr != CE_None, 1, "Could not read from source dataset");
+		// No data cells have no direction
+		if (this->noData > 0) {
+			size_t nPixels = (size_t) w.xSize * w.ySize;
+			for (size_t i = 0; i < nPixels; ++i) {
+				if (accSlot->directions[i] == this->noData) {
+					accSlot->directions[i] = 0;
+				}
+			}
+		}
+		return err;
+	}
+
+	GALGError compute(WindowSlot *slot, const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		AccumulationSlot *accSlot = (AccumulationSlot *) slot;
+		bool acyclic = accSlot->accumulator.accumulate(accSlot->directions, w,
+				this->accumulating ? &this->links.getInflows() : NULL,
+				accSlot->accumulation);
+		RETURNIF(!acyclic, 1, "Flow directions form a cycle");
+		if (!this->accumulating) {
+			accSlot->links.clear();
+			accSlot->accumulator.link(accSlot->directions, w,
+					accSlot->accumulation, accSlot->links);
+		}
+		return err;
+	}
+
+	GALGError write(WindowSlot *slot, const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		AccumulationSlot *accSlot = (AccumulationSlot *) slot;
+		if (!this->accumulating) {
+			this->links.addLinks(accSlot->links);
+			return err;
+		}
+		CPLErr eErr = this->dstDataset->GetRasterBand(1)->RasterIO(GF_Write,
+				w.xOff, w.yOff, w.xSize, w.ySize, accSlot->accumulation,
+				w.xSize, w.ySize, GDT_Float64, 0, 0);
+		RETURNIF(eErr != CE_None, 1, "Could not write to output dataset");
+		return err;
+	}
+
+private:
+	const char *inputPathStr;
+	GDALDataset *srcDataset, *dstDataset;
+	FlowLinks &links;
+	int maxXSize, maxYSize;
+	int nReaders;
+	BufferPool *pool;
+	bool accumulating;
+	int noData;
+};
+
+GALGError RasterProcess::accumulateFlow(const char *directionPathStr,
+		const char *outputPathStr, int *windowXSize, int *windowYSize) {
+
+	GALGError result = { 0, NULL };
+	GDALDataset *srcDataset;
+	GDALDataset *dstDataset;
+	srcDataset = (GDALDataset *) GDALOpen(directionPathStr, GA_ReadOnly);
+	RETURNIF(srcDataset == NULL, 1, "Could not open source dataset");
+
+	result = createOutputDataset(this->writeOptions(), srcDataset,
+			outputPathStr, dstDataset, false, 1, GDT_Float64);
+	if (result.errnum != 0) {
+		GDALClose(srcDataset);
+		return result;
+	}
+	dstDataset->GetRasterBand(1)->SetNoDataValue(0);
+
+	std::vector<GALGWindow> windows;
+	int maxXSize, maxYSize;
+	result = planWindows(srcDataset, 1, windowXSize, windowYSize, 0,
+			this->windowBudget(), 1 + sizeof(double) + sizeof(int), windows,
+			maxXSize, maxYSize);
+
+	if (result.errnum == 0) {
+		FlowLinks links;
+		AccumulationJob job(directionPathStr, srcDataset, dstDataset, links,
+				maxXSize, maxYSize, this->bufferPool);
+		result = this->engine->run(job, windows);
+		if (result.errnum == 0) {
+			result = job.finishScan();
+		}
+		if (result.errnum == 0) {
+			result = this->engine->run(job, windows);
+		}
+	}
+
+	result = closeOutputDataset(this->writeOptions(), dstDataset,
+			outputPathStr, result);
+	GDALClose(srcDataset);
+	return result;
+}
+
+/*
+ * A window of a statistics pass and its statistics
+ */
+class StatisticsSlot: public WindowSlot {
+
+public:
+	StatisticsSlot(BufferPool *pool) :
+			values(NULL), pool(pool) {
+	}
+	~StatisticsSlot() {
+		this->pool->release(this->values);
+	}
+	double *values;
+	RasterStatistics statistics;
+
+private:
+	BufferPool *pool;
+};
+
+/*
+ * Statistics of one band. Each window is accumulated on its own in
+ * compute and merged into the band's statistics in write, in window order.
+ */
+class StatisticsJob: public WindowJob {
+
+public:
+	StatisticsJob(const char *inputPathStr, GDALDataset *srcDataset,
+			RasterStatistics &statistics, int maxXSize, int maxYSize,
+			BufferPool *pool) :
+			inputPathStr(inputPathStr), srcDataset(srcDataset), statistics(
+					statistics), emptyStatistics(statistics), maxXSize(maxXSize), maxYSize(
+					maxYSize), nReaders(0), pool(pool) {
+	}
+
+	GALGError createReader(WindowReader *&reader) {
+		GALGError err = { 0, NULL };
+		if (this->nReaders == 0) {
+			reader = new MapReader(this->srcDataset, false);
+		} else {
+			GDALDataset *dataset = (GDALDataset *) GDALOpen(this->inputPathStr,
+					GA_ReadOnly);
+			RETURNIF(dataset == NULL, 1, "Could not open source dataset");
+			reader = new MapReader(dataset, true);
+		}
+		this->nReaders++;
+		return err;
+	}
+
+	GALGError createSlot(WindowSlot *&slot) {
+		GALGError err = { 0, NULL };
+		StatisticsSlot *statsSlot = new StatisticsSlot(this->pool);
+		slot = statsSlot;
+		statsSlot->values = (double *) this->pool->acquire(
+				(size_t) this->maxXSize * this->maxYSize * sizeof(double));
+		RETURNIF(statsSlot->values == NULL, 1, "Unable to allocate data arrays");
+		return err;
+	}
+
+	GALGError read(WindowReader *reader, WindowSlot *slot,
+			const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		GDALRasterBand *band = ((MapReader *) reader)->dataset->GetRasterBand(
+				w.band);
+		CPLErr eErr = band->RasterIO(GF_Read, w.xOff, w.yOff, w.xSize, w.ySize,
+				((StatisticsSlot *) slot)->values, w.xSize, w.ySize,
+				GDT_Float64, 0, 0);
+		RETURNIF(eErr != CE_None, 1, "Could not read from source dataset");
+		return err;
+	}
+
+	GALGError compute(WindowSlot *slot, const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		StatisticsSlot *statsSlot = (StatisticsSlot *) slot;
+		statsSlot->statistics = this->emptyStatistics;
+		statsSlot->statistics.add(statsSlot->values,
+				(size_t) w.xSize * w.ySize);
+		return err;
+	}
+
+	GALGError write(WindowSlot *slot, const GALGWindow &w) {
+		return this->statistics.merge(((StatisticsSlot *) slot)->statistics);
+	}
+
+private:
+	const char *inputPathStr;
+	GDALDataset *srcDataset;
+	RasterStatistics &statistics;
+	RasterStatistics emptyStatistics;
+	int maxXSize, maxYSize;
+	int nReaders;
+	BufferPool *pool;
+};
+
+GALGError RasterProcess::computeStatistics(const char *inputPathStr, int band,
+		RasterStatistics &statistics, int *windowXSize, int *windowYSize) {
+
+	GALGError result = { 0, NULL };
+	GDALDataset *srcDataset;
+	srcDataset = (GDALDataset *) GDALOpen(inputPathStr, GA_ReadOnly);
+	RETURNIF(srcDataset == NULL, 1, "Could not open source dataset");
+	if (band < 1 || band > srcDataset->GetRasterCount()) {
+		GDALClose(srcDataset);
+		result.errnum = 1;
+		result.msg = "No such band";
+		return result;
+	}
+	int bHasNoData;
+	double noDataValue = srcDataset->GetRasterBand(band)->GetNoDataValue(
+			&bHasNoData);
+	statistics.reset();
+	statistics.setNoData(bHasNoData != 0, noDataValue);
+
+	std::vector<GALGWindow> windows;
+	int maxXSize, maxYSize;
+	result = planWindows(srcDataset, 1, windowXSize, windowYSize, 0,
+			this->windowBudget(), sizeof(double), windows, maxXSize, maxYSize);
+	for (size_t i = 0; i < windows.size(); ++i) {
+		windows[i].band = band;
+	}
+
+	if (result.errnum == 0) {
+		StatisticsJob job(inputPathStr, srcDataset, statistics, maxXSize,
+				maxYSize, this->bufferPool);
+		result = this->engine->run(job, windows);
+	}
+
+	GDALClose(srcDataset);
+	return result;
+}
+
+/*
+ * Thread-private handles on the value and zone datasets of a ZonalJob
+ */
+class ZonalReader: public WindowReader {
+
+public:
+	ZonalReader(GDALDataset *values, GDALDataset *zones, bool owned) :
+			values(values), zones(zones), owned(owned) {
+	}
+	~ZonalReader() {
+		if (this->owned) {
+			GDALClose(this->values);
+			GDALClose(this->zones);
+		}
+	}
+	GDALDataset *values, *zones;
+
+private:
+	bool owned;
+};
+
+/*
+ * Buffers for one window of zonal statistics
+ */
+class ZonalSlot: public WindowSlot {
+
+public:
+	ZonalSlot(BufferPool *pool) :
+			values(NULL), zones(NULL), pool(pool) {
+	}
+	~ZonalSlot() {
+		this->pool->release(this->values);
+		this->pool->release(this->zones);
+	}
+	double *values, *zones;
+
+private:
+	BufferPool *pool;
+};
+
+/*
+ * Zonal statistics. Each window is aggregated into a zone table no other
+ * thread is using, taken from a free list: there are only ever as many
+ * tables as windows computed at once, i.e. compute threads, however many
+ * slots a pipeline has. Nothing is written per window and the tables are
+ * merged once every window is done.
+ */
+class ZonalJob: public WindowJob {
+
+public:
+	ZonalJob(const char *valuePathStr, const char *zonePathStr,
+			GDALDataset *valueDataset, GDALDataset *zoneDataset, int maxXSize,
+			int maxYSize, BufferPool *pool) :
+			valuePathStr(valuePathStr), zonePathStr(zonePathStr), valueDataset(
+					valueDataset), zoneDataset(zoneDataset), maxXSize(maxXSize), maxYSize(
+					maxYSize), nReaders(0), pool(pool) {
+		int bHasNoData;
+		this->tableMutex = CPLCreateMutex();
+		CPLReleaseMutex(this->tableMutex);
+		this->valueNoDataValue =
+				valueDataset->GetRasterBand(1)->GetNoDataValue(&bHasNoData);
+		this->hasValueNoData = bHasNoData != 0;
+		this->zoneNoDataValue = zoneDataset->GetRasterBand(1)->GetNoDataValue(
+				&bHasNoData);
+		this->hasZoneNoData = bHasNoData != 0;
+	}
+
+	~ZonalJob() {
+		for (size_t i = 0; i < this->tables.size(); ++i) {
+			delete this->tables[i];
+		}
+		CPLDestroyMutex(this->tableMutex);
+	}
+
+	/*
+	 * Merge the tables of every thread, once the windows are done
+	 */
+	void finish(ZoneTable &result) {
+		result.clear();
+		for (size_t i = 0; i < this->tables.size(); ++i) {
+			result.merge(*this->tables[i]);
+		}
+	}
+
+	GALGError createReader(WindowReader *&reader) {
+		GALGError err = { 0, NULL };
+		if (this->nReaders == 0) {
+			reader = new ZonalReader(this->valueDataset, this->zoneDataset,
+					false);
+		} else {
+			GDALDataset *values = (GDALDataset *) GDALOpen(this->valuePathStr,
+					GA_ReadOnly);
+			RETURNIF(values == NULL, 1, "Could not open value dataset");
+			GDALDataset *zones = (GDALDataset *) GDALOpen(this->zonePathStr,
+					GA_ReadOnly);
+			if (zones == NULL) {
+				GDALClose(values);
+			}
+			RETURNIF(zones == NULL, 1, "Could not open zone dataset");
+			reader = new ZonalReader(values, zones, true);
+		}
+		this->nReaders++;
+		return err;
+	}
+
+	GALGError createSlot(WindowSlot *&slot) {
+		GALGError err = { 0, NULL };
+		ZonalSlot *zonalSlot = new ZonalSlot(this->pool);
+		slot = zonalSlot;
+		size_t nBytes = (size_t) this->maxXSize * this->maxYSize
+				* sizeof(double);
+		zonalSlot->values = (double *) this->pool->acquire(nBytes);
+		zonalSlot->zones = (double *) this->pool->acquire(nBytes);
+		RETURNIF(zonalSlot->values == NULL || zonalSlot->zones == NULL, 1,
+				"Unable to allocate data arrays");
+		return err;
+	}
+
+	GALGError read(WindowReader *reader, WindowSlot *slot,
+			const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		ZonalReader *zonalReader = (ZonalReader *) reader;
+		ZonalSlot *zonalSlot = (ZonalSlot *) slot;
+		CPLErr eErr = zonalReader->values->GetRasterBand(1)->RasterIO(GF_Read,
+				w.xOff, w.yOff, w.xSize, w.ySize, zonalSlot->values, w.xSize,
+				w.ySize, GDT_Float64, 0, 0);
+		RETURNIF(eErr != CE_None, 1, "Could not read from value dataset");
+		eErr = zonalReader->zones->GetRasterBand(1)->RasterIO(GF_Read, w.xOff,
+				w.yOff, w.xSize, w.ySize, zonalSlot->zones, w.xSize, w.ySize,
+				GDT_Float64, 0, 0);
+		RETURNIF(eErr != CE_None, 1, "Could not read from zone dataset");
+		return err;
+	}
+
+	GALGError compute(WindowSlot *slot, const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		ZonalSlot *zonalSlot = (ZonalSlot *) slot;
+		ZoneTable *table = this->acquireTable();
+		table->add(zonalSlot->zones, zonalSlot->values,
+				(size_t) w.xSize * w.ySize);
+		this->releaseTable(table);
+		return err;
+	}
+
+	GALGError write(WindowSlot *slot, const GALGWindow &w) {
+		GALGError err = { 0, NULL };
+		return err;
+	}
+
+private:
+	/*
+	 * A table for the calling thread alone, until it is released
+	 */
+	ZoneTable *acquireTable() {
+		CPLAcquireMutex(this->tableMutex, 1000.0);
+		ZoneTable *table;
+		if (this->freeTables.empty()) {
+			table = new ZoneTable();
+			table->setNoData(this->hasZoneNoData, this->zoneNoDataValue,
+					this->hasValueNoData, this->valueNoDataValue);
+			this->tables.push_back(table);
+		} else {
+			table = this->freeTables.back();
+			this->freeTables.pop_back();
+		}
+		CPLReleaseMutex(this->tableMutex);
+		return table;
+	}
+
+	void releaseTable(ZoneTable *table) {
+		CPLAcquireMutex(this->tableMutex, 1000.0);
+		this->freeTables.push_back(table);
+		CPLReleaseMutex(this->tableMutex);
+	}
+
+	const char *valuePathStr, *zonePathStr;
+	GDALDataset *valueDataset, *zoneDataset;
+	int maxXSize, maxYSize;
+	int nReaders;
+	BufferPool *pool;
+	bool hasValueNoData, hasZoneNoData;
+	double valueNoDataValue, zoneNoDataValue;
+	std::vector<ZoneTable *> tables, freeTables;
+	CPLMutex *tableMutex;
+};
+
+GALGError RasterProcess::zonalStatistics(const char *valuePathStr,
+		const char *zonePathStr, const char *tablePathStr,
+		std::vector<GALGZoneStats> *zones, int *windowXSize, int *windowYSize) {
+
+	GALGError result = { 0, NULL };
+	RETURNIF(tablePathStr == NULL && zones == NULL, 1, "No output requested");
+	GDALDataset *valueDataset;
+	GDALDataset *zoneDataset;
+	valueDataset = (GDALDataset *) GDALOpen(valuePathStr, GA_ReadOnly);
+	RETURNIF(valueDataset == NULL, 1, "Could not open value dataset");
+	zoneDataset = (GDALDataset *) GDALOpen(zonePathStr, GA_ReadOnly);
+	if (zoneDataset == NULL) {
+		GDALClose(valueDataset);
+		result.errnum = 1;
+		result.msg = "Could not open zone dataset";
+		return result;
+	}
+	if (zoneDataset->GetRasterXSize() != valueDataset->GetRasterXSize()
+			|| zoneDataset->GetRasterYSize() != valueDataset->GetRasterYSize()) {
+		result.errnum = 1;
+		result.msg = "Value and zone datasets must be the same size";
+	}
+
+	// A value and a zone per pixel
+	std::vector<GALGWindow> windows;
+	int maxXSize, maxYSize;
+	if (result.errnum == 0) {
+		result = planWindows(valueDataset, 1, windowXSize, windowYSize, 0,
+				this->windowBudget(), 2 * sizeof(double), windows, maxXSize,
+				maxYSize);
+	}
+
+	if (result.errnum == 0) {
+		ZoneTable table;
+		ZonalJob job(valuePathStr, zonePathStr, valueDataset, zoneDataset,
+				maxXSize, maxYSize, this->bufferPool);
+		result = this->engine->run(job, windows);
+		if (result.errnum == 0) {
+			job.finish(table);
+			std::vector<GALGZoneStats> tableZones;
+			table.getZones(zones != NULL ? *zones : tableZones);
+			if (tablePathStr != NULL) {
+				result = galgWriteZoneTable(tablePathStr,
+						zones != NULL ? *zones : tableZones);
+			}
+		}
+	}
+
+	GDALClose(zoneDataset);
+	GDALClose(valueDataset);
+	return result;
+}
@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "statistics.h"
+#include "cpl_port.h"
+
+/*****************
+ * QUANTILE SKETCH
+ *****************/
+
+QuantileSketch::QuantileSketch() :
+		k(200), count(0), size(0), maxSize(0), seed(1) {
+	this->clear();
+}
+
+GALGError QuantileSketch::setAccuracy(int k) {
+	GALGError err = { 0, NULL };
+	RETURNIF(k < 8, 1, "Quantile sketch accuracy must be at least 8");
+	this->k = k;
+	this->clear();
+	return err;
+}
+
+/*
+ * Lower levels get geometrically smaller compactors, as their items weigh less
+ */
+int QuantileSketch::capacity(size_t level) const {
+	size_t depth = this->levels.size() - 1 - level;
+	return std::max(2, (int) std::ceil(this->k * std::pow(2.0 / 3.0, (double) depth)));
+}
+
+void QuantileSketch::add(double value) {
+	this->levels[0].push_back(value);
+	this->size++;
+	this->count++;
+	if (this->size >= this->maxSize) {
+		this->compress();
+	}
+}
+
+void QuantileSketch::compress() {
+	while (this->size >= this->maxSize) {
+		for (size_t h = 0; h < this->levels.size(); ++h) {
+			if (this->levels[h].size() < (size_t) this->capacity(h)) {
+				continue;
+			}
+			if (h + 1 == this->levels.size()) {
+				this->levels.push_back(std::vector<double>());
+			}
+			std::vector<double> &level = this->levels[h];
+			std::sort(level.begin(), level.end());
+			// A random half of each pair moves up; an odd item stays
+			this->seed = this->seed * 1103515245 + 12345;
+			size_t offset = (this->seed >> 16) & 1;
+			size_t nPaired = level.size() & ~(size_t) 1;
+			for (size_t i = offset; i < nPaired; i += 2) {
+				this->levels[h + 1].push_back(level[i]);
+			}
+			level.erase(level.begin(), level.begin() + nPaired);
+			this->size -= nPaired / 2;
+			break;
+		}
+		this->maxSize = 0;
+		for (size_t h = 0; h < this->levels.size(); ++h) {
+			this->maxSize += this->capacity(h);
+		}
+	}
+}
+
+void QuantileSketch::merge(const QuantileSketch &other) {
+	while (this->levels.size() < other.levels.size()) {
+		this->levels.push_back(std::vector<double>());
+	}
+	for (size_t h = 0; h < other.levels.size(); ++h) {
+		this->levels[h].insert(this->levels[h].end(), other.levels[h].begin(),
+				other.levels[h].end());
+	}
+	this->size += other.size;
+	this->count += other.count;
+	this->maxSize = 0;
+	for (size_t h = 0; h < this->levels.size(); ++h) {
+		this->maxSize += this->capacity(h);
+	}
+	this->compress();
+}
+
+double QuantileSketch::quantile(double q) const {
+	std::vector<std::pair<double, GIntBig> > items;
+	items.reserve(this->size);
+	GIntBig total = 0;
+	for (size_t h = 0; h < this->levels.size(); ++h) {
+		for (size_t i = 0; i < this->levels[h].size(); ++i) {
+			items.push_back(std::make_pair(this->levels[h][i], (GIntBig) 1 << h));
+			total += (GIntBig) 1 << h;
+		}
+	}
+	if (items.empty()) {
+		return std::numeric_limits<double>::quiet_NaN();
+	}
+	std::sort(items.begin(), items.end());
+	double rank = std::min(std::max(q, 0.0), 1.0) * total;
+	GIntBig below = 0;
+	for (size_t i = 0; i < items.size(); ++i) {
+		below += items[i].second;
+		if (below >= rank) {
+			return items[i].first;
+		}
+	}
+	return items.back().first;
+}
+
+void QuantileSketch::clear() {
+	this->levels.assign(1, std::vector<double>());
+	this->count = 0;
+	this->size = 0;
+	this->seed = 1;
+	this->maxSize = this->capacity(0);
+}
+
+/*****************
+ * RASTER STATISTICS
+ *****************/
+
+RasterStatistics::RasterStatistics() :
+		hasNoData(false), noDataValue(0), count(0), min(0), max(0), mean(0), m2(
+				0), histMin(0), histMax(0), useSketch(false) {
+	this->reset();
+}
+
+GALGError RasterStatistics::setHistogramParams(double min, double max,
+		int nBins) {
+	GALGError err = { 0, NULL };
+	RETURNIF(nBins < 0, 1, "Number of histogram bins cannot be negative");
+	RETURNIF(nBins > 0 && !(max > min), 1,
+			"Histogram maximum must be greater than its minimum");
+	this->histMin = min;
+	this->histMax = max;
+	this->histogram.assign(nBins, 0);
+	return err;
+}
+
+GALGError RasterStatistics::setQuantileParams(int k) {
+	GALGError err = { 0, NULL };
+	this->useSketch = k > 0;
+	if (this->useSketch) {
+		err = this->sketch.setAccuracy(k);
+	}
+	return err;
+}
+
+void RasterStatistics::setNoData(bool hasNoData, double noDataValue) {
+	this->hasNoData = hasNoData;
+	this->noDataValue = noDataValue;
+}
+
+void RasterStatistics::add(const double *values, size_t nValues) {
+	// Moments of the batch on its own (two passes over values still in
+	// cache), merged into the running moments afterwards
+	GIntBig n = 0;
+	double sum = 0;
+	double lo = std::numeric_limits<double>::infinity();
+	double hi = -std::numeric_limits<double>::infinity();
+	for (size_t i = 0; i < nValues; ++i) {
+		double v = values[i];
+		if (CPLIsNan(v) || (this->hasNoData && v == this->noDataValue)) {
+			continue;
+		}
+		n++;
+		sum += v;
+		lo = std::min(lo, v);
+		hi = std::max(hi, v);
+	}
+	if (n == 0) {
+		return;
+	}
+	double batchMean = sum / n;
+	double batchM2 = 0;
+	int nBins = (int) this->histogram.size();
+	double binScale =
+			nBins > 0 ? nBins / (this->histMax - this->histMin) : 0;
+	for (size_t i = 0; i < nValues; ++i) {
+		double v = values[i];
+		if (CPLIsNan(v) || (this->hasNoData && v == this->noDataValue)) {
+			continue;
+		}
+		batchM2 += (v - batchMean) * (v - batchMean);
+		if (nBins > 0 && v >= this->histMin && v <= this->histMax) {
+			int bin = std::min((int) ((v - this->histMin) * binScale), nBins - 1);
+			this->histogram[bin]++;
+		}
+		if (this->useSketch) {
+			this->sketch.add(v);
+		}
+	}
+
+	GIntBig total = this->count + n;
+	double delta = batchMean - this->mean;
+	this->mean += delta * n / total;
+	this->m2 += batchM2 + delta * delta * ((double) this->count * n / total);
+	this->min = this->count == 0 ? lo : std::min(this->min, lo);
+	this->max = this->count == 0 ? hi : std::max(this->max, hi);
+	this->count = total;
+}
+
+void RasterStatistics::add(const void *values, GDALDataType eType,
+		int nPixelSpace, size_t nValues) {
+	if (eType == GDT_Float64 && nPixelSpace == sizeof(double)) {
+		this->add((const double *) values, nValues);
+		return;
+	}
+	this->scratch.resize(nValues);
+	GDALCopyWords(values, eType, nPixelSpace, &this->scratch[0], GDT_Float64,
+			sizeof(double), (int) nValues);
+	this->add(&this->scratch[0], nValues);
+}
+
+GALGError RasterStatistics::merge(const RasterStatistics &other) {
+	GALGError err = { 0, NULL };
+	RETURNIF(
+			this->histogram.size() != other.histogram.size()
+					|| this->histMin != other.histMin
+					|| this->histMax != other.histMax, 1,
+			"Cannot merge statistics with different histograms");
+	for (size_t i = 0; i < this->histogram.size(); ++i) {
+		this->histogram[i] += other.histogram[i];
+	}
+	if (this->useSketch && other.useSketch) {
+		this->sketch.merge(other.sketch);
+	}
+	if (other.count == 0) {
+		return err;
+	}
+	GIntBig total = this->count + other.count;
+	double delta = other.mean - this->mean;
+	this->mean += delta * other.count / total;
+	this->m2 += other.m2
+			+ delta * delta * ((double) this->count * other.count / total);
+	this->min = this->count == 0 ? other.min : std::min(this->min, other.min);
+	this->max = this->count == 0 ? other.max : std::max(this->max, other.max);
+	this->count = total;
+	return err;
+}
+
+void RasterStatistics::reset() {
+	this->count = 0;
+	this->min = 0;
+	this->max = 0;
+	this->mean = 0;
+	this->m2 = 0;
+	std::fill(this->histogram.begin(), this->histogram.end(), 0);
+	this->sketch.clear();
+}
+
+GIntBig RasterStatistics::getCount() const {
+	return this->count;
+}
+
+double RasterStatistics::getMin() const {
+	return this->min;
+}
+
+double RasterStatistics::getMax() const {
+	return this->max;
+}
+
+double RasterStatistics::getSum() const {
+	return this->mean * this->count;
+}
+
+double RasterStatistics::getMean() const {
+	return this->mean;
+}
+
+/*
+ * Population variance
+ */
+double RasterStatistics::getVariance() const {
+	return this->count > 0 ? this->m2 / this->count : 0;
+}
+
+double RasterStatistics::getStdDev() const {
+	return std::sqrt(this->getVariance());
+}
+
+const std::vector<GIntBig> &RasterStatistics::getHistogram() const {
+	return this->histogram;
+}
+
+/*
+ * Approximate unless the values all fit in the sketch; NaN without a sketch
+ */
+double RasterStatistics::getQuantile(double q) const {
+	if (!this->useSketch) {
+		return std::numeric_limits<double>::quiet_NaN();
+	}
+	return this->sketch.quantile(q);
+}
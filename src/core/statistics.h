@@ -0,0 +1,114 @@
+/*
+ * STATISTICS API
+ *
+ * Streaming statistics of a raster band: moments, a fixed-bin histogram and
+ * approximate quantiles, accumulated window by window. Statistics of
+ * separate windows can be merged, so each window (or thread) accumulates
+ * its own and they are combined afterwards.
+ */
+#ifndef STATISTICS_H_
+#define STATISTICS_H_
+
+#include <vector>
+#include "gdal_priv.h"
+
+#include "core_exp.h"
+#include "common.h"
+
+/*
+ * \brief A KLL quantile sketch (Karnin, Lang and Liberty, 2016).
+ *
+ * Keeps a stack of compactors; items at level h stand for 2^h values.
+ * A full level is sorted and every other item, from a random start, is
+ * promoted to the next level. The rank error is about 1.7 / k of the
+ * count, using O(k) memory however many values are added; quantiles are
+ * exact until the first compaction.
+ */
+class GALGCORE_DLL QuantileSketch {
+
+public:
+	QuantileSketch();
+	GALGError setAccuracy(int k);
+	void add(double value);
+	void merge(const QuantileSketch &other);
+	/*
+	 * The value with rank q * count (0 <= q <= 1). NaN when empty.
+	 */
+	double quantile(double q) const;
+	void clear();
+
+protected:
+	int capacity(size_t level) const;
+	void compress();
+	int k;
+	GIntBig count;
+	size_t size, maxSize;
+	GUInt32 seed;
+	std::vector<std::vector<double> > levels;
+};
+
+/*
+ * \brief Mergeable statistics of the valid pixels of a band.
+ *
+ * No data and NaN pixels are left out. The mean and variance are
+ * accumulated per batch and merged with Chan et al.'s update of Welford's
+ * method, so they stay accurate for long streams. The histogram and the
+ * quantile sketch are optional (off by default).
+ *
+ * Merging statistics with different histogram settings is an error.
+ */
+class GALGCORE_DLL RasterStatistics {
+
+public:
+	RasterStatistics();
+	virtual ~RasterStatistics() {};
+
+	/*
+	 * nBins equal bins over [min, max]; values outside are counted but not
+	 * binned. nBins = 0 turns the histogram off.
+	 */
+	GALGError setHistogramParams(double min, double max, int nBins);
+
+	/*
+	 * Turn the quantile sketch on (k >= 8, larger is more accurate) or off (0)
+	 */
+	GALGError setQuantileParams(int k);
+	void setNoData(bool hasNoData, double noDataValue);
+
+	void add(const double *values, size_t nValues);
+
+	/*
+	 * Add values of any data type, nPixelSpace bytes apart
+	 */
+	void add(const void *values, GDALDataType eType, int nPixelSpace,
+			size_t nValues);
+	GALGError merge(const RasterStatistics &other);
+
+	/*
+	 * Forget the values added, keeping the settings
+	 */
+	void reset();
+
+	GIntBig getCount() const;
+	double getMin() const;
+	double getMax() const;
+	double getSum() const;
+	double getMean() const;
+	double getVariance() const;
+	double getStdDev() const;
+	const std::vector<GIntBig> &getHistogram() const;
+	double getQuantile(double q) const;
+
+protected:
+	bool hasNoData;
+	double noDataValue;
+	GIntBig count;
+	double min, max, mean, m2;
+	double histMin, histMax;
+	std::vector<GIntBig> histogram;
+	bool useSketch;
+	QuantileSketch sketch;
+	std::vector<double> scratch;
+};
+
+#endif // STATISTICS_H_
@@ -0,0 +1,399 @@
+#include <algorithm>
+#include <utility>
+#include "tilesink.h"
+
+/*****************
+ * TILE SINK
+ *****************/
+
+TileSink::TileSink() :
+		dataset(NULL), blockXSize(1), blockYSize(1), nXTiles(0), nYTiles(
+				0), frontier(0), nextTile(0), budgetBytes(0), heldBytes(0), peakBytes(0), nTilesWritten(
+				0), aborted(false) {
+	this->err.errnum = 0;
+	this->err.msg = NULL;
+	this->mutex = CPLCreateMutex();
+	CPLReleaseMutex(this->mutex);
+	this->writeMutex = CPLCreateMutex();
+	CPLReleaseMutex(this->writeMutex);
+	this->cond = CPLCreateCond();
+}
+
+TileSink::~TileSink() {
+	for (size_t i = 0; i < this->tiles.size(); ++i) {
+		this->pool.release(this->tiles[i]);
+	}
+	CPLDestroyCond(this->cond);
+	CPLDestroyMutex(this->writeMutex);
+	CPLDestroyMutex(this->mutex);
+}
+
+GALGError TileSink::open(GDALDataset *dataset,
+		const std::vector<GALGWindow> &owned, GIntBig budgetBytes) {
+	GALGError result = { 0, NULL };
+	RETURNIF(dataset == NULL || dataset->GetRasterCount() == 0, 1,
+			"No output dataset");
+	RETURNIF(budgetBytes < 0, 1, "Tile budget must not be negative");
+	for (size_t i = 0; i < this->tiles.size(); ++i) {
+		this->pool.release(this->tiles[i]);
+	}
+	this->dataset = dataset;
+	this->owned = owned;
+	this->budgetBytes = budgetBytes;
+	this->heldBytes = 0;
+	this->peakBytes = 0;
+	this->nTilesWritten = 0;
+	this->aborted = false;
+	this->err = result;
+
+	dataset->GetRasterBand(1)->GetBlockSize(&this->blockXSize,
+			&this->blockYSize);
+	this->nXTiles = (dataset->GetRasterXSize() + this->blockXSize - 1)
+			/ this->blockXSize;
+	this->nYTiles = (dataset->GetRasterYSize() + this->blockYSize - 1)
+			/ this->blockYSize;
+	int nBands = dataset->GetRasterCount();
+	this->types.clear();
+	this->fillValues.clear();
+	for (int iBand = 0; iBand < nBands; ++iBand) {
+		GDALRasterBand *band = dataset->GetRasterBand(iBand + 1);
+		int bHasNoData;
+		double noDataValue = band->GetNoDataValue(&bHasNoData);
+		this->types.push_back(band->GetRasterDataType());
+		this->fillValues.push_back(bHasNoData ? noDataValue : 0);
+	}
+
+	size_t nTiles = (size_t) nBands * this->nXTiles * this->nYTiles;
+	this->remaining.assign(nTiles, 0);
+	this->stored.assign(nTiles, false);
+	this->tiles.assign(nTiles, NULL);
+	std::vector<int> lastWindows(nTiles, -1);
+	for (size_t i = 0; i < owned.size(); ++i) {
+		const GALGWindow &o = owned[i];
+		RETURNIF(o.band < 1 || o.band > nBands, 1, "Window band out of range");
+		int xFirst, yFirst, xLast, yLast;
+		this->tilesOf(o, xFirst, yFirst, xLast, yLast);
+		for (int ty = yFirst; ty <= yLast; ++ty) {
+			int y0 = std::max(o.yOff, ty * this->blockYSize);
+			int y1 = std::min(o.yOff + o.ySize, (ty + 1) * this->blockYSize);
+			for (int tx = xFirst; tx <= xLast; ++tx) {
+				int x0 = std::max(o.xOff, tx * this->blockXSize);
+				int x1 = std::min(o.xOff + o.xSize, (tx + 1) * this->blockXSize);
+				size_t iTile = ((size_t) (o.band - 1) * this->nYTiles + ty)
+						* this->nXTiles + tx;
+				this->remaining[iTile] += (GIntBig) (x1 - x0) * (y1 - y0);
+				lastWindows[iTile] = std::max(lastWindows[iTile], (int) i);
+			}
+		}
+	}
+
+	// Tiles are written in the order of the last window over them, so the
+	// order does not depend on which windows happen to finish first
+	std::vector<std::pair<int, size_t> > order;
+	for (size_t iTile = 0; iTile < nTiles; ++iTile) {
+		if (lastWindows[iTile] >= 0) {
+			order.push_back(std::make_pair(lastWindows[iTile], iTile));
+		}
+	}
+	std::sort(order.begin(), order.end());
+	this->tileOrder.clear();
+	this->tileLastWindows.clear();
+	for (size_t i = 0; i < order.size(); ++i) {
+		this->tileLastWindows.push_back(order[i].first);
+		this->tileOrder.push_back(order[i].second);
+	}
+	this->nextTile = 0;
+	this->done.assign(owned.size(), false);
+	this->frontier = 0;
+	return result;
+}
+
+/*
+ * The range of tiles overlapping a region; empty (last < first) for an
+ * empty region
+ */
+void TileSink::tilesOf(const GALGWindow &o, int &xFirst, int &yFirst,
+		int &xLast, int &yLast) {
+	xFirst = o.xOff / this->blockXSize;
+	yFirst = o.yOff / this->blockYSize;
+	xLast = o.xSize > 0 ? (o.xOff + o.xSize - 1) / this->blockXSize : -1;
+	yLast = o.ySize > 0 ? (o.yOff + o.ySize - 1) / this->blockYSize : -1;
+}
+
+GALGError TileSink::write(const GALGWindow &w, const void *data,
+		GDALDataType eType) {
+	GALGError result = { 0, NULL };
+	const GALGWindow &o = this->owned[w.index];
+	int xFirst, yFirst, xLast, yLast;
+	this->tilesOf(o, xFirst, yFirst, xLast, yLast);
+	size_t bandTile = (size_t) (o.band - 1) * this->nYTiles * this->nXTiles;
+	int nTileBytes = GDALGetDataTypeSize(this->types[o.band - 1]) / 8;
+	GIntBig tileBytes = (GIntBig) this->blockXSize * this->blockYSize
+			* nTileBytes;
+
+	// Wait for room for the tiles this window starts
+	CPLAcquireMutex(this->mutex, 1000.0);
+	while (!this->aborted) {
+		GIntBig neededBytes = 0;
+		for (int ty = yFirst; ty <= yLast; ++ty) {
+			for (int tx = xFirst; tx <= xLast; ++tx) {
+				if (this->tiles[bandTile + (size_t) ty * this->nXTiles + tx]
+						== NULL) {
+					neededBytes += tileBytes;
+				}
+			}
+		}
+		if ((size_t) w.index == this->frontier
+				|| this->heldBytes + neededBytes <= this->budgetBytes) {
+			break;
+		}
+		CPLCondWait(this->cond, this->mutex);
+	}
+	if (this->aborted) {
+		result = this->err;
+		CPLReleaseMutex(this->mutex);
+		return result;
+	}
+	double fillValue = this->fillValues[o.band - 1];
+	for (int ty = yFirst; ty <= yLast; ++ty) {
+		for (int tx = xFirst; tx <= xLast; ++tx) {
+			void *&tile = this->tiles[bandTile + (size_t) ty * this->nXTiles + tx];
+			if (tile != NULL) {
+				continue;
+			}
+			tile = this->pool.acquire((size_t) tileBytes);
+			if (tile == NULL) {
+				this->aborted = true;
+				this->err.errnum = 1;
+				this->err.msg = "Unable to allocate output tile";
+				result = this->err;
+				CPLCondBroadcast(this->cond);
+				CPLReleaseMutex(this->mutex);
+				return result;
+			}
+			CPLErr eErr = CE_None;
+			if (this->stored[bandTile + (size_t) ty * this->nXTiles + tx]) {
+				CPLAcquireMutex(this->writeMutex, 1000.0);
+				eErr = this->dataset->GetRasterBand(o.band)->ReadBlock(tx, ty,
+						tile);
+				CPLReleaseMutex(this->writeMutex);
+			} else {
+				GDALCopyWords(&fillValue, GDT_Float64, 0, tile,
+						this->types[o.band - 1], nTileBytes,
+						this->blockXSize * this->blockYSize);
+			}
+			this->heldBytes += tileBytes;
+			this->peakBytes = std::max(this->peakBytes, this->heldBytes);
+			if (eErr != CE_None) {
+				this->aborted = true;
+				this->err.errnum = 1;
+				this->err.msg = "Could not read back output tile";
+				result = this->err;
+				CPLCondBroadcast(this->cond);
+				CPLReleaseMutex(this->mutex);
+				return result;
+			}
+		}
+	}
+	CPLReleaseMutex(this->mutex);
+
+	// Other windows only copy into other parts of the same tiles
+	int nPixelBytes = GDALGetDataTypeSize(eType) / 8;
+	for (int ty = yFirst; ty <= yLast; ++ty) {
+		int y0 = std::max(o.yOff, ty * this->blockYSize);
+		int y1 = std::min(o.yOff + o.ySize, (ty + 1) * this->blockYSize);
+		for (int tx = xFirst; tx <= xLast; ++tx) {
+			int x0 = std::max(o.xOff, tx * this->blockXSize);
+			int x1 = std::min(o.xOff + o.xSize, (tx + 1) * this->blockXSize);
+			GByte *tile = (GByte *) this->tiles[bandTile
+					+ (size_t) ty * this->nXTiles + tx];
+			for (int y = y0; y < y1; ++y) {
+				GDALCopyWords(
+						(const GByte *) data
+								+ ((size_t) (y - w.yOff) * w.xSize + (x0 - w.xOff))
+										* nPixelBytes, eType, nPixelBytes,
+						tile + ((size_t) (y - ty * this->blockYSize)
+								* this->blockXSize + (x0 - tx * this->blockXSize))
+								* nTileBytes, this->types[o.band - 1],
+						nTileBytes, x1 - x0);
+			}
+		}
+	}
+	return this->finish(w, false);
+}
+
+GALGError TileSink::discard(const GALGWindow &w) {
+	return this->finish(w, false);
+}
+
+GALGError TileSink::restore(const GALGWindow &w) {
+	return this->finish(w, true);
+}
+
+bool TileSink::isWritten(const GALGWindow &w) {
+	const GALGWindow &o = this->owned[w.index];
+	int xFirst, yFirst, xLast, yLast;
+	this->tilesOf(o, xFirst, yFirst, xLast, yLast);
+	size_t bandTile = (size_t) (o.band - 1) * this->nYTiles * this->nXTiles;
+	bool written = true;
+	CPLAcquireMutex(this->mutex, 1000.0);
+	for (int ty = yFirst; ty <= yLast && written; ++ty) {
+		for (int tx = xFirst; tx <= xLast && written; ++tx) {
+			size_t iTile = bandTile + (size_t) ty * this->nXTiles + tx;
+			written = this->remaining[iTile] == 0 && this->tiles[iTile] == NULL;
+		}
+	}
+	CPLReleaseMutex(this->mutex);
+	return written;
+}
+
+void TileSink::flush() {
+	CPLAcquireMutex(this->writeMutex, 1000.0);
+	this->dataset->FlushCache();
+	CPLReleaseMutex(this->writeMutex);
+}
+
+/*
+ * Count a window's pixels as arrived and write the tiles it completes
+ */
+GALGError TileSink::finish(const GALGWindow &w, bool restored) {
+	GALGError result = { 0, NULL };
+	const GALGWindow &o = this->owned[w.index];
+	int xFirst, yFirst, xLast, yLast;
+	this->tilesOf(o, xFirst, yFirst, xLast, yLast);
+	size_t bandTile = (size_t) (o.band - 1) * this->nYTiles * this->nXTiles;
+
+	CPLAcquireMutex(this->mutex, 1000.0);
+	if (this->aborted) {
+		result = this->err;
+		CPLReleaseMutex(this->mutex);
+		return result;
+	}
+	for (int ty = yFirst; ty <= yLast; ++ty) {
+		int y0 = std::max(o.yOff, ty * this->blockYSize);
+		int y1 = std::min(o.yOff + o.ySize, (ty + 1) * this->blockYSize);
+		for (int tx = xFirst; tx <= xLast; ++tx) {
+			int x0 = std::max(o.xOff, tx * this->blockXSize);
+			int x1 = std::min(o.xOff + o.xSize, (tx + 1) * this->blockXSize);
+			size_t iTile = bandTile + (size_t) ty * this->nXTiles + tx;
+			this->remaining[iTile] -= (GIntBig) (x1 - x0) * (y1 - y0);
+			this->stored[iTile] = this->stored[iTile] || restored;
+		}
+	}
+	this->done[w.index] = true;
+	while (this->frontier < this->done.size() && this->done[this->frontier]) {
+		this->frontier++;
+	}
+	CPLCondBroadcast(this->cond);
+	CPLReleaseMutex(this->mutex);
+	return this->emit();
+}
+
+/*
+ * Write, in tile order, the tiles whose windows are all done, i.e. whose
+ * last window is behind the frontier. One thread writes at a time; the
+ * others leave the tiles they made ready to it.
+ */
+GALGError TileSink::emit() {
+	GALGError result = { 0, NULL };
+	CPLAcquireMutex(this->writeMutex, 1000.0);
+	while (result.errnum == 0) {
+		CPLAcquireMutex(this->mutex, 1000.0);
+		if (this->aborted || this->nextTile >= this->tileOrder.size()
+				|| (size_t) this->tileLastWindows[this->nextTile]
+						>= this->frontier) {
+			CPLReleaseMutex(this->mutex);
+			break;
+		}
+		size_t iTile = this->tileOrder[this->nextTile++];
+		// Tiles which received no pixels are left to the driver
+		bool held = this->tiles[iTile] != NULL;
+		CPLReleaseMutex(this->mutex);
+		if (held) {
+			result = this->writeTile(iTile);
+			this->releaseTile(iTile);
+		}
+	}
+	CPLReleaseMutex(this->writeMutex);
+	return result;
+}
+
+/*
+ * Write a tile to the dataset; the caller holds writeMutex
+ */
+GALGError TileSink::writeTile(size_t iTile) {
+	GALGError result = { 0, NULL };
+	size_t nBandTiles = (size_t) this->nXTiles * this->nYTiles;
+	int band = (int) (iTile / nBandTiles) + 1;
+	int ty = (int) (iTile % nBandTiles / this->nXTiles);
+	int tx = (int) (iTile % this->nXTiles);
+
+	CPLErr eErr = this->dataset->GetRasterBand(band)->WriteBlock(tx, ty,
+			this->tiles[iTile]);
+
+	CPLAcquireMutex(this->mutex, 1000.0);
+	if (eErr != CE_None) {
+		if (this->err.errnum == 0) {
+			this->err.errnum = 1;
+			this->err.msg = "Could not write to output dataset";
+		}
+		this->aborted = true;
+		result = this->err;
+	} else {
+		this->nTilesWritten++;
+	}
+	CPLCondBroadcast(this->cond);
+	CPLReleaseMutex(this->mutex);
+	return result;
+}
+
+void TileSink::releaseTile(size_t iTile) {
+	size_t nBandTiles = (size_t) this->nXTiles * this->nYTiles;
+	int band = (int) (iTile / nBandTiles) + 1;
+	GIntBig tileBytes = (GIntBig) this->blockXSize * this->blockYSize
+			* (GDALGetDataTypeSize(this->types[band - 1]) / 8);
+	CPLAcquireMutex(this->mutex, 1000.0);
+	this->pool.release(this->tiles[iTile]);
+	this->tiles[iTile] = NULL;
+	this->heldBytes -= tileBytes;
+	CPLCondBroadcast(this->cond);
+	CPLReleaseMutex(this->mutex);
+}
+
+void TileSink::abort() {
+	CPLAcquireMutex(this->mutex, 1000.0);
+	this->aborted = true;
+	CPLCondBroadcast(this->cond);
+	CPLReleaseMutex(this->mutex);
+}
+
+GALGError TileSink::close() {
+	GALGError result = { 0, NULL };
+	// Only left over when windows went missing; what arrived is kept,
+	// still in tile order
+	CPLAcquireMutex(this->writeMutex, 1000.0);
+	for (size_t i = this->nextTile; i < this->tileOrder.size(); ++i) {
+		size_t iTile = this->tileOrder[i];
+		if (this->tiles[iTile] == NULL) {
+			continue;
+		}
+		if (!this->aborted && result.errnum == 0) {
+			result = this->writeTile(iTile);
+		}
+		this->releaseTile(iTile);
+	}
+	this->nextTile = this->tileOrder.size();
+	CPLReleaseMutex(this->writeMutex);
+	if (result.errnum == 0) {
+		result = this->err;
+	}
+	return result;
+}
+
+GIntBig TileSink::getTilesWritten() {
+	return this->nTilesWritten;
+}
+
+GIntBig TileSink::getPeakBytes() {
+	return this->peakBytes;
+}
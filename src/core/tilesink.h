@@ -0,0 +1,143 @@
+/*
+ * TILE SINK API
+ *
+ * Gathers processed windows, finished in any order on any thread, into
+ * whole tiles of the output dataset and writes each tile once it is
+ * complete, in an order which does not depend on the threads.
+ */
+#ifndef TILESINK_H_
+#define TILESINK_H_
+
+#include <vector>
+#include "gdal_priv.h"
+#include "cpl_multiproc.h"
+
+#include "core_exp.h"
+#include "common.h"
+#include "engine.h"
+#include "bufferpool.h"
+
+/*
+ * \brief Reassembles windows into output tiles.
+ *
+ * Windows need not line up with the output's tiles. Each window's pixels
+ * are copied into buffers of the tiles it touches, and a tile is written
+ * with a single WriteBlock once every pixel of it has arrived, so a
+ * compressed tile is never written partially, read back and written again.
+ * Tiles are written in the order of the last window over them (then of
+ * tile index), each once that window and every earlier one are done, so
+ * the file's layout is the same however windows are scheduled.
+ * Tiles which receive no pixels at all (every window over them discarded)
+ * are never written, which keeps sparse outputs sparse; any other pixels
+ * never written take the band's no data value.
+ *
+ * Copying runs concurrently; tiles are written one at a time. Tile buffers
+ * are recycled through the sink's own pool and held within a byte budget: a window
+ * needing new tiles beyond the budget waits until tiles are written,
+ * unless it is the earliest window not yet done, so windows claimed in
+ * order always make progress.
+ */
+class GALGCORE_DLL TileSink {
+
+public:
+	TileSink();
+	virtual ~TileSink();
+
+	/*
+	 * Start collecting tiles of dataset. owned holds, for each window (by
+	 * index), the region of it which goes to the output; the regions must
+	 * not overlap. Bands are written separately, so a pixel interleaved
+	 * output still has its other bands read back by the driver.
+	 */
+	GALGError open(GDALDataset *dataset, const std::vector<GALGWindow> &owned,
+			GIntBig budgetBytes);
+
+	/*
+	 * Add a whole window of eType pixels; only its owned region is used.
+	 * May be called from any thread, once per window.
+	 */
+	GALGError write(const GALGWindow &w, const void *data, GDALDataType eType);
+
+	/*
+	 * A window whose pixels will not come through the sink (skipped, or
+	 * written some other way)
+	 */
+	GALGError discard(const GALGWindow &w);
+
+	/*
+	 * A window already in the dataset, e.g. from an interrupted run. Tiles
+	 * it shares with other windows are read back before they are filled.
+	 */
+	GALGError restore(const GALGWindow &w);
+
+	/*
+	 * Whether every tile of a window has been written to the dataset
+	 */
+	bool isWritten(const GALGWindow &w);
+
+	/*
+	 * Flush the dataset, between tile writes
+	 */
+	void flush();
+
+	/*
+	 * Give up, e.g. when another window failed: waiting and later calls
+	 * return at once and nothing more is written
+	 */
+	void abort();
+
+	/*
+	 * Write any tiles still held and release every buffer
+	 */
+	GALGError close();
+
+	GIntBig getTilesWritten();
+	GIntBig getPeakBytes();
+
+protected:
+	GALGError finish(const GALGWindow &w, bool restored);
+	GALGError emit();
+	GALGError writeTile(size_t iTile);
+	void releaseTile(size_t iTile);
+	void tilesOf(const GALGWindow &owned, int &xFirst, int &yFirst,
+			int &xLast, int &yLast);
+	TileSink(const TileSink &);
+	TileSink &operator=(const TileSink &);
+	BufferPool pool;
+	GDALDataset *dataset;
+	std::vector<GALGWindow> owned;
+	int blockXSize, blockYSize, nXTiles, nYTiles;
+	std::vector<GDALDataType> types;
+	std::vector<double> fillValues;
+	/*
+	 * Per tile (band by band, row by row): pixels still to arrive, whether
+	 * some are already in the dataset, and the buffer, if any pixels have
+	 * arrived
+	 */
+	std::vector<GIntBig> remaining;
+	std::vector<bool> stored;
+	std::vector<void *> tiles;
+	/*
+	 * Windows done, and the earliest one not done
+	 */
+	std::vector<bool> done;
+	size_t frontier;
+	/*
+	 * Tiles in the order they are written, with the last window over each,
+	 * and the next one to write
+	 */
+	std::vector<size_t> tileOrder;
+	std::vector<int> tileLastWindows;
+	size_t nextTile;
+	GIntBig budgetBytes, heldBytes, peakBytes, nTilesWritten;
+	bool aborted;
+	GALGError err;
+	CPLMutex *mutex;
+	CPLCond *cond;
+	/*
+	 * Held while tiles are written to (or read back from) the dataset
+	 */
+	CPLMutex *writeMutex;
+};
+
+#endif // TILESINK_H_
@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <cmath>
+#include "zonal.h"
+#include "cpl_port.h"
+#include "cpl_vsi.h"
+
+static bool zoneLess(const GALGZoneStats &a, const GALGZoneStats &b) {
+	return a.zone < b.zone;
+}
+
+ZoneTable::ZoneTable() :
+		hasZoneNoData(false), hasValueNoData(false), zoneNoDataValue(0), valueNoDataValue(
+				0), nZones(0), nBits(0) {
+	this->clear();
+}
+
+void ZoneTable::setNoData(bool hasZoneNoData, double zoneNoDataValue,
+		bool hasValueNoData, double valueNoDataValue) {
+	this->hasZoneNoData = hasZoneNoData;
+	this->zoneNoDataValue = zoneNoDataValue;
+	this->hasValueNoData = hasValueNoData;
+	this->valueNoDataValue = valueNoDataValue;
+}
+
+/*
+ * Fibonacci hashing: the top bits of the zone times 2^64 / phi
+ */
+size_t ZoneTable::slotOf(GIntBig zone) const {
+	return (size_t) (((GUIntBig) zone * 0x9E3779B97F4A7C15ULL)
+			>> (64 - this->nBits));
+}
+
+GALGZoneStats &ZoneTable::entry(GIntBig zone) {
+	size_t mask = this->entries.size() - 1;
+	size_t i = this->slotOf(zone);
+	while (this->entries[i].count != 0) {
+		if (this->entries[i].zone == zone) {
+			return this->entries[i];
+		}
+		i = (i + 1) & mask;
+	}
+	if (2 * (this->nZones + 1) > this->entries.size()) {
+		this->grow();
+		return this->entry(zone);
+	}
+	// A new zone: the caller adds its first value
+	GALGZoneStats &stats = this->entries[i];
+	stats.zone = zone;
+	stats.mean = 0;
+	stats.m2 = 0;
+	stats.min = HUGE_VAL;
+	stats.max = -HUGE_VAL;
+	this->nZones++;
+	return stats;
+}
+
+void ZoneTable::grow() {
+	std::vector<GALGZoneStats> old;
+	old.swap(this->entries);
+	this->nBits++;
+	GALGZoneStats empty = { 0, 0, 0, 0, 0, 0 };
+	this->entries.assign((size_t) 1 << this->nBits, empty);
+	size_t mask = this->entries.size() - 1;
+	for (size_t j = 0; j < old.size(); ++j) {
+		if (old[j].count == 0) {
+			continue;
+		}
+		size_t i = this->slotOf(old[j].zone);
+		while (this->entries[i].count != 0) {
+			i = (i + 1) & mask;
+		}
+		this->entries[i] = old[j];
+	}
+}
+
+void ZoneTable::add(const double *zones, const double *values,
+		size_t nPixels) {
+	GALGZoneStats *stats = NULL;
+	GIntBig lastZone = 0;
+	for (size_t i = 0; i < nPixels; ++i) {
+		double z = zones[i], v = values[i];
+		if (CPLIsNan(z) || CPLIsNan(v)
+				|| (this->hasZoneNoData && z == this->zoneNoDataValue)
+				|| (this->hasValueNoData && v == this->valueNoDataValue)) {
+			continue;
+		}
+		GIntBig zone = (GIntBig) z;
+		if (stats == NULL || zone != lastZone) {
+			stats = &this->entry(zone);
+			lastZone = zone;
+		}
+		stats->count++;
+		double delta = v - stats->mean;
+		stats->mean += delta / stats->count;
+		stats->m2 += delta * (v - stats->mean);
+		stats->min = std::min(stats->min, v);
+		stats->max = std::max(stats->max, v);
+	}
+}
+
+void ZoneTable::merge(const ZoneTable &other) {
+	for (size_t j = 0; j < other.entries.size(); ++j) {
+		const GALGZoneStats &from = other.entries[j];
+		if (from.count == 0) {
+			continue;
+		}
+		GALGZoneStats &to = this->entry(from.zone);
+		GIntBig total = to.count + from.count;
+		double delta = from.mean - to.mean;
+		to.mean += delta * from.count / total;
+		to.m2 += from.m2 + delta * delta * ((double) to.count * from.count / total);
+		to.min = std::min(to.min, from.min);
+		to.max = std::max(to.max, from.max);
+		to.count = total;
+	}
+}
+
+size_t ZoneTable::size() const {
+	return this->nZones;
+}
+
+void ZoneTable::getZones(std::vector<GALGZoneStats> &zones) const {
+	zones.clear();
+	zones.reserve(this->nZones);
+	for (size_t j = 0; j < this->entries.size(); ++j) {
+		if (this->entries[j].count != 0) {
+			zones.push_back(this->entries[j]);
+		}
+	}
+	std::sort(zones.begin(), zones.end(), zoneLess);
+}
+
+void ZoneTable::clear() {
+	this->nBits = 6;
+	GALGZoneStats empty = { 0, 0, 0, 0, 0, 0 };
+	this->entries.assign((size_t) 1 << this->nBits, empty);
+	this->nZones = 0;
+}
+
+GALGError galgWriteZoneTable(const char *tablePathStr,
+		const std::vector<GALGZoneStats> &zones) {
+	GALGError err = { 0, NULL };
+	VSILFILE *file = VSIFOpenL(tablePathStr, "wb");
+	RETURNIF(file == NULL, 1, "Could not create zone table");
+	bool ok = VSIFPrintfL(file, "zone,count,sum,mean,min,max,std\n") > 0;
+	for (size_t i = 0; i < zones.size() && ok; ++i) {
+		const GALGZoneStats &z = zones[i];
+		ok = VSIFPrintfL(file,
+				CPL_FRMT_GIB "," CPL_FRMT_GIB ",%.17g,%.17g,%.17g,%.17g,%.17g\n",
+				z.zone, z.count, z.mean * z.count, z.mean, z.min, z.max,
+				std::sqrt(z.m2 / z.count)) > 0;
+	}
+	ok = VSIFCloseL(file) == 0 && ok;
+	RETURNIF(!ok, 1, "Could not write zone table");
+	return err;
+}
@@ -0,0 +1,78 @@
+/*
+ * ZONAL API
+ *
+ * Per-zone statistics of a value raster, the zones given by a second,
+ * co-registered raster of zone ids. Zones are aggregated into hash tables
+ * which hold one entry per zone, whatever the size of the rasters.
+ */
+#ifndef ZONAL_H_
+#define ZONAL_H_
+
+#include <vector>
+#include "gdal_priv.h"
+
+#include "core_exp.h"
+#include "common.h"
+
+/*
+ * The statistics of one zone. mean and m2 (the sum of squared differences
+ * from the mean) are kept by Welford's method.
+ */
+typedef struct GALGZoneStats {
+	GIntBig zone;
+	GIntBig count;
+	double mean, m2;
+	double min, max;
+} GALGZoneStats;
+
+/*
+ * \brief An open-addressing hash table of zone statistics.
+ *
+ * Entries are stored inline and probed linearly, so a lookup touches one
+ * or two cache lines; the table doubles once half full. Consecutive pixels
+ * of the same zone skip the lookup altogether.
+ */
+class GALGCORE_DLL ZoneTable {
+
+public:
+	ZoneTable();
+	virtual ~ZoneTable() {};
+	void setNoData(bool hasZoneNoData, double zoneNoDataValue,
+			bool hasValueNoData, double valueNoDataValue);
+
+	/*
+	 * Add co-registered zone ids and values. Pixels whose zone or value is
+	 * no data or NaN are left out.
+	 */
+	void add(const double *zones, const double *values, size_t nPixels);
+	void merge(const ZoneTable &other);
+	size_t size() const;
+
+	/*
+	 * Every zone, in zone order
+	 */
+	void getZones(std::vector<GALGZoneStats> &zones) const;
+	void clear();
+
+protected:
+	size_t slotOf(GIntBig zone) const;
+	GALGZoneStats &entry(GIntBig zone);
+	void grow();
+	bool hasZoneNoData, hasValueNoData;
+	double zoneNoDataValue, valueNoDataValue;
+	/*
+	 * Empty entries have a count of 0
+	 */
+	std::vector<GALGZoneStats> entries;
+	size_t nZones;
+	int nBits;
+};
+
+/*
+ * Write zone statistics as CSV: zone, count, sum, mean, min, max and
+ * (population) standard deviation
+ */
+GALGCORE_DLL GALGError galgWriteZoneTable(const char *tablePathStr,
+		const std::vector<GALGZoneStats> &zones);
+
+#endif // ZONAL_H_
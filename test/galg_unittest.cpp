@@ -1,10 +1,23 @@
 #include "gtest/gtest.h"
 #include "gdal.h"
 #include "gdal_priv.h"
+#include "cpl_string.h"
 #include "../src/core/iterator.h"
 #include "../src/core/galg.h"
+#include "../src/core/bufferpool.h"
+#include "../src/core/flow.h"
+#include "../src/core/mappedband.h"
+#include "../src/core/tilesink.h"
 #include "../src/alg/threshold.h"
+#include "../src/alg/reduce.h"
+#include "../src/alg/pixelops.h"
+#include "../src/alg/expr.h"
+#include "../src/alg/focal.h"
+#include <math.h>
 #include <cstdio>
+#include <algorithm>
+#include <map>
+#include <queue>
 
 char *file_name;
 
@@ -34,6 +47,34 @@ void ones_dataset(GDALDataset *ds) {
 
 }
 
+/*
+ * Write a Float32 GeoTIFF of pseudo-random values, with a few no data (-9999) pixels
+ */
+void random_dataset(const char *path, int xSize, int ySize, unsigned int seed) {
+	std::vector<float> data(xSize * ySize);
+	for (size_t i = 0; i < data.size(); ++i) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = (seed >> 16) % 97 == 0 ? -9999.0f : (float)((seed >> 16) % 1000) / 10.0f;
+	}
+	GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	GDALDataset *ds = driver->Create(path, xSize, ySize, 1, GDT_Float32, NULL);
+	ds->GetRasterBand(1)->SetNoDataValue(-9999.0);
+	ds->GetRasterBand(1)->RasterIO(GF_Write, 0, 0, xSize, ySize, &data[0], xSize, ySize, GDT_Float32, 0, 0);
+	GDALClose(ds);
+}
+
+/*
+ * Read the first band of a dataset as float
+ */
+std::vector<float> read_band(const char *path) {
+	GDALDataset *ds = (GDALDataset *)GDALOpen(path, GA_ReadOnly);
+	int xSize = ds->GetRasterXSize(), ySize = ds->GetRasterYSize();
+	std::vector<float> data(xSize * ySize);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, xSize, ySize, &data[0], xSize, ySize, GDT_Float32, 0, 0);
+	GDALClose(ds);
+	return data;
+}
+
 class IteratorTest: public testing::Test {
 
 protected:
@@ -142,25 +183,33 @@ TEST_F(IteratorTest, YieldsCorrectOffsets) {
 	EXPECT_FALSE(isMore);
 }
 
+TEST_F(IteratorTest, YieldsSinglePixelRemainder) {
+	/*
+	 * 3 x 11 blocks over the 10 x 12 raster leave a last
+	 * column of blocks 1 pixel wide and a last row 1 pixel high
+	 */
+	it->setBlockSize(3, 11);
+	int nBlocks = 0, nPixels = 0;
+	bool sawColumn = false, sawRow = false;
+	while (it->next(&xSize, &ySize, &xOff, &yOff)) {
+		nBlocks++;
+		nPixels += xSize * ySize;
+		sawColumn = sawColumn || (xOff == 9 && xSize == 1);
+		sawRow = sawRow || (yOff == 11 && ySize == 1);
+	}
+	EXPECT_EQ(8, nBlocks);
+	EXPECT_EQ(10 * 12, nPixels);
+	EXPECT_TRUE(sawColumn);
+	EXPECT_TRUE(sawRow);
+}
+
 TEST_F(IteratorTest, YieldsCorrectPixelBuffer) {
 	/*
 	 * A 10 x 12 raster with a block
 	 * size of 5 x 5 and a buffer of 1
-	 * should yield the following blocks
-	 *   | 0 1 2 3 4 5 6 7 8 9
-	 * --|---------------------
-	 * 0 | 0 0 0 0 0 0
-	 * 1 | 0 0 0 0 0 0
-	 * 2 | 0 0 0 0 0 0
-	 * 3 | 0 0 0 0 0 0
-	 * 4 | 0 0 0 0 0 0
-	 * 5 | 0 0 0 0 0 0
-	 * 6 |
-	 * 7 |
-	 * 8 |
-	 * 9 |
-	 * 10|
-	 * 11|
+	 * should yield each block widened
+	 * by 1 pixel within the raster, e.g.
+	 * the second and fourth blocks:
 	 *   | 0 1 2 3 4 5 6 7 8 9
 	 * --|---------------------
 	 * 0 |         1 1 1 1 1 1
@@ -170,25 +219,6 @@ TEST_F(IteratorTest, YieldsCorrectPixelBuffer) {
 	 * 4 |         1 1 1 1 1 1
 	 * 5 |         1 1 1 1 1 1
 	 * 6 |
-	 * 7 |
-	 * 8 |
-	 * 9 |
-	 * 10|
-	 * 11|
-	 *   | 0 1 2 3 4 5 6 7 8 9
-	 * --|---------------------
-	 * 0 |
-	 * 1 |
-	 * 2 |
-	 * 3 |
-	 * 4 |
-	 * 5 | 2 2 2 2 2 2
-	 * 6 | 2 2 2 2 2 2
-	 * 7 | 2 2 2 2 2 2
-	 * 8 | 2 2 2 2 2 2
-	 * 9 | 2 2 2 2 2 2
-	 * 10| 2 2 2 2 2 2
-	 * 11|
 	 *   | 0 1 2 3 4 5 6 7 8 9
 	 * --|---------------------
 	 * 3 |
@@ -200,52 +230,27 @@ TEST_F(IteratorTest, YieldsCorrectPixelBuffer) {
 	 * 9 |         3 3 3 3 3 3
 	 * 10|         3 3 3 3 3 3
 	 * 11|
-	 *   | 0 1 2 3 4 5 6 7 8 9
-	 * --|---------------------
-	 * 8 |
-	 * 9 | 4 4 4 4 4 4
-	 * 10| 4 4 4 4 4 4
-	 * 11| 4 4 4 4 4 4
-	 *
-	 *   | 0 1 2 3 4 5 6 7 8 9
-	 * --|---------------------
-	 * 8 |
-	 * 9 |         5 5 5 5 5 5
-	 * 10|         5 5 5 5 5 5
-	 * 11|         5 5 5 5 5 5
-
+	 * Neighbouring blocks overlap by
+	 * twice the buffer, so every pixel
+	 * of a block has its neighbours
 	 */
 	delete it;
 	it = new BufferedIterator(ds, 1);
 	it->setBlockSize(5, 5);
 
-	isMore = it->next(&xSize, &ySize, &xOff, &yOff);
-	EXPECT_TRUE(isMore);
-	EXPECT_EQ(6, xSize);
-	EXPECT_EQ(6, ySize);
-	EXPECT_EQ(0, xOff);
-	EXPECT_EQ(0, yOff);
-
-	isMore = it->next(&xSize, &ySize, &xOff, &yOff);
-	EXPECT_TRUE(isMore);
-	EXPECT_EQ(5, xSize);
-	EXPECT_EQ(6, ySize);
-	EXPECT_EQ(5, xOff);
-	EXPECT_EQ(0, yOff);
-
-	isMore = it->next(&xSize, &ySize, &xOff, &yOff);
-	EXPECT_TRUE(isMore);
-	EXPECT_EQ(6, xSize);
-	EXPECT_EQ(7, ySize);
-	EXPECT_EQ(0, xOff);
-	EXPECT_EQ(5, yOff);
-
-	isMore = it->next(&xSize, &ySize, &xOff, &yOff);
-	EXPECT_TRUE(isMore);
-	EXPECT_EQ(5, xSize);
-	EXPECT_EQ(7, ySize);
-	EXPECT_EQ(5, xOff);
-	EXPECT_EQ(5, yOff);
+	// xOff, yOff, xSize, ySize
+	const int expected[6][4] = {
+		{ 0, 0, 6, 6 }, { 4, 0, 6, 6 },
+		{ 0, 4, 6, 7 }, { 4, 4, 6, 7 },
+		{ 0, 9, 6, 3 }, { 4, 9, 6, 3 } };
+	for (int i = 0; i < 6; ++i) {
+		isMore = it->next(&xSize, &ySize, &xOff, &yOff);
+		EXPECT_TRUE(isMore);
+		EXPECT_EQ(expected[i][0], xOff);
+		EXPECT_EQ(expected[i][1], yOff);
+		EXPECT_EQ(expected[i][2], xSize);
+		EXPECT_EQ(expected[i][3], ySize);
+	}
 
 	isMore = it->next(&xSize, &ySize, &xOff, &yOff);
 	EXPECT_FALSE(isMore);
@@ -259,72 +264,129 @@ TEST_F(IteratorTest, YieldsCorrectPixelBuffer2) {
 	it = new BufferedIterator(ds, 1);
 	it->setBlockSize(3, 3);
 
-	isMore = it->next(&xSize, &ySize, &xOff, &yOff);
-	EXPECT_TRUE(isMore);
-	EXPECT_EQ(4, xSize);
-	EXPECT_EQ(4, ySize);
-	EXPECT_EQ(0, xOff);
-	EXPECT_EQ(0, yOff);
+	// Offsets and sizes of the widened blocks along each axis
+	const int xOffs[4] = { 0, 2, 5, 8 }, xSizes[4] = { 4, 5, 5, 2 };
+	const int yOffs[4] = { 0, 2, 5, 8 }, ySizes[4] = { 4, 5, 5, 4 };
+	for (int row = 0; row < 4; ++row) {
+		for (int col = 0; col < 4; ++col) {
+			isMore = it->next(&xSize, &ySize, &xOff, &yOff);
+			EXPECT_TRUE(isMore);
+			EXPECT_EQ(xOffs[col], xOff);
+			EXPECT_EQ(yOffs[row], yOff);
+			EXPECT_EQ(xSizes[col], xSize);
+			EXPECT_EQ(ySizes[row], ySize);
+		}
+	}
 
 	isMore = it->next(&xSize, &ySize, &xOff, &yOff);
-	EXPECT_TRUE(isMore);
-	EXPECT_EQ(5, xSize);
-	EXPECT_EQ(4, ySize);
-	EXPECT_EQ(3, xOff);
-	EXPECT_EQ(0, yOff);
+	EXPECT_FALSE(isMore);
+}
 
-	isMore = it->next(&xSize, &ySize, &xOff, &yOff);
-	EXPECT_TRUE(isMore);
-	EXPECT_EQ(3, xSize);
-	EXPECT_EQ(4, ySize);
-	EXPECT_EQ(7, xOff);
-	EXPECT_EQ(0, yOff);
+/*
+ * Adds one to every valid pixel and counts how often it ran on native data
+ */
+template <typename T>
+class AddOne: public IProcessImageT<T> {
 
-	isMore = it->next(&xSize, &ySize, &xOff, &yOff);
-	EXPECT_TRUE(isMore);
-	EXPECT_EQ(4, xSize);
-	EXPECT_EQ(5, ySize);
-	EXPECT_EQ(0, xOff);
-	EXPECT_EQ(3, yOff);
+public:
+	AddOne() : nNativeCalls(0) {}
+	GALGError processImageT(T *inputArray, T *outputArray, int nWindowXSize, int nWindowYSize,
+			double *inNoDataValue, double *outNoDataValue) {
+		GALGError err = { 0, NULL };
+		for (int i = 0; i < nWindowXSize * nWindowYSize; ++i) {
+			outputArray[i] = inputArray[i] == (T)*inNoDataValue ? (T)*outNoDataValue : inputArray[i] + 1;
+		}
+		return err;
+	}
+	GALGError processImageNative(void *inputArray, void *outputArray, GDALDataType eDataType,
+			int nWindowXSize, int nWindowYSize, double *inNoDataValue, double *outNoDataValue) {
+		nNativeCalls++;
+		return IProcessImageT<T>::processImageNative(inputArray, outputArray, eDataType, nWindowXSize, nWindowYSize,
+				inNoDataValue, outNoDataValue);
+	}
+	int nNativeCalls;
+};
 
-	isMore = it->next(&xSize, &ySize, &xOff, &yOff);
-	EXPECT_TRUE(isMore);
-	EXPECT_EQ(5, xSize);
-	EXPECT_EQ(5, ySize);
-	EXPECT_EQ(3, xOff);
-	EXPECT_EQ(3, yOff);
+/*
+ * Normalised difference of two bands, e.g. NDVI from red and near infra-red
+ */
+class NormalisedDifference: public IProcessBands {
 
-	isMore = it->next(&xSize, &ySize, &xOff, &yOff);
-	EXPECT_TRUE(isMore);
-	EXPECT_EQ(3, xSize);
-	EXPECT_EQ(5, ySize);
-	EXPECT_EQ(7, xOff);
-	EXPECT_EQ(3, yOff);
+public:
+	GALGInterleave getInterleave() {
+		return GALG_INTERLEAVE_PIXEL;
+	}
+	int getOutputBandCount(int nInputBands) {
+		return 1;
+	}
+	GALGError processBands(float *inputArray, int nInputBands, float *outputArray, int nOutputBands,
+			int nWindowXSize, int nWindowYSize, double *inNoDataValues, double *outNoDataValues) {
+		GALGError err = { 0, NULL };
+		for (int i = 0; i < nWindowXSize * nWindowYSize; ++i) {
+			float red = inputArray[i * nInputBands], nir = inputArray[i * nInputBands + 1];
+			outputArray[i] = (nir - red) / (nir + red);
+		}
+		return err;
+	}
+};
 
-	isMore = it->next(&xSize, &ySize, &xOff, &yOff);
-	EXPECT_TRUE(isMore);
-	EXPECT_EQ(4, xSize);
-	EXPECT_EQ(5, ySize);
-	EXPECT_EQ(0, xOff);
-	EXPECT_EQ(7, yOff);
+/*
+ * Counts the windows it is given
+ */
+class CountWindows: public IProcessImage {
 
-	isMore = it->next(&xSize, &ySize, &xOff, &yOff);
-	EXPECT_TRUE(isMore);
-	EXPECT_EQ(5, xSize);
-	EXPECT_EQ(5, ySize);
-	EXPECT_EQ(3, xOff);
-	EXPECT_EQ(7, yOff);
+public:
+	CountWindows() : nWindows(0) {}
+	GALGError processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+			double *inNoDataValue, double *outNoDataValue) {
+		nWindows++;
+		return IProcessImage::processImage(inputArray, outputArray, nWindowXSize, nWindowYSize,
+				inNoDataValue, outNoDataValue);
+	}
+	int nWindows;
+};
 
-	isMore = it->next(&xSize, &ySize, &xOff, &yOff);
-	EXPECT_TRUE(isMore);
-	EXPECT_EQ(3, xSize);
-	EXPECT_EQ(5, ySize);
-	EXPECT_EQ(7, xOff);
-	EXPECT_EQ(7, yOff);
+/*
+ * Copies windows through, failing once it has been given nWindows
+ */
+class FailAfter: public IProcessImage {
 
-	isMore = it->next(&xSize, &ySize, &xOff, &yOff);
-	EXPECT_FALSE(isMore);
-}
+public:
+	FailAfter(int nWindows) : nWindows(nWindows) {}
+	GALGError processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+			double *inNoDataValue, double *outNoDataValue) {
+		GALGError err = { 1, "Interrupted" };
+		if (nWindows-- <= 0) {
+			return err;
+		}
+		return IProcessImage::processImage(inputArray, outputArray, nWindowXSize, nWindowYSize,
+				inNoDataValue, outNoDataValue);
+	}
+	int nWindows;
+};
+
+// Sums each pixel with the pixels directly above and below it
+class ColumnSum: public IProcessImage {
+
+public:
+	int getPixelBuffer() {
+		return 1;
+	}
+	GALGError processImage(float *inputArray, float *outputArray, int nWindowXSize, int nWindowYSize,
+			double *inNoDataValue, double *outNoDataValue) {
+		GALGError err = { 0, NULL };
+		for (int y = 0; y < nWindowYSize; ++y) {
+			for (int x = 0; x < nWindowXSize; ++x) {
+				float sum = 0;
+				for (int dy = std::max(y - 1, 0); dy <= std::min(y + 1, nWindowYSize - 1); ++dy) {
+					sum += inputArray[dy * nWindowXSize + x];
+				}
+				outputArray[y * nWindowXSize + x] = sum;
+			}
+		}
+		return err;
+	}
+};
 
 class ProcessTest: public testing::Test {
 
@@ -363,6 +425,1740 @@ TEST_F(ProcessTest, Threshold) {
 	GDALClose(src);
 }
 
+TEST_F(ProcessTest, MapManyChainsProcesses) {
+	// Truncating at 100 then at 50 is the same as truncating at 50
+	RasterProcess process;
+	Threshold first, second;
+	first.setThresholdParams(100.0, 100.0, (int)THRESH_TRUNC);
+	second.setThresholdParams(50.0, 50.0, (int)THRESH_TRUNC);
+	IProcessImage passThrough;
+	std::vector<IProcessImage *> chain;
+	chain.push_back(&first);
+	chain.push_back(&passThrough);
+	chain.push_back(&second);
+	int xsize = 5, ysize = 5, buffer = 0;
+	GALGError err = process.mapMany(chain, file_name, "temp.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+
+	float srcData[10 * 12], dstData[10 * 12];
+	GDALDataset *ds = (GDALDataset *)GDALOpen(file_name, GA_ReadOnly);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, srcData, 10, 12, GDT_Float32, 0, 0);
+	GDALClose(ds);
+	ds = (GDALDataset *)GDALOpen("temp.tif", GA_ReadOnly);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, dstData, 10, 12, GDT_Float32, 0, 0);
+	GDALClose(ds);
+	for (int i = 0; i < 10 * 12; ++i) {
+		EXPECT_EQ(std::min(srcData[i], 50.0f), dstData[i]);
+	}
+}
+
+TEST_F(ProcessTest, MapManyChainsFocalAcrossWindows) {
+	// Every stage of the chain sees the whole neighbourhood of each output pixel,
+	// so windowed output matches running the stages one after another on the whole image
+	const int nx = 23, ny = 17;
+	random_dataset("temp_src.tif", nx, ny, 3);
+	std::vector<float> in = read_band("temp_src.tif"), middle(nx * ny), expected(nx * ny);
+	FocalStatistics maximum, mean;
+	maximum.setFocalParams(1, FOCAL_MAX);
+	mean.setFocalParams(2, FOCAL_MEAN);
+	GaussianBlur blur;
+	blur.setGaussianParams(0.5);
+	double noData = -9999.0;
+	maximum.processImage(&in[0], &expected[0], nx, ny, &noData, &noData);
+	blur.processImage(&expected[0], &middle[0], nx, ny, &noData, &noData);
+	mean.processImage(&middle[0], &expected[0], nx, ny, &noData, &noData);
+
+	std::vector<IProcessImage *> chain;
+	chain.push_back(&maximum);
+	chain.push_back(&blur);
+	chain.push_back(&mean);
+	for (int nThreads = 1; nThreads <= 3; nThreads += 2) {
+		RasterProcess process;
+		process.setNumThreads(nThreads);
+		int xsize = 5, ysize = 4;
+		GALGError err = process.mapMany(chain, "temp_src.tif", "temp.tif", &xsize, &ysize, NULL, false);
+		EXPECT_EQ(err.errnum, 0);
+		std::vector<float> out = read_band("temp.tif");
+		for (int i = 0; i < nx * ny; ++i) {
+			EXPECT_NEAR(expected[i], out[i], 1e-3) << "at " << i % nx << "," << i / nx << " with " << nThreads << " threads";
+		}
+	}
+	std::remove("temp_src.tif");
+}
+
+TEST_F(ProcessTest, FusedExpressionMatchesChain) {
+	// One fused pass gives the same raster as rescaling then clamping through mapMany
+	RasterProcess process;
+	Rescale rescale;
+	rescale.setRescaleParams(3.0, -20.0);
+	Clamp clamp;
+	clamp.setClampParams(0.0, 100.0);
+	std::vector<IProcessImage *> chain;
+	chain.push_back(&rescale);
+	chain.push_back(&clamp);
+	int xsize = 5, ysize = 5, buffer = 0;
+	GALGError err = process.mapMany(chain, file_name, "temp.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+
+	auto fused = pixelExpression(exprClamp(exprPixel() * 3.0f - 20.0f, 0.0f, 100.0f));
+	err = process.map(fused, file_name, "temp2.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+
+	float chainData[10 * 12], fusedData[10 * 12];
+	GDALDataset *ds = (GDALDataset *)GDALOpen("temp.tif", GA_ReadOnly);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, chainData, 10, 12, GDT_Float32, 0, 0);
+	GDALClose(ds);
+	ds = (GDALDataset *)GDALOpen("temp2.tif", GA_ReadOnly);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, fusedData, 10, 12, GDT_Float32, 0, 0);
+	GDALClose(ds);
+	for (int i = 0; i < 10 * 12; ++i) {
+		EXPECT_FLOAT_EQ(chainData[i], fusedData[i]);
+	}
+	std::remove("temp2.tif");
+
+	// Selects, comparisons and no data
+	auto select = pixelExpression(exprSelect(exprPixel() > 10.0f, exprAbs(-exprPixel()) / 2.0f, 1.0f));
+	float in[4] = { -9999.0f, 5.0f, 10.0f, 30.0f }, out[4];
+	double inNoData = -9999.0, outNoData = -1.0;
+	err = select.processImage(in, out, 2, 2, &inNoData, &outNoData);
+	EXPECT_EQ(err.errnum, 0);
+	EXPECT_FLOAT_EQ(-1.0f, out[0]);
+	EXPECT_FLOAT_EQ(1.0f, out[1]);
+	EXPECT_FLOAT_EQ(1.0f, out[2]);
+	EXPECT_FLOAT_EQ(15.0f, out[3]);
+}
+
+TEST_F(ProcessTest, FocalMatchesBruteForce) {
+	// Running sums and van Herk/Gil-Werman against direct neighbourhood loops, with no data and a radius wider than the window
+	const int nx = 37, ny = 23;
+	float in[nx * ny], out[nx * ny];
+	unsigned int seed = 1;
+	for (int i = 0; i < nx * ny; ++i) {
+		seed = seed * 1103515245 + 12345;
+		in[i] = (float)((seed >> 16) % 1000) / 10.0f;
+	}
+	in[5] = in[100] = in[400] = -9999.0f;
+	double inNoData = -9999.0, outNoData = -1.0;
+
+	const int radii[3] = { 1, 3, 40 };
+	for (int ir = 0; ir < 3; ++ir) {
+		int r = radii[ir];
+		for (int stat = FOCAL_MEAN; stat <= FOCAL_MAX; ++stat) {
+			FocalStatistics focal;
+			focal.setFocalParams(r, stat);
+			EXPECT_EQ(r, focal.getPixelBuffer());
+			EXPECT_EQ(0, focal.processImage(in, out, nx, ny, &inNoData, &outNoData).errnum);
+			for (int y = 0; y < ny; ++y) {
+				for (int x = 0; x < nx; ++x) {
+					double sum = 0, sumSq = 0, n = 0;
+					float lo = 1e30f, hi = -1e30f;
+					for (int v = std::max(y - r, 0); v <= std::min(y + r, ny - 1); ++v) {
+						for (int u = std::max(x - r, 0); u <= std::min(x + r, nx - 1); ++u) {
+							float z = in[v * nx + u];
+							if (z == -9999.0f) {
+								continue;
+							}
+							sum += z;
+							sumSq += (double)z * z;
+							n += 1;
+							lo = std::min(lo, z);
+							hi = std::max(hi, z);
+						}
+					}
+					double expected[4] = { sum / n, sqrt(std::max(sumSq / n - (sum / n) * (sum / n), 0.0)), lo, hi };
+					float actual = out[y * nx + x];
+					if (in[y * nx + x] == -9999.0f) {
+						EXPECT_EQ(-1.0f, actual);
+					} else {
+						EXPECT_NEAR(expected[stat], actual, 1e-3) << "r " << r << " stat " << stat << " at " << x << "," << y;
+					}
+				}
+			}
+		}
+	}
+
+	// Gaussian blur leaves out no data neighbours and renormalises; an unnormalised kernel extends the edges
+	GaussianBlur blur;
+	blur.setGaussianParams(1.0);
+	EXPECT_EQ(3, blur.getPixelBuffer());
+	EXPECT_EQ(0, blur.processImage(in, out, nx, ny, &inNoData, &outNoData).errnum);
+	float weights[7];
+	for (int i = 0; i < 7; ++i) {
+		weights[i] = (float)exp(-(double)(i - 3) * (i - 3) / 2.0);
+	}
+	for (int y = 0; y < ny; ++y) {
+		for (int x = 0; x < nx; ++x) {
+			if (in[y * nx + x] == -9999.0f) {
+				continue;
+			}
+			double sum = 0, weight = 0;
+			for (int v = std::max(y - 3, 0); v <= std::min(y + 3, ny - 1); ++v) {
+				for (int u = std::max(x - 3, 0); u <= std::min(x + 3, nx - 1); ++u) {
+					if (in[v * nx + u] != -9999.0f) {
+						sum += weights[u - x + 3] * weights[v - y + 3] * in[v * nx + u];
+						weight += weights[u - x + 3] * weights[v - y + 3];
+					}
+				}
+			}
+			EXPECT_NEAR(sum / weight, out[y * nx + x], 1e-3);
+		}
+	}
+
+	SeparableConvolution sobel;
+	std::vector<float> derivative(3), smooth(3);
+	derivative[0] = -1.0f; derivative[1] = 0.0f; derivative[2] = 1.0f;
+	smooth[0] = 1.0f; smooth[1] = 2.0f; smooth[2] = 1.0f;
+	sobel.setKernel(derivative, smooth, false);
+	EXPECT_EQ(0, sobel.processImage(in, out, nx, ny, NULL, NULL).errnum);
+	for (int y = 0; y < ny; ++y) {
+		for (int x = 0; x < nx; ++x) {
+			double sum = 0;
+			for (int v = -1; v <= 1; ++v) {
+				for (int u = -1; u <= 1; ++u) {
+					int yy = std::min(std::max(y + v, 0), ny - 1), xx = std::min(std::max(x + u, 0), nx - 1);
+					sum += derivative[u + 1] * smooth[v + 1] * in[yy * nx + xx];
+				}
+			}
+			EXPECT_NEAR(sum, out[y * nx + x], 1e-2);
+		}
+	}
+}
+
+TEST_F(ProcessTest, TerrainOnAPlane) {
+	// z = 2 * x rises to the east: 63.4 degrees of slope, facing west
+	float dem[6 * 5], out[6 * 5];
+	for (int i = 0; i < 6 * 5; ++i) {
+		dem[i] = 2.0f * (i % 6);
+	}
+	double inNoData = -9999.0, outNoData = -1.0;
+	Slope slope;
+	EXPECT_EQ(0, slope.processImage(dem, out, 6, 5, &inNoData, &outNoData).errnum);
+	EXPECT_NEAR(atan(2.0) * 180 / 3.14159265358979, out[2 * 6 + 2], 1e-4);
+	slope.setSlopeParams(true);
+	slope.processImage(dem, out, 6, 5, &inNoData, &outNoData);
+	EXPECT_NEAR(200.0, out[2 * 6 + 2], 1e-3);
+
+	Aspect aspect;
+	EXPECT_EQ(0, aspect.processImage(dem, out, 6, 5, &inNoData, &outNoData).errnum);
+	EXPECT_NEAR(270.0, out[2 * 6 + 2], 1e-4);
+
+	// Lit from the west, the west facing slope gets cos(zenith - slope)
+	Hillshade hillshade;
+	hillshade.setHillshadeParams(270.0, 45.0);
+	EXPECT_EQ(0, hillshade.processImage(dem, out, 6, 5, &inNoData, &outNoData).errnum);
+	EXPECT_NEAR(255 * cos(45 * 3.14159265358979 / 180 - atan(2.0)), out[2 * 6 + 2], 1e-2);
+}
+
+TEST_F(ProcessTest, FocalMapMatchesWholeImage) {
+	// Through RasterProcess, which widens the windows by the pixel buffer, the
+	// output is the same as processing the whole image at once
+	const int nx = 23, ny = 19;
+	random_dataset("temp_src.tif", nx, ny, 5);
+	std::vector<float> in = read_band("temp_src.tif"), expected(nx * ny);
+	double noData = -9999.0;
+
+	FocalStatistics max1, max2, mean2;
+	max1.setFocalParams(1, FOCAL_MAX);
+	max2.setFocalParams(2, FOCAL_MAX);
+	mean2.setFocalParams(2, FOCAL_MEAN);
+	GaussianBlur blur;
+	blur.setGaussianParams(1.0);
+	Slope slope;
+	IProcessImage *processors[5] = { &max1, &max2, &mean2, &blur, &slope };
+	const char *names[5] = { "max r1", "max r2", "mean r2", "blur", "slope" };
+
+	RasterProcess process;
+	for (int p = 0; p < 5; ++p) {
+		processors[p]->processImage(&in[0], &expected[0], nx, ny, &noData, &noData);
+		int xsize = 5, ysize = 5;
+		GALGError err = process.map(*processors[p], "temp_src.tif", "temp.tif", &xsize, &ysize, NULL, false);
+		EXPECT_EQ(err.errnum, 0);
+		std::vector<float> out = read_band("temp.tif");
+		for (int i = 0; i < nx * ny; ++i) {
+			EXPECT_NEAR(expected[i], out[i], 1e-3) << names[p] << " at " << i % nx << "," << i / nx;
+		}
+	}
+	std::remove("temp_src.tif");
+}
+
+TEST_F(ProcessTest, LabelComponentsAcrossWindows) {
+	// Random blobs dense enough that components wind through many windows
+	const int nx = 40, ny = 30;
+	GByte pixels[nx * ny];
+	unsigned int seed = 7;
+	for (int i = 0; i < nx * ny; ++i) {
+		seed = seed * 1103515245 + 12345;
+		pixels[i] = (GByte)((seed >> 16) % 100 < 55 ? 1 + (seed >> 24) % 2 : 0);
+	}
+	GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	GDALDataset *ds = driver->Create("temp_blobs.tif", nx, ny, 1, GDT_Byte, NULL);
+	ds->GetRasterBand(1)->RasterIO(GF_Write, 0, 0, nx, ny, pixels, nx, ny, GDT_Byte, 0, 0);
+	GDALClose(ds);
+	for (int connectivity = 4; connectivity <= 8; connectivity += 4) {
+		for (int match = 0; match < 2; ++match) {
+			// A flood fill of the whole raster is the reference
+			GUInt32 expected[nx * ny];
+			GUInt32 nExpected = 0;
+			memset(expected, 0, sizeof(expected));
+			for (int seedPixel = 0; seedPixel < nx * ny; ++seedPixel) {
+				if (pixels[seedPixel] == 0 || expected[seedPixel] != 0) {
+					continue;
+				}
+				expected[seedPixel] = ++nExpected;
+				std::vector<int> stack(1, seedPixel);
+				while (!stack.empty()) {
+					int i = stack.back();
+					stack.pop_back();
+					for (int dy = -1; dy <= 1; ++dy) {
+						for (int dx = -1; dx <= 1; ++dx) {
+							int x = i % nx + dx, y = i / nx + dy, j = y * nx + x;
+							if ((dx == 0 && dy == 0) || (connectivity == 4 && dx != 0 && dy != 0) || x < 0
+									|| x >= nx || y < 0 || y >= ny || pixels[j] == 0 || expected[j] != 0
+									|| (match && pixels[j] != pixels[i])) {
+								continue;
+							}
+							expected[j] = nExpected;
+							stack.push_back(j);
+						}
+					}
+				}
+			}
+
+			RasterProcess process;
+			process.setNumThreads(3);
+			int xsize = 7, ysize = 6;
+			GIntBig nComponents = 0;
+			GALGError err = process.labelComponents("temp_blobs.tif", "temp.tif", &xsize, &ysize, connectivity,
+					match != 0, &nComponents);
+			EXPECT_EQ(0, err.errnum);
+			EXPECT_EQ((GIntBig)nExpected, nComponents);
+
+			GUInt32 actual[nx * ny];
+			ds = (GDALDataset *)GDALOpen("temp.tif", GA_ReadOnly);
+			EXPECT_EQ(GDT_UInt32, ds->GetRasterBand(1)->GetRasterDataType());
+			ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, nx, ny, actual, nx, ny, GDT_UInt32, 0, 0);
+			GDALClose(ds);
+
+			// The same partition of the pixels: labels correspond one to one
+			std::map<GUInt32, GUInt32> forward, backward;
+			for (int i = 0; i < nx * ny; ++i) {
+				EXPECT_EQ(expected[i] == 0, actual[i] == 0);
+				EXPECT_LE(actual[i], (GUInt32)nComponents);
+				if (forward.count(expected[i]) == 0) {
+					forward[expected[i]] = actual[i];
+				}
+				if (backward.count(actual[i]) == 0) {
+					backward[actual[i]] = expected[i];
+				}
+				EXPECT_EQ(forward[expected[i]], actual[i]);
+				EXPECT_EQ(backward[actual[i]], expected[i]);
+			}
+		}
+	}
+	std::remove("temp_blobs.tif");
+}
+
+TEST_F(ProcessTest, FlowRoutingAcrossTiles) {
+	// A bumpy surface full of pits, with a hole of no data in the middle
+	const int nx = 37, ny = 29;
+	const float noData = -9999;
+	float dem[nx * ny];
+	unsigned int seed = 11;
+	for (int y = 0; y < ny; ++y) {
+		for (int x = 0; x < nx; ++x) {
+			seed = seed * 1103515245 + 12345;
+			dem[y * nx + x] = (float)(50 + 20 * sin(x * 0.4) * cos(y * 0.5) + (seed >> 16) % 10);
+		}
+	}
+	for (int y = 12; y < 15; ++y) {
+		for (int x = 16; x < 19; ++x) {
+			dem[y * nx + x] = noData;
+		}
+	}
+	GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	GDALDataset *ds = driver->Create("temp_dem.tif", nx, ny, 1, GDT_Float32, NULL);
+	ds->GetRasterBand(1)->SetNoDataValue(noData);
+	ds->GetRasterBand(1)->RasterIO(GF_Write, 0, 0, nx, ny, dem, nx, ny, GDT_Float32, 0, 0);
+	GDALClose(ds);
+
+	// Priority-flood of the whole raster from its outlets is the reference fill
+	float expected[nx * ny];
+	std::vector<bool> seen(nx * ny, false);
+	std::priority_queue<std::pair<float, int>, std::vector<std::pair<float, int> >,
+			std::greater<std::pair<float, int> > > queue;
+	for (int i = 0; i < nx * ny; ++i) {
+		expected[i] = dem[i];
+		if (dem[i] == noData) {
+			continue;
+		}
+		int x = i % nx, y = i / nx;
+		bool outlet = false;
+		for (int dy = -1; dy <= 1; ++dy) {
+			for (int dx = -1; dx <= 1; ++dx) {
+				int ax = x + dx, ay = y + dy;
+				outlet = outlet || ax < 0 || ay < 0 || ax >= nx || ay >= ny || dem[ay * nx + ax] == noData;
+			}
+		}
+		if (outlet) {
+			seen[i] = true;
+			queue.push(std::make_pair(dem[i], i));
+		}
+	}
+	while (!queue.empty()) {
+		std::pair<float, int> cell = queue.top();
+		queue.pop();
+		for (int dy = -1; dy <= 1; ++dy) {
+			for (int dx = -1; dx <= 1; ++dx) {
+				int x = cell.second % nx + dx, y = cell.second / nx + dy, j = y * nx + x;
+				if (x < 0 || y < 0 || x >= nx || y >= ny || seen[j] || dem[j] == noData) {
+					continue;
+				}
+				seen[j] = true;
+				expected[j] = std::max(dem[j], cell.first);
+				queue.push(std::make_pair(expected[j], j));
+			}
+		}
+	}
+
+	int nRaised = 0;
+	for (int i = 0; i < nx * ny; ++i) {
+		nRaised += expected[i] > dem[i];
+	}
+	EXPECT_GT(nRaised, 0);
+
+	RasterProcess process;
+	process.setNumThreads(3);
+	int xsize = 7, ysize = 6;
+	GALGError err = process.routeFlow("temp_dem.tif", "temp_filled.tif", "temp_dirs.tif", &xsize, &ysize);
+	EXPECT_EQ(0, err.errnum);
+
+	float filled[nx * ny];
+	GByte dirs[nx * ny];
+	ds = (GDALDataset *)GDALOpen("temp_filled.tif", GA_ReadOnly);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, nx, ny, filled, nx, ny, GDT_Float32, 0, 0);
+	GDALClose(ds);
+	ds = (GDALDataset *)GDALOpen("temp_dirs.tif", GA_ReadOnly);
+	EXPECT_EQ(GDT_Byte, ds->GetRasterBand(1)->GetRasterDataType());
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, nx, ny, dirs, nx, ny, GDT_Byte, 0, 0);
+	GDALClose(ds);
+	EXPECT_EQ(0, memcmp(expected, filled, sizeof(filled)));
+
+	// Every path runs downhill over the fill, without cycles, out of the raster or into no data;
+	// counting the cells on each path gives the reference accumulation
+	std::vector<double> expectedAcc(nx * ny, 0.0);
+	for (int i = 0; i < nx * ny; ++i) {
+		EXPECT_EQ(dem[i] == noData, dirs[i] == 0);
+		int j = i, nSteps = 0;
+		while (j >= 0 && dirs[j] != 0 && nSteps <= nx * ny) {
+			expectedAcc[j] += 1;
+			int dx, dy;
+			ASSERT_TRUE(galgD8Offset(dirs[j], &dx, &dy));
+			int x = j % nx + dx, y = j / nx + dy;
+			int next = x < 0 || y < 0 || x >= nx || y >= ny ? -1 : y * nx + x;
+			if (next >= 0 && dirs[next] != 0) {
+				EXPECT_LE(filled[next], filled[j]);
+			}
+			j = next;
+			nSteps++;
+		}
+		EXPECT_LE(nSteps, nx * ny);
+	}
+
+	// One tile gives the same directions
+	GByte wholeDirs[nx * ny];
+	xsize = nx;
+	ysize = ny;
+	err = process.routeFlow("temp_dem.tif", NULL, "temp_dirs_whole.tif", &xsize, &ysize);
+	EXPECT_EQ(0, err.errnum);
+	ds = (GDALDataset *)GDALOpen("temp_dirs_whole.tif", GA_ReadOnly);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, nx, ny, wholeDirs, nx, ny, GDT_Byte, 0, 0);
+	GDALClose(ds);
+	for (int i = 0; i < nx * ny; ++i) {
+		EXPECT_EQ(wholeDirs[i] == 0, dirs[i] == 0);
+	}
+
+	xsize = 5;
+	ysize = 4;
+	err = process.accumulateFlow("temp_dirs.tif", "temp.tif", &xsize, &ysize);
+	EXPECT_EQ(0, err.errnum);
+	double acc[nx * ny];
+	ds = (GDALDataset *)GDALOpen("temp.tif", GA_ReadOnly);
+	EXPECT_EQ(GDT_Float64, ds->GetRasterBand(1)->GetRasterDataType());
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, nx, ny, acc, nx, ny, GDT_Float64, 0, 0);
+	GDALClose(ds);
+	for (int i = 0; i < nx * ny; ++i) {
+		EXPECT_EQ(expectedAcc[i], acc[i]);
+	}
+
+	std::remove("temp_dem.tif");
+	std::remove("temp_filled.tif");
+	std::remove("temp_dirs.tif");
+	std::remove("temp_dirs_whole.tif");
+}
+
+TEST_F(ProcessTest, FlowAccumulationRejectsCycles) {
+	// Two cells pointing at each other, in different tiles
+	GByte dirs[4 * 4];
+	memset(dirs, galgD8Code(0, 1), sizeof(dirs));
+	dirs[1 * 4 + 1] = galgD8Code(1, 0);
+	dirs[1 * 4 + 2] = galgD8Code(-1, 0);
+	GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	GDALDataset *ds = driver->Create("temp_dirs.tif", 4, 4, 1, GDT_Byte, NULL);
+	ds->GetRasterBand(1)->RasterIO(GF_Write, 0, 0, 4, 4, dirs, 4, 4, GDT_Byte, 0, 0);
+	GDALClose(ds);
+
+	RasterProcess process;
+	int xsize = 2, ysize = 2;
+	GALGError err = process.accumulateFlow("temp_dirs.tif", "temp.tif", &xsize, &ysize);
+	EXPECT_EQ(1, err.errnum);
+	xsize = 4;
+	ysize = 4;
+	err = process.accumulateFlow("temp_dirs.tif", "temp.tif", &xsize, &ysize);
+	EXPECT_EQ(1, err.errnum);
+	std::remove("temp_dirs.tif");
+}
+
+TEST_F(ProcessTest, StatisticsMatchBruteForce) {
+	double values[10 * 12];
+	GDALDataset *ds = (GDALDataset *)GDALOpen(file_name, GA_ReadOnly);
+	int bHasNoData;
+	double noData = ds->GetRasterBand(1)->GetNoDataValue(&bHasNoData);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, values, 10, 12, GDT_Float64, 0, 0);
+	GDALClose(ds);
+	std::vector<double> valid;
+	for (int i = 0; i < 10 * 12; ++i) {
+		if (!(bHasNoData && values[i] == noData)) {
+			valid.push_back(values[i]);
+		}
+	}
+	std::sort(valid.begin(), valid.end());
+	double sum = 0, squares = 0;
+	for (size_t i = 0; i < valid.size(); ++i) {
+		sum += valid[i];
+	}
+	double mean = sum / valid.size();
+	for (size_t i = 0; i < valid.size(); ++i) {
+		squares += (valid[i] - mean) * (valid[i] - mean);
+	}
+
+	RasterProcess process;
+	process.setNumThreads(3);
+	RasterStatistics stats;
+	double lo = valid.front(), hi = valid.back();
+	EXPECT_EQ(0, stats.setHistogramParams(lo, hi, 8).errnum);
+	EXPECT_EQ(0, stats.setQuantileParams(200).errnum);
+	int xsize = 3, ysize = 5;
+	GALGError err = process.computeStatistics(file_name, 1, stats, &xsize, &ysize);
+	EXPECT_EQ(0, err.errnum);
+	EXPECT_EQ((GIntBig)valid.size(), stats.getCount());
+	EXPECT_EQ(lo, stats.getMin());
+	EXPECT_EQ(hi, stats.getMax());
+	EXPECT_NEAR(mean, stats.getMean(), 1e-9 * fabs(mean) + 1e-12);
+	EXPECT_NEAR(squares / valid.size(), stats.getVariance(), 1e-9 * squares);
+
+	std::vector<GIntBig> histogram(8, 0);
+	for (size_t i = 0; i < valid.size(); ++i) {
+		histogram[std::min((int)((valid[i] - lo) * 8 / (hi - lo)), 7)]++;
+	}
+	EXPECT_TRUE(histogram == stats.getHistogram());
+
+	// Few enough values for the sketch to hold them all: quantiles are exact
+	for (int q = 0; q <= 4; ++q) {
+		size_t rank = (size_t)ceil(q / 4.0 * valid.size());
+		EXPECT_EQ(valid[rank > 0 ? rank - 1 : 0], stats.getQuantile(q / 4.0));
+	}
+	EXPECT_EQ(1, process.computeStatistics(file_name, 2, stats, &xsize, &ysize).errnum);
+}
+
+TEST_F(ProcessTest, QuantileSketchRankError) {
+	// Two sketches of a shuffled stream, merged, keep ranks to within a few 1/k
+	const int n = 200000;
+	std::vector<double> stream(n);
+	for (int i = 0; i < n; ++i) {
+		stream[i] = i;
+	}
+	unsigned int seed = 3;
+	for (int i = n - 1; i > 0; --i) {
+		seed = seed * 1103515245 + 12345;
+		std::swap(stream[i], stream[(seed >> 8) % (i + 1)]);
+	}
+	RasterStatistics first, second;
+	first.setQuantileParams(200);
+	second.setQuantileParams(200);
+	first.add(&stream[0], n / 2);
+	second.add(&stream[n / 2], n / 2);
+	EXPECT_EQ(0, first.merge(second).errnum);
+	EXPECT_EQ(n, first.getCount());
+	for (int q = 1; q < 10; ++q) {
+		EXPECT_NEAR(q / 10.0 * n, first.getQuantile(q / 10.0), 0.02 * n);
+	}
+
+	RasterStatistics binned;
+	binned.setHistogramParams(0, 1, 4);
+	EXPECT_EQ(1, first.merge(binned).errnum);
+}
+
+TEST_F(ProcessTest, MapCollectsOutputStatistics) {
+	// Overlapping windows still count each output pixel once
+	RasterProcess process;
+	process.setNumThreads(3);
+	std::vector<RasterStatistics> statistics(1);
+	statistics[0].setQuantileParams(64);
+	process.setOutputStatistics(&statistics);
+	Threshold threshold;
+	threshold.setThresholdParams(100.0, 50.0, (int)THRESH_BINARY);
+	int xsize = 4, ysize = 3, buffer = 2;
+	GALGError err = process.map(threshold, file_name, "temp.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(0, err.errnum);
+	ASSERT_EQ(1u, statistics.size());
+
+	double values[10 * 12];
+	GDALDataset *ds = (GDALDataset *)GDALOpen("temp.tif", GA_ReadOnly);
+	int bHasNoData;
+	double noData = ds->GetRasterBand(1)->GetNoDataValue(&bHasNoData);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, values, 10, 12, GDT_Float64, 0, 0);
+	GDALClose(ds);
+	RasterStatistics expected;
+	expected.setNoData(bHasNoData != 0, noData);
+	expected.add(values, 10 * 12);
+	EXPECT_EQ(expected.getCount(), statistics[0].getCount());
+	EXPECT_EQ(expected.getMin(), statistics[0].getMin());
+	EXPECT_EQ(expected.getMax(), statistics[0].getMax());
+	EXPECT_DOUBLE_EQ(expected.getSum(), statistics[0].getSum());
+
+	// Collecting stops once unset
+	process.setOutputStatistics(NULL);
+	statistics[0].reset();
+	err = process.map(threshold, file_name, "temp.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(0, err.errnum);
+	EXPECT_EQ(0, statistics[0].getCount());
+}
+
+TEST_F(ProcessTest, ZonalStatisticsMatchBruteForce) {
+	double values[10 * 12];
+	GDALDataset *ds = (GDALDataset *)GDALOpen(file_name, GA_ReadOnly);
+	int bHasNoData;
+	double noData = ds->GetRasterBand(1)->GetNoDataValue(&bHasNoData);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, values, 10, 12, GDT_Float64, 0, 0);
+	GDALClose(ds);
+
+	// Blocky zones with large ids, and a no data zone
+	GInt32 zoneIds[10 * 12];
+	for (int y = 0; y < 12; ++y) {
+		for (int x = 0; x < 10; ++x) {
+			zoneIds[y * 10 + x] = (x / 3 + y / 4 * 7) % 5 * 100003;
+		}
+	}
+	GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	ds = driver->Create("temp_zones.tif", 10, 12, 1, GDT_Int32, NULL);
+	ds->GetRasterBand(1)->SetNoDataValue(200006);
+	ds->GetRasterBand(1)->RasterIO(GF_Write, 0, 0, 10, 12, zoneIds, 10, 12, GDT_Int32, 0, 0);
+	GDALClose(ds);
+
+	std::map<GIntBig, std::vector<double> > expected;
+	for (int i = 0; i < 10 * 12; ++i) {
+		if (zoneIds[i] != 200006 && !(bHasNoData && values[i] == noData)) {
+			expected[zoneIds[i]].push_back(values[i]);
+		}
+	}
+
+	for (int pipelined = 0; pipelined < 2; ++pipelined) {
+		RasterProcess process;
+		process.setNumThreads(3);
+		process.setPipelineDepth(pipelined ? 6 : 0);
+		std::vector<GALGZoneStats> zones;
+		int xsize = 3, ysize = 5;
+		GALGError err = process.zonalStatistics(file_name, "temp_zones.tif", "temp_zones.csv", &zones, &xsize,
+				&ysize);
+		EXPECT_EQ(0, err.errnum);
+		ASSERT_EQ(expected.size(), zones.size());
+		size_t i = 0;
+		for (std::map<GIntBig, std::vector<double> >::iterator it = expected.begin(); it != expected.end(); ++it, ++i) {
+			const std::vector<double> &v = it->second;
+			double sum = 0, squares = 0;
+			for (size_t j = 0; j < v.size(); ++j) {
+				sum += v[j];
+			}
+			for (size_t j = 0; j < v.size(); ++j) {
+				squares += (v[j] - sum / v.size()) * (v[j] - sum / v.size());
+			}
+			EXPECT_EQ(it->first, zones[i].zone);
+			EXPECT_EQ((GIntBig)v.size(), zones[i].count);
+			EXPECT_EQ(*std::min_element(v.begin(), v.end()), zones[i].min);
+			EXPECT_EQ(*std::max_element(v.begin(), v.end()), zones[i].max);
+			EXPECT_NEAR(sum / v.size(), zones[i].mean, 1e-9 * fabs(sum / v.size()) + 1e-9);
+			EXPECT_NEAR(squares, zones[i].m2, 1e-9 * squares + 1e-9);
+		}
+
+		// A header and a line per zone
+		FILE *csv = fopen("temp_zones.csv", "r");
+		ASSERT_TRUE(csv != NULL);
+		int nLines = 0;
+		char line[512];
+		while (fgets(line, sizeof(line), csv) != NULL) {
+			nLines++;
+		}
+		fclose(csv);
+		EXPECT_EQ((int)expected.size() + 1, nLines);
+	}
+
+	// The zone raster must match the value raster
+	ds = driver->Create("temp_zones.tif", 4, 4, 1, GDT_Int32, NULL);
+	GDALClose(ds);
+	RasterProcess process;
+	std::vector<GALGZoneStats> zones;
+	GALGError err = process.zonalStatistics(file_name, "temp_zones.tif", NULL, &zones, NULL, NULL);
+	EXPECT_EQ(1, err.errnum);
+	EXPECT_STREQ("Value and zone datasets must be the same size", err.msg);
+	std::remove("temp_zones.tif");
+	std::remove("temp_zones.csv");
+}
+
+TEST_F(ProcessTest, ZoneTableGrows) {
+	// Many zones, added in two tables and merged
+	std::vector<double> zones(20000), values(20000);
+	for (int i = 0; i < 20000; ++i) {
+		zones[i] = (i * 7919) % 5000 - 2500;
+		values[i] = i;
+	}
+	ZoneTable first, second;
+	first.add(&zones[0], &values[0], 10000);
+	second.add(&zones[10000], &values[10000], 10000);
+	first.merge(second);
+	EXPECT_EQ(5000u, first.size());
+	std::vector<GALGZoneStats> stats;
+	first.getZones(stats);
+	ASSERT_EQ(5000u, stats.size());
+	for (size_t i = 0; i < stats.size(); ++i) {
+		EXPECT_EQ((GIntBig)i - 2500, stats[i].zone);
+		EXPECT_EQ(4, stats[i].count);
+	}
+}
+
+TEST_F(ProcessTest, OutputOptionsCompression) {
+	RasterProcess process;
+	AddOne<GInt32> addOne;
+	int xsize = 4, ysize = 3;
+	GALGError err = process.map(addOne, file_name, "temp.tif", &xsize, &ysize, NULL, false);
+	EXPECT_EQ(0, err.errnum);
+	GDALDataset *ds = (GDALDataset *)GDALOpen("temp.tif", GA_ReadOnly);
+	const char *compression = ds->GetMetadataItem("COMPRESSION", "IMAGE_STRUCTURE");
+	ASSERT_TRUE(compression != NULL);
+	EXPECT_TRUE(EQUAL(compression, "ZSTD") || EQUAL(compression, "DEFLATE"));
+	double expected[10 * 12];
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, expected, 10, 12, GDT_Float64, 0, 0);
+	GDALClose(ds);
+
+	// Bad options are refused
+	OutputOptions options;
+	EXPECT_EQ(1, options.setCompression("JPEG2000", -1).errnum);
+	EXPECT_EQ(1, options.setCompression("ZSTD", 23).errnum);
+	EXPECT_EQ(1, options.setBlockSize(20, 20).errnum);
+	EXPECT_EQ(1, options.setDriver("NoSuchDriver").errnum);
+
+	// An explicit codec and tile size
+	EXPECT_EQ(0, options.setCompression("LZW", -1).errnum);
+	EXPECT_EQ(0, options.setBlockSize(32, 32).errnum);
+	process.setOutputOptions(options);
+	err = process.map(addOne, file_name, "temp.tif", &xsize, &ysize, NULL, false);
+	EXPECT_EQ(0, err.errnum);
+	ds = (GDALDataset *)GDALOpen("temp.tif", GA_ReadOnly);
+	EXPECT_STREQ("LZW", ds->GetMetadataItem("COMPRESSION", "IMAGE_STRUCTURE"));
+	int blockXSize, blockYSize;
+	ds->GetRasterBand(1)->GetBlockSize(&blockXSize, &blockYSize);
+	EXPECT_EQ(32, blockXSize);
+	EXPECT_EQ(32, blockYSize);
+	GDALClose(ds);
+
+	// A cloud optimised output replaces its temporary file
+	options.setCloudOptimised(true);
+	process.setOutputOptions(options);
+	err = process.map(addOne, file_name, "temp_cog.tif", &xsize, &ysize, NULL, false);
+	EXPECT_EQ(0, err.errnum);
+	ds = (GDALDataset *)GDALOpen("temp_cog.tif", GA_ReadOnly);
+	ASSERT_TRUE(ds != NULL);
+	double values[10 * 12];
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, values, 10, 12, GDT_Float64, 0, 0);
+	GDALClose(ds);
+	for (int i = 0; i < 10 * 12; ++i) {
+		EXPECT_EQ(expected[i], values[i]);
+	}
+	CPLPushErrorHandler(CPLQuietErrorHandler);
+	ds = (GDALDataset *)GDALOpen("temp_cog.tif.tmp.tif", GA_ReadOnly);
+	CPLPopErrorHandler();
+	EXPECT_TRUE(ds == NULL);
+	std::remove("temp_cog.tif");
+}
+
+TEST_F(ProcessTest, ParallelCompression) {
+	OutputOptions options;
+	EXPECT_EQ(1, options.setCompressionThreads(-1).errnum);
+	EXPECT_EQ(0, options.setCompressionThreads(4).errnum);
+	GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	char **creationOptions = options.getCreationOptions(driver, GDT_Int32, 100, 100, 1, false);
+	EXPECT_STREQ("4", CSLFetchNameValue(creationOptions, "NUM_THREADS"));
+	CSLDestroy(creationOptions);
+	options.setCompression("NONE", -1);
+	creationOptions = options.getCreationOptions(driver, GDT_Int32, 100, 100, 1, false);
+	EXPECT_TRUE(CSLFetchNameValue(creationOptions, "NUM_THREADS") == NULL);
+	CSLDestroy(creationOptions);
+
+	// Compressing on the worker threads' count gives the same file contents
+	Threshold threshold;
+	threshold.setThresholdParams(100.0, 50.0, (int)THRESH_BINARY);
+	int xsize = 4, ysize = 3;
+	RasterProcess serial;
+	GALGError err = serial.map(threshold, file_name, "temp.tif", &xsize, &ysize, NULL, false);
+	EXPECT_EQ(0, err.errnum);
+	double expected[10 * 12], values[10 * 12];
+	GDALDataset *ds = (GDALDataset *)GDALOpen("temp.tif", GA_ReadOnly);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, expected, 10, 12, GDT_Float64, 0, 0);
+	GDALClose(ds);
+
+	RasterProcess parallel;
+	parallel.setNumThreads(4);
+	err = parallel.map(threshold, file_name, "temp.tif", &xsize, &ysize, NULL, false);
+	EXPECT_EQ(0, err.errnum);
+	ds = (GDALDataset *)GDALOpen("temp.tif", GA_ReadOnly);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, values, 10, 12, GDT_Float64, 0, 0);
+	GDALClose(ds);
+	for (int i = 0; i < 10 * 12; ++i) {
+		EXPECT_EQ(expected[i], values[i]);
+	}
+}
+
+TEST_F(ProcessTest, ChainsInMemoryDatasets) {
+	// The same two steps through files, then through a MEM dataset and /vsimem/
+	AddOne<GInt32> addOne;
+	Threshold threshold;
+	threshold.setThresholdParams(100.0, 50.0, (int)THRESH_BINARY);
+	int xsize = 4, ysize = 3;
+	RasterProcess files;
+	GALGError err = files.map(addOne, file_name, "temp.tif", &xsize, &ysize, NULL, false);
+	EXPECT_EQ(0, err.errnum);
+	err = files.map(threshold, "temp.tif", "temp2.tif", &xsize, &ysize, NULL, false);
+	EXPECT_EQ(0, err.errnum);
+
+	GDALDataset *src = (GDALDataset *)GDALOpen(file_name, GA_ReadOnly);
+	ASSERT_TRUE(src != NULL);
+	RasterProcess memory;
+	OutputOptions options;
+	ASSERT_EQ(0, options.setDriver("MEM").errnum);
+	memory.setOutputOptions(options);
+	GDALDataset *added = NULL;
+	err = memory.map(addOne, src, "", &xsize, &ysize, NULL, false, &added);
+	EXPECT_EQ(0, err.errnum);
+	ASSERT_TRUE(added != NULL);
+	EXPECT_STREQ("MEM", added->GetDriver()->GetDescription());
+	GDALClose(src);
+
+	// An in-memory source is shared by the worker threads
+	memory.setOutputOptions(OutputOptions());
+	memory.setNumThreads(3);
+	GDALDataset *thresholded = NULL;
+	err = memory.map(threshold, added, "/vsimem/chained.tif", &xsize, &ysize, NULL, false, &thresholded);
+	EXPECT_EQ(0, err.errnum);
+	ASSERT_TRUE(thresholded != NULL);
+
+	float expected[10 * 12], values[10 * 12];
+	GDALDataset *ds = (GDALDataset *)GDALOpen("temp.tif", GA_ReadOnly);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, expected, 10, 12, GDT_Float32, 0, 0);
+	GDALClose(ds);
+	added->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, values, 10, 12, GDT_Float32, 0, 0);
+	EXPECT_EQ(0, memcmp(expected, values, sizeof(values)));
+	ds = (GDALDataset *)GDALOpen("temp2.tif", GA_ReadOnly);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, expected, 10, 12, GDT_Float32, 0, 0);
+	GDALClose(ds);
+	thresholded->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, values, 10, 12, GDT_Float32, 0, 0);
+	EXPECT_EQ(0, memcmp(expected, values, sizeof(values)));
+	GDALClose(thresholded);
+	GDALClose(added);
+	VSIUnlink("/vsimem/chained.tif");
+	std::remove("temp2.tif");
+
+	// A failed job hands nothing back
+	thresholded = added;
+	err = memory.map(threshold, (GDALDataset *)NULL, "temp.tif", &xsize, &ysize, NULL, false, &thresholded);
+	EXPECT_EQ(1, err.errnum);
+	EXPECT_TRUE(thresholded == NULL);
+}
+
+TEST_F(ProcessTest, OtherJobsTakeDatasets) {
+	// mapBands, mapRows and reduce on an in-memory source, shared by three threads
+	GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("MEM");
+	GDALDataset *src = driver->Create("", 10, 12, 2, GDT_Float32, NULL);
+	float bands[2][10 * 12];
+	for (int i = 0; i < 10 * 12; ++i) {
+		bands[0][i] = (float)(i % 10 + 1);
+		bands[1][i] = 3 * bands[0][i];
+	}
+	src->GetRasterBand(1)->SetNoDataValue(-1);
+	src->GetRasterBand(1)->RasterIO(GF_Write, 0, 0, 10, 12, bands[0], 10, 12, GDT_Float32, 0, 0);
+	src->GetRasterBand(2)->RasterIO(GF_Write, 0, 0, 10, 12, bands[1], 10, 12, GDT_Float32, 0, 0);
+
+	RasterProcess process;
+	OutputOptions options;
+	ASSERT_EQ(0, options.setDriver("MEM").errnum);
+	process.setOutputOptions(options);
+	process.setNumThreads(3);
+	int xsize = 4, ysize = 5, buffer = 0;
+	float values[10 * 12];
+
+	NormalisedDifference ndvi;
+	GDALDataset *result = NULL;
+	GALGError err = process.mapBands(ndvi, src, "", &xsize, &ysize, &buffer, false, &result);
+	EXPECT_EQ(0, err.errnum);
+	ASSERT_TRUE(result != NULL);
+	EXPECT_EQ(1, result->GetRasterCount());
+	result->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, values, 10, 12, GDT_Float32, 0, 0);
+	for (int i = 0; i < 10 * 12; ++i) {
+		EXPECT_FLOAT_EQ(0.5f, values[i]);
+	}
+	GDALClose(result);
+
+	ColumnSum columnSum;
+	std::vector<float> expected(10 * 12);
+	double noData = -1;
+	columnSum.processImage(bands[0], &expected[0], 10, 12, &noData, &noData);
+	int stripHeight = 4;
+	err = process.mapRows(columnSum, src, "", &stripHeight, NULL, &result);
+	EXPECT_EQ(0, err.errnum);
+	ASSERT_TRUE(result != NULL);
+	result->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, values, 10, 12, GDT_Float32, 0, 0);
+	EXPECT_EQ(expected, std::vector<float>(values, values + 10 * 12));
+	GDALClose(result);
+
+	ReduceMax maxReducer;
+	GDALDataset *inputs[] = { src, src, NULL };
+	err = process.reduce(maxReducer, inputs, "", &xsize, &ysize, &buffer, false, &result);
+	EXPECT_EQ(0, err.errnum);
+	ASSERT_TRUE(result != NULL);
+	result->GetRasterBand(2)->RasterIO(GF_Read, 0, 0, 10, 12, values, 10, 12, GDT_Float32, 0, 0);
+	EXPECT_EQ(0, memcmp(bands[1], values, sizeof(values)));
+	GDALClose(result);
+
+	// A failed job hands nothing back
+	GDALDataset *empty[] = { NULL };
+	result = src;
+	err = process.reduce(maxReducer, empty, "", &xsize, &ysize, &buffer, false, &result);
+	EXPECT_EQ(1, err.errnum);
+	EXPECT_TRUE(result == NULL);
+	GDALClose(src);
+}
+
+TEST_F(ProcessTest, CheckpointResumes) {
+	// 8x8 windows over 16x16 output tiles of a 64x64 raster
+	char **options = NULL;
+	options = CSLSetNameValue(options, "TILED", "YES");
+	options = CSLSetNameValue(options, "BLOCKXSIZE", "16");
+	options = CSLSetNameValue(options, "BLOCKYSIZE", "16");
+	GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	GDALDataset *ds = driver->Create("temp_src.tif", 64, 64, 1, GDT_Float32, options);
+	CSLDestroy(options);
+	float input[64 * 64];
+	for (int i = 0; i < 64 * 64; ++i) {
+		input[i] = (float) i;
+	}
+	ds->GetRasterBand(1)->RasterIO(GF_Write, 0, 0, 64, 64, input, 64, 64, GDT_Float32, 0, 0);
+	GDALClose(ds);
+
+	// Interrupted after 20 windows: the first two rows of windows fill the
+	// first row of tiles, so 16 windows are safely in the output
+	RasterProcess process;
+	ASSERT_EQ(1, process.setCheckpointing(true, -1).errnum);
+	ASSERT_EQ(0, process.setCheckpointing(true, 0).errnum);
+	int xsize = 8, ysize = 8;
+	FailAfter interrupted(20);
+	GALGError err = process.map(interrupted, "temp_src.tif", "temp.tif", &xsize, &ysize, NULL, false);
+	EXPECT_EQ(1, err.errnum);
+	VSIStatBufL stat;
+	EXPECT_EQ(0, VSIStatL("temp.tif.journal", &stat));
+
+	// The rerun only processes the other 48 and removes the journal
+	CountWindows counter;
+	err = process.map(counter, "temp_src.tif", "temp.tif", &xsize, &ysize, NULL, false);
+	EXPECT_EQ(0, err.errnum);
+	EXPECT_EQ(48, counter.nWindows);
+	EXPECT_NE(0, VSIStatL("temp.tif.journal", &stat));
+	float output[64 * 64];
+	ds = (GDALDataset *)GDALOpen("temp.tif", GA_ReadOnly);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 64, 64, output, 64, 64, GDT_Float32, 0, 0);
+	GDALClose(ds);
+	EXPECT_EQ(0, memcmp(input, output, sizeof(input)));
+
+	// Without a journal, the whole job runs again
+	CountWindows again;
+	err = process.map(again, "temp_src.tif", "temp.tif", &xsize, &ysize, NULL, false);
+	EXPECT_EQ(0, err.errnum);
+	EXPECT_EQ(64, again.nWindows);
+	std::remove("temp_src.tif");
+}
+
+TEST_F(ProcessTest, CheckpointRefusesOtherJobs) {
+	// Two sources of the same geometry and tiling
+	char **options = NULL;
+	options = CSLSetNameValue(options, "TILED", "YES");
+	options = CSLSetNameValue(options, "BLOCKXSIZE", "16");
+	options = CSLSetNameValue(options, "BLOCKYSIZE", "16");
+	GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	const char *sources[] = { "temp_src.tif", "temp_src2.tif" };
+	float input[2][64 * 64];
+	for (int s = 0; s < 2; ++s) {
+		for (int i = 0; i < 64 * 64; ++i) {
+			input[s][i] = (float) (i * (s + 1));
+		}
+		GDALDataset *ds = driver->Create(sources[s], 64, 64, 1, GDT_Float32, options);
+		ds->GetRasterBand(1)->RasterIO(GF_Write, 0, 0, 64, 64, input[s], 64, 64, GDT_Float32, 0, 0);
+		GDALClose(ds);
+	}
+	CSLDestroy(options);
+
+	// A journal left by the first source is refused for the second
+	RasterProcess process;
+	ASSERT_EQ(0, process.setCheckpointing(true, 0).errnum);
+	int xsize = 8, ysize = 8;
+	FailAfter interrupted(20);
+	GALGError err = process.map(interrupted, sources[0], "temp.tif", &xsize, &ysize, NULL, false);
+	EXPECT_EQ(1, err.errnum);
+	CountWindows counter;
+	err = process.map(counter, sources[1], "temp.tif", &xsize, &ysize, NULL, false);
+	EXPECT_EQ(0, err.errnum);
+	EXPECT_EQ(64, counter.nWindows);
+	std::vector<float> output = read_band("temp.tif");
+	EXPECT_EQ(0, memcmp(input[1], &output[0], sizeof(input[1])));
+
+	// And one left under another job key
+	FailAfter keyed(20);
+	ASSERT_EQ(0, process.setCheckpointing(true, 0, "threshold 100").errnum);
+	err = process.map(keyed, sources[0], "temp.tif", &xsize, &ysize, NULL, false);
+	EXPECT_EQ(1, err.errnum);
+	ASSERT_EQ(0, process.setCheckpointing(true, 0, "threshold 50").errnum);
+	CountWindows rekeyed;
+	err = process.map(rekeyed, sources[0], "temp.tif", &xsize, &ysize, NULL, false);
+	EXPECT_EQ(0, err.errnum);
+	EXPECT_EQ(64, rekeyed.nWindows);
+	VSIStatBufL stat;
+	EXPECT_NE(0, VSIStatL("temp.tif.journal", &stat));
+	std::remove(sources[0]);
+	std::remove(sources[1]);
+}
+
+TEST_F(ProcessTest, ReduceStreamsInputs) {
+	// Reducing copies of the same raster gives the raster back,
+	// for both incremental and whole-window reductions
+	RasterProcess process;
+	const char *inputs[] = { file_name, file_name, file_name, NULL };
+	int xsize = 4, ysize = 4, buffer = 0;
+
+	float srcData[10 * 12], dstData[10 * 12];
+	GDALDataset *ds = (GDALDataset *)GDALOpen(file_name, GA_ReadOnly);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, srcData, 10, 12, GDT_Float32, 0, 0);
+	GDALClose(ds);
+
+	ReduceMax maxReducer;
+	ReduceMean meanReducer;
+	ReduceMedian medianReducer;
+	IReduceImage *reducers[] = { &maxReducer, &meanReducer, &medianReducer };
+	for (int i = 0; i < 3; ++i) {
+		GALGError err = process.reduce(*reducers[i], inputs, "temp.tif", &xsize, &ysize, &buffer, false);
+		EXPECT_EQ(err.errnum, 0);
+		ds = (GDALDataset *)GDALOpen("temp.tif", GA_ReadOnly);
+		ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, dstData, 10, 12, GDT_Float32, 0, 0);
+		GDALClose(ds);
+		EXPECT_EQ(0, memcmp(srcData, dstData, sizeof(srcData)));
+	}
+}
+
+TEST_F(ProcessTest, ReduceTracksValidity) {
+	// The second input's -9999 is valid although it is the output's no data
+	// value, so the mosaic keeps it and the maximum does not go below it
+	float first[] = { -9999, -9999 }, second[] = { -9999, 3 }, third[] = { -10000, 4 };
+	float *inputs[] = { first, second, third };
+	double inNoData[] = { -9999, -1, -1 }, outNoData = -9999;
+	float result[2];
+
+	IReduceImage mosaic;
+	EXPECT_EQ(0, mosaic.reduceImage(inputs, 3, result, 2, 1, inNoData, &outNoData).errnum);
+	EXPECT_EQ(-9999, result[0]);
+	EXPECT_EQ(3, result[1]);
+
+	ReduceMax maxReducer;
+	EXPECT_EQ(0, maxReducer.reduceImage(inputs, 3, result, 2, 1, inNoData, &outNoData).errnum);
+	EXPECT_EQ(-9999, result[0]);
+	EXPECT_EQ(4, result[1]);
+}
+
+TEST_F(ProcessTest, NativeDataType) {
+	// The test raster is Int32, so an Int32 processor runs without conversion
+	RasterProcess process;
+	AddOne<GInt32> addOne;
+	int xsize = 5, ysize = 5, buffer = 0;
+	GALGError err = process.map(addOne, file_name, "temp.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+	EXPECT_GT(addOne.nNativeCalls, 0);
+
+	GInt32 srcData[10 * 12], dstData[10 * 12];
+	GDALDataset *ds = (GDALDataset *)GDALOpen(file_name, GA_ReadOnly);
+	double noData = ds->GetRasterBand(1)->GetNoDataValue();
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, srcData, 10, 12, GDT_Int32, 0, 0);
+	GDALClose(ds);
+	ds = (GDALDataset *)GDALOpen("temp.tif", GA_ReadOnly);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, dstData, 10, 12, GDT_Int32, 0, 0);
+	GDALClose(ds);
+	for (int i = 0; i < 10 * 12; ++i) {
+		EXPECT_EQ(srcData[i] == (GInt32)noData ? srcData[i] : srcData[i] + 1, dstData[i]);
+	}
+
+	// A Float64 processor falls back to the converting float path
+	AddOne<double> addOneDouble;
+	err = process.map(addOneDouble, file_name, "temp.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+	EXPECT_EQ(0, addOneDouble.nNativeCalls);
+}
+
+TEST_F(ProcessTest, MapBandsInterleaved) {
+	// Build a two band raster where band 1 is x + 1 and band 2 is 3 * (x + 1)
+	GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	GDALDataset *ds = driver->Create("temp_bands.tif", 10, 12, 2, GDT_Float32, NULL);
+	float bands[2][10 * 12];
+	for (int i = 0; i < 10 * 12; ++i) {
+		bands[0][i] = (float)(i % 10 + 1);
+		bands[1][i] = 3 * bands[0][i];
+	}
+	ds->GetRasterBand(1)->RasterIO(GF_Write, 0, 0, 10, 12, bands[0], 10, 12, GDT_Float32, 0, 0);
+	ds->GetRasterBand(2)->RasterIO(GF_Write, 0, 0, 10, 12, bands[1], 10, 12, GDT_Float32, 0, 0);
+	GDALClose(ds);
+
+	RasterProcess process;
+	NormalisedDifference ndvi;
+	int xsize = 4, ysize = 5, buffer = 0;
+	GALGError err = process.mapBands(ndvi, "temp_bands.tif", "temp.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+
+	ds = (GDALDataset *)GDALOpen("temp.tif", GA_ReadOnly);
+	EXPECT_EQ(1, ds->GetRasterCount());
+	float result[10 * 12];
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, result, 10, 12, GDT_Float32, 0, 0);
+	GDALClose(ds);
+	for (int i = 0; i < 10 * 12; ++i) {
+		EXPECT_FLOAT_EQ(0.5f, result[i]);
+	}
+	std::remove("temp_bands.tif");
+}
+
+TEST_F(ProcessTest, SkipHoles) {
+	// Three 16 x 16 tiles: one with data, one entirely no data and one never written
+	char **options = NULL;
+	options = CSLSetNameValue(options, "TILED", "YES");
+	options = CSLSetNameValue(options, "BLOCKXSIZE", "16");
+	options = CSLSetNameValue(options, "BLOCKYSIZE", "16");
+	options = CSLSetNameValue(options, "SPARSE_OK", "TRUE");
+	GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	GDALDataset *ds = driver->Create("temp_sparse.tif", 48, 16, 1, GDT_Byte, options);
+	CSLDestroy(options);
+	ds->GetRasterBand(1)->SetNoDataValue(0);
+	GByte tile[16 * 16];
+	memset(tile, 7, sizeof(tile));
+	ds->GetRasterBand(1)->RasterIO(GF_Write, 0, 0, 16, 16, tile, 16, 16, GDT_Byte, 0, 0);
+	memset(tile, 0, sizeof(tile));
+	ds->GetRasterBand(1)->RasterIO(GF_Write, 16, 0, 16, 16, tile, 16, 16, GDT_Byte, 0, 0);
+	GDALClose(ds);
+
+	RasterProcess process;
+	CountWindows counter;
+	int xsize = 16, ysize = 16, buffer = 0;
+	GALGError err = process.map(counter, "temp_sparse.tif", "temp.tif", &xsize, &ysize, &buffer, true);
+	EXPECT_EQ(err.errnum, 0);
+	EXPECT_EQ(1, counter.nWindows);
+
+	// Without skipHoles every window is processed
+	counter.nWindows = 0;
+	err = process.map(counter, "temp_sparse.tif", "temp.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+	EXPECT_EQ(3, counter.nWindows);
+
+	// A no data value a Byte cannot hold matches no pixel, so the zero
+	// tile has data
+	double unrepresentable[] = { 0.5, -9999 };
+	for (int i = 0; i < 2; ++i) {
+		ds = (GDALDataset *) GDALOpen("temp_sparse.tif", GA_Update);
+		ds->GetRasterBand(1)->SetNoDataValue(unrepresentable[i]);
+		GDALClose(ds);
+		counter.nWindows = 0;
+		err = process.map(counter, "temp_sparse.tif", "temp.tif", &xsize, &ysize, &buffer, true);
+		EXPECT_EQ(err.errnum, 0);
+		EXPECT_EQ(2, counter.nWindows);
+	}
+	std::remove("temp_sparse.tif");
+}
+
+TEST_F(ProcessTest, PlannerSnapsToBlocks) {
+	char **options = NULL;
+	options = CSLSetNameValue(options, "TILED", "YES");
+	options = CSLSetNameValue(options, "BLOCKXSIZE", "16");
+	options = CSLSetNameValue(options, "BLOCKYSIZE", "16");
+	options = CSLSetNameValue(options, "COMPRESS", "LZW");
+	GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	GDALDataset *ds = driver->Create("temp_tiled.tif", 100, 64, 1, GDT_Float32, options);
+	CSLDestroy(options);
+
+	WindowPlanner planner(ds);
+	EXPECT_TRUE(planner.isCompressed());
+	int xsize, ysize;
+
+	// Room for 2 x 2 tiles
+	planner.setBytesPerPixel(8);
+	planner.setMemoryBudget(32 * 32 * 8);
+	planner.plan(&xsize, &ysize);
+	EXPECT_EQ(32, xsize);
+	EXPECT_EQ(32, ysize);
+
+	// A buffered window still covers whole tiles; only its halo is read beyond them
+	planner.setBufferSize(2);
+	planner.setMemoryBudget(36 * 36 * 8);
+	planner.plan(&xsize, &ysize);
+	EXPECT_EQ(32, xsize);
+	EXPECT_EQ(32, ysize);
+	planner.setMemoryBudget(36 * 36 * 8 - 1);
+	planner.plan(&xsize, &ysize);
+	EXPECT_EQ(0, xsize % 16);
+	EXPECT_EQ(0, ysize % 16);
+	EXPECT_LT(xsize * ysize, 32 * 32);
+
+	// A compressed tile is never split, however small the budget
+	planner.setBufferSize(0);
+	planner.setMemoryBudget(16);
+	planner.plan(&xsize, &ysize);
+	EXPECT_EQ(16, xsize);
+	EXPECT_EQ(16, ysize);
+
+	// A large budget is capped by the raster
+	planner.setMemoryBudget(1 << 30);
+	planner.plan(&xsize, &ysize);
+	EXPECT_EQ(100, xsize);
+	EXPECT_EQ(64, ysize);
+	GDALClose(ds);
+	std::remove("temp_tiled.tif");
+
+	// Planned windows give the same output as explicit ones
+	Threshold threshold;
+	threshold.setThresholdParams(100.0, 50.0, (int)THRESH_BINARY);
+	RasterProcess process;
+	int buffer = 1;
+	GALGError err = process.map(threshold, file_name, "temp.tif", NULL, NULL, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+	xsize = 3;
+	ysize = 3;
+	err = process.map(threshold, file_name, "temp2.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+	GDALDataset *planned = (GDALDataset *) GDALOpen("temp.tif", GA_ReadOnly);
+	GDALDataset *fixed = (GDALDataset *) GDALOpen("temp2.tif", GA_ReadOnly);
+	std::vector<float> a(10 * 12), b(10 * 12);
+	planned->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, &a[0], 10, 12, GDT_Float32, 0, 0);
+	fixed->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, &b[0], 10, 12, GDT_Float32, 0, 0);
+	EXPECT_EQ(a, b);
+	GDALClose(planned);
+	GDALClose(fixed);
+	std::remove("temp2.tif");
+}
+
+TEST_F(ProcessTest, BlockCacheServesHalos) {
+	char **options = NULL;
+	options = CSLSetNameValue(options, "TILED", "YES");
+	options = CSLSetNameValue(options, "BLOCKXSIZE", "16");
+	options = CSLSetNameValue(options, "BLOCKYSIZE", "16");
+	GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	GDALDataset *ds = driver->Create("temp_tiled.tif", 48, 48, 1, GDT_Float32, options);
+	CSLDestroy(options);
+	std::vector<float> pixels(48 * 48);
+	for (size_t i = 0; i < pixels.size(); ++i) {
+		pixels[i] = (float) (i % 97);
+	}
+	ds->GetRasterBand(1)->RasterIO(GF_Write, 0, 0, 48, 48, &pixels[0], 48, 48, GDT_Float32, 0, 0);
+	GDALClose(ds);
+
+	Threshold threshold;
+	threshold.setThresholdParams(50.0, 1.0, (int)THRESH_BINARY);
+	int xsize = 12, ysize = 12, buffer = 4;
+	RasterProcess uncached;
+	GALGError err = uncached.map(threshold, "temp_tiled.tif", "temp.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+
+	RasterProcess cached;
+	err = cached.setBlockCacheSize(-1);
+	EXPECT_NE(err.errnum, 0);
+	err = cached.setBlockCacheSize(9 * 16 * 16 * sizeof(float));
+	EXPECT_EQ(err.errnum, 0);
+	err = cached.map(threshold, "temp_tiled.tif", "temp2.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+
+	// Every block is decoded once; overlapping windows hit the cache
+	EXPECT_EQ(9, cached.getBlockCacheMisses());
+	EXPECT_GT(cached.getBlockCacheHits(), 0);
+
+	GDALDataset *a = (GDALDataset *) GDALOpen("temp.tif", GA_ReadOnly);
+	GDALDataset *b = (GDALDataset *) GDALOpen("temp2.tif", GA_ReadOnly);
+	std::vector<float> outA(48 * 48), outB(48 * 48);
+	a->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 48, 48, &outA[0], 48, 48, GDT_Float32, 0, 0);
+	b->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 48, 48, &outB[0], 48, 48, GDT_Float32, 0, 0);
+	EXPECT_EQ(outA, outB);
+	GDALClose(a);
+	GDALClose(b);
+	std::remove("temp2.tif");
+	std::remove("temp_tiled.tif");
+}
+
+TEST_F(ProcessTest, MapRowsStreamsStrips) {
+	GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	GDALDataset *ds = driver->Create("temp_rows.tif", 7, 23, 1, GDT_Float32, NULL);
+	ds->GetRasterBand(1)->SetNoDataValue(255);
+	std::vector<float> pixels(7 * 23);
+	for (size_t i = 0; i < pixels.size(); ++i) {
+		pixels[i] = (float) (i % 13);
+	}
+	ds->GetRasterBand(1)->RasterIO(GF_Write, 0, 0, 7, 23, &pixels[0], 7, 23, GDT_Float32, 0, 0);
+	GDALClose(ds);
+
+	// The whole raster in one call is the reference
+	ColumnSum columnSum;
+	std::vector<float> expected(pixels.size());
+	double noData = 0;
+	columnSum.processImage(&pixels[0], &expected[0], 7, 23, &noData, &noData);
+
+	RasterProcess process;
+	int stripHeights[] = { 1, 4, 23 };
+	for (int i = 0; i < 3; ++i) {
+		GALGError err = process.mapRows(columnSum, "temp_rows.tif", "temp.tif", &stripHeights[i], NULL);
+		EXPECT_EQ(err.errnum, 0);
+		GDALDataset *out = (GDALDataset *) GDALOpen("temp.tif", GA_ReadOnly);
+		std::vector<float> result(pixels.size());
+		out->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 7, 23, &result[0], 7, 23, GDT_Float32, 0, 0);
+		EXPECT_EQ(expected, result);
+		GDALClose(out);
+	}
+
+	// A Byte processor on a Float32 band goes through the float path
+	AddOne<GByte> addOne;
+	int stripHeight = 4;
+	GALGError err = process.mapRows(addOne, "temp_rows.tif", "temp.tif", &stripHeight, NULL);
+	EXPECT_EQ(err.errnum, 0);
+	EXPECT_EQ(0, addOne.nNativeCalls);
+	std::vector<float> result = read_band("temp.tif");
+	for (size_t i = 0; i < pixels.size(); ++i) {
+		EXPECT_EQ(pixels[i] + 1, result[i]);
+	}
+
+	int tooHigh = 24;
+	err = process.mapRows(columnSum, "temp_rows.tif", "temp.tif", &tooHigh, NULL);
+	EXPECT_NE(err.errnum, 0);
+	std::remove("temp_rows.tif");
+}
+
+TEST_F(ProcessTest, BufferPoolReusesBuffers) {
+	BufferPool pool;
+	void *a = pool.acquire(1000);
+	void *b = pool.acquire(10);
+	EXPECT_EQ(0u, (size_t) a % GALG_BUFFER_ALIGNMENT);
+	EXPECT_EQ(0u, (size_t) b % GALG_BUFFER_ALIGNMENT);
+
+	// A released buffer is handed out again for any request it can hold
+	pool.release(a);
+	EXPECT_EQ(a, pool.acquire(500));
+	EXPECT_EQ(2, pool.getAllocationCount());
+	EXPECT_EQ(1010, pool.getPeakBytes());
+	pool.release(a);
+	pool.release(b);
+	pool.trim();
+	EXPECT_EQ(0, pool.getAllocatedBytes());
+
+	// Repeated runs reuse the buffers of the first
+	Threshold threshold;
+	threshold.setThresholdParams(100.0, 50.0, (int)THRESH_BINARY);
+	int xsize = 3, ysize = 3, buffer = 1;
+	RasterProcess process;
+	GALGError err = process.map(threshold, file_name, "temp.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+	GIntBig peak = process.getPeakBufferBytes();
+	EXPECT_EQ((GIntBig) 2 * 5 * 5 * sizeof(float), peak);
+	err = process.map(threshold, file_name, "temp.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+	EXPECT_EQ(peak, process.getPeakBufferBytes());
+}
+
+TEST_F(ProcessTest, BlockWindowsInPlace) {
+	// Windows of exactly one tile are processed inside the block cache
+	char **options = NULL;
+	options = CSLSetNameValue(options, "TILED", "YES");
+	options = CSLSetNameValue(options, "BLOCKXSIZE", "16");
+	options = CSLSetNameValue(options, "BLOCKYSIZE", "16");
+	GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	GDALDataset *ds = driver->Create("temp_tiled.tif", 48, 32, 1, GDT_Int16, options);
+	CSLDestroy(options);
+	std::vector<GInt16> pixels(48 * 32);
+	for (size_t i = 0; i < pixels.size(); ++i) {
+		pixels[i] = (GInt16) (i % 101);
+	}
+	ds->GetRasterBand(1)->SetNoDataValue(-1);
+	ds->GetRasterBand(1)->RasterIO(GF_Write, 0, 0, 48, 32, &pixels[0], 48, 32, GDT_Int16, 0, 0);
+	GDALClose(ds);
+
+	AddOne<GInt16> first, second;
+	std::vector<IProcessImage *> chain;
+	chain.push_back(&first);
+	chain.push_back(&second);
+	RasterProcess process;
+	int xsize = 16, ysize = 16, buffer = 0;
+	GALGError err = process.mapMany(chain, "temp_tiled.tif", "temp.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+	EXPECT_EQ(6, second.nNativeCalls);
+	EXPECT_EQ(6, process.getInPlaceWindows());
+
+	ds = (GDALDataset *) GDALOpen("temp.tif", GA_ReadOnly);
+	int blockXSize, blockYSize;
+	ds->GetRasterBand(1)->GetBlockSize(&blockXSize, &blockYSize);
+	EXPECT_EQ(16, blockXSize);
+	EXPECT_EQ(16, blockYSize);
+	std::vector<GInt16> result(pixels.size());
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 48, 32, &result[0], 48, 32, GDT_Int16, 0, 0);
+	GDALClose(ds);
+	for (size_t i = 0; i < pixels.size(); ++i) {
+		EXPECT_EQ(pixels[i] + 2, result[i]);
+	}
+
+	// With a buffer, the clipped corner windows read exactly one tile but
+	// only own part of it, so they go through the tile sink like the rest
+	xsize = 12, ysize = 12, buffer = 4;
+	err = process.mapMany(chain, "temp_tiled.tif", "temp.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+	EXPECT_EQ(0, process.getInPlaceWindows());
+	ds = (GDALDataset *) GDALOpen("temp.tif", GA_ReadOnly);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 48, 32, &result[0], 48, 32, GDT_Int16, 0, 0);
+	GDALClose(ds);
+	for (size_t i = 0; i < pixels.size(); ++i) {
+		EXPECT_EQ(pixels[i] + 2, result[i]);
+	}
+	std::remove("temp_tiled.tif");
+}
+
+TEST_F(ProcessTest, MemoryMappedInput) {
+	GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	GDALDataset *ds = driver->Create("temp_striped.tif", 20, 30, 1, GDT_Float32, NULL);
+	std::vector<float> pixels(20 * 30);
+	for (size_t i = 0; i < pixels.size(); ++i) {
+		pixels[i] = (float) (i % 41);
+	}
+	ds->GetRasterBand(1)->SetNoDataValue(-1);
+	ds->GetRasterBand(1)->RasterIO(GF_Write, 0, 0, 20, 30, &pixels[0], 20, 30, GDT_Float32, 0, 0);
+	MappedBand mapped;
+	EXPECT_TRUE(mapped.open("temp_striped.tif", ds->GetRasterBand(1)));
+	GDALClose(ds);
+
+	// Compressed bands (such as map's output) are not mapped
+	RasterProcess process;
+	CountWindows copy;
+	process.map(copy, file_name, "temp.tif", NULL, NULL, NULL, false);
+	ds = (GDALDataset *) GDALOpen("temp.tif", GA_ReadOnly);
+	EXPECT_FALSE(mapped.open("temp.tif", ds->GetRasterBand(1)));
+	GDALClose(ds);
+
+	// Full-width strips are read in place, other windows copied from the
+	// mapping; both match a RasterIO read
+	process.setMemoryMapInput(true);
+	int widths[] = { 20, 7 };
+	for (int i = 0; i < 2; ++i) {
+		AddOne<float> addOne;
+		int xsize = widths[i], ysize = 5, buffer = 0;
+		GALGError err = process.map(addOne, "temp_striped.tif", "temp.tif", &xsize, &ysize, &buffer, false);
+		EXPECT_EQ(err.errnum, 0);
+		ds = (GDALDataset *) GDALOpen("temp.tif", GA_ReadOnly);
+		std::vector<float> result(pixels.size());
+		ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 20, 30, &result[0], 20, 30, GDT_Float32, 0, 0);
+		GDALClose(ds);
+		for (size_t j = 0; j < pixels.size(); ++j) {
+			EXPECT_EQ(pixels[j] + 1, result[j]);
+		}
+	}
+	std::remove("temp_striped.tif");
+}
+
+TEST_F(ProcessTest, ParallelMatchesSerial) {
+	// A multi-threaded map should produce exactly the same pixels as a serial one
+	Threshold threshold;
+	threshold.setThresholdParams(100.0, 50.0, (int)THRESH_BINARY);
+	int xsize = 3, ysize = 3, buffer = 1;
+
+	RasterProcess serial;
+	GALGError err = serial.map(threshold, file_name, "temp.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+
+	RasterProcess parallel;
+	err = parallel.setNumThreads(4);
+	EXPECT_EQ(err.errnum, 0);
+	err = parallel.map(threshold, file_name, "temp2.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+
+	float serialData[10 * 12], parallelData[10 * 12];
+	GDALDataset *ds = (GDALDataset *)GDALOpen("temp.tif", GA_ReadOnly);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, serialData, 10, 12, GDT_Float32, 0, 0);
+	GDALClose(ds);
+	ds = (GDALDataset *)GDALOpen("temp2.tif", GA_ReadOnly);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, parallelData, 10, 12, GDT_Float32, 0, 0);
+	GDALClose(ds);
+	EXPECT_EQ(0, memcmp(serialData, parallelData, sizeof(serialData)));
+	std::remove("temp2.tif");
+}
+
+TEST_F(ProcessTest, PipelinedMatchesSerial) {
+	// Prefetching and write-behind must not change the output
+	Threshold threshold;
+	threshold.setThresholdParams(100.0, 50.0, (int)THRESH_BINARY);
+	int xsize = 3, ysize = 3, buffer = 0;
+
+	RasterProcess serial;
+	GALGError err = serial.map(threshold, file_name, "temp.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+
+	RasterProcess pipelined;
+	pipelined.setPipelineDepth(3);
+	pipelined.setNumThreads(2);
+	err = pipelined.map(threshold, file_name, "temp2.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+
+	float serialData[10 * 12], pipelinedData[10 * 12];
+	GDALDataset *ds = (GDALDataset *)GDALOpen("temp.tif", GA_ReadOnly);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, serialData, 10, 12, GDT_Float32, 0, 0);
+	GDALClose(ds);
+	ds = (GDALDataset *)GDALOpen("temp2.tif", GA_ReadOnly);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, pipelinedData, 10, 12, GDT_Float32, 0, 0);
+	GDALClose(ds);
+	EXPECT_EQ(0, memcmp(serialData, pipelinedData, sizeof(serialData)));
+	std::remove("temp2.tif");
+}
+
+TEST_F(ProcessTest, TileSinkReassemblesTiles) {
+	// 8x8 windows arriving backwards into 16x16 tiles of a 40x40 raster
+	char **options = NULL;
+	options = CSLSetNameValue(options, "TILED", "YES");
+	options = CSLSetNameValue(options, "BLOCKXSIZE", "16");
+	options = CSLSetNameValue(options, "BLOCKYSIZE", "16");
+	GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	GDALDataset *ds = driver->Create("temp.tif", 40, 40, 1, GDT_Int16, options);
+	CSLDestroy(options);
+	ds->GetRasterBand(1)->SetNoDataValue(-1);
+
+	std::vector<GALGWindow> windows;
+	for (int y = 0; y < 40; y += 8) {
+		for (int x = 0; x < 40; x += 8) {
+			GALGWindow w = { (int) windows.size(), 1, x, y, 8, 8 };
+			windows.push_back(w);
+		}
+	}
+	TileSink sink;
+	ASSERT_EQ(0, sink.open(ds, windows, 1 << 20).errnum);
+	float data[8 * 8];
+	for (int i = (int) windows.size() - 1; i >= 0; --i) {
+		const GALGWindow &w = windows[i];
+		// The first window, and the only one over the corner tile, are dropped
+		if (i == 0) {
+			// Tiles wait for every window before them, so nothing is written yet
+			EXPECT_EQ(0, sink.getTilesWritten());
+		}
+		if (i == 0 || (w.xOff == 32 && w.yOff == 32)) {
+			EXPECT_EQ(0, sink.discard(w).errnum);
+			continue;
+		}
+		for (int j = 0; j < 8 * 8; ++j) {
+			data[j] = (float) ((w.yOff + j / 8) * 40 + w.xOff + j % 8);
+		}
+		EXPECT_EQ(0, sink.write(w, data, GDT_Float32).errnum);
+	}
+	EXPECT_EQ(0, sink.close().errnum);
+	EXPECT_EQ(8, sink.getTilesWritten());
+	EXPECT_GE((GIntBig) 1 << 20, sink.getPeakBytes());
+
+	GInt16 values[40 * 40];
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 40, 40, values, 40, 40, GDT_Int16, 0, 0);
+	// The corner tile is left to the driver
+	for (int y = 0; y < 40; ++y) {
+		for (int x = 0; x < (y < 32 ? 40 : 32); ++x) {
+			EXPECT_EQ(x < 8 && y < 8 ? -1 : y * 40 + x, values[y * 40 + x]);
+		}
+	}
+	GDALClose(ds);
+}
+
+TEST_F(ProcessTest, TileSinkBackPressure) {
+	// A budget too small for any tile still lets windows through in order,
+	// with the output of a serial run
+	Threshold threshold;
+	threshold.setThresholdParams(100.0, 50.0, (int)THRESH_BINARY);
+	int xsize = 4, ysize = 3, buffer = 2;
+	RasterProcess serial;
+	GALGError err = serial.map(threshold, file_name, "temp.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(0, err.errnum);
+
+	RasterProcess parallel;
+	parallel.setNumThreads(4);
+	parallel.setMemoryBudget(1);
+	err = parallel.map(threshold, file_name, "temp2.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(0, err.errnum);
+	RasterProcess pipelined;
+	pipelined.setNumThreads(3);
+	pipelined.setPipelineDepth(6);
+	pipelined.setMemoryBudget(1);
+	err = pipelined.map(threshold, file_name, "temp3.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(0, err.errnum);
+
+	float expected[10 * 12], values[10 * 12];
+	GDALDataset *ds = (GDALDataset *)GDALOpen("temp.tif", GA_ReadOnly);
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, expected, 10, 12, GDT_Float32, 0, 0);
+	GDALClose(ds);
+	const char *paths[] = { "temp2.tif", "temp3.tif" };
+	for (int i = 0; i < 2; ++i) {
+		ds = (GDALDataset *)GDALOpen(paths[i], GA_ReadOnly);
+		ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, values, 10, 12, GDT_Float32, 0, 0);
+		GDALClose(ds);
+		EXPECT_EQ(0, memcmp(expected, values, sizeof(values)));
+		std::remove(paths[i]);
+	}
+}
+
+TEST_F(ProcessTest, SimdMatchesScalar) {
+	// Odd lengths leave a scalar tail after the vector loop; NaNs and no data are mixed in
+	const int n = 103;
+	float a[n], b[n], expected[n], actual[n];
+	for (int i = 0; i < n; ++i) {
+		a[i] = (float)(i % 17) - 8.5f;
+		b[i] = (float)(i % 5) - 2.0f;
+	}
+	a[3] = -9999.0f;
+	b[7] = -9999.0f;
+	a[11] = NAN;
+	double inNoData = -9999.0, outNoData = -1.0;
+	GALGPixelNoData noData = galgPixelNoData(&inNoData, &outNoData);
+
+	GALGSimdLevel best = galgGetSimdLevel();
+	for (int level = GALG_SIMD_SCALAR; level <= GALG_SIMD_NEON; ++level) {
+		if (galgSetSimdLevel((GALGSimdLevel)level) != level) {
+			continue;
+		}
+		for (int m = 0; m < 3; ++m) {
+			for (int op = GALG_BAND_ADD; op <= GALG_BAND_NORMALISED_DIFFERENCE; ++op) {
+				if (m == 0) {
+					galgSetSimdLevel(GALG_SIMD_SCALAR);
+					galgAffineClamp(a, expected, n, 1.5f, 0.25f, -5.0f, 5.0f, op % 2 == 0, noData);
+					galgSetSimdLevel((GALGSimdLevel)level);
+					galgAffineClamp(a, actual, n, 1.5f, 0.25f, -5.0f, 5.0f, op % 2 == 0, noData);
+				} else if (m == 1) {
+					galgSetSimdLevel(GALG_SIMD_SCALAR);
+					galgThresholdSelect(a, expected, n, 0.5f * op, 1.0f, op % 2 == 0, 0.0f, op % 2 == 1, noData);
+					galgSetSimdLevel((GALGSimdLevel)level);
+					galgThresholdSelect(a, actual, n, 0.5f * op, 1.0f, op % 2 == 0, 0.0f, op % 2 == 1, noData);
+				} else {
+					galgSetSimdLevel(GALG_SIMD_SCALAR);
+					galgBandOp(a, b, expected, n, (GALGBandOp)op, noData, noData);
+					galgSetSimdLevel((GALGSimdLevel)level);
+					galgBandOp(a, b, actual, n, (GALGBandOp)op, noData, noData);
+				}
+				for (int i = 0; i < n; ++i) {
+					if (CPLIsNan(expected[i])) {
+						EXPECT_TRUE(CPLIsNan(actual[i])) << "level " << level << " primitive " << m << " pixel " << i;
+					} else {
+						EXPECT_FLOAT_EQ(expected[i], actual[i]) << "level " << level << " primitive " << m << " pixel " << i;
+					}
+				}
+			}
+		}
+	}
+	galgSetSimdLevel(best);
+	EXPECT_EQ(best, galgGetSimdLevel());
+}
+
+TEST_F(ProcessTest, ThresholdTypes) {
+	float in[5] = { -9999.0f, 5.0f, 10.0f, 15.0f, 20.0f };
+	float out[5];
+	double inNoData = -9999.0, outNoData = 0.0;
+	const float expected[5][5] = {
+		{ 0.0f, 0.0f, 0.0f, 2.0f, 2.0f },    // BINARY
+		{ 0.0f, 2.0f, 2.0f, 0.0f, 0.0f },    // BINARY_INV
+		{ 0.0f, 5.0f, 10.0f, 10.0f, 10.0f }, // TRUNC
+		{ 0.0f, 0.0f, 0.0f, 15.0f, 20.0f },  // TOZERO
+		{ 0.0f, 5.0f, 10.0f, 0.0f, 0.0f }    // TOZERO_INV
+	};
+	for (int type = THRESH_BINARY; type <= THRESH_TOZERO_INV; ++type) {
+		Threshold threshold;
+		threshold.setThresholdParams(2.0, 10.0, type);
+		GALGError err = threshold.processImage(in, out, 5, 1, &inNoData, &outNoData);
+		EXPECT_EQ(0, err.errnum);
+		for (int i = 0; i < 5; ++i) {
+			EXPECT_FLOAT_EQ(expected[type][i], out[i]) << "type " << type << " pixel " << i;
+		}
+	}
+	Threshold unknown;
+	unknown.setThresholdParams(2.0, 10.0, 7);
+	EXPECT_NE(0, unknown.processImage(in, out, 5, 1, &inNoData, &outNoData).errnum);
+}
+
+TEST_F(ProcessTest, PixelOps) {
+	float in[6] = { -9999.0f, -3.7f, 0.5f, 1.5f, 254.6f, 300.0f };
+	float out[6];
+	double inNoData = -9999.0, outNoData = -1.0;
+
+	Rescale rescale;
+	rescale.setRescaleRange(0.0, 300.0, 0.0, 1.0);
+	EXPECT_EQ(0, rescale.processImage(in, out, 3, 2, &inNoData, &outNoData).errnum);
+	EXPECT_FLOAT_EQ(-1.0f, out[0]);
+	EXPECT_FLOAT_EQ(1.0f, out[5]);
+
+	Cast cast;
+	cast.setCastParams(GDT_Byte);
+	EXPECT_EQ(0, cast.processImage(in, out, 3, 2, &inNoData, &outNoData).errnum);
+	const float casted[6] = { -1.0f, 0.0f, 0.0f, 2.0f, 255.0f, 255.0f };
+	for (int i = 0; i < 6; ++i) {
+		EXPECT_FLOAT_EQ(casted[i], out[i]);
+	}
+
+	NoDataMask mask;
+	mask.setMaskParams(0.5, 254.6);
+	EXPECT_EQ(0, mask.processImage(in, out, 3, 2, &inNoData, &outNoData).errnum);
+	const float masked[6] = { -1.0f, -1.0f, 0.5f, 1.5f, 254.6f, -1.0f };
+	for (int i = 0; i < 6; ++i) {
+		EXPECT_FLOAT_EQ(masked[i], out[i]);
+	}
+	EXPECT_NE(0, mask.processImage(in, out, 3, 2, &inNoData, NULL).errnum);
+}
+
+TEST_F(ProcessTest, BandMathNormalisedDifference) {
+	// Band 1 is x + 1 and band 2 is 3 * (x + 1), so (b2 - b1) / (b2 + b1) is 0.5 everywhere
+	GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	GDALDataset *ds = driver->Create("temp_bands.tif", 10, 12, 2, GDT_Float32, NULL);
+	float bands[2][10 * 12];
+	for (int i = 0; i < 10 * 12; ++i) {
+		bands[0][i] = (float)(i % 10 + 1);
+		bands[1][i] = 3 * bands[0][i];
+	}
+	ds->GetRasterBand(1)->RasterIO(GF_Write, 0, 0, 10, 12, bands[0], 10, 12, GDT_Float32, 0, 0);
+	ds->GetRasterBand(2)->RasterIO(GF_Write, 0, 0, 10, 12, bands[1], 10, 12, GDT_Float32, 0, 0);
+	GDALClose(ds);
+
+	RasterProcess process;
+	BandMath ndvi;
+	ndvi.setBandMathParams(GALG_BAND_NORMALISED_DIFFERENCE, 2, 1);
+	int xsize = 4, ysize = 3, buffer = 0;
+	GALGError err = process.mapBands(ndvi, "temp_bands.tif", "temp.tif", &xsize, &ysize, &buffer, false);
+	EXPECT_EQ(err.errnum, 0);
+
+	ds = (GDALDataset *)GDALOpen("temp.tif", GA_ReadOnly);
+	EXPECT_EQ(1, ds->GetRasterCount());
+	float result[10 * 12];
+	ds->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, 10, 12, result, 10, 12, GDT_Float32, 0, 0);
+	GDALClose(ds);
+	for (int i = 0; i < 10 * 12; ++i) {
+		EXPECT_FLOAT_EQ(0.5f, result[i]);
+	}
+	std::remove("temp_bands.tif");
+}
+
 }
 
 int main(int argc, char** argv) {